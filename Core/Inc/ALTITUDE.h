@@ -0,0 +1,40 @@
+/*
+ * ALTITUDE.h
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_ALTITUDE_H_
+#define INC_ALTITUDE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALTITUDE_GRAVITY		9.80665f	// m/s^2 per g
+#define ALTITUDE_GROUND_SAMPLES	25			// Barometer samples averaged into the ground reference
+
+/* Height above the ground reference from the barometer and the vertical accelerometer. Up is
+ * positive, unlike the body and earth axes */
+typedef struct ALTITUDE_CONTROLLER
+{
+	float Altitude;					// m above the ground reference
+	float Velocity;					// m/s, climbing is positive
+	float Bias;						// Vertical accelerometer bias, m/s^2
+	float BaroAltitude;				// Last barometer altitude, m
+	float Ground;					// Reference pressure, hPa
+	float GroundSum;
+	uint16_t GroundSamples;
+	uint8_t Primed;					// Ground reference taken, the filter is running
+	float K1;						// Altitude, velocity and bias correction gains
+	float K2;
+	float K3;
+} ALTITUDE_CONTROLLER;
+
+ALTITUDE_CONTROLLER* ALTITUDE_INIT(float tau);
+float ALTITUDE_FROM_PRESSURE(float pressure, float ground);
+void ALTITUDE_PREDICT(ALTITUDE_CONTROLLER* alt, const float* down, const float* accel, float dt);
+void ALTITUDE_CORRECT(ALTITUDE_CONTROLLER* alt, float pressure, float dt);
+
+#endif /* INC_ALTITUDE_H_ */
@@ -0,0 +1,49 @@
+/*
+ * ATTITUDE.h
+ *
+ *  Created on: Jan 30, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_ATTITUDE_H_
+#define INC_ATTITUDE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "PID.h"
+#include "EKF.h"
+
+typedef enum
+{
+	ATTITUDE_MAHONY = 0,			// Complementary filter on every gyro sample
+	ATTITUDE_EKF					// EKF with gyro bias states, run on the outer loop steps
+} attitudeEstimators_e;
+
+/* Attitude estimate plus the angle mode outer loop. Angles are degrees, positive is rolled
+ * right, pitched forward (nose down) and yawed right, same sense as the rate loop */
+typedef struct ATTITUDE_CONTROLLER
+{
+	float Q[4];						// Body to earth (north/east/down) quaternion, w x y z
+	float R[3][3];					// Same rotation as a matrix, body vector into earth axes
+	float Roll;
+	float Pitch;
+	float Yaw;						// Gyro only unless the EKF is given a magnetometer
+	float Integral[3];				// Mahony I-term, gyro bias estimate in rad/s
+	attitudeEstimators_e Estimator;
+	EKF_CONTROLLER* Ekf;			// Only allocated for ATTITUDE_EKF
+	float GyroSum[3];				// Rates summed between EKF steps, rad/s
+	float RateTarget[PID_AXES];		// Outer loop output, roll/pitch only, yaw is left at 0
+	uint8_t Samples;
+	uint8_t Divider;				// Inner loop steps per outer step
+	uint8_t Primed;					// Estimate has been seeded from the accelerometer
+	float Dt;						// Gyro sample period, s
+	float Kp;						// deg/s of rate per degree of tilt error
+	float MaxAngle;					// Tilt at full stick
+	float MaxRate;					// Largest rate the outer loop asks for
+} ATTITUDE_CONTROLLER;
+
+ATTITUDE_CONTROLLER* ATTITUDE_INIT(float sampleHz, uint8_t divider, attitudeEstimators_e estimator, float kp, float maxAngle, float maxRate);
+uint8_t ATTITUDE_UPDATE(ATTITUDE_CONTROLLER* att, const float* gyro, const float* accel, const float* mag, float stickRoll, float stickPitch);
+
+#endif /* INC_ATTITUDE_H_ */
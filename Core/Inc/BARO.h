@@ -0,0 +1,86 @@
+/*
+ * BARO.h
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_BARO_H_
+#define INC_BARO_H_
+
+#include "main.h"
+#include "stdbool.h"
+#include "I2CQ.h"
+
+// I2C Address LPS25H
+#define BARO_I2C_ADDR		0x5D << 1
+#define BARO_WHO_AM_I_VALUE	0xBD
+// Register address MSB set, auto-increment on multi-byte reads
+#define BARO_AUTO_INC		0x80
+// STATUS_REG through PRESS_OUT_H in one read, the status says whether the sample is new
+#define BARO_BURST_SIZE		4
+// Blocking write timeout for the start-up configuration, ms
+#define BARO_INIT_TIMEOUT	10
+#define BARO_ODR_HZ			25
+#define BARO_LSB_PER_HPA	4096.0f
+// Samples in the FIFO moving average, 2, 4, 8, 16 or 32. Each doubling halves the noise power
+// and adds half a sample period of lag
+#define BARO_MEAN_SAMPLES	4
+// RES_CONF, internal averaging recommended for FIFO mean mode, 32 pressure / 16 temperature
+#define BARO_RES_AVG		0x05
+// CTRL_REG1, powered up at 25Hz, output registers not updated until all bytes are read
+#define BARO_CTRL1_PD		0x80
+#define BARO_CTRL1_ODR_25	0x40
+#define BARO_CTRL1_BDU		0x04
+// CTRL_REG2, FIFO on
+#define BARO_CTRL2_FIFO_EN	0x40
+// FIFO_CTRL, mean mode, WTM_POINT is the number of samples averaged less 1
+#define BARO_FIFO_MEAN		0xC0
+// STATUS_REG, new pressure sample
+#define BARO_STATUS_P_DA	0x02
+
+/* LPS25H on the shared IMU bus, one burst read per BARO_START */
+typedef struct BARO_CONTROLLER
+{
+	I2CQ_CONTROLLER* Bus;
+	uint8_t Present;				// WHO_AM_I answered, nothing is read otherwise
+	uint8_t Data[BARO_BURST_SIZE];	// STATUS_REG then PRESS_OUT_XL..PRESS_OUT_H
+	volatile uint8_t Busy;
+	volatile uint8_t Ready;			// Raw holds a sample BARO_READ hasn't taken
+	int32_t Raw;
+	uint32_t Time;					// DWT cycles when the sample arrived
+	uint32_t Stale;					// Reads that found no new sample
+	uint32_t Failed;
+} BARO_CONTROLLER;
+
+BARO_CONTROLLER* BARO_INIT(I2CQ_CONTROLLER* bus);
+uint8_t BARO_START(BARO_CONTROLLER* baro);
+bool BARO_READ(BARO_CONTROLLER* baro, float* pressure);
+int32_t BARO_DECODE(const uint8_t* data);
+
+/**************** LPS25H Register Address Defines ****************/
+#define BARO_REF_P_XL		0x08	// Reference pressure lowest 8 bits
+#define BARO_REF_P_L		0x09	// Reference pressure middle 8 bits
+#define BARO_REF_P_H		0x0A	// Reference pressure upper 8 bits
+#define BARO_WHO_AM_I		0x0F	// Value fixed to 0xBD
+#define BARO_RES_CONF		0x10	// Pressure and temperature internal averaging
+#define BARO_CTRL_REG1		0x20	// Power down, ODR, interrupt circuit, block data update, SPI mode
+#define BARO_CTRL_REG2		0x21	// Boot, FIFO enable, watermark stop, FIFO mean decimation, reset, one shot
+#define BARO_CTRL_REG3		0x22	// Interrupt pin polarity, drive and signal
+#define BARO_CTRL_REG4		0x23	// FIFO interrupts on the data ready pin
+#define BARO_INT_CFG		0x24	// Pressure threshold interrupt enables
+#define BARO_INT_SOURCE		0x25	// Pressure threshold interrupt source
+#define BARO_STATUS_REG		0x27	// Pressure/temperature data available and overrun
+#define BARO_PRESS_OUT_XL	0x28	// Pressure lowest 8 bits (LSB)
+#define BARO_PRESS_OUT_L	0x29	// Pressure middle 8 bits
+#define BARO_PRESS_OUT_H	0x2A	// Pressure upper 8 bits (MSB)
+#define BARO_TEMP_OUT_L		0x2B	// Temperature lower 8 bits (LSB)
+#define BARO_TEMP_OUT_H		0x2C	// Temperature upper 8 bits (MSB)
+#define BARO_FIFO_CTRL		0x2E	// FIFO mode and watermark level
+#define BARO_FIFO_STATUS	0x2F	// FIFO watermark, overrun, empty and level
+#define BARO_THS_P_L		0x30	// Pressure threshold lower 8 bits
+#define BARO_THS_P_H		0x31	// Pressure threshold upper 8 bits
+#define BARO_RPDS_L			0x39	// Pressure offset lower 8 bits
+#define BARO_RPDS_H			0x3A	// Pressure offset upper 8 bits
+
+#endif /* INC_BARO_H_ */
@@ -0,0 +1,88 @@
+/*
+ * DSHOT.h
+ *
+ *  Created on: Oct 24, 2020
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_DSHOT_H_
+#define INC_DSHOT_H_
+
+#include <stdint.h>
+
+// Inverted DSHOT, ESCs answer every frame with a GCR encoded eRPM reply on the same wire
+#define DSHOT_BIDIR
+
+// APB1 timer clock (TIM2-TIM7), PCLK1 is 54MHz so the timers run at 2x = 108MHz, not the 216MHz core clock
+#define TIMER_CLOCK_HZ		108000000
+#define TIMER_CLOCK_MHZ		(TIMER_CLOCK_HZ / 1000000)
+
+#define DSHOT_MIN_THROTTLE	47		// 0-47 are commands
+#define DSHOT_MAX_THROTTLE 	2047
+#define DSHOT_MAX_MOTORS	8		// Widest frame any encoder will be asked to fill
+
+// One packet is 3 low lead-in words, 16 data bits, then 5 low words so the line idles between packets
+#define DSHOT_PACKET_SIZE 	24
+#define DSHOT_PACKET_LEAD	3
+#define DSHOT_PACKET_BITS	16
+// Most rows any ESC_PROTOCOLS entry sends per frame, sizes the frame buffers
+#define ESC_PROTOCOL_MAX_ROWS	DSHOT_PACKET_SIZE
+
+// Bidirectional reply is 21 GCR bits sent at 5/4 of the DSHOT bit rate
+#define DSHOT_TELEM_BITS		21
+#define DSHOT_TELEM_EDGES		22		// Worst case edge count for one reply plus the start edge
+#define DSHOT_TELEM_BIT_TICKS(ARR)	((ARR) * 4 / 5)
+#define DSHOT_TELEM_INVALID		0xFFFFFFFF
+// Reply starts ~30uS after the frame, listen for the whole reply plus a bit either side
+#define DSHOT_TELEM_WINDOW(ARR)	(40 * TIMER_CLOCK_MHZ + (DSHOT_TELEM_BITS + 2) * DSHOT_TELEM_BIT_TICKS(ARR))
+
+/* Nibble lookup table, four CCR values per nibble (most significant bit first) */
+typedef struct DSHOT_ENCODER
+{
+	uint16_t NibbleWidths[16][4];
+} DSHOT_ENCODER;
+
+typedef enum {
+	ESC_PROTOCOL_DSHOT150 = 0,
+	ESC_PROTOCOL_DSHOT300,
+	ESC_PROTOCOL_DSHOT600,
+	ESC_PROTOCOL_DSHOT1200,
+	ESC_PROTOCOL_ONESHOT125,
+	ESC_PROTOCOL_ONESHOT42,
+	ESC_PROTOCOL_MULTISHOT,
+	ESC_PROTOCOL_PWM,
+	ESC_PROTOCOL_COUNT
+} escProtocols_e;
+
+/* Output protocol descriptor, everything the ESC layer needs to drive the timer and fill frames.
+ * DSHOT: ARR is one bit, LowBit/HighBit are the 0/1 pulse widths, FrameRows = DSHOT_PACKET_SIZE
+ * Analog: ARR is one pulse period, LowBit/HighBit are the stop/full throttle pulse widths */
+typedef struct ESC_PROTOCOL
+{
+	const char* Name;
+	uint32_t Prescaler;
+	uint32_t ARR;
+	uint32_t LowBit;
+	uint32_t HighBit;
+	uint32_t FrameRows;
+	uint8_t Digital;		// Packets, commands and eRPM replies only exist on DSHOT
+	void (*Encode)(const struct ESC_PROTOCOL* proto, const DSHOT_ENCODER* enc, uint16_t* frame,
+					const uint16_t* values, uint32_t count, uint8_t telemMask);
+} ESC_PROTOCOL;
+
+extern const ESC_PROTOCOL ESC_PROTOCOLS[ESC_PROTOCOL_COUNT];
+
+uint16_t makeDshotPacketBytes(uint32_t value, uint8_t telemBit);
+void DSHOT_ENCODER_INIT(DSHOT_ENCODER* enc, uint32_t lowBit, uint32_t highBit);
+void DSHOT_WRITE_FRAME(const DSHOT_ENCODER* enc, uint16_t* frame, uint32_t stride, uint32_t column, uint16_t dshotBytes);
+void DSHOT_ENCODE_FRAME(const DSHOT_ENCODER* enc, uint16_t* frame, const uint16_t* packets, uint32_t count);
+void DSHOT_CLEAR_FRAME(uint16_t* frame, uint32_t stride, uint32_t column);
+void DSHOT_ENCODE_THROTTLE(const ESC_PROTOCOL* proto, const DSHOT_ENCODER* enc, uint16_t* frame,
+							const uint16_t* values, uint32_t count, uint8_t telemMask);
+void ANALOG_ENCODE_THROTTLE(const ESC_PROTOCOL* proto, const DSHOT_ENCODER* enc, uint16_t* frame,
+							const uint16_t* values, uint32_t count, uint8_t telemMask);
+uint32_t DSHOT_DECODE_EDGES(const uint16_t* edges, uint32_t count, uint32_t bitTicks);
+uint32_t DSHOT_DECODE_GCR(uint32_t value);
+uint32_t DSHOT_DECODE_ERPM(const uint16_t* edges, uint32_t count, uint32_t bitTicks);
+
+#endif /* INC_DSHOT_H_ */
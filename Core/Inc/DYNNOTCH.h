@@ -0,0 +1,48 @@
+/*
+ * DYNNOTCH.h
+ *
+ *  Created on: Feb 13, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_DYNNOTCH_H_
+#define INC_DYNNOTCH_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FILTER.h"
+
+#define DYNNOTCH_SIZE		64						// Sliding DFT length, bin width = sample rate / 64
+#define DYNNOTCH_BINS		(DYNNOTCH_SIZE / 2 + 1)	// DC to Nyquist
+#define DYNNOTCH_MAX_PEAKS	3						// Notches per axis
+
+/* Sliding DFT of every gyro axis plus the notches it steers */
+typedef struct DYNNOTCH_CONTROLLER
+{
+	float History[FILTER_AXES][DYNNOTCH_SIZE];	// Last DYNNOTCH_SIZE samples, oldest at Index
+	float Re[FILTER_AXES][DYNNOTCH_BINS];
+	float Im[FILTER_AXES][DYNNOTCH_BINS];
+	float TwiddleRe[DYNNOTCH_BINS];
+	float TwiddleIm[DYNNOTCH_BINS];
+	uint8_t Index;
+	uint8_t StartBin;							// Bins searched for peaks, MinHz to MaxHz
+	uint8_t EndBin;
+	uint8_t PeakCount;
+	uint8_t Step;								// Slice of peak search/retune work done next
+	float Peaks[FILTER_AXES][DYNNOTCH_MAX_PEAKS];	// Found by the last search, Hz, 0 if none
+	float Centre[FILTER_AXES][DYNNOTCH_MAX_PEAKS];	// Smoothed notch centres, Hz
+	uint8_t Active[FILTER_AXES];				// Bit per notch, set once a peak has claimed it
+	FILTER_BIQUAD Notch[FILTER_AXES][DYNNOTCH_MAX_PEAKS];
+	float DampingN;								// DYNNOTCH_DAMPING ^ DYNNOTCH_SIZE
+	float SampleHz;
+	float MinHz;
+	float MaxHz;
+	float Q;
+} DYNNOTCH_CONTROLLER;
+
+DYNNOTCH_CONTROLLER* DYNNOTCH_INIT(float sampleHz, uint8_t peakCount, float minHz, float maxHz, float q);
+void DYNNOTCH_UPDATE(DYNNOTCH_CONTROLLER* dn, const float* axes);
+void DYNNOTCH_APPLY(DYNNOTCH_CONTROLLER* dn, float* axes);
+
+#endif /* INC_DYNNOTCH_H_ */
@@ -0,0 +1,39 @@
+/*
+ * EKF.h
+ *
+ *  Created on: Feb 27, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_EKF_H_
+#define INC_EKF_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EKF_STATES	6	// Attitude error (3) and gyro bias (3)
+
+/* Multiplicative EKF, the quaternion is carried outside the covariance and only its small
+ * error angle is a filter state. Body axes X forward / Y right / Z down, earth north/east/down */
+typedef struct EKF_CONTROLLER
+{
+	float Q[4];							// Body to earth quaternion, w x y z
+	float Bias[3];						// Gyro bias, rad/s
+	float P[EKF_STATES][EKF_STATES];	// Error covariance
+	float Error[EKF_STATES];			// Correction built up over one set of measurements
+	float MagRef;						// Field heading in earth axes at the first sample, rad
+	uint8_t MagRefSet;
+	float GyroNoise;					// Variances, per second for the process noise
+	float BiasNoise;
+	float AccelNoise;
+	float MagNoise;
+} EKF_CONTROLLER;
+
+EKF_CONTROLLER* EKF_INIT(const float* q);
+void EKF_PREDICT(EKF_CONTROLLER* ekf, const float* gyro, float dt);
+void EKF_ACCEL_UPDATE(EKF_CONTROLLER* ekf, const float* accel);
+void EKF_MAG_UPDATE(EKF_CONTROLLER* ekf, const float* mag);
+void EKF_APPLY(EKF_CONTROLLER* ekf);
+
+#endif /* INC_EKF_H_ */
@@ -13,9 +13,15 @@
 #include <string.h>
 #include "main.h"
 #include "RX.h"
+#include "DSHOT.h"
+#include "MIXER.h"
 
-#define DSHOT_PACKET_SIZE 	24
-#define ESC_COUNT 			4
+#define ESC_MAX_MOTORS		DSHOT_MAX_MOTORS
+#define ESC_MAX_TIMERS		4	// Timers the motor outputs may be spread over
+#define ESC_TIMER_CHANNELS	4
+#define MOTOR_POLE_PAIRS	7	// 14 magnet motors, RPM = eRPM / pole pairs
+#define DSHOT_FRAME_BUFFERS	2	// One frame on the wire while the next is encoded
+#define ESC_CMD_QUEUE_SIZE	8
 
 typedef enum {
     DSHOT_CMD_MOTOR_STOP = 0,
@@ -48,44 +54,116 @@ typedef enum {
     DSHOT_CMD_MAX = 47
 } dshotCommands_e;
 
-typedef enum {
-	FRONT_LEFT_MOTOR = 0,
-	FRONT_RIGHT_MOTOR,
-	BACK_LEFT_MOTOR,
-	BACK_RIGHT_MOTOR,
-	LEFT_SIDE_MOTORS,
-	RIGHT_SIDE_MOTORS,
-	FRONT_SIDE_MOTORS,
-	BACK_SIDE_MOTORS,
-	ALL_MOTORS
-} motors;
+// Motors and groups of motors are bitmasks, bit n = entry n of the ESC_OUTPUT table
+#define ESC_MOTOR(N)		(1 << (N))
+#define FRONT_LEFT_MOTOR	ESC_MOTOR(0)
+#define FRONT_RIGHT_MOTOR	ESC_MOTOR(1)
+#define BACK_LEFT_MOTOR		ESC_MOTOR(2)
+#define BACK_RIGHT_MOTOR	ESC_MOTOR(3)
+#define LEFT_SIDE_MOTORS	(FRONT_LEFT_MOTOR | BACK_LEFT_MOTOR)
+#define RIGHT_SIDE_MOTORS	(FRONT_RIGHT_MOTOR | BACK_RIGHT_MOTOR)
+#define FRONT_SIDE_MOTORS	(FRONT_LEFT_MOTOR | FRONT_RIGHT_MOTOR)
+#define BACK_SIDE_MOTORS	(BACK_LEFT_MOTOR | BACK_RIGHT_MOTOR)
+#define ALL_MOTORS			0xFF
 
-typedef struct ESC
+/* One motor output. Motors on the same timer share one burst stream, so they must use the
+ * same DMA and DMARequest, and every timer must run from TIMER_CLOCK_HZ. */
+typedef struct ESC_OUTPUT
 {
-	uint32_t Throttle[ESC_COUNT];
-	uint32_t ThrottleDshot[ESC_COUNT][DSHOT_PACKET_SIZE];
-	uint32_t Channel[ESC_COUNT];
-	uint8_t SendingFlag;
-	TIM_HandleTypeDef* Timer[ESC_COUNT];
-	DMA_HandleTypeDef* DMA[ESC_COUNT];
-	volatile uint32_t* CCR[ESC_COUNT];
-} ESC_CONTROLLER;
+	TIM_HandleTypeDef* Timer;
+	uint32_t Channel;				// TIM_CHANNEL_1 - TIM_CHANNEL_4
+	DMA_HandleTypeDef* DMA;			// Stream bursting frame rows through the timer's DMAR
+	uint32_t DMARequest;			// TIM_DMA_UPDATE or TIM_DMA_CCx, request pacing the burst
+	DMA_HandleTypeDef* CaptureDMA;	// Stream on this channel's CC request for eRPM replies, NULL if none
+} ESC_OUTPUT;
 
-typedef struct
+/* Register masks of one motor, worked out from its ESC_OUTPUT entry at init */
+typedef struct ESC_MOTOR
 {
-	uint32_t FrontLeft;
-	uint32_t FrontRight;
-	uint32_t BackLeft;
-	uint32_t BackRight;
-} MOTOR_THROTTLES;
+	const ESC_OUTPUT* Output;
+	uint8_t Group;					// Timer group driving this motor
+	uint8_t Channel;				// 0 - 3, CCR1 - CCR4
+	uint8_t Column;					// Column of the group frame, CCR offset from the burst base
+	uint32_t CcerEnable;			// CCxE
+	uint32_t CcerInvert;			// CCxP
+	uint32_t CcerBothEdges;			// CCxP | CCxNP
+	uint32_t DierCapture;			// CCxDE, 0 without a capture stream
+} ESC_MOTOR;
+
+/* Every motor on one timer, one DMA burst writes a row into CCR(base) .. CCR(base + width - 1) */
+typedef struct ESC_GROUP
+{
+	uint16_t Frame[DSHOT_FRAME_BUFFERS][ESC_PROTOCOL_MAX_ROWS * ESC_TIMER_CHANNELS];	// Interleaved frames, Width halfwords per row
+	TIM_HandleTypeDef* Timer;
+	DMA_HandleTypeDef* DMA;
+	uint32_t DMARequest;
+	uint8_t BaseChannel;
+	uint8_t Width;
+	uint8_t MotorMask;
+	uint8_t BackBuffer;				// Frame the control loop may write, the other one belongs to the DMA
+	volatile uint8_t SendingFlag;	// Set while a frame is on the wire, cleared by ESC_FRAME_SENT
+	volatile uint8_t CaptureFlag;	// Set while the motor pins are listening for eRPM replies
+	volatile uint8_t TelemReady;	// Window closed, TelemEdges waiting to be decoded
+	uint32_t CcerEnable;			// Masks of all the group's motors OR'd together
+	uint32_t CcerInvert;
+	uint32_t CcerBothEdges;
+	uint32_t DierCapture;
+} ESC_GROUP;
+
+/* One queued DSHOT command, sent in place of the throttle for the motors in Mask */
+typedef struct ESC_CMD
+{
+	uint8_t Cmd;
+	uint8_t Mask;			// Motors receiving the command, bit n = motor n
+	uint8_t Repeats;		// Command frames still to send
+	uint8_t TelemBit;		// Settings commands only, every ESC asked replies on the shared telemetry line
+	uint16_t RepeatDelay;	// mS between command frames
+	uint16_t GuardDelay;	// mS after the last frame before the next command may start
+} ESC_CMD;
+
+typedef struct ESC
+{
+	uint32_t Throttle[ESC_MAX_MOTORS];
+	uint8_t MotorCount;
+	uint8_t MotorMask;					// One bit per configured motor
+	uint8_t GroupCount;
+	ESC_MOTOR Motors[ESC_MAX_MOTORS];
+	ESC_GROUP Groups[ESC_MAX_TIMERS];
+	uint16_t TelemEdges[ESC_MAX_MOTORS][DSHOT_TELEM_EDGES];	// Timer count of every reply edge
+	uint8_t TelemCount[ESC_MAX_MOTORS];		// Edges captured in the last window
+	uint32_t RPM[ESC_MAX_MOTORS];			// Last good reply per motor
+	uint32_t TelemErrors[ESC_MAX_MOTORS];	// Replies that were missing or failed to decode
+	uint8_t Bidir;						// eRPM replies are read back after every frame
+	const ESC_PROTOCOL* Protocol;
+	ESC_CMD CmdQueue[ESC_CMD_QUEUE_SIZE];
+	uint8_t CmdHead;					// Command being sent
+	uint8_t CmdTail;					// Next free slot
+	uint32_t CmdDueTick;				// HAL tick the next command frame may go out
+	uint32_t CmdQueued;					// Tickets handed out by ESC_SEND_CMD
+	uint32_t CmdDone;					// Tickets whose last frame has been sent
+	uint8_t TelemRequest;				// Motors to set the telemetry bit for in the next throttle frame
+	uint16_t BackValues[ESC_MAX_MOTORS];	// Values encoded into the back buffers
+	uint8_t BackTelem;					// Telemetry mask encoded into the back buffers
+	uint8_t BackValid;					// Back buffers hold BackValues, cleared once they are sent
+	const MIXER_LAYOUT* Mixer;			// Frame geometry, NULL keeps the motors off
+	mixerModes_e MixMode;				// Desaturation when roll/pitch/yaw overrun the throttle range
+	DSHOT_ENCODER Encoder;
+} ESC_CONTROLLER;
 
-ESC_CONTROLLER* ESC_INIT(TIM_HandleTypeDef** dmaTickTimers, TIM_HandleTypeDef* pwmTimer, DMA_HandleTypeDef** dma);
-void ESC_UPDATE_THROTTLE(ESC_CONTROLLER* ESC);
-void ESC_SEND_CMD(ESC_CONTROLLER* ESC, uint32_t cmd, uint32_t motorNum);
-void ESC_CALC_THROTTLE(ESC_CONTROLLER* escSet, RX_CONTROLLER* thisRX, uint8_t armed);
+ESC_CONTROLLER* ESC_INIT(const ESC_OUTPUT* outputs, uint32_t motorCount, escProtocols_e protocol);
+void ESC_SET_PROTOCOL(ESC_CONTROLLER* escSet, escProtocols_e protocol);
+uint8_t ESC_SET_MIXER(ESC_CONTROLLER* escSet, mixerLayouts_e layout, mixerModes_e mode);
+void ESC_FRAME_SENT(ESC_CONTROLLER* escSet, DMA_HandleTypeDef* dma);
+void ESC_CAPTURE_DONE(ESC_CONTROLLER* escSet, TIM_HandleTypeDef* htim);
+uint8_t ESC_FRAME_IDLE(ESC_CONTROLLER* escSet);
+void DSHOT_SEND_PACKET(ESC_CONTROLLER* escSet, uint32_t data, uint32_t telemBit, uint32_t motorMask);
+uint8_t ESC_UPDATE_THROTTLE(ESC_CONTROLLER* ESC);
+uint32_t ESC_SEND_CMD(ESC_CONTROLLER* ESC, uint32_t cmd, uint32_t motorMask);
+uint8_t ESC_CMD_COMPLETE(ESC_CONTROLLER* escSet, uint32_t ticket);
+uint8_t ESC_CMD_IDLE(ESC_CONTROLLER* escSet);
+void ESC_REQUEST_TELEMETRY(ESC_CONTROLLER* escSet, uint32_t motorMask);
+void ESC_CALC_THROTTLE(ESC_CONTROLLER* escSet, const MIXER_AXES* demand, uint8_t armed);
 
-#define ONESHOT_ADC_CONV(THROTTLE, ADC_VALUE) (THROTTLE = ((ADC_VALUE / 6.07) + 675))
-#define MULTISHOT_ADC_CONV(THROTTLE, ADC_VALUE) (THROTTLE = ((ADC_VALUE / 1.82) + 2250))
 #define DSHOT_ADC_CONV(THROTTLE, ADC_VALUE) (THROTTLE = (ADC_VALUE - 1600))
 
 #endif /* INC_ESC_H_ */
@@ -0,0 +1,67 @@
+/*
+ * FILTER.h
+ *
+ *  Created on: Feb 6, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_FILTER_H_
+#define INC_FILTER_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FILTER_AXES			3
+#define FILTER_MAX_STAGES	6
+
+typedef enum {
+	FILTER_NONE = 0,		// Stage passes samples through
+	FILTER_PT1,
+	FILTER_PT2,
+	FILTER_PT3,
+	FILTER_BIQUAD_LPF,
+	FILTER_BIQUAD_NOTCH,
+	FILTER_TYPE_COUNT
+} filterTypes_e;
+
+/* What a stage should be, Hz is the cutoff or the notch centre, Q only applies to biquads */
+typedef struct FILTER_CONFIG
+{
+	filterTypes_e Type;
+	float Hz;
+	float Q;
+} FILTER_CONFIG;
+
+/* One stage over all axes, state is kept per axis side by side so a stage runs as one pass */
+typedef struct FILTER_STAGE
+{
+	FILTER_CONFIG Config;
+	float K;						// PTn gain per cascaded PT1
+	float B0, B1, B2, A1, A2;		// Biquad, normalised so A0 = 1
+	float S1[FILTER_AXES];			// PTn cascade outputs or biquad delay line
+	float S2[FILTER_AXES];
+	float S3[FILTER_AXES];
+} FILTER_STAGE;
+
+/* One biquad on a single axis, for filters whose coefficients differ per axis */
+typedef struct FILTER_BIQUAD
+{
+	float B0, B1, B2, A1, A2;
+	float S1, S2;
+} FILTER_BIQUAD;
+
+typedef struct FILTER_CHAIN
+{
+	FILTER_STAGE Stages[FILTER_MAX_STAGES];
+	uint8_t StageCount;
+	float SampleHz;
+} FILTER_CHAIN;
+
+FILTER_CHAIN* FILTER_INIT(float sampleHz);
+uint8_t FILTER_SET_STAGE(FILTER_CHAIN* chain, uint8_t stage, const FILTER_CONFIG* config);
+void FILTER_APPLY(FILTER_CHAIN* chain, float* axes);
+void FILTER_BIQUAD_SET(FILTER_BIQUAD* bq, filterTypes_e type, float hz, float q, float sampleHz);
+float FILTER_BIQUAD_APPLY(FILTER_BIQUAD* bq, float x);
+
+#endif /* INC_FILTER_H_ */
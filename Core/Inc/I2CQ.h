@@ -0,0 +1,89 @@
+/*
+ * I2CQ.h
+ *
+ *  Created on: Mar 6, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_I2CQ_H_
+#define INC_I2CQ_H_
+
+#include "main.h"
+#include "I2CTIMING.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define I2CQ_SIZE			8		// Jobs waiting or running, power of 2
+#define I2CQ_NACK_RETRIES	3		// Tries after a NACK before the job fails
+#define I2CQ_BUS_RETRIES	1		// Tries after a bus error and recovery
+#define I2CQ_RECOVER_HZ		100000	// SCL rate for the clock-out
+#define I2CQ_DEVICES		4		// Addresses the bus profiler keeps separate counts for
+// Errors that mean the bus is stuck and needs clocking out
+#define I2CQ_STUCK_ERRORS	(HAL_I2C_ERROR_BERR | HAL_I2C_ERROR_ARLO | HAL_I2C_ERROR_TIMEOUT)
+
+typedef enum
+{
+	I2CQ_READ = 0,
+	I2CQ_WRITE
+} i2cqDirs_e;
+
+/* Completion callback, runs in interrupt context. ok is 0 if the job failed after its retries */
+typedef void (*I2CQ_DONE)(void* context, uint8_t ok);
+
+/* One register read or write, the buffer must stay valid until Done runs */
+typedef struct I2CQ_JOB
+{
+	uint16_t Addr;					// 8 bit (shifted) device address
+	uint8_t Reg;
+	uint8_t* Data;
+	uint16_t Size;
+	i2cqDirs_e Dir;
+	I2CQ_DONE Done;
+	void* Context;
+	uint8_t Tries;
+} I2CQ_JOB;
+
+/* Bus use by one device over a profiler window. Bytes are on the wire, address and register
+ * included, Jobs counts every attempt so retries show up */
+typedef struct I2CQ_STATS
+{
+	uint16_t Addr;					// 0 while the slot is free
+	uint32_t Jobs;
+	uint32_t Bytes;
+	uint32_t BusyCycles;			// Core clock cycles from start to complete or error
+} I2CQ_STATS;
+
+/* Job ring for one I2C peripheral, chained from its complete and error callbacks */
+typedef struct I2CQ_CONTROLLER
+{
+	I2C_HandleTypeDef* I2c;
+	I2CQ_JOB Jobs[I2CQ_SIZE];
+	volatile uint8_t Head;			// Next free slot
+	volatile uint8_t Tail;			// Running job when Busy
+	volatile uint8_t Busy;
+	volatile uint8_t RecoverPending;	// Set by the error interrupt, I2CQ_SERVICE recovers
+	GPIO_TypeDef* SclPort;			// Pins for the bus recovery clock-out
+	uint16_t SclPin;
+	GPIO_TypeDef* SdaPort;
+	uint16_t SdaPin;
+	uint32_t Failed;				// Jobs given up on
+	uint32_t Full;					// Submits refused, ring full
+	uint32_t Recoveries;
+	i2cTimingSpeeds_e Speed;
+	uint32_t BusHz;					// SCL rate the current TIMINGR gives, 0 until I2CQ_SPEED
+	uint32_t StartCycles;			// DWT count when the running job started
+	uint32_t WindowStart;
+	I2CQ_STATS Count[I2CQ_DEVICES];	// Window being filled
+	I2CQ_STATS Second[I2CQ_DEVICES];	// Last full second, read this one
+} I2CQ_CONTROLLER;
+
+I2CQ_CONTROLLER* I2CQ_INIT(I2C_HandleTypeDef* i2c, GPIO_TypeDef* sclPort, uint16_t sclPin, GPIO_TypeDef* sdaPort, uint16_t sdaPin);
+uint8_t I2CQ_SUBMIT(I2CQ_CONTROLLER* q, uint16_t addr, uint8_t reg, uint8_t* data, uint16_t size, i2cqDirs_e dir, I2CQ_DONE done, void* context);
+void I2CQ_CPLT(I2CQ_CONTROLLER* q);
+void I2CQ_ERROR(I2CQ_CONTROLLER* q);
+void I2CQ_RECOVER(I2CQ_CONTROLLER* q);
+void I2CQ_SERVICE(I2CQ_CONTROLLER* q);
+uint8_t I2CQ_SPEED(I2CQ_CONTROLLER* q, i2cTimingSpeeds_e speed, uint32_t fmp);
+void I2CQ_PROFILE(I2CQ_CONTROLLER* q);
+
+#endif /* INC_I2CQ_H_ */
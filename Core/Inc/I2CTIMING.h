@@ -0,0 +1,57 @@
+/*
+ * I2CTIMING.h
+ *
+ *  Created on: Mar 13, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_I2CTIMING_H_
+#define INC_I2CTIMING_H_
+
+#include <stdint.h>
+
+// I2C kernel clock, RCC_I2C1CLKSOURCE_PCLK1 and APB1 is HCLK / 4
+#define I2CTIMING_CLOCK_HZ		54000000
+
+// Bus edges assumed for the board until they are measured. 1MHz only fits with the analog filter
+// on if the rise stays under ~95nS, which wants 1k or stiffer pull ups
+#define I2CTIMING_RISE_NS		50
+#define I2CTIMING_FALL_NS		10
+
+typedef enum
+{
+	I2CTIMING_STANDARD = 0,			// 100kHz
+	I2CTIMING_FAST,					// 400kHz, fastest the LSM6DS33 is rated for
+	I2CTIMING_FAST_PLUS,			// 1MHz, needs the Fm+ drive on the pins
+	I2CTIMING_SPEEDS
+} i2cTimingSpeeds_e;
+
+/* I2C spec limits for one speed, all times in nS */
+typedef struct I2CTIMING_SPEC
+{
+	uint32_t Hz;
+	uint32_t LowMin;				// tLOW
+	uint32_t HighMin;				// tHIGH
+	uint32_t RiseMax;				// tr
+	uint32_t FallMax;				// tf
+	uint32_t DataSetupMin;			// tSU;DAT
+	uint32_t DataValidMax;			// tVD;DAT
+} I2CTIMING_SPEC;
+
+extern const I2CTIMING_SPEC I2CTIMING_SPECS[I2CTIMING_SPEEDS];
+
+/* TIMINGR fields the calculator picked, for printing and checking */
+typedef struct I2CTIMING_RESULT
+{
+	uint32_t Timingr;				// 0 if nothing fits
+	uint8_t Presc;
+	uint8_t SclDel;
+	uint8_t SdaDel;
+	uint8_t SclH;
+	uint8_t SclL;
+	uint32_t BusHz;					// SCL rate the register gives with the assumed edges
+} I2CTIMING_RESULT;
+
+uint32_t I2CTIMING_CALC(uint32_t clockHz, i2cTimingSpeeds_e speed, uint32_t riseNs, uint32_t fallNs, I2CTIMING_RESULT* result);
+
+#endif /* INC_I2CTIMING_H_ */
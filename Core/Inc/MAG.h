@@ -0,0 +1,89 @@
+/*
+ * MAG.h
+ *
+ *  Created on: Mar 20, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_MAG_H_
+#define INC_MAG_H_
+
+#include "main.h"
+#include "stdbool.h"
+#include "I2CQ.h"
+#include "MAGCAL.h"
+
+// I2C Address LIS3MDL
+#define MAG_I2C_ADDR		0x1D << 1
+#define MAG_WHO_AM_I_VALUE	0x3D
+// Register address MSB set, auto-increment on multi-byte reads
+#define MAG_AUTO_INC		0x80
+// STATUS_REG through OUT_Z_H in one read, the status says whether the sample is new
+#define MAG_BURST_SIZE		7
+// Blocking write timeout for the start-up configuration, ms
+#define MAG_INIT_TIMEOUT	10
+// CTRL_REG1, ultra high performance X/Y at 80Hz
+#define MAG_CTRL1_OM_UHP	0x60
+#define MAG_CTRL1_ODR_80	0x1C
+#define MAG_ODR_HZ			80
+// CTRL_REG3, continuous conversion
+#define MAG_CTRL3_CONTINUOUS	0x00
+// CTRL_REG4, ultra high performance Z
+#define MAG_CTRL4_OMZ_UHP	0x0C
+// CTRL_REG5, output registers not updated until both bytes are read
+#define MAG_CTRL5_BDU		0x40
+// STATUS_REG, new X, Y and Z sample
+#define MAG_STATUS_ZYXDA	0x08
+
+/* Full scale, written to CTRL_REG2 FS[1:0] */
+typedef enum
+{
+	MAG_RANGE_4G = 0,
+	MAG_RANGE_8G,
+	MAG_RANGE_12G,
+	MAG_RANGE_16G,
+	MAG_RANGES
+} magRanges_e;
+
+/* LIS3MDL on the shared IMU bus, one burst read per MAG_START */
+typedef struct MAG_CONTROLLER
+{
+	I2CQ_CONTROLLER* Bus;
+	uint8_t Present;				// WHO_AM_I answered, nothing is read otherwise
+	uint8_t Data[MAG_BURST_SIZE];	// STATUS_REG then OUT_X_L..OUT_Z_H
+	volatile uint8_t Busy;
+	volatile uint8_t Ready;			// Raw holds a sample MAG_READ hasn't taken
+	int16_t Raw[MAGCAL_AXES];
+	uint32_t Time;					// DWT cycles when the sample arrived
+	float GaussPerLsb;
+	MAGCAL_CONFIG Cal;
+	uint32_t Stale;					// Reads that found no new sample
+	uint32_t Failed;
+} MAG_CONTROLLER;
+
+MAG_CONTROLLER* MAG_INIT(I2CQ_CONTROLLER* bus, magRanges_e range, const MAGCAL_CONFIG* cal);
+uint8_t MAG_START(MAG_CONTROLLER* mag);
+bool MAG_READ(MAG_CONTROLLER* mag, float* field);
+
+/**************** LIS3MDL Register Address Defines ****************/
+#define MAG_WHO_AM_I		0x0F	// Value fixed to 0x3D
+#define MAG_CTRL_REG1		0x20	// Temperature enable, X/Y operating mode, ODR, fast ODR, self-test
+#define MAG_CTRL_REG2		0x21	// Full-scale selection, reboot, soft reset
+#define MAG_CTRL_REG3		0x22	// Low power, SPI mode, conversion mode (continuous/single/power down)
+#define MAG_CTRL_REG4		0x23	// Z operating mode, big/little endian
+#define MAG_CTRL_REG5		0x24	// Fast read, block data update
+#define MAG_STATUS_REG		0x27	// X/Y/Z data available and overrun
+#define MAG_OUT_X_L			0x28	// X-axis lower 8 bits (LSB)
+#define MAG_OUT_X_H			0x29	// X-axis upper 8 bits (MSB)
+#define MAG_OUT_Y_L			0x2A	// Y-axis lower 8 bits (LSB)
+#define MAG_OUT_Y_H			0x2B	// Y-axis upper 8 bits (MSB)
+#define MAG_OUT_Z_L			0x2C	// Z-axis lower 8 bits (LSB)
+#define MAG_OUT_Z_H			0x2D	// Z-axis upper 8 bits (MSB)
+#define MAG_TEMP_OUT_L		0x2E	// Temperature lower 8 bits (LSB)
+#define MAG_TEMP_OUT_H		0x2F	// Temperature upper 8 bits (MSB)
+#define MAG_INT_CFG			0x30	// Interrupt axis enables, polarity, latch
+#define MAG_INT_SRC			0x31	// Interrupt source
+#define MAG_INT_THS_L		0x32	// Interrupt threshold lower 8 bits
+#define MAG_INT_THS_H		0x33	// Interrupt threshold upper 8 bits
+
+#endif /* INC_MAG_H_ */
@@ -0,0 +1,29 @@
+/*
+ * MAGCAL.h
+ *
+ *  Created on: Mar 20, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_MAGCAL_H_
+#define INC_MAGCAL_H_
+
+#include <stdint.h>
+
+#define MAGCAL_AXES			3
+
+/* Hard and soft iron correction from an ellipsoid fit of a rotated sample set. Offset is the
+ * ellipsoid centre in gauss, Soft maps the ellipsoid back onto a sphere */
+typedef struct MAGCAL_CONFIG
+{
+	float Offset[MAGCAL_AXES];
+	float Soft[MAGCAL_AXES][MAGCAL_AXES];
+} MAGCAL_CONFIG;
+
+// No correction, for boards that haven't been calibrated yet
+#define MAGCAL_IDENTITY		{{0.0f, 0.0f, 0.0f}, {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}}}
+
+void MAGCAL_DECODE(const uint8_t* data, int16_t* raw);
+void MAGCAL_APPLY(const MAGCAL_CONFIG* cal, const int16_t* raw, float gaussPerLsb, float* field);
+
+#endif /* INC_MAGCAL_H_ */
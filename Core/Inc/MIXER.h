@@ -0,0 +1,54 @@
+/*
+ * MIXER.h
+ *
+ *  Created on: Jan 16, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_MIXER_H_
+#define INC_MIXER_H_
+
+#include <stdint.h>
+
+#define MIXER_MAX_MOTORS	8
+
+typedef enum {
+	MIXER_QUAD_X = 0,
+	MIXER_QUAD_PLUS,
+	MIXER_HEX_X,
+	MIXER_OCTO_X,
+	MIXER_LAYOUT_COUNT
+} mixerLayouts_e;
+
+/* What happens when the roll/pitch/yaw demand does not fit between the output limits */
+typedef enum {
+	MIXER_MODE_CLAMP = 0,		// Every motor clamped on its own, differential is lost at the limits
+	MIXER_MODE_AIRMODE,			// Scale roll, pitch and yaw together, then shift throttle to fit
+	MIXER_MODE_AIRMODE_RP,		// Give up yaw first, roll and pitch only shrink once yaw is gone
+	MIXER_MODE_COUNT
+} mixerModes_e;
+
+/* One value per control axis, used for both the stick demand and each motor's weights.
+ * Positive is roll right, pitch forward and yaw right */
+typedef struct MIXER_AXES
+{
+	float Throttle;
+	float Roll;
+	float Pitch;
+	float Yaw;
+} MIXER_AXES;
+
+/* Frame geometry, Weights[n] is how much each axis moves motor n */
+typedef struct MIXER_LAYOUT
+{
+	const char* Name;
+	uint8_t MotorCount;
+	MIXER_AXES Weights[MIXER_MAX_MOTORS];
+} MIXER_LAYOUT;
+
+extern const MIXER_LAYOUT MIXER_LAYOUTS[MIXER_LAYOUT_COUNT];
+
+void MIXER_APPLY(const MIXER_LAYOUT* layout, const MIXER_AXES* demand, mixerModes_e mode,
+				 float minOut, float maxOut, uint32_t* out);
+
+#endif /* INC_MIXER_H_ */
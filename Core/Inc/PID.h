@@ -0,0 +1,54 @@
+/*
+ * PID.h
+ *
+ *  Created on: Jan 23, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_PID_H_
+#define INC_PID_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PID_AXES	3
+
+typedef enum {
+	PID_ROLL = 0,
+	PID_PITCH,
+	PID_YAW
+} pidAxes_e;
+
+/* Gains for one axis, error is in deg/s and the output in mixer (DSHOT) units */
+typedef struct PID_GAINS
+{
+	float P;
+	float I;		// Per second
+	float D;		// Seconds, applied to the measured rate only
+	float ILimit;	// Largest the I-term may grow either way
+} PID_GAINS;
+
+/* One axis with the gains already scaled by the fixed step */
+typedef struct PID_AXIS
+{
+	float Kp;
+	float KiDt;				// I * dt
+	float KdHz;				// D / dt
+	float ILimit;
+	float Integral;
+	float LastMeasure;
+} PID_AXIS;
+
+typedef struct PID_CONTROLLER
+{
+	PID_AXIS Axes[PID_AXES];
+	float OutLimit;			// Largest roll/pitch/yaw demand either way
+	uint8_t Primed;			// LastMeasure holds a real sample, cleared by PID_RESET
+} PID_CONTROLLER;
+
+PID_CONTROLLER* PID_INIT(const PID_GAINS* gains, float sampleHz, float outLimit);
+void PID_RESET(PID_CONTROLLER* pid);
+void PID_UPDATE(PID_CONTROLLER* pid, const float* setpoint, const float* measure, float* out);
+
+#endif /* INC_PID_H_ */
@@ -0,0 +1,46 @@
+/*
+ * RPMFILTER.h
+ *
+ *  Created on: Feb 20, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_RPMFILTER_H_
+#define INC_RPMFILTER_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FILTER.h"
+
+#define RPMFILTER_MAX_MOTORS	8
+#define RPMFILTER_HARMONICS		3	// Motor rotation frequency and its 2nd and 3rd harmonic
+#define RPMFILTER_NOTCHES		(RPMFILTER_MAX_MOTORS * RPMFILTER_HARMONICS)
+
+/* One motor harmonic, the coefficients are shared by every axis and the state is per axis */
+typedef struct RPMFILTER_NOTCH
+{
+	float B0, B1, A1, A2;			// Notch has B2 = B0
+	float S1[FILTER_AXES];
+	float S2[FILTER_AXES];
+	uint8_t Active;					// 0 passes samples through, centre is out of range
+} RPMFILTER_NOTCH;
+
+typedef struct RPMFILTER_CONTROLLER
+{
+	RPMFILTER_NOTCH Notches[RPMFILTER_NOTCHES];	// Motor m harmonic h is [m * RPMFILTER_HARMONICS + h]
+	float RPM[RPMFILTER_MAX_MOTORS];			// Smoothed mechanical RPM per motor
+	uint8_t MotorCount;
+	uint8_t NextNotch;							// First notch retuned on the next update
+	uint8_t UpdatesPerStep;						// Notches retuned per RPMFILTER_UPDATE
+	float SampleHz;
+	float MinHz;								// Notches below this are switched off
+	float Q;
+} RPMFILTER_CONTROLLER;
+
+RPMFILTER_CONTROLLER* RPMFILTER_INIT(float sampleHz, uint8_t motorCount, uint8_t updatesPerStep, float minHz, float q);
+void RPMFILTER_SET_RPM(RPMFILTER_CONTROLLER* rf, uint8_t motor, float rpm);
+void RPMFILTER_UPDATE(RPMFILTER_CONTROLLER* rf);
+void RPMFILTER_APPLY(RPMFILTER_CONTROLLER* rf, float* axes);
+
+#endif /* INC_RPMFILTER_H_ */
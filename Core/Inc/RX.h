@@ -12,6 +12,10 @@
 #include <stdlib.h>
 #include "main.h"
 
+#define RX_NEUTRAL_VALUE	1028	// Pitch/roll/yaw stick centred
+#define RX_STICK_RANGE		1020	// Full deflection either side of centre
+// Stick deflection from -1 to 1, positive is roll right, pitch forward and yaw right
+#define RX_STICK(V)			(((int32_t) (V) - RX_NEUTRAL_VALUE) / (float) RX_STICK_RANGE)
 
 typedef struct RX_CONTROLLER
 {
@@ -0,0 +1,62 @@
+/*
+ * TELEM.h
+ *
+ *  Created on: Jan 9, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef INC_TELEM_H_
+#define INC_TELEM_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "main.h"
+#include "ESC.h"
+
+#define TELEM_FRAME_SIZE	10		// KISS/BLHeli32 frame, 9 data bytes + CRC8
+#define TELEM_RX_SIZE		64		// Circular DMA buffer, several frames deep
+#define TELEM_TIMEOUT_MS	3		// 10 bytes at 115200 is ~870uS, give up on a motor after this
+
+/* One decoded telemetry frame */
+typedef struct TELEM_DATA
+{
+	uint8_t Temperature;		// C
+	uint16_t Voltage;			// 10mV
+	uint16_t Current;			// 10mA
+	uint16_t Consumption;		// mAh
+	uint32_t RPM;				// Mechanical RPM
+	uint32_t Tick;				// HAL tick the frame was received
+} TELEM_DATA;
+
+/* Per motor snapshot, Seq is odd while the UART interrupt is writing Data */
+typedef struct TELEM_SLOT
+{
+	volatile uint32_t Seq;
+	TELEM_DATA Data;
+} TELEM_SLOT;
+
+typedef struct TELEM_CONTROLLER
+{
+	uint8_t RxBuffer[TELEM_RX_SIZE];	// Written by the circular DMA
+	uint32_t RxRead;					// Next RxBuffer byte the parser has not seen
+	uint8_t Frame[TELEM_FRAME_SIZE];	// Frame being assembled
+	uint8_t FrameCount;
+	volatile int8_t Pending;			// Motor whose reply is expected, -1 when none
+	uint8_t NextMotor;					// Round robin position
+	uint32_t RequestTick;
+	uint8_t MotorCount;
+	TELEM_SLOT Slots[ESC_MAX_MOTORS];
+	uint32_t CrcErrors;
+	uint32_t Timeouts[ESC_MAX_MOTORS];
+	UART_HandleTypeDef* UART;
+} TELEM_CONTROLLER;
+
+TELEM_CONTROLLER* TELEM_INIT(UART_HandleTypeDef* uart, uint32_t motorCount);
+void TELEM_RX_EVENT(TELEM_CONTROLLER* telem);
+void TELEM_RX_ERROR(TELEM_CONTROLLER* telem);
+int32_t TELEM_NEXT_REQUEST(TELEM_CONTROLLER* telem);
+void TELEM_READ(TELEM_CONTROLLER* telem, uint32_t motor, TELEM_DATA* out);
+uint8_t TELEM_CRC8(const uint8_t* data, uint32_t len);
+uint8_t TELEM_PARSE_FRAME(const uint8_t* frame, TELEM_DATA* out);
+
+#endif /* INC_TELEM_H_ */
@@ -10,6 +10,35 @@
 
 #include "main.h"
 #include "stdbool.h"
+#include "I2CQ.h"
+
+// I2C Address LSM6DS33
+#define XLG_I2C_ADDR		0x6A << 1
+// Register size of XLG
+#define XLG_REG_SIZE		0x1
+// Gyro set up by XLG_INIT, 1.66kHz ODR at 2000 dps full scale
+#define XLG_G_ODR_HZ		1660
+#define XLG_G_DPS_PER_LSB	0.070f
+// Accelerometer set up by XLG_INIT, 2g full scale
+#define XLG_XL_G_PER_LSB	0.000061f
+// OUTX_L_G through OUTZ_H_XL in one auto-increment read, gyro then accelerometer
+#define XLG_BURST_SIZE		12
+// CTRL3_C bits
+#define XLG_CTRL3_BDU		0x40	// Output registers not updated until both bytes are read
+#define XLG_CTRL3_IF_INC	0x04	// Register address increments on multi-byte access
+// Blocking write timeout for the start-up configuration, ms
+#define XLG_INIT_TIMEOUT	10
+// FIFO batching, each sample is 6 words: gyro XYZ then accelerometer XYZ
+#define XLG_FIFO_WORDS		6
+#define XLG_FIFO_DRAIN_MAX	16		// Samples moved per DMA read
+#define XLG_FIFO_RING_SIZE	32		// Samples held for the rate loop, power of 2
+#define XLG_FIFO_ODR_1660	0x40	// ODR_FIFO in FIFO_CTRL5, matches the gyro rate
+#define XLG_FIFO_CONTINUOUS	0x06	// FIFO_MODE in FIFO_CTRL5, oldest data overwritten when full
+#define XLG_FIFO_NO_DEC		0x09	// FIFO_CTRL3, gyro and accelerometer every sample
+#define XLG_FIFO_STATUS_WTM	0x80	// FIFO_STATUS2 bits
+#define XLG_FIFO_STATUS_OVR	0x40
+#define XLG_INT1_FTH		0x08	// INT1_CTRL, FIFO watermark on INT1
+#define XLG_INT1_DRDY_G		0x02	// INT1_CTRL, gyro data ready on INT1
 
 /* 3-Axis Data Struct */
 typedef struct XLG_DATA
@@ -18,20 +47,74 @@ typedef struct XLG_DATA
 	int16_t y;
 	int16_t z;
 	bool dataReady;
+	uint32_t timestamp;				// DWT cycle count when the sample was taken
 } XLG_DATA;
 
-void XLG_INIT(I2C_HandleTypeDef* i2c);
-void XLG_WRITE(I2C_HandleTypeDef* i2c, uint8_t addr, uint8_t* writeByte, uint32_t writeSize);
-void XLG_READ(I2C_HandleTypeDef* i2c, uint8_t addr, uint8_t* readByte, uint32_t readSize);
-void XLG_G_DATA_READ(I2C_HandleTypeDef* i2c, XLG_DATA* gData);
-void XLG_XL_DATA_READ(I2C_HandleTypeDef* i2c, XLG_DATA* xlData);
+/* Where the sample read is up to, one DMA transfer per stage */
+typedef enum
+{
+	XLG_STAGE_IDLE = 0,
+	XLG_STAGE_STATUS,			// STATUS_REG read in flight
+	XLG_STAGE_DATA				// Output register burst in flight
+} xlgStages_e;
 
-// I2C Address LSM6DS33
-#define XLG_I2C_ADDR		0x6A << 1
-// I2C Address LIS3MDL
-#define M_I2C_ADDR			0x1D << 1
-// Register size of XLG
-#define XLG_REG_SIZE		0x1
+/* DMA buffer for the burst read of one gyro/accelerometer sample, started by INT1 data ready */
+typedef struct XLG_BURST
+{
+	I2CQ_CONTROLLER* Bus;
+	XLG_DATA* G;					// Where decoded samples go
+	XLG_DATA* XL;
+	uint8_t Data[XLG_BURST_SIZE];
+	xlgStages_e Stage;
+	uint32_t SampleTime;			// DWT cycles at the edge of the sample being read
+	uint32_t EdgeTime;				// Edge that came in while a read was running
+	volatile uint8_t Pending;
+	uint32_t LastTime;
+	uint32_t Missed;				// Samples overwritten before they were read
+} XLG_BURST;
+
+/* One gyro + accelerometer sample pulled out of the chip FIFO */
+typedef struct XLG_SAMPLE
+{
+	int16_t G[3];
+	int16_t XL[3];
+	uint32_t Time;					// DWT cycles, rebuilt from the drain time and the ODR
+} XLG_SAMPLE;
+
+/* Chip FIFO drained in batches on the watermark, samples queued for the rate loop */
+typedef struct XLG_FIFO
+{
+	I2CQ_CONTROLLER* Bus;
+	uint8_t Status[4];				// FIFO_STATUS1..4
+	uint8_t Data[(XLG_FIFO_DRAIN_MAX + 1) * XLG_FIFO_WORDS * 2];	// Extra sample of room to realign
+	uint16_t Skip;					// Words read only to get back to a gyro X word
+	uint16_t Draining;				// Samples in the read in flight
+	xlgStages_e Stage;
+	uint16_t Watermark;				// Samples per batch
+	uint32_t Period;				// DWT cycles per sample
+	uint32_t AnchorTime;			// Watermark edge the drain in flight started from
+	uint8_t Anchored;
+	uint32_t EdgeTime;				// Edge that came in while a read was running
+	volatile uint8_t Pending;
+	uint32_t LastTime;
+	uint8_t Timed;					// LastTime holds a queued sample
+	uint32_t Overruns;				// Samples lost, chip FIFO or ring full
+	XLG_SAMPLE Ring[XLG_FIFO_RING_SIZE];
+	volatile uint16_t Head;			// Written by the I2C interrupt
+	volatile uint16_t Tail;			// Written by the main loop
+} XLG_FIFO;
+
+void XLG_INIT(I2C_HandleTypeDef* i2c);
+uint8_t XLG_WRITE(I2CQ_CONTROLLER* bus, uint8_t addr, uint8_t* writeByte, uint32_t writeSize, I2CQ_DONE done, void* context);
+uint8_t XLG_READ(I2CQ_CONTROLLER* bus, uint8_t addr, uint8_t* readByte, uint32_t readSize, I2CQ_DONE done, void* context);
+void XLG_BURST_INIT(XLG_BURST* burst, I2CQ_CONTROLLER* bus, XLG_DATA* gData, XLG_DATA* xlData);
+void XLG_BURST_START(XLG_BURST* burst);
+void XLG_BURST_EDGE(XLG_BURST* burst);
+void XLG_BURST_DECODE(const uint8_t* data, XLG_DATA* gData, XLG_DATA* xlData);
+void XLG_FIFO_INIT(XLG_FIFO* fifo, I2CQ_CONTROLLER* bus, uint16_t watermark);
+void XLG_FIFO_START(XLG_FIFO* fifo);
+void XLG_FIFO_EDGE(XLG_FIFO* fifo);
+bool XLG_FIFO_POP(XLG_FIFO* fifo, XLG_DATA* gData, XLG_DATA* xlData);
 
 /**************** LSM6DS33 Register Address Defines ****************/
 // Embedded functions configuration register
@@ -63,6 +63,9 @@ void DMA_XferCpltCallback(DMA_HandleTypeDef *hdma);
 /* Private defines -----------------------------------------------------------*/
 #define USER_Btn_Pin GPIO_PIN_13
 #define USER_Btn_GPIO_Port GPIOC
+#define XLG_INT1_Pin GPIO_PIN_3
+#define XLG_INT1_GPIO_Port GPIOF
+#define XLG_INT1_EXTI_IRQn EXTI3_IRQn
 #define MCO_Pin GPIO_PIN_0
 #define MCO_GPIO_Port GPIOH
 #define TIM_3_CH1_MOTOR_1_Pin GPIO_PIN_6
@@ -79,10 +82,10 @@ void DMA_XferCpltCallback(DMA_HandleTypeDef *hdma);
 #define STLK_RX_GPIO_Port GPIOD
 #define STLK_TX_Pin GPIO_PIN_9
 #define STLK_TX_GPIO_Port GPIOD
-#define TIM4_CH1_DMA_LATCH_Pin GPIO_PIN_12
-#define TIM4_CH1_DMA_LATCH_GPIO_Port GPIOD
-#define TIM4_CH2_MOTOR_1_Pin GPIO_PIN_13
-#define TIM4_CH2_MOTOR_1_GPIO_Port GPIOD
+#define TIM4_CH2_MOTOR_5_Pin GPIO_PIN_13
+#define TIM4_CH2_MOTOR_5_GPIO_Port GPIOD
+#define TIM4_CH3_MOTOR_6_Pin GPIO_PIN_14
+#define TIM4_CH3_MOTOR_6_GPIO_Port GPIOD
 #define USB_OverCurrent_Pin GPIO_PIN_7
 #define USB_OverCurrent_GPIO_Port GPIOG
 #define TIM_3_CH1_MOTOR_4_Pin GPIO_PIN_9
@@ -0,0 +1,100 @@
+/*
+ * ALTITUDE.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Altitude and Vertical Velocity
+Barometer pressure into height, blended with the accelerometer so altitude hold has a velocity
+that is smooth and doesn't lag. It does not touch any peripheral so it can be compiled and checked
+off target.
+
+Pressure to height is the standard atmosphere, h = 44330.8 * (1 - (p / p0)^0.190263), without
+powf. (p / p0)^a = exp(a * ln(p / p0)), with
+- ln(p / p0) = 2 atanh(y), y = (p - p0) / (p + p0), odd series to y^9
+- exp(z) - 1 series to z^5, so the small heights near the ground don't cancel away
+Under 1mm of error from -500m to 4000m around the reference, growing to 1.64m at 9km.
+
+Third order complementary filter, run on every gyro sample with one correction per barometer
+sample. The vertical acceleration is the specific force turned into earth axes with the
+attitude estimate, gravity removed. The barometer error corrects altitude, velocity and the
+accelerometer bias with gains from one time constant tau
+- K1 = 3 / tau, K2 = 3 / tau^2, K3 = 1 / tau^3 (all three poles at -1 / tau)
+Below tau the accelerometer carries the estimate, above it the barometer does.
+*/
+
+#include "ALTITUDE.h"
+
+#define ALTITUDE_SCALE		44330.8f	// m, standard atmosphere
+#define ALTITUDE_EXPONENT	0.190263f
+
+/* Function Summary: Set up the filter, it starts once the ground reference has been averaged
+ * Param: tau - Crossover time constant, s
+ * Return: Pointer to struct containing the filter
+ */
+ALTITUDE_CONTROLLER* ALTITUDE_INIT(float tau)
+{
+	ALTITUDE_CONTROLLER* alt = malloc(sizeof(ALTITUDE_CONTROLLER));
+	memset(alt, 0, sizeof(ALTITUDE_CONTROLLER));
+	alt->K1 = 3.0f / tau;
+	alt->K2 = 3.0f / (tau * tau);
+	alt->K3 = 1.0f / (tau * tau * tau);
+	return alt;
+}
+
+/* Function Summary: Height of a pressure above a reference pressure, standard atmosphere
+ * Param: pressure - hPa
+ * Param: ground - Reference pressure, hPa
+ * Return: m, positive above the reference
+ */
+float ALTITUDE_FROM_PRESSURE(float pressure, float ground)
+{
+	float y = (pressure - ground) / (pressure + ground);
+	float y2 = y * y;
+	float ln = 2.0f * y * (1.0f + y2 * (1.0f / 3.0f + y2 * (1.0f / 5.0f + y2 * (1.0f / 7.0f + y2 * (1.0f / 9.0f)))));
+	float z = ALTITUDE_EXPONENT * ln;
+	float expm1 = z * (1.0f + z * (1.0f / 2.0f + z * (1.0f / 6.0f + z * (1.0f / 24.0f + z * (1.0f / 120.0f)))));
+	return -ALTITUDE_SCALE * expm1;
+}
+
+/* Function Summary: Integrate the vertical acceleration, every gyro sample
+ * Param: alt - Filter state
+ * Param: down - Earth down row of the body to earth rotation, ATTITUDE_CONTROLLER R[2]
+ * Param: accel - Specific force in g, X forward / Y right / Z down
+ * Param: dt - Sample period, s
+ * Return: VOID
+ */
+void ALTITUDE_PREDICT(ALTITUDE_CONTROLLER* alt, const float* down, const float* accel, float dt)
+{
+	if (!alt->Primed) return;
+	// Still and level the down component is -1g, anything past that is acceleration
+	float forceDown = down[0] * accel[0] + down[1] * accel[1] + down[2] * accel[2];
+	float up = -(forceDown + 1.0f) * ALTITUDE_GRAVITY - alt->Bias;
+	alt->Altitude += (alt->Velocity + 0.5f * up * dt) * dt;
+	alt->Velocity += up * dt;
+}
+
+/* Function Summary: Pull the estimate towards a barometer sample. The first
+ * ALTITUDE_GROUND_SAMPLES are averaged into the ground reference instead
+ * Param: alt - Filter state
+ * Param: pressure - hPa
+ * Param: dt - Time since the last barometer sample, s
+ * Return: VOID
+ */
+void ALTITUDE_CORRECT(ALTITUDE_CONTROLLER* alt, float pressure, float dt)
+{
+	if (!alt->Primed)
+	{
+		alt->GroundSum += pressure;
+		if (++alt->GroundSamples < ALTITUDE_GROUND_SAMPLES) return;
+		alt->Ground = alt->GroundSum / alt->GroundSamples;
+		alt->Primed = 1;
+		return;
+	}
+	alt->BaroAltitude = ALTITUDE_FROM_PRESSURE(pressure, alt->Ground);
+	float error = alt->BaroAltitude - alt->Altitude;
+	alt->Altitude += alt->K1 * error * dt;
+	alt->Velocity += alt->K2 * error * dt;
+	alt->Bias -= alt->K3 * error * dt;
+}
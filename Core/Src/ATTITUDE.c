@@ -0,0 +1,236 @@
+/*
+ * ATTITUDE.c
+ *
+ *  Created on: Jan 30, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Attitude Estimate and Angle Mode
+Mahony complementary filter on a quaternion, run on every gyro sample. The gyro is integrated
+for fast changes, and the error between the measured and predicted gravity direction is fed
+back through a PI term so the estimate does not drift and the I-term learns the gyro bias.
+
+The accelerometer only shows gravity when the frame isn't accelerating, so the feedback is
+faded out as the measured magnitude moves away from 1g (punch-outs, hard turns) and is off
+past ATTITUDE_ACCEL_BAND. The accelerometer says nothing about heading, so Yaw is gyro only.
+
+ATTITUDE_EKF swaps the Mahony filter for the EKF in EKF.c, which also estimates gyro bias and
+takes a magnetometer for heading. It is too heavy for every sample, so the gyro is summed and
+the EKF steps once per outer loop step on the averaged rate.
+
+Axes are body X forward, Y right, Z down. Accelerometer input is specific force in g, level
+and still reads (0, 0, -1). Gyro input is deg/s in pidAxes_e order, roll right, pitch forward
+and yaw right.
+
+Angle mode turns stick position into a target tilt (full stick = MaxAngle), and a P loop on
+the tilt error gives the roll/pitch rate setpoints for the rate PID. The outer loop is
+decimated, it runs once every Divider samples and the inner loop keeps chasing the last
+RateTarget in between.
+*/
+
+#include <math.h>
+#include "ATTITUDE.h"
+
+#define RAD_TO_DEG				57.29578f
+#define DEG_TO_RAD				0.01745329f
+#define ATTITUDE_MAHONY_KP		1.0f	// Gravity feedback, rad/s per unit of direction error
+#define ATTITUDE_MAHONY_KI		0.05f	// Bias learning
+#define ATTITUDE_ACCEL_BAND		0.25f	// g away from 1g where the gravity feedback reaches 0
+
+/* Function Summary: 1 / sqrt(x) from the float exponent trick plus two Newton steps, about 5ppm
+ * off, cheaper than VSQRT and VDIV back to back
+ * Param: x - Positive value
+ * Return: 1 / sqrt(x)
+ */
+static float ATTITUDE_INV_SQRT(float x)
+{
+	float half = 0.5f * x;
+	uint32_t bits;
+	float y;
+	memcpy(&bits, &x, sizeof(bits));
+	bits = 0x5F375A86 - (bits >> 1);
+	memcpy(&y, &bits, sizeof(y));
+	y = y * (1.5f - half * y * y);
+	y = y * (1.5f - half * y * y);
+	return y;
+}
+
+/* Function Summary: Rotation matrix and Euler angles from the quaternion
+ * Param: att - Attitude state
+ * Return: VOID
+ */
+static void ATTITUDE_OUTPUT(ATTITUDE_CONTROLLER* att)
+{
+	float w = att->Q[0], x = att->Q[1], y = att->Q[2], z = att->Q[3];
+	att->R[0][0] = 1.0f - 2.0f * (y * y + z * z);
+	att->R[0][1] = 2.0f * (x * y - w * z);
+	att->R[0][2] = 2.0f * (x * z + w * y);
+	att->R[1][0] = 2.0f * (x * y + w * z);
+	att->R[1][1] = 1.0f - 2.0f * (x * x + z * z);
+	att->R[1][2] = 2.0f * (y * z - w * x);
+	att->R[2][0] = 2.0f * (x * z - w * y);
+	att->R[2][1] = 2.0f * (y * z + w * x);
+	att->R[2][2] = 1.0f - 2.0f * (x * x + y * y);
+	float sinPitch = -att->R[2][0];
+	if (sinPitch > 1.0f) sinPitch = 1.0f;
+	else if (sinPitch < -1.0f) sinPitch = -1.0f;
+	att->Roll = atan2f(att->R[2][1], att->R[2][2]) * RAD_TO_DEG;
+	att->Pitch = -asinf(sinPitch) * RAD_TO_DEG;		// Nose down is positive here
+	att->Yaw = atan2f(att->R[1][0], att->R[0][0]) * RAD_TO_DEG;
+}
+
+/* Function Summary: Set up the attitude estimate and the angle outer loop
+ * Param: sampleHz - Gyro rate, one ATTITUDE_UPDATE per sample
+ * Param: divider - Gyro samples per outer loop step, also the EKF decimation
+ * Param: estimator - ATTITUDE_MAHONY or ATTITUDE_EKF
+ * Param: kp - deg/s of rate per degree of tilt error
+ * Param: maxAngle - Tilt at full stick, degrees
+ * Param: maxRate - Largest roll/pitch rate the outer loop asks for, deg/s
+ * Return: Pointer to struct containing the attitude state
+ */
+ATTITUDE_CONTROLLER* ATTITUDE_INIT(float sampleHz, uint8_t divider, attitudeEstimators_e estimator, float kp, float maxAngle, float maxRate)
+{
+	ATTITUDE_CONTROLLER* att = malloc(sizeof(ATTITUDE_CONTROLLER));
+	memset(att, 0, sizeof(ATTITUDE_CONTROLLER));
+	att->Q[0] = 1.0f;
+	att->Divider = divider ? divider : 1;
+	att->Dt = 1.0f / sampleHz;
+	att->Kp = kp;
+	att->MaxAngle = maxAngle;
+	att->MaxRate = maxRate;
+	att->Estimator = estimator;
+	if (estimator == ATTITUDE_EKF) att->Ekf = EKF_INIT(att->Q);
+	ATTITUDE_OUTPUT(att);
+	return att;
+}
+
+/* Function Summary: Seed the quaternion from the accelerometer tilt, heading starts at 0
+ * Param: att - Attitude state
+ * Param: accel - Specific force, X forward / Y right / Z down
+ * Return: VOID
+ */
+static void ATTITUDE_SEED(ATTITUDE_CONTROLLER* att, const float* accel)
+{
+	float roll = atan2f(-accel[1], -accel[2]);
+	float pitchUp = atan2f(accel[0], sqrtf(accel[1] * accel[1] + accel[2] * accel[2]));
+	float cr = cosf(roll / 2), sr = sinf(roll / 2);
+	float cp = cosf(pitchUp / 2), sp = sinf(pitchUp / 2);
+	att->Q[0] = cr * cp;
+	att->Q[1] = sr * cp;
+	att->Q[2] = cr * sp;
+	att->Q[3] = -sr * sp;
+}
+
+/* Function Summary: One Mahony step, gravity feedback then quaternion integration
+ * Param: att - Attitude state
+ * Param: rate - Body rates, rad/s, X forward / Y right / Z down
+ * Param: accel - Specific force in g, X forward / Y right / Z down
+ * Return: VOID
+ */
+static void ATTITUDE_MAHONY_STEP(ATTITUDE_CONTROLLER* att, const float* rate, const float* accel)
+{
+	float gx = rate[0], gy = rate[1], gz = rate[2];
+	float w = att->Q[0], x = att->Q[1], y = att->Q[2], z = att->Q[3];
+	float normSq = accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2];
+	if (normSq > 0)
+	{
+		float invNorm = ATTITUDE_INV_SQRT(normSq);
+		float norm = normSq * invNorm;
+		// Trust gravity less the further the frame is from 1g
+		float weight = 1.0f - fabsf(norm - 1.0f) / ATTITUDE_ACCEL_BAND;
+		if (weight > 0)
+		{
+			// Measured "up" (specific force points away from gravity) against the predicted up,
+			// the third row of R flipped
+			float ax = accel[0] * invNorm, ay = accel[1] * invNorm, az = accel[2] * invNorm;
+			float vx = -2.0f * (x * z - w * y);
+			float vy = -2.0f * (y * z + w * x);
+			float vz = -(1.0f - 2.0f * (x * x + y * y));
+			float ex = (ay * vz - az * vy) * weight;
+			float ey = (az * vx - ax * vz) * weight;
+			float ez = (ax * vy - ay * vx) * weight;
+			att->Integral[0] += ATTITUDE_MAHONY_KI * ex * att->Dt;
+			att->Integral[1] += ATTITUDE_MAHONY_KI * ey * att->Dt;
+			att->Integral[2] += ATTITUDE_MAHONY_KI * ez * att->Dt;
+			gx += ATTITUDE_MAHONY_KP * ex;
+			gy += ATTITUDE_MAHONY_KP * ey;
+			gz += ATTITUDE_MAHONY_KP * ez;
+		}
+	}
+	gx += att->Integral[0];
+	gy += att->Integral[1];
+	gz += att->Integral[2];
+	// q += q * (0, g) * dt / 2
+	float h = 0.5f * att->Dt;
+	att->Q[0] = w + (-x * gx - y * gy - z * gz) * h;
+	att->Q[1] = x + (w * gx + y * gz - z * gy) * h;
+	att->Q[2] = y + (w * gy - x * gz + z * gx) * h;
+	att->Q[3] = z + (w * gz + x * gy - y * gx) * h;
+	float invQ = ATTITUDE_INV_SQRT(att->Q[0] * att->Q[0] + att->Q[1] * att->Q[1] +
+								   att->Q[2] * att->Q[2] + att->Q[3] * att->Q[3]);
+	for (int i = 0; i < 4; i++) att->Q[i] *= invQ;
+}
+
+/* Function Summary: One EKF step over the rates averaged since the last one
+ * Param: att - Attitude state
+ * Param: accel - Specific force in g, X forward / Y right / Z down
+ * Param: mag - Magnetic field, X forward / Y right / Z down, NULL when there is none
+ * Return: VOID
+ */
+static void ATTITUDE_EKF_STEP(ATTITUDE_CONTROLLER* att, const float* accel, const float* mag)
+{
+	float rate[3];
+	for (int i = 0; i < 3; i++) rate[i] = att->GyroSum[i] / att->Divider;
+	memset(att->GyroSum, 0, sizeof(att->GyroSum));
+	EKF_PREDICT(att->Ekf, rate, att->Dt * att->Divider);
+	EKF_ACCEL_UPDATE(att->Ekf, accel);
+	if (mag) EKF_MAG_UPDATE(att->Ekf, mag);
+	EKF_APPLY(att->Ekf);
+	memcpy(att->Q, att->Ekf->Q, sizeof(att->Q));
+}
+
+/* Function Summary: One estimator step per gyro sample, every Divider samples the roll/pitch
+ * rate targets are updated as well. With the EKF the estimate itself only moves on those steps
+ * Param: att - Attitude state
+ * Param: gyro - Body rates, deg/s, pidAxes_e order
+ * Param: accel - Specific force in g, X forward / Y right / Z down
+ * Param: mag - Magnetic field, X forward / Y right / Z down, NULL when there is none. Only
+ * the EKF uses it
+ * Param: stickRoll - Roll stick, -1 to 1
+ * Param: stickPitch - Pitch stick, -1 to 1
+ * Return: 1 if the outer loop ran on this sample
+ */
+uint8_t ATTITUDE_UPDATE(ATTITUDE_CONTROLLER* att, const float* gyro, const float* accel, const float* mag, float stickRoll, float stickPitch)
+{
+	if (!att->Primed)
+	{
+		if (accel[0] == 0 && accel[1] == 0 && accel[2] == 0) return 0;
+		ATTITUDE_SEED(att, accel);
+		if (att->Ekf) memcpy(att->Ekf->Q, att->Q, sizeof(att->Q));
+		att->Primed = 1;
+	}
+	// Body rates in rad/s about X forward / Y right / Z down, pitching forward is a negative Y rate
+	float rate[3] = {gyro[PID_ROLL] * DEG_TO_RAD, -gyro[PID_PITCH] * DEG_TO_RAD, gyro[PID_YAW] * DEG_TO_RAD};
+	if (att->Estimator == ATTITUDE_EKF)
+	{
+		for (int i = 0; i < 3; i++) att->GyroSum[i] += rate[i];
+	}
+	else
+	{
+		ATTITUDE_MAHONY_STEP(att, rate, accel);
+	}
+	if (++att->Samples < att->Divider) return 0;
+	att->Samples = 0;
+	if (att->Estimator == ATTITUDE_EKF) ATTITUDE_EKF_STEP(att, accel, mag);
+	ATTITUDE_OUTPUT(att);
+	// Tilt error into rate setpoints for the inner loop
+	float rollRate = att->Kp * (stickRoll * att->MaxAngle - att->Roll);
+	float pitchRate = att->Kp * (stickPitch * att->MaxAngle - att->Pitch);
+	if (rollRate > att->MaxRate) rollRate = att->MaxRate;
+	else if (rollRate < -att->MaxRate) rollRate = -att->MaxRate;
+	if (pitchRate > att->MaxRate) pitchRate = att->MaxRate;
+	else if (pitchRate < -att->MaxRate) pitchRate = -att->MaxRate;
+	att->RateTarget[PID_ROLL] = rollRate;
+	att->RateTarget[PID_PITCH] = pitchRate;
+	return 1;
+}
@@ -0,0 +1,110 @@
+/*
+ * BARO.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** LPS25H Barometer
+The AltIMU-10 barometer shares I2C1 with the LSM6DS33 and LIS3MDL. It runs at 25Hz in FIFO mean
+mode, so the chip keeps a moving average of the last BARO_MEAN_SAMPLES pressures in the output
+registers and one 4 byte read gets an averaged sample. The main loop decimates the reads
+against the gyro and starts them in the gap after a gyro read, same as the magnetometer.
+
+Pressure is 24 bit two's complement, 4096 LSB per hPa. Height and the vertical velocity filter
+are in ALTITUDE.
+*/
+
+#include "BARO.h"
+
+/* Function Summary: Check the chip is there and start it in FIFO mean mode
+ * Param: bus - Queue for the I2C peripheral, configuration uses blocking writes on its handle
+ * Return: Pointer to struct containing the barometer
+ */
+BARO_CONTROLLER* BARO_INIT(I2CQ_CONTROLLER* bus)
+{
+	I2C_HandleTypeDef* i2c = bus->I2c;
+	BARO_CONTROLLER* baro = malloc(sizeof(BARO_CONTROLLER));
+	memset(baro, 0, sizeof(BARO_CONTROLLER));
+	baro->Bus = bus;
+	// Boards without the barometer carry on, BARO_START does nothing
+	uint8_t whoAmI = 0;
+	if (HAL_I2C_Mem_Read(i2c, BARO_I2C_ADDR, BARO_WHO_AM_I, 1, &whoAmI, 1, BARO_INIT_TIMEOUT) != HAL_OK ||
+		whoAmI != BARO_WHO_AM_I_VALUE) return baro;
+	baro->Present = 1;
+	uint8_t writeThis = BARO_RES_AVG;
+	HAL_I2C_Mem_Write(i2c, BARO_I2C_ADDR, BARO_RES_CONF, 1, &writeThis, 1, BARO_INIT_TIMEOUT);
+	writeThis = BARO_FIFO_MEAN | (BARO_MEAN_SAMPLES - 1);
+	HAL_I2C_Mem_Write(i2c, BARO_I2C_ADDR, BARO_FIFO_CTRL, 1, &writeThis, 1, BARO_INIT_TIMEOUT);
+	writeThis = BARO_CTRL2_FIFO_EN;
+	HAL_I2C_Mem_Write(i2c, BARO_I2C_ADDR, BARO_CTRL_REG2, 1, &writeThis, 1, BARO_INIT_TIMEOUT);
+	// Power up last, once the averaging is set
+	writeThis = BARO_CTRL1_PD | BARO_CTRL1_ODR_25 | BARO_CTRL1_BDU;
+	HAL_I2C_Mem_Write(i2c, BARO_I2C_ADDR, BARO_CTRL_REG1, 1, &writeThis, 1, BARO_INIT_TIMEOUT);
+	return baro;
+}
+
+/* Function Summary: Decode the pressure output registers
+ * Param: data - PRESS_OUT_XL through PRESS_OUT_H, 3 bytes
+ * Return: Pressure, BARO_LSB_PER_HPA per hPa
+ */
+int32_t BARO_DECODE(const uint8_t* data)
+{
+	// 24 bit two's complement, shifted up and back down to extend the sign
+	return (int32_t)(((uint32_t)data[0] << 8) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 24)) >> 8;
+}
+
+/* Function Summary: Burst read finished, keep the sample if the chip had a new one. Runs in the
+ * I2C interrupt
+ * Param: context - Barometer
+ * Param: ok - 0 if the read failed after its retries
+ * Return: VOID
+ */
+static void BARO_DONE(void* context, uint8_t ok)
+{
+	BARO_CONTROLLER* baro = context;
+	baro->Busy = 0;
+	if (!ok)
+	{
+		baro->Failed++;
+		return;
+	}
+	if (!(baro->Data[0] & BARO_STATUS_P_DA))
+	{
+		baro->Stale++;
+		return;
+	}
+	baro->Raw = BARO_DECODE(&baro->Data[1]);
+	baro->Time = DWT->CYCCNT;
+	baro->Ready = 1;
+}
+
+/* Function Summary: Queue one burst read, from the main loop between gyro reads
+ * Param: baro - Barometer
+ * Return: 0 if nothing was queued, no chip, a read still running or the queue full
+ */
+uint8_t BARO_START(BARO_CONTROLLER* baro)
+{
+	if (!baro->Present || baro->Busy) return 0;
+	baro->Busy = 1;
+	if (!I2CQ_SUBMIT(baro->Bus, BARO_I2C_ADDR, BARO_STATUS_REG | BARO_AUTO_INC, baro->Data, BARO_BURST_SIZE, I2CQ_READ, BARO_DONE, baro))
+	{
+		baro->Busy = 0;
+		return 0;
+	}
+	return 1;
+}
+
+/* Function Summary: Take the newest sample. Call before the next BARO_START, Raw is only written
+ * by the read that starts
+ * Param: baro - Barometer
+ * Param: pressure - Output, hPa
+ * Return: false if there was no new sample
+ */
+bool BARO_READ(BARO_CONTROLLER* baro, float* pressure)
+{
+	if (!baro->Ready) return false;
+	baro->Ready = 0;
+	*pressure = baro->Raw / BARO_LSB_PER_HPA;
+	return true;
+}
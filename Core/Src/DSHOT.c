@@ -0,0 +1,296 @@
+/*
+ * DSHOT.c
+ *
+ *  Created on: Oct 24, 2020
+ *      Author: Jeff Raines
+ */
+
+/** DSHOT frame encoding
+This file only builds packets and pulse width buffers, it does not touch any
+peripheral so it can be compiled and checked off target.
+
+Frames are interleaved so a single timer DMA burst can feed every channel. Every
+protocol's CCR values fit the 16 bit timers, so frames are halfwords and the burst
+streams move halfwords into DMAR:
+
+| halfword 0          | halfword 1          | ... | halfword stride-1          |
+| bit 0 CCR (motor 0) | bit 0 CCR (motor 1) | ... | bit 0 CCR (motor stride-1) |
+| bit 1 CCR (motor 0) | bit 1 CCR (motor 1) | ... | bit 1 CCR (motor stride-1) |
+
+Bidirectional eRPM reply - 21 bits, every edge on the wire is a 1 (NRZI)
+- 21 bit NRZI value -> value ^ (value >> 1) -> 20 bit GCR -> 4 nibbles (5 bits each)
+- Decoded 16 bits | 15-13 = exponent | 12-4 = mantissa | 3-0 = checksum |
+- Period (uS) = mantissa << exponent, 0xFFF means the motor is stopped
+
+Protocol table - all counts are for the 108MHz APB1 timer clock
+- DSHOT: ARR = clock / bit rate, 0 bit = 37.5% of ARR, 1 bit = 75% of ARR
+- Analog: one pulse per frame followed by a zero row so the line stays low until the
+  next frame. Throttle 48-2047 maps linearly onto the min-max pulse, commands are stop
+- PWM needs a prescaler, 2mS is more than the 16 bit counter holds at 108MHz
+*/
+
+#include "DSHOT.h"
+
+#define GCR_INVALID		0xFF
+
+#define DSHOT_ARR(KBIT)			(TIMER_CLOCK_HZ / ((KBIT) * 1000))
+#define DSHOT_BIT0(KBIT)		((DSHOT_ARR(KBIT) * 3 + 4) / 8)
+#define DSHOT_BIT1(KBIT)		((DSHOT_ARR(KBIT) * 3 + 2) / 4)
+#define ANALOG_TICKS(US, PSC)	((US) * TIMER_CLOCK_MHZ / ((PSC) + 1))
+#define ANALOG_FRAME_ROWS		2
+
+// Min pulse (uS), max pulse (uS), period (uS), prescaler
+#define ONESHOT125_TIMING		125, 250, 260, 0
+#define ONESHOT42_TIMING		42, 84, 90, 0
+#define MULTISHOT_TIMING		5, 25, 30, 0
+#define PWM_TIMING				1000, 2000, 2040, 107
+
+// Bit rate divides the clock exactly, pulses fit in a bit and the eRPM window fits the 16 bit counter
+#define DSHOT_VALID(KBIT)		(TIMER_CLOCK_HZ % ((KBIT) * 1000) == 0 && DSHOT_BIT0(KBIT) > 0 && \
+								 DSHOT_BIT1(KBIT) < DSHOT_ARR(KBIT) && DSHOT_TELEM_WINDOW(DSHOT_ARR(KBIT)) <= 0xFFFF)
+#define ANALOG_VALID(TIMING)	ANALOG_VALID_(TIMING)
+#define ANALOG_VALID_(MIN_US, MAX_US, PERIOD_US, PSC) \
+								((MIN_US) > 0 && (MIN_US) < (MAX_US) && (MAX_US) < (PERIOD_US) && (PSC) <= 0xFFFF && \
+								 ANALOG_TICKS(PERIOD_US, PSC) <= 0x10000 && ANALOG_TICKS(MIN_US, PSC) < ANALOG_TICKS(MAX_US, PSC))
+
+_Static_assert(DSHOT_VALID(150), "DSHOT150 timing does not fit TIM3");
+_Static_assert(DSHOT_VALID(300), "DSHOT300 timing does not fit TIM3");
+_Static_assert(DSHOT_VALID(600), "DSHOT600 timing does not fit TIM3");
+_Static_assert(DSHOT_VALID(1200), "DSHOT1200 timing does not fit TIM3");
+_Static_assert(ANALOG_VALID(ONESHOT125_TIMING), "Oneshot125 timing does not fit TIM3");
+_Static_assert(ANALOG_VALID(ONESHOT42_TIMING), "Oneshot42 timing does not fit TIM3");
+_Static_assert(ANALOG_VALID(MULTISHOT_TIMING), "Multishot timing does not fit TIM3");
+_Static_assert(ANALOG_VALID(PWM_TIMING), "PWM timing does not fit TIM3");
+_Static_assert(DSHOT_PACKET_SIZE <= ESC_PROTOCOL_MAX_ROWS, "DSHOT frame larger than the frame buffer");
+_Static_assert(ANALOG_FRAME_ROWS <= ESC_PROTOCOL_MAX_ROWS, "Analog frame larger than the frame buffer");
+
+#define DSHOT_PROTOCOL(NAME, KBIT) \
+	{ NAME, 0, DSHOT_ARR(KBIT), DSHOT_BIT0(KBIT), DSHOT_BIT1(KBIT), DSHOT_PACKET_SIZE, 1, DSHOT_ENCODE_THROTTLE }
+#define ANALOG_PROTOCOL(NAME, TIMING)	ANALOG_PROTOCOL_(NAME, TIMING)
+#define ANALOG_PROTOCOL_(NAME, MIN_US, MAX_US, PERIOD_US, PSC) \
+	{ NAME, PSC, ANALOG_TICKS(PERIOD_US, PSC), ANALOG_TICKS(MIN_US, PSC), ANALOG_TICKS(MAX_US, PSC), \
+	  ANALOG_FRAME_ROWS, 0, ANALOG_ENCODE_THROTTLE }
+
+const ESC_PROTOCOL ESC_PROTOCOLS[ESC_PROTOCOL_COUNT] = {
+	[ESC_PROTOCOL_DSHOT150] = DSHOT_PROTOCOL("DSHOT150", 150),
+	[ESC_PROTOCOL_DSHOT300] = DSHOT_PROTOCOL("DSHOT300", 300),
+	[ESC_PROTOCOL_DSHOT600] = DSHOT_PROTOCOL("DSHOT600", 600),
+	[ESC_PROTOCOL_DSHOT1200] = DSHOT_PROTOCOL("DSHOT1200", 1200),
+	[ESC_PROTOCOL_ONESHOT125] = ANALOG_PROTOCOL("ONESHOT125", ONESHOT125_TIMING),
+	[ESC_PROTOCOL_ONESHOT42] = ANALOG_PROTOCOL("ONESHOT42", ONESHOT42_TIMING),
+	[ESC_PROTOCOL_MULTISHOT] = ANALOG_PROTOCOL("MULTISHOT", MULTISHOT_TIMING),
+	[ESC_PROTOCOL_PWM] = ANALOG_PROTOCOL("PWM", PWM_TIMING)
+};
+
+// 5 bit GCR symbol to nibble, every unused symbol is invalid
+static const uint8_t gcrDecode[32] = {
+	GCR_INVALID, GCR_INVALID, GCR_INVALID, GCR_INVALID, GCR_INVALID, GCR_INVALID, GCR_INVALID, GCR_INVALID,
+	GCR_INVALID, 0x9, 0xA, 0xB, GCR_INVALID, 0xD, 0xE, 0xF,
+	GCR_INVALID, GCR_INVALID, 0x2, 0x3, GCR_INVALID, 0x5, 0x6, 0x7,
+	GCR_INVALID, 0x0, 0x8, 0x1, GCR_INVALID, 0x4, 0xC, GCR_INVALID
+};
+
+/* Function Summary: Build the 16 bit DSHOT packet (throttle, telemetry bit, checksum)
+ * Param: value - 11 bit throttle or command value
+ * Param: telemBit - telemetry request bit
+ * Return: Packet ready to be converted into pulse widths
+ */
+uint16_t makeDshotPacketBytes(uint32_t value, uint8_t telemBit)
+{
+	uint16_t packet = (value << 1) | telemBit;
+	// xor of the three data nibbles
+	uint16_t csum = (packet ^ (packet >> 4) ^ (packet >> 8)) & 0xf;
+#ifdef DSHOT_BIDIR
+	// Inverted checksum tells the ESC to answer with eRPM telemetry
+	csum = ~csum & 0xf;
+#endif
+	return (packet << 4) | csum;
+}
+
+/* Function Summary: Fill the nibble lookup table for a protocol's bit pulse widths.
+ * Each entry holds the four CCR values for one nibble, most significant bit first.
+ * Param: * enc - Encoder table to fill
+ * Param: lowBit - CCR value for a 0 bit
+ * Param: highBit - CCR value for a 1 bit
+ * Return: VOID
+ */
+void DSHOT_ENCODER_INIT(DSHOT_ENCODER* enc, uint32_t lowBit, uint32_t highBit)
+{
+	for (int nibble = 0; nibble < 16; nibble++)
+	{
+		for (int bit = 0; bit < 4; bit++)
+		{
+			enc->NibbleWidths[nibble][bit] = ((nibble >> (3 - bit)) & 0b1) ? highBit : lowBit;
+		}
+	}
+}
+
+/* Function Summary: Write one packet into a single motor column of an interleaved frame.
+ * Lead-in and trailing rows are left alone, they are zeroed once by DSHOT_CLEAR_FRAME.
+ * Param: * enc - Encoder table for the active protocol
+ * Param: * frame - Interleaved frame buffer, DSHOT_PACKET_SIZE rows of stride halfwords
+ * Param: stride - Number of motors (halfwords) per row
+ * Param: column - Motor column to write
+ * Param: dshotBytes - Packet from makeDshotPacketBytes
+ * Return: VOID
+ */
+void DSHOT_WRITE_FRAME(const DSHOT_ENCODER* enc, uint16_t* frame, uint32_t stride, uint32_t column, uint16_t dshotBytes)
+{
+	uint16_t* slot = frame + DSHOT_PACKET_LEAD * stride + column;
+	for (int shift = DSHOT_PACKET_BITS - 4; shift >= 0; shift -= 4)
+	{
+		const uint16_t* widths = enc->NibbleWidths[(dshotBytes >> shift) & 0xf];
+		slot[0] = widths[0];
+		slot[stride] = widths[1];
+		slot[2 * stride] = widths[2];
+		slot[3 * stride] = widths[3];
+		slot += 4 * stride;
+	}
+}
+
+/* Function Summary: Write a packet for every motor in one pass. Rows are filled in order
+ * so the frame is written sequentially instead of one strided column at a time.
+ * Param: * enc - Encoder table for the active protocol
+ * Param: * frame - Interleaved frame buffer, DSHOT_PACKET_SIZE rows of count halfwords
+ * Param: * packets - One packet per motor from makeDshotPacketBytes
+ * Param: count - Number of motors (halfwords) per row
+ * Return: VOID
+ */
+void DSHOT_ENCODE_FRAME(const DSHOT_ENCODER* enc, uint16_t* frame, const uint16_t* packets, uint32_t count)
+{
+	uint16_t* row = frame + DSHOT_PACKET_LEAD * count;
+	for (int shift = DSHOT_PACKET_BITS - 4; shift >= 0; shift -= 4)
+	{
+		for (uint32_t m = 0; m < count; m++)
+		{
+			const uint16_t* widths = enc->NibbleWidths[(packets[m] >> shift) & 0xf];
+			row[m] = widths[0];
+			row[m + count] = widths[1];
+			row[m + 2 * count] = widths[2];
+			row[m + 3 * count] = widths[3];
+		}
+		row += 4 * count;
+	}
+}
+
+/* Function Summary: DSHOT protocol encoder, builds a packet per motor and fills the frame
+ * Param: * proto - Active protocol (unused, widths come from enc)
+ * Param: * enc - Encoder table for the active protocol
+ * Param: * frame - Interleaved frame buffer, DSHOT_PACKET_SIZE rows of count halfwords
+ * Param: * values - Throttle or command value per motor
+ * Param: count - Number of motors (halfwords) per row, at most DSHOT_MAX_MOTORS
+ * Param: telemMask - bit n sets the telemetry request bit in motor n's packet
+ * Return: VOID
+ */
+void DSHOT_ENCODE_THROTTLE(const ESC_PROTOCOL* proto, const DSHOT_ENCODER* enc, uint16_t* frame,
+							const uint16_t* values, uint32_t count, uint8_t telemMask)
+{
+	(void)proto;
+	uint16_t packets[DSHOT_MAX_MOTORS];
+	if (count > DSHOT_MAX_MOTORS) count = DSHOT_MAX_MOTORS;
+	for (uint32_t m = 0; m < count; m++) packets[m] = makeDshotPacketBytes(values[m], (telemMask >> m) & 0b1);
+	DSHOT_ENCODE_FRAME(enc, frame, packets, count);
+}
+
+/* Function Summary: Oneshot/Multishot/PWM encoder, one pulse row then one zero row
+ * Param: * proto - Active protocol, LowBit/HighBit are the stop/full throttle pulses
+ * Param: * enc - Unused
+ * Param: * frame - Interleaved frame buffer, ANALOG_FRAME_ROWS rows of count halfwords
+ * Param: * values - DSHOT scale throttle per motor, command values are sent as stop
+ * Param: count - Number of motors (halfwords) per row
+ * Param: telemMask - Unused
+ * Return: VOID
+ */
+void ANALOG_ENCODE_THROTTLE(const ESC_PROTOCOL* proto, const DSHOT_ENCODER* enc, uint16_t* frame,
+							const uint16_t* values, uint32_t count, uint8_t telemMask)
+{
+	(void)enc;
+	(void)telemMask;
+	uint32_t span = proto->HighBit - proto->LowBit;
+	for (uint32_t m = 0; m < count; m++)
+	{
+		uint32_t value = values[m];
+		if (value > DSHOT_MAX_THROTTLE) value = DSHOT_MAX_THROTTLE;
+		if (value <= DSHOT_MIN_THROTTLE) frame[m] = proto->LowBit;
+		else frame[m] = proto->LowBit + (value - DSHOT_MIN_THROTTLE) * span / (DSHOT_MAX_THROTTLE - DSHOT_MIN_THROTTLE);
+		frame[count + m] = 0;
+	}
+}
+
+/* Function Summary: Zero a motor column so that motor sees no packet in this frame
+ * Param: * frame - Interleaved frame buffer, DSHOT_PACKET_SIZE rows of stride halfwords
+ * Param: stride - Number of motors (halfwords) per row
+ * Param: column - Motor column to clear
+ * Return: VOID
+ */
+void DSHOT_CLEAR_FRAME(uint16_t* frame, uint32_t stride, uint32_t column)
+{
+	for (int i = 0; i < DSHOT_PACKET_SIZE; i++) frame[i * stride + column] = 0;
+}
+
+/* Function Summary: Rebuild the 21 bit NRZI reply from captured edge times. Each gap is
+ * rounded to a whole number of bits, the run starts with a 1 (the edge) followed by 0s.
+ * Param: * edges - Timer counts of every captured edge, first entry is the start edge
+ * Param: count - Number of valid entries in edges
+ * Param: bitTicks - Timer counts per reply bit
+ * Return: Raw 21 bit value or DSHOT_TELEM_INVALID
+ */
+uint32_t DSHOT_DECODE_EDGES(const uint16_t* edges, uint32_t count, uint32_t bitTicks)
+{
+	if (count < 2) return DSHOT_TELEM_INVALID;
+	uint32_t value = 0;
+	uint32_t bits = 0;
+	for (uint32_t i = 1; i < count; i++)
+	{
+		// Capture timer is 16 bits, mask so a wrap between edges still gives the gap
+		uint32_t len = ((((edges[i] - edges[i - 1]) & 0xFFFF) + bitTicks / 2) / bitTicks);
+		if (len == 0) return DSHOT_TELEM_INVALID;
+		// Edge back to idle after the last bit, the padding below finishes the run
+		if (bits + len > DSHOT_TELEM_BITS) break;
+		value = (value << len) | (1 << (len - 1));
+		bits += len;
+	}
+	// Line stays idle after the last edge, pad the final run out to 21 bits
+	if (bits < DSHOT_TELEM_BITS)
+	{
+		uint32_t len = DSHOT_TELEM_BITS - bits;
+		value = (value << len) | (1 << (len - 1));
+	}
+	return value;
+}
+
+/* Function Summary: Convert a raw 21 bit reply into the 12 bit period field
+ * Param: value - Raw value from DSHOT_DECODE_EDGES
+ * Return: 12 bit exponent/mantissa period or DSHOT_TELEM_INVALID on a bad symbol or checksum
+ */
+uint32_t DSHOT_DECODE_GCR(uint32_t value)
+{
+	if (value == DSHOT_TELEM_INVALID) return DSHOT_TELEM_INVALID;
+	uint32_t gcr = value ^ (value >> 1);
+	uint32_t decoded = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		uint8_t nibble = gcrDecode[(gcr >> (5 * i)) & 0x1f];
+		if (nibble == GCR_INVALID) return DSHOT_TELEM_INVALID;
+		decoded |= nibble << (4 * i);
+	}
+	uint32_t csum = decoded ^ (decoded >> 4) ^ (decoded >> 8) ^ (decoded >> 12);
+	if ((csum & 0xf) != 0xf) return DSHOT_TELEM_INVALID;
+	return decoded >> 4;
+}
+
+/* Function Summary: Decode captured reply edges all the way to electrical RPM
+ * Param: * edges - Timer counts of every captured edge, first entry is the start edge
+ * Param: count - Number of valid entries in edges
+ * Param: bitTicks - Timer counts per reply bit
+ * Return: eRPM, 0 if the motor is stopped, DSHOT_TELEM_INVALID if the reply is corrupt
+ */
+uint32_t DSHOT_DECODE_ERPM(const uint16_t* edges, uint32_t count, uint32_t bitTicks)
+{
+	uint32_t period = DSHOT_DECODE_GCR(DSHOT_DECODE_EDGES(edges, count, bitTicks));
+	if (period == DSHOT_TELEM_INVALID) return DSHOT_TELEM_INVALID;
+	if (period == 0xFFF) return 0;
+	uint32_t periodUs = (period & 0x1FF) << (period >> 9);
+	if (periodUs == 0) return DSHOT_TELEM_INVALID;
+	return 60000000 / periodUs;
+}
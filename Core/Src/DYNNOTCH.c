@@ -0,0 +1,205 @@
+/*
+ * DYNNOTCH.c
+ *
+ *  Created on: Feb 13, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Dynamic Notch
+Motor and prop noise moves with throttle, so the notches follow the gyro spectrum instead of
+sitting at fixed frequencies.
+
+Spectrum is a sliding DFT, every sample updates only the bins between MinHz and MaxHz:
+	X[k] = (X[k] * r + x[n] - r^N * x[n - N]) * e^(j2pik/N)
+r slightly under 1 keeps rounding errors from building up. That part is a fixed cost per sample.
+
+The rest is spread out so no single sample pays for it, one slice per DYNNOTCH_UPDATE:
+- Step 2a: search axis a for the PeakCount biggest local maxima, refined between bins with a
+  parabola through the peak bin and its neighbours
+- Step 2a + 1: pull axis a's notch centres towards those peaks and recompute the notches
+Every axis is retuned once every 2 * FILTER_AXES samples.
+
+Notches start parked evenly across MinHz to MaxHz and bypassed. A notch only starts filtering
+once a peak claims it, and jumps straight to that peak the first time, so unused notches never
+cut a hole in the bottom of the range.
+*/
+
+#include <math.h>
+#include "DYNNOTCH.h"
+
+#define DYNNOTCH_PI			3.14159265f
+#define DYNNOTCH_DAMPING	0.9999f		// r, per sample
+#define DYNNOTCH_SMOOTHING	0.3f		// Share of the new peak taken per retune
+#define DYNNOTCH_THRESHOLD	2.0f		// Peak power must be this many times the mean to count
+
+/* Function Summary: Set up the sliding DFT and park every notch, bypassed, across the range
+ * Param: sampleHz - Gyro rate, one DYNNOTCH_UPDATE per sample
+ * Param: peakCount - Notches per axis, 1 - DYNNOTCH_MAX_PEAKS
+ * Param: minHz - Lowest frequency to track
+ * Param: maxHz - Highest frequency to track, below sampleHz / 2
+ * Param: q - Notch quality factor
+ * Return: Pointer to struct containing the dynamic notch state
+ */
+DYNNOTCH_CONTROLLER* DYNNOTCH_INIT(float sampleHz, uint8_t peakCount, float minHz, float maxHz, float q)
+{
+	DYNNOTCH_CONTROLLER* dn = malloc(sizeof(DYNNOTCH_CONTROLLER));
+	memset(dn, 0, sizeof(DYNNOTCH_CONTROLLER));
+	float binHz = sampleHz / DYNNOTCH_SIZE;
+	dn->SampleHz = sampleHz;
+	dn->MinHz = minHz;
+	dn->MaxHz = maxHz;
+	dn->Q = q;
+	dn->DampingN = powf(DYNNOTCH_DAMPING, DYNNOTCH_SIZE);
+	dn->PeakCount = peakCount > DYNNOTCH_MAX_PEAKS ? DYNNOTCH_MAX_PEAKS : (peakCount ? peakCount : 1);
+	// One spare bin either side so the parabola fit always has neighbours
+	dn->StartBin = minHz / binHz;
+	if (dn->StartBin < 1) dn->StartBin = 1;
+	dn->EndBin = maxHz / binHz + 1;
+	if (dn->EndBin > DYNNOTCH_BINS - 2) dn->EndBin = DYNNOTCH_BINS - 2;
+	for (int k = dn->StartBin - 1; k <= dn->EndBin + 1; k++)
+	{
+		float phase = 2.0f * DYNNOTCH_PI * k / DYNNOTCH_SIZE;
+		dn->TwiddleRe[k] = cosf(phase);
+		dn->TwiddleIm[k] = sinf(phase);
+	}
+	for (int a = 0; a < FILTER_AXES; a++)
+	{
+		for (int p = 0; p < dn->PeakCount; p++)
+		{
+			// Parked in the middle of an equal share of the range, so peaks claim the nearest
+			dn->Centre[a][p] = minHz + (maxHz - minHz) * (p + 0.5f) / dn->PeakCount;
+		}
+	}
+	return dn;
+}
+
+/* Function Summary: Find the biggest peaks of one axis
+ * Param: dn - Dynamic notch state
+ * Param: axis - Axis to search
+ * Return: VOID
+ */
+static void DYNNOTCH_FIND_PEAKS(DYNNOTCH_CONTROLLER* dn, int axis)
+{
+	float power[DYNNOTCH_BINS];
+	float mean = 0;
+	uint8_t bins[DYNNOTCH_MAX_PEAKS] = {0};
+	for (int k = dn->StartBin - 1; k <= dn->EndBin + 1; k++)
+	{
+		power[k] = dn->Re[axis][k] * dn->Re[axis][k] + dn->Im[axis][k] * dn->Im[axis][k];
+		if (k >= dn->StartBin && k <= dn->EndBin) mean += power[k];
+	}
+	mean /= dn->EndBin - dn->StartBin + 1;
+	// Local maxima over the threshold, kept sorted biggest first
+	for (int k = dn->StartBin; k <= dn->EndBin; k++)
+	{
+		if (power[k] <= power[k - 1] || power[k] < power[k + 1] || power[k] < mean * DYNNOTCH_THRESHOLD) continue;
+		for (int p = 0; p < dn->PeakCount; p++)
+		{
+			if (!bins[p] || power[k] > power[bins[p]])
+			{
+				for (int q = dn->PeakCount - 1; q > p; q--) bins[q] = bins[q - 1];
+				bins[p] = k;
+				break;
+			}
+		}
+	}
+	float binHz = dn->SampleHz / DYNNOTCH_SIZE;
+	for (int p = 0; p < dn->PeakCount; p++)
+	{
+		int k = bins[p];
+		if (!k)
+		{
+			dn->Peaks[axis][p] = 0;
+			continue;
+		}
+		// Vertex of the parabola through the three bins around the peak
+		float y0 = power[k - 1], y1 = power[k], y2 = power[k + 1];
+		float denom = y0 - 2.0f * y1 + y2;
+		float offset = denom != 0 ? 0.5f * (y0 - y2) / denom : 0;
+		float hz = (k + offset) * binHz;
+		if (hz < dn->MinHz) hz = dn->MinHz;
+		else if (hz > dn->MaxHz) hz = dn->MaxHz;
+		dn->Peaks[axis][p] = hz;
+	}
+}
+
+/* Function Summary: Move one axis' notches towards the last peaks found. Biggest peak first,
+ * each peak takes the closest notch not already taken, so a notch does not jump across the
+ * spectrum when a peak is missed for a search or two peaks swap size. A bypassed notch that is
+ * claimed goes straight to its peak and starts filtering
+ * Param: dn - Dynamic notch state
+ * Param: axis - Axis to retune
+ * Return: VOID
+ */
+static void DYNNOTCH_RETUNE(DYNNOTCH_CONTROLLER* dn, int axis)
+{
+	uint8_t taken = 0;
+	for (int p = 0; p < dn->PeakCount; p++)
+	{
+		float peak = dn->Peaks[axis][p];
+		if (peak == 0) break;
+		int best = -1;
+		float bestDist = 0;
+		for (int n = 0; n < dn->PeakCount; n++)
+		{
+			if (taken & (1 << n)) continue;
+			float dist = fabsf(dn->Centre[axis][n] - peak);
+			if (best < 0 || dist < bestDist)
+			{
+				best = n;
+				bestDist = dist;
+			}
+		}
+		taken |= 1 << best;
+		if (dn->Active[axis] & (1 << best)) dn->Centre[axis][best] += (peak - dn->Centre[axis][best]) * DYNNOTCH_SMOOTHING;
+		else
+		{
+			dn->Centre[axis][best] = peak;
+			dn->Active[axis] |= 1 << best;
+		}
+		FILTER_BIQUAD_SET(&dn->Notch[axis][best], FILTER_BIQUAD_NOTCH, dn->Centre[axis][best], dn->Q, dn->SampleHz);
+	}
+}
+
+/* Function Summary: Feed one unfiltered gyro sample into the spectrum and do one slice of the
+ * peak search / retune work
+ * Param: dn - Dynamic notch state
+ * Param: axes - FILTER_AXES gyro samples
+ * Return: VOID
+ */
+void DYNNOTCH_UPDATE(DYNNOTCH_CONTROLLER* dn, const float* axes)
+{
+	for (int a = 0; a < FILTER_AXES; a++)
+	{
+		float delta = axes[a] - dn->DampingN * dn->History[a][dn->Index];
+		dn->History[a][dn->Index] = axes[a];
+		for (int k = dn->StartBin - 1; k <= dn->EndBin + 1; k++)
+		{
+			float re = dn->Re[a][k] * DYNNOTCH_DAMPING + delta;
+			float im = dn->Im[a][k] * DYNNOTCH_DAMPING;
+			dn->Re[a][k] = re * dn->TwiddleRe[k] - im * dn->TwiddleIm[k];
+			dn->Im[a][k] = re * dn->TwiddleIm[k] + im * dn->TwiddleRe[k];
+		}
+	}
+	dn->Index = (dn->Index + 1) % DYNNOTCH_SIZE;
+	int axis = dn->Step >> 1;
+	if (dn->Step & 1) DYNNOTCH_RETUNE(dn, axis);
+	else DYNNOTCH_FIND_PEAKS(dn, axis);
+	if (++dn->Step >= 2 * FILTER_AXES) dn->Step = 0;
+}
+
+/* Function Summary: Run every axis through its claimed notches
+ * Param: dn - Dynamic notch state
+ * Param: axes - FILTER_AXES samples, filtered in place
+ * Return: VOID
+ */
+void DYNNOTCH_APPLY(DYNNOTCH_CONTROLLER* dn, float* axes)
+{
+	for (int a = 0; a < FILTER_AXES; a++)
+	{
+		for (int p = 0; p < dn->PeakCount; p++)
+		{
+			if (dn->Active[a] & (1 << p)) axes[a] = FILTER_BIQUAD_APPLY(&dn->Notch[a][p], axes[a]);
+		}
+	}
+}
@@ -0,0 +1,241 @@
+/*
+ * EKF.c
+ *
+ *  Created on: Feb 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Attitude and Gyro Bias EKF
+Multiplicative (error state) EKF. The quaternion is propagated with the bias corrected gyro,
+and the filter only tracks a 3 angle attitude error plus the 3 gyro biases, so P is 6x6 and
+everything is fixed size inside EKF_CONTROLLER, nothing is allocated after EKF_INIT.
+
+Predict: F = | I - [w x]dt   -I dt |	P = F P F' + Q, done in 3x3 blocks since half of F
+             | 0              I    |	is identity or zero
+The accelerometer gives the gravity direction in the body frame, for a predicted body vector h
+the Jacobian is H = | [h x]  0 |. The magnetometer only corrects heading, the horizontal field
+direction against the one seen at the first sample. Every row of H has its bias half zero, so
+each axis is applied as its own scalar update with no matrix inverse and the sums skip that half.
+
+Call order per step: EKF_PREDICT, any measurement updates, then EKF_APPLY to fold the
+correction into the quaternion and bias.
+*/
+
+#include <math.h>
+#include "EKF.h"
+
+#define EKF_ACCEL_BAND		0.25f	// g away from 1g where accelerometer updates stop
+#define EKF_GYRO_SD			0.005f	// rad/s, gyro noise
+#define EKF_BIAS_SD			0.0002f	// rad/s per root second, bias random walk
+#define EKF_ACCEL_SD		0.05f	// Unit vector noise on the gravity direction
+#define EKF_MAG_SD			0.05f	// rad, heading noise from the field direction
+#define EKF_GATE			4.0f	// Standard deviations, larger innovations are ignored
+#define EKF_PI				3.14159265f
+#define EKF_ATTITUDE_SD0	0.1f	// rad, starting uncertainty of the seeded attitude
+#define EKF_BIAS_SD0		0.02f	// rad/s, starting uncertainty of the bias
+
+/* Function Summary: Body vector of an earth frame vector, v_body = R' v_earth
+ * Param: q - Body to earth quaternion
+ * Param: earth - Earth frame vector
+ * Param: body - Returns the body frame vector
+ */
+static void EKF_TO_BODY(const float* q, const float* earth, float* body)
+{
+	float w = q[0], x = q[1], y = q[2], z = q[3];
+	body[0] = (1 - 2 * (y * y + z * z)) * earth[0] + 2 * (x * y + w * z) * earth[1] + 2 * (x * z - w * y) * earth[2];
+	body[1] = 2 * (x * y - w * z) * earth[0] + (1 - 2 * (x * x + z * z)) * earth[1] + 2 * (y * z + w * x) * earth[2];
+	body[2] = 2 * (x * z + w * y) * earth[0] + 2 * (y * z - w * x) * earth[1] + (1 - 2 * (x * x + y * y)) * earth[2];
+}
+
+/* Function Summary: Earth vector of a body frame vector, v_earth = R v_body
+ * Param: q - Body to earth quaternion
+ * Param: body - Body frame vector
+ * Param: earth - Returns the earth frame vector
+ */
+static void EKF_TO_EARTH(const float* q, const float* body, float* earth)
+{
+	float w = q[0], x = q[1], y = q[2], z = q[3];
+	earth[0] = (1 - 2 * (y * y + z * z)) * body[0] + 2 * (x * y - w * z) * body[1] + 2 * (x * z + w * y) * body[2];
+	earth[1] = 2 * (x * y + w * z) * body[0] + (1 - 2 * (x * x + z * z)) * body[1] + 2 * (y * z - w * x) * body[2];
+	earth[2] = 2 * (x * z - w * y) * body[0] + 2 * (y * z + w * x) * body[1] + (1 - 2 * (x * x + y * y)) * body[2];
+}
+
+/* Function Summary: Start the filter from a known attitude with zero bias
+ * Param: q - Starting body to earth quaternion, usually seeded from the accelerometer
+ * Return: Pointer to struct containing the filter state
+ */
+EKF_CONTROLLER* EKF_INIT(const float* q)
+{
+	EKF_CONTROLLER* ekf = malloc(sizeof(EKF_CONTROLLER));
+	memset(ekf, 0, sizeof(EKF_CONTROLLER));
+	memcpy(ekf->Q, q, sizeof(ekf->Q));
+	ekf->GyroNoise = EKF_GYRO_SD * EKF_GYRO_SD;
+	ekf->BiasNoise = EKF_BIAS_SD * EKF_BIAS_SD;
+	ekf->AccelNoise = EKF_ACCEL_SD * EKF_ACCEL_SD;
+	ekf->MagNoise = EKF_MAG_SD * EKF_MAG_SD;
+	for (int i = 0; i < 3; i++)
+	{
+		ekf->P[i][i] = EKF_ATTITUDE_SD0 * EKF_ATTITUDE_SD0;
+		ekf->P[i + 3][i + 3] = EKF_BIAS_SD0 * EKF_BIAS_SD0;
+	}
+	return ekf;
+}
+
+/* Function Summary: Propagate the quaternion and covariance over one step
+ * Param: ekf - Filter state
+ * Param: gyro - Body rates, rad/s, X forward / Y right / Z down, bias not removed
+ * Param: dt - Step length, s
+ * Return: VOID
+ */
+void EKF_PREDICT(EKF_CONTROLLER* ekf, const float* gyro, float dt)
+{
+	float wx = gyro[0] - ekf->Bias[0], wy = gyro[1] - ekf->Bias[1], wz = gyro[2] - ekf->Bias[2];
+	float w = ekf->Q[0], x = ekf->Q[1], y = ekf->Q[2], z = ekf->Q[3];
+	float h = 0.5f * dt;
+	ekf->Q[0] = w + (-x * wx - y * wy - z * wz) * h;
+	ekf->Q[1] = x + (w * wx + y * wz - z * wy) * h;
+	ekf->Q[2] = y + (w * wy - x * wz + z * wx) * h;
+	ekf->Q[3] = z + (w * wz + x * wy - y * wx) * h;
+	float invNorm = 1.0f / sqrtf(ekf->Q[0] * ekf->Q[0] + ekf->Q[1] * ekf->Q[1] + ekf->Q[2] * ekf->Q[2] + ekf->Q[3] * ekf->Q[3]);
+	for (int i = 0; i < 4; i++) ekf->Q[i] *= invNorm;
+	// Phi = I - [w x]dt, the attitude block of F
+	float phi[3][3] = {
+		{1.0f, wz * dt, -wy * dt},
+		{-wz * dt, 1.0f, wx * dt},
+		{wy * dt, -wx * dt, 1.0f}
+	};
+	float phiA[3][3], phiB[3][3];
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			phiA[i][j] = 0;
+			phiB[i][j] = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				phiA[i][j] += phi[i][k] * ekf->P[k][j];
+				phiB[i][j] += phi[i][k] * ekf->P[k][j + 3];
+			}
+		}
+	}
+	// A' = Phi A Phi' - dt (Phi B + (Phi B)') + dt^2 C,  B' = Phi B - dt C,  C' = C
+	float newA[3][3];
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			float sum = 0;
+			for (int k = 0; k < 3; k++) sum += phiA[i][k] * phi[j][k];
+			newA[i][j] = sum - dt * (phiB[i][j] + phiB[j][i]) + dt * dt * ekf->P[i + 3][j + 3];
+		}
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			ekf->P[i][j] = newA[i][j];
+			ekf->P[i][j + 3] = phiB[i][j] - dt * ekf->P[i + 3][j + 3];
+			ekf->P[j + 3][i] = ekf->P[i][j + 3];
+		}
+		ekf->P[i][i] += ekf->GyroNoise * dt;
+		ekf->P[i + 3][i + 3] += ekf->BiasNoise * dt;
+	}
+}
+
+/* Function Summary: Scalar measurement update for a Jacobian row that only touches the
+ * attitude error, the bias half of H is zero and skipped. Innovations past EKF_GATE standard
+ * deviations are dropped, they come from disturbances the noise model doesn't cover
+ * Param: ekf - Filter state
+ * Param: row - Attitude part of H
+ * Param: innovation - Measured minus predicted, before this step's corrections
+ * Param: noise - Measurement variance
+ */
+static void EKF_SCALAR_UPDATE(EKF_CONTROLLER* ekf, const float* row, float innovation, float noise)
+{
+	float pht[EKF_STATES];
+	for (int i = 0; i < EKF_STATES; i++)
+	{
+		pht[i] = ekf->P[i][0] * row[0] + ekf->P[i][1] * row[1] + ekf->P[i][2] * row[2];
+	}
+	float s = row[0] * pht[0] + row[1] * pht[1] + row[2] * pht[2] + noise;
+	innovation -= row[0] * ekf->Error[0] + row[1] * ekf->Error[1] + row[2] * ekf->Error[2];
+	if (innovation * innovation > EKF_GATE * EKF_GATE * s) return;
+	for (int i = 0; i < EKF_STATES; i++)
+	{
+		float k = pht[i] / s;
+		ekf->Error[i] += k * innovation;
+		for (int j = 0; j < EKF_STATES; j++) ekf->P[i][j] -= k * pht[j];
+	}
+}
+
+/* Function Summary: Correct the tilt against gravity, skipped while accelerating hard and
+ * trusted less the further the magnitude is from 1g
+ * Param: ekf - Filter state
+ * Param: accel - Specific force in g, X forward / Y right / Z down
+ * Return: VOID
+ */
+void EKF_ACCEL_UPDATE(EKF_CONTROLLER* ekf, const float* accel)
+{
+	static const float up[3] = {0, 0, -1};
+	float norm = sqrtf(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]);
+	float weight = 1.0f - fabsf(norm - 1.0f) / EKF_ACCEL_BAND;
+	if (norm == 0 || weight <= 0) return;
+	float measured[3] = {accel[0] / norm, accel[1] / norm, accel[2] / norm};
+	float h[3];
+	EKF_TO_BODY(ekf->Q, up, h);
+	// Rows of [h x]
+	const float H[3][3] = {
+		{0, -h[2], h[1]},
+		{h[2], 0, -h[0]},
+		{-h[1], h[0], 0}
+	};
+	float noise = ekf->AccelNoise / (weight * weight);
+	for (int i = 0; i < 3; i++) EKF_SCALAR_UPDATE(ekf, H[i], measured[i] - h[i], noise);
+}
+
+/* Function Summary: Correct heading against the magnetic field. Only the horizontal direction
+ * is used so a disturbed field can't pull the tilt. The first call records the reference, so
+ * heading is relative to the attitude at that moment
+ * Param: ekf - Filter state
+ * Param: mag - Field in body axes X forward / Y right / Z down, any units
+ * Return: VOID
+ */
+void EKF_MAG_UPDATE(EKF_CONTROLLER* ekf, const float* mag)
+{
+	float earth[3];
+	EKF_TO_EARTH(ekf->Q, mag, earth);
+	if (earth[0] == 0 && earth[1] == 0) return;
+	float heading = atan2f(earth[1], earth[0]);
+	if (!ekf->MagRefSet)
+	{
+		ekf->MagRef = heading;
+		ekf->MagRefSet = 1;
+		return;
+	}
+	float innovation = ekf->MagRef - heading;
+	if (innovation > EKF_PI) innovation -= 2 * EKF_PI;
+	else if (innovation < -EKF_PI) innovation += 2 * EKF_PI;
+	// Heading error is the earth down component of the body error angle, the last row of R
+	float w = ekf->Q[0], x = ekf->Q[1], y = ekf->Q[2], z = ekf->Q[3];
+	float H[3] = {2 * (x * z - w * y), 2 * (y * z + w * x), 1 - 2 * (x * x + y * y)};
+	EKF_SCALAR_UPDATE(ekf, H, innovation, ekf->MagNoise);
+}
+
+/* Function Summary: Fold the measurement corrections into the quaternion and bias
+ * Param: ekf - Filter state
+ * Return: VOID
+ */
+void EKF_APPLY(EKF_CONTROLLER* ekf)
+{
+	float dx = 0.5f * ekf->Error[0], dy = 0.5f * ekf->Error[1], dz = 0.5f * ekf->Error[2];
+	float w = ekf->Q[0], x = ekf->Q[1], y = ekf->Q[2], z = ekf->Q[3];
+	// q = q * (1, dtheta / 2)
+	ekf->Q[0] = w - x * dx - y * dy - z * dz;
+	ekf->Q[1] = x + w * dx + y * dz - z * dy;
+	ekf->Q[2] = y + w * dy - x * dz + z * dx;
+	ekf->Q[3] = z + w * dz + x * dy - y * dx;
+	float invNorm = 1.0f / sqrtf(ekf->Q[0] * ekf->Q[0] + ekf->Q[1] * ekf->Q[1] + ekf->Q[2] * ekf->Q[2] + ekf->Q[3] * ekf->Q[3]);
+	for (int i = 0; i < 4; i++) ekf->Q[i] *= invNorm;
+	for (int i = 0; i < 3; i++) ekf->Bias[i] += ekf->Error[i + 3];
+	memset(ekf->Error, 0, sizeof(ekf->Error));
+}
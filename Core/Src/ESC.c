@@ -33,385 +33,593 @@ Prescaler = (Timer Freq (Hz) / (PWM Freq (Hz) * (Counter Period) + 1) - 1)
 
 * 0 Logic = 37.3, 37.5, 37.4, 37.6 ~ 37.3% - 37.6% on time
 * 1 Logic = 75.0, 75.1m, 74.9, 75.3 ~ 74.9% - 73.3% on time
+
+Protocol is picked at runtime from ESC_PROTOCOLS (DSHOT.c), ESC_SET_PROTOCOL can switch
+between DSHOT150-1200, Oneshot125, Oneshot42, Multishot and PWM on a running controller
+
+Bidirectional DSHOT (DSHOT_BIDIR)
+- Output is inverted, line idles high and each bit is a low pulse, checksum is inverted
+- ~30uS after each frame the ESC drives a 21 bit GCR eRPM reply at 5/4 the bit rate
+- Burst DMA complete -> that timer's motor channels switch to input capture on both edges
+  and each CCRx is DMA'd into TelemEdges -> the timer's update interrupt at the end of the
+  window switches the channels back to PWM output -> the next ESC_UPDATE_THROTTLE decodes
+  the edges before it sends
+
+Motor outputs come from an ESC_OUTPUT table (main.c), up to ESC_MAX_MOTORS. Motors are
+grouped per timer and each timer gets its own burst stream:
+- TIM3 CH1-CH4 (motors 1-4), burst paced by UPDATE on DMA1 S2
+- TIM4 CH2-CH3 (motors 5-6), burst paced by CC2 on DMA1 S3, TIM4_UP shares S6 with I2C1_TX
 */
 
 #include "ESC.h"
 #include "main.h"
 
-//#define DSHOT150
-#define DSHOT300
-//#define DSHOT600
-//#define DSHOT1200
-//#define MULTISHOT
-//#define ONESHOT
-
-#ifdef DSHOT150
-#define TIMER_ARR		720 // Auto Reload Register
-#define DSHOT_LOW_BIT	270 // Low logic PWM value for DSHOT150
-#define DSHOT_HIGH_BIT 	540 // High logic PWM value for DSHOT150
-#endif
-
-#ifdef DSHOT300
-#define TIMER_ARR		360 // Auto Reload Register
-#define DSHOT_LOW_BIT	135 // Low logic PWM value for DSHOT300
-#define DSHOT_HIGH_BIT 	270 // High logic PWM value for DSHOT300
-#endif
-
-#ifdef DSHOT600
-#define TIMER_ARR		180 // Auto Reload Register
-#define DSHOT_LOW_BIT	68 	// Low logic PWM value for DSHOT600
-#define DSHOT_HIGH_BIT 	135 // High logic PWM value for DSHOT600
-#endif
-
-#ifdef DSHOT1200
-#define TIMER_ARR		90 	// Auto Reload Register
-#define DSHOT_LOW_BIT	34 	// Low logic PWM value for DSHOT1200
-#define DSHOT_HIGH_BIT 	68 	// High logic PWM value for DSHOT1200
-#endif
-
-#ifdef MULTISHOT
-#define TIMER_ARR 		1350 // Auto Reload Register
-#endif
-
-#ifdef ONESHOT
-#define TIMER_ARR 		4500 // Auto Reload Register
-#endif
-
-#define DSHOT_MIN_THROTTLE	47
 #define DSHOT_MIN_IDLE		250
-#define DSHOT_MAX_THROTTLE 	2047
-#define XYZ_NEUTRAL_VALUE	1028
-#define SENSITIVITY_CONST	0.25
 
-#if defined(DSHOT150) || defined(DSHOT300) || defined(DSHOT600) || defined(DSHOT1200)
+_Static_assert(MIXER_MAX_MOTORS <= ESC_MAX_MOTORS, "Mixer layouts drive more motors than the ESC controller holds");
+
+// CCMR1 holds CH1/CH2 and CCMR2 CH3/CH4, one byte per channel in the same layout
+#define CCMR_SHIFT(CH)		(((CH) & 1) * 8)
+#define CCMR_CHANNEL_MASK	(0xFF | TIM_CCMR1_OC1M_3)
+#define CCMR_PWM_PRELOAD	(TIM_CCMR1_OC1M_1 | TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1PE)
+#define CCMR_INPUT_CAPTURE	TIM_CCMR1_CC1S_0
 
-#define __DSHOT_CONSUME_BIT(__DSHOT_BYTE__, __BIT__) (__DSHOT_BYTE__ = (((__BIT__ & 0b1) == 0b1) ? DSHOT_HIGH_BIT : DSHOT_LOW_BIT))
+/* Function Summary: Set the CCMR mode byte of one motor channel, the other channel sharing
+ * the register is left alone
+ * Param: tim - Timer driving the motor
+ * Param: channel - 0 - 3 for CH1 - CH4
+ * Param: mode - CCMR_PWM_PRELOAD or CCMR_INPUT_CAPTURE
+ * Return: VOID
+ */
+static void ESC_SET_CHANNEL_MODE(TIM_TypeDef* tim, uint8_t channel, uint32_t mode)
+{
+	volatile uint32_t* ccmr = &tim->CCMR1 + (channel >> 1);
+	*ccmr = (*ccmr & ~(CCMR_CHANNEL_MASK << CCMR_SHIFT(channel))) | (mode << CCMR_SHIFT(channel));
+}
 
-/* Function Summary: Initiate the Electronic Speed Controller (ESC) for
- * a particular timer and DMA streams
- * Param: * dmaTickTimers - Pointer to predefined timer used to trigger dma streams
- * Param: * pwmTimer - Pointer to timer handle responsible for outputting to ESCs
- * Param: ** dmaHandlers - Array containing set of DMA streams
+/* Function Summary: Initiate the Electronic Speed Controller (ESC) outputs from a table of
+ * motor outputs. Motors are grouped by timer, each timer raises one DMA request per bit and
+ * its stream bursts one frame row through DMAR into that timer's motor CCRs, so every motor
+ * of a timer is driven in lockstep from one stream.
+ * Param: * outputs - One entry per motor, motor n is bit n of every motor mask
+ * Param: motorCount - Number of entries in outputs, at most ESC_MAX_MOTORS
+ * Param: protocol - Output protocol from escProtocols_e
  * Return: Pointer to struct containing all necessary data for ESC operation
  */
-ESC_CONTROLLER* ESC_INIT(TIM_HandleTypeDef** dmaTickTimers, TIM_HandleTypeDef* pwmTimer, DMA_HandleTypeDef** dmaHandlers)
+ESC_CONTROLLER* ESC_INIT(const ESC_OUTPUT* outputs, uint32_t motorCount, escProtocols_e protocol)
 {
-	dmaTickTimers[0]->Instance->ARR = TIMER_ARR - 1; 	// htim4 ARR, synchronize timer that control DMA requests
-	dmaTickTimers[1]->Instance->ARR = TIMER_ARR - 1; 	// htim5 ARR, synchronize timer that control DMA requests
-	pwmTimer->Instance->ARR = TIMER_ARR - 1;		 		// htim3 ARR, synchronize timer that control DMA requests
-	// Enable DMA requests on CH1 and CH2
-	dmaTickTimers[0]->Instance->DIER = TIM_DIER_CC1DE | TIM_DIER_CC2DE | TIM_DIER_CC3DE;
-	dmaTickTimers[1]->Instance->DIER = TIM_DIER_CC1DE | TIM_DIER_CC2DE;
-	HAL_TIM_PWM_Start(dmaTickTimers[0], TIM_CHANNEL_1);
-	HAL_TIM_PWM_Start(dmaTickTimers[0], TIM_CHANNEL_2);
-	HAL_TIM_PWM_Start(dmaTickTimers[0], TIM_CHANNEL_3);
-	HAL_TIM_PWM_Start(dmaTickTimers[1], TIM_CHANNEL_2);
-	int bytes = sizeof(ESC_CONTROLLER)*ESC_COUNT;
-	ESC_CONTROLLER* escSet = malloc(bytes);
-	for (int i = 0; i < ESC_COUNT; i++)
+	ESC_CONTROLLER* escSet = malloc(sizeof(ESC_CONTROLLER));
+	memset(escSet, 0, sizeof(ESC_CONTROLLER));
+	if (motorCount > ESC_MAX_MOTORS) motorCount = ESC_MAX_MOTORS;
+	escSet->MotorCount = motorCount;
+	escSet->MotorMask = (1 << motorCount) - 1;
+	uint8_t lastChannel[ESC_MAX_TIMERS] = {0};
+	for (uint32_t m = 0; m < motorCount; m++)
+	{
+		const ESC_OUTPUT* out = &outputs[m];
+		ESC_MOTOR* motor = &escSet->Motors[m];
+		int g = 0;
+		while (g < escSet->GroupCount && escSet->Groups[g].Timer != out->Timer) g++;
+		if (g == escSet->GroupCount)
+		{
+			if (g == ESC_MAX_TIMERS) Error_Handler();
+			escSet->Groups[g].Timer = out->Timer;
+			escSet->Groups[g].DMA = out->DMA;
+			escSet->Groups[g].DMARequest = out->DMARequest;
+			escSet->Groups[g].BaseChannel = ESC_TIMER_CHANNELS;
+			escSet->GroupCount++;
+		}
+		ESC_GROUP* group = &escSet->Groups[g];
+		motor->Output = out;
+		motor->Group = g;
+		motor->Channel = out->Channel / 4;	// TIM_CHANNEL_x steps by 4
+		motor->CcerEnable = TIM_CCER_CC1E << (4 * motor->Channel);
+		motor->CcerInvert = TIM_CCER_CC1P << (4 * motor->Channel);
+		motor->CcerBothEdges = (TIM_CCER_CC1P | TIM_CCER_CC1NP) << (4 * motor->Channel);
+		motor->DierCapture = out->CaptureDMA ? TIM_DIER_CC1DE << motor->Channel : 0;
+		group->MotorMask |= ESC_MOTOR(m);
+		group->CcerEnable |= motor->CcerEnable;
+		group->CcerInvert |= motor->CcerInvert;
+		group->CcerBothEdges |= motor->CcerBothEdges;
+		group->DierCapture |= motor->DierCapture;
+		if (motor->Channel < group->BaseChannel) group->BaseChannel = motor->Channel;
+		if (motor->Channel > lastChannel[g]) lastChannel[g] = motor->Channel;
+	}
+	for (uint32_t m = 0; m < motorCount; m++)
+	{
+		ESC_MOTOR* motor = &escSet->Motors[m];
+		motor->Column = motor->Channel - escSet->Groups[motor->Group].BaseChannel;
+	}
+	for (int g = 0; g < escSet->GroupCount; g++)
 	{
-		escSet->Throttle[i] = 0;
-		for (int j = 0; j < DSHOT_PACKET_SIZE; j++) escSet->ThrottleDshot[i][j] = 0;
-		escSet->Channel[i] = 4*i;
-		escSet->SendingFlag = 0;
-		escSet->Timer[i] = pwmTimer;
-		escSet->DMA[i] = dmaHandlers[i];
- 		escSet->CCR[i] = &(pwmTimer->Instance->CCR1) + i;
-		*escSet->CCR[i] = 0;
+		ESC_GROUP* group = &escSet->Groups[g];
+		TIM_TypeDef* tim = group->Timer->Instance;
+		group->Width = lastChannel[g] - group->BaseChannel + 1;
+		// DMA burst writes Width halfwords starting at the group's first CCR on every request
+		tim->DCR = (TIM_DMABASE_CCR1 + group->BaseChannel) | ((group->Width - 1) << TIM_DCR_DBL_Pos);
+		for (uint32_t m = 0; m < motorCount; m++)
+		{
+			if (!(group->MotorMask & ESC_MOTOR(m))) continue;
+			ESC_SET_CHANNEL_MODE(tim, escSet->Motors[m].Channel, CCMR_PWM_PRELOAD);
+			*(&tim->CCR1 + escSet->Motors[m].Channel) = 0;
+			HAL_TIM_PWM_Start(group->Timer, outputs[m].Channel);
+		}
 	}
-	for (int i = 0; i < ESC_COUNT; i++)
+	ESC_SET_PROTOCOL(escSet, protocol);
+	// Streams are only pointed at DMAR here, DSHOT_START_FRAME picks the buffer and arms them for each frame
+	for (int g = 0; g < escSet->GroupCount; g++)
 	{
-		HAL_TIM_PWM_Start(pwmTimer, escSet->Channel[i]);
-		HAL_DMA_RegisterCallback(escSet->DMA[i], HAL_DMA_XFER_HALFCPLT_CB_ID, *DMA_XferCpltCallback);
-		HAL_DMA_Start_IT(escSet->DMA[i], (uint32_t) &escSet->ThrottleDshot[i],
-								(uint32_t) escSet->CCR[i], DSHOT_PACKET_SIZE);
+		ESC_GROUP* group = &escSet->Groups[g];
+		group->DMA->Instance->PAR = (uint32_t) &group->Timer->Instance->DMAR;
+		group->Timer->Instance->DIER |= group->DMARequest;
 	}
 	return escSet;
 }
 
-uint16_t makeDshotPacketBytes(uint32_t value, uint8_t telemBit)
+#ifdef DSHOT_BIDIR
+/* Function Summary: Turn every motor pin of a timer around to listen for its eRPM reply.
+ * Called from the burst complete interrupt, the last rows of the frame are idle so no data
+ * is cut off. Motors without a capture stream still release the line, their reply is dropped.
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Param: group - Timer group whose frame just finished
+ * Return: VOID
+ */
+static void DSHOT_START_CAPTURE(ESC_CONTROLLER* escSet, ESC_GROUP* group)
 {
-	uint16_t packet = (value << 1) | telemBit;
-	int csum = 0;
-	int csumData = packet;
-	for (int i = 0; i < 3; i++)
+	TIM_TypeDef* tim = group->Timer->Instance;
+	tim->DIER &= ~group->DMARequest;
+	// CCxS can only be changed while the channel is disabled
+	tim->CCER &= ~group->CcerEnable;
+	for (int m = 0; m < escSet->MotorCount; m++)
 	{
-		csum ^= csumData; // xor data by nibbles
-		csumData >>= 4;
+		if (group->MotorMask & ESC_MOTOR(m)) ESC_SET_CHANNEL_MODE(tim, escSet->Motors[m].Channel, CCMR_INPUT_CAPTURE);
 	}
-	csum &= 0xf;
-	packet = (packet << 4) | csum;
-	return packet;
+	tim->CCER |= group->CcerBothEdges | group->CcerEnable;
+	// Count from 0 to the end of the reply window, the update at the top closes it. The UG
+	// below raises UIF too, clear it so the window interrupt only fires at the real end
+	tim->ARR = DSHOT_TELEM_WINDOW(escSet->Protocol->ARR) - 1;
+	tim->EGR = TIM_EGR_UG;
+	tim->SR = ~TIM_SR_UIF;
+	for (int m = 0; m < escSet->MotorCount; m++)
+	{
+		ESC_MOTOR* motor = &escSet->Motors[m];
+		DMA_HandleTypeDef* dma = motor->Output->CaptureDMA;
+		if (!(group->MotorMask & ESC_MOTOR(m)) || !dma) continue;
+		__HAL_DMA_CLEAR_FLAG(dma, __HAL_DMA_GET_TC_FLAG_INDEX(dma) | __HAL_DMA_GET_HT_FLAG_INDEX(dma) |
+									__HAL_DMA_GET_TE_FLAG_INDEX(dma));
+		// A stream shared with the burst is flipped to peripheral to memory
+		dma->Instance->CR &= ~DMA_SxCR_DIR;
+		dma->Instance->PAR = (uint32_t) (&tim->CCR1 + motor->Channel);
+		dma->Instance->M0AR = (uint32_t) escSet->TelemEdges[m];
+		dma->Instance->NDTR = DSHOT_TELEM_EDGES;
+		__HAL_DMA_ENABLE(dma);
+	}
+	group->CaptureFlag = 1;
+	tim->DIER |= group->DierCapture | TIM_DIER_UIE;
 }
 
-
-void DSHOT_SEND_PACKET(ESC_CONTROLLER* escSet, uint32_t data, uint32_t telemBit, uint32_t motorNum)
+/* Function Summary: Close the reply window of a timer and hand its pins back to the PWM
+ * output. Runs in the timer's update interrupt at the end of the window, the edge counts are
+ * kept for DSHOT_DECODE_TELEMETRY so decoding happens in the main loop.
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Param: group - Timer group that is listening
+ * Return: VOID
+ */
+static void DSHOT_STOP_CAPTURE(ESC_CONTROLLER* escSet, ESC_GROUP* group)
 {
-	uint16_t dshotBytes = makeDshotPacketBytes(data, telemBit);
-	// 17th bit is to set CCR to 0 to keep it low between packets
-	uint32_t dshotPacket[DSHOT_PACKET_SIZE] = {0};
-	// Populate checksum bits
-	for (int i = 18; i >= 3; i--)
+	TIM_TypeDef* tim = group->Timer->Instance;
+	tim->DIER &= ~(group->DierCapture | TIM_DIER_UIE);
+	for (int m = 0; m < escSet->MotorCount; m++)
 	{
-		__DSHOT_CONSUME_BIT(dshotPacket[i], dshotBytes);
-		dshotBytes >>= 1;
+		DMA_HandleTypeDef* dma = escSet->Motors[m].Output->CaptureDMA;
+		if (!(group->MotorMask & ESC_MOTOR(m)) || !dma) continue;
+		__HAL_DMA_DISABLE(dma);
+		while (dma->Instance->CR & DMA_SxCR_EN);
+		escSet->TelemCount[m] = DSHOT_TELEM_EDGES - dma->Instance->NDTR;
 	}
-	escSet->SendingFlag = 1;
-	switch(motorNum) {
-		case (FRONT_LEFT_MOTOR):
-			memcpy(escSet->ThrottleDshot[0], dshotPacket, sizeof(dshotPacket));
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[0], DMA_FLAG_TCIF0_4 | DMA_FLAG_HTIF0_4 | DMA_FLAG_FEIF0_4);
-			escSet->DMA[0]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			__HAL_DMA_ENABLE(escSet->DMA[0]);
-			break;
-		case (FRONT_RIGHT_MOTOR):
-			memcpy(escSet->ThrottleDshot[1], dshotPacket, sizeof(dshotPacket));
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[1], DMA_FLAG_TCIF3_7 | DMA_FLAG_HTIF3_7 | DMA_FLAG_FEIF3_7);
-			escSet->DMA[1]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			__HAL_DMA_ENABLE(escSet->DMA[1]);
-			break;
-		case (BACK_LEFT_MOTOR):
-			memcpy(escSet->ThrottleDshot[2], dshotPacket, sizeof(dshotPacket));
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[2], DMA_FLAG_TCIF3_7 | DMA_FLAG_HTIF3_7 | DMA_FLAG_FEIF3_7);
-			escSet->DMA[2]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			__HAL_DMA_ENABLE(escSet->DMA[2]);
-			break;
-		case (BACK_RIGHT_MOTOR):
-			memcpy(escSet->ThrottleDshot[3], dshotPacket, sizeof(dshotPacket));
-			escSet->DMA[3]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[3], DMA_FLAG_TCIF0_4 | DMA_FLAG_HTIF0_4 | DMA_FLAG_FEIF0_4);
-			__HAL_DMA_ENABLE(escSet->DMA[3]);
-			break;
-		case (LEFT_SIDE_MOTORS):
-			memcpy(escSet->ThrottleDshot[0], dshotPacket, sizeof(dshotPacket));
-			memcpy(escSet->ThrottleDshot[2], dshotPacket, sizeof(dshotPacket));
-			escSet->DMA[0]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			escSet->DMA[2]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[0], DMA_FLAG_TCIF0_4 | DMA_FLAG_HTIF0_4 | DMA_FLAG_FEIF0_4);
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[2], DMA_FLAG_TCIF3_7 | DMA_FLAG_HTIF3_7 | DMA_FLAG_FEIF3_7);
-			__HAL_DMA_ENABLE(escSet->DMA[0]);
-			__HAL_DMA_ENABLE(escSet->DMA[2]);
-			break;
-		case (RIGHT_SIDE_MOTORS):
-			memcpy(escSet->ThrottleDshot[1], dshotPacket, sizeof(dshotPacket));
-			memcpy(escSet->ThrottleDshot[3], dshotPacket, sizeof(dshotPacket));
-			escSet->DMA[1]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			escSet->DMA[3]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[1], DMA_FLAG_TCIF3_7 | DMA_FLAG_HTIF3_7) | DMA_FLAG_FEIF3_7;
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[3], DMA_FLAG_TCIF0_4 | DMA_FLAG_HTIF0_4 | DMA_FLAG_FEIF0_4);
-			__HAL_DMA_ENABLE(escSet->DMA[1]);
-			__HAL_DMA_ENABLE(escSet->DMA[3]);
-			break;
-		case (FRONT_SIDE_MOTORS):
-			memcpy(escSet->ThrottleDshot[0], dshotPacket, sizeof(dshotPacket));
-			memcpy(escSet->ThrottleDshot[1], dshotPacket, sizeof(dshotPacket));
-			escSet->DMA[0]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			escSet->DMA[1]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[0], DMA_FLAG_TCIF0_4 | DMA_FLAG_HTIF0_4 | DMA_FLAG_FEIF0_4);
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[1], DMA_FLAG_TCIF3_7 | DMA_FLAG_HTIF3_7 | DMA_FLAG_FEIF3_7);
-			__HAL_DMA_ENABLE(escSet->DMA[0]);
-			__HAL_DMA_ENABLE(escSet->DMA[1]);
-			break;
-		case (BACK_SIDE_MOTORS):
-			memcpy(escSet->ThrottleDshot[2], dshotPacket, sizeof(dshotPacket));
-			memcpy(escSet->ThrottleDshot[3], dshotPacket, sizeof(dshotPacket));
-			escSet->DMA[2]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			escSet->DMA[3]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[2], DMA_FLAG_TCIF3_7 | DMA_FLAG_HTIF3_7 | DMA_FLAG_FEIF3_7);
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[3], DMA_FLAG_TCIF0_4 | DMA_FLAG_HTIF0_4 | DMA_FLAG_FEIF0_4);
-			__HAL_DMA_ENABLE(escSet->DMA[2]);
-			__HAL_DMA_ENABLE(escSet->DMA[3]);
-			break;
-		case (ALL_MOTORS):
-			memcpy(escSet->ThrottleDshot[0], dshotPacket, sizeof(dshotPacket));
-			memcpy(escSet->ThrottleDshot[1], dshotPacket, sizeof(dshotPacket));
-			memcpy(escSet->ThrottleDshot[2], dshotPacket, sizeof(dshotPacket));
-			memcpy(escSet->ThrottleDshot[3], dshotPacket, sizeof(dshotPacket));
-			escSet->DMA[0]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			escSet->DMA[1]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			escSet->DMA[2]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			escSet->DMA[3]->Instance->NDTR = DSHOT_PACKET_SIZE;
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[0], DMA_FLAG_TCIF0_4 | DMA_FLAG_HTIF0_4 | DMA_FLAG_FEIF0_4);
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[1], DMA_FLAG_TCIF3_7 | DMA_FLAG_HTIF3_7 | DMA_FLAG_FEIF3_7);
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[2], DMA_FLAG_TCIF3_7 | DMA_FLAG_HTIF3_7 | DMA_FLAG_FEIF3_7);
-			__HAL_DMA_CLEAR_FLAG(escSet->DMA[3], DMA_FLAG_TCIF0_4 | DMA_FLAG_HTIF0_4 | DMA_FLAG_FEIF0_4);
-			__HAL_DMA_ENABLE(escSet->DMA[0]);
-			__HAL_DMA_ENABLE(escSet->DMA[1]);
-			__HAL_DMA_ENABLE(escSet->DMA[2]);
-			__HAL_DMA_ENABLE(escSet->DMA[3]);
-			break;
+	tim->CCER &= ~group->CcerEnable;
+	for (int m = 0; m < escSet->MotorCount; m++)
+	{
+		if (!(group->MotorMask & ESC_MOTOR(m))) continue;
+		ESC_SET_CHANNEL_MODE(tim, escSet->Motors[m].Channel, CCMR_PWM_PRELOAD);
+		*(&tim->CCR1 + escSet->Motors[m].Channel) = 0;
 	}
-	escSet->SendingFlag = 0;
+	tim->CCER = (tim->CCER & ~group->CcerBothEdges) | group->CcerInvert | group->CcerEnable;
+	tim->ARR = escSet->Protocol->ARR - 1;
+	tim->EGR = TIM_EGR_UG;
+	tim->SR = ~TIM_SR_UIF;
+	// Burst stream back to memory to peripheral through DMAR
+	DMA_Stream_TypeDef* stream = group->DMA->Instance;
+	stream->CR |= DMA_SxCR_DIR_0;
+	stream->PAR = (uint32_t) &tim->DMAR;
+	tim->DIER |= group->DMARequest;
+	group->TelemReady = 1;
+	group->CaptureFlag = 0;
 }
 
-/* Function Summary: Once the throttle has a new value loaded in this is called to
- * start the output of that throttle value.
- * Param: ESC - Pointer to the single ESC_CONTROLLER that needs throttle to be updated.
+/* Function Summary: Decode the replies of a closed window into RPM, from the main loop
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Param: group - Timer group whose window DSHOT_STOP_CAPTURE closed
  * Return: VOID
  */
-void ESC_UPDATE_THROTTLE(ESC_CONTROLLER* escSet)
+static void DSHOT_DECODE_TELEMETRY(ESC_CONTROLLER* escSet, ESC_GROUP* group)
 {
-	// Throttle cannot exceed 11 bits, so max value is 2047
-	DSHOT_SEND_PACKET(escSet, escSet->Throttle[0], 0, FRONT_LEFT_MOTOR);
-	DSHOT_SEND_PACKET(escSet, escSet->Throttle[1], 0, FRONT_RIGHT_MOTOR);
-	DSHOT_SEND_PACKET(escSet, escSet->Throttle[2], 0, BACK_LEFT_MOTOR);
-	DSHOT_SEND_PACKET(escSet, escSet->Throttle[3], 0, BACK_RIGHT_MOTOR);
+	if (!group->TelemReady) return;
+	uint32_t bitTicks = DSHOT_TELEM_BIT_TICKS(escSet->Protocol->ARR);
+	for (int m = 0; m < escSet->MotorCount; m++)
+	{
+		if (!(group->MotorMask & ESC_MOTOR(m)) || !escSet->Motors[m].Output->CaptureDMA) continue;
+		uint32_t erpm = DSHOT_DECODE_ERPM(escSet->TelemEdges[m], escSet->TelemCount[m], bitTicks);
+		if (erpm == DSHOT_TELEM_INVALID) escSet->TelemErrors[m]++;
+		else escSet->RPM[m] = erpm / MOTOR_POLE_PAIRS;
+	}
+	group->TelemReady = 0;
 }
+#endif
 
-// TO DO: Commands often times do not save, need to figure out why.
-/* Function Summary: Send particular DSHOT command to ESC
- * Param: escSet - Pointer to the single ESC_CONTROLLER,
- * Param: cmd - command from available command list,
- * Param: motorNum - specific motor(s) to send the command to
+/* Function Summary: Called from a burst stream transfer complete callback once the last
+ * row of a frame has been written to its timer
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Param: dma - Stream that finished
  * Return: VOID
  */
-void ESC_SEND_CMD(ESC_CONTROLLER* escSet, uint32_t cmd, uint32_t motorNum)
+void ESC_FRAME_SENT(ESC_CONTROLLER* escSet, DMA_HandleTypeDef* dma)
 {
-	// Need to set telemetry bit to 1 if either of these commands are sent
-	if (cmd == DSHOT_CMD_SPIN_DIRECTION_NORMAL || DSHOT_CMD_SPIN_DIRECTION_REVERSED ||
-			   DSHOT_CMD_SPIN_DIRECTION_1 || DSHOT_CMD_SPIN_DIRECTION_2)
+	for (int g = 0; g < escSet->GroupCount; g++)
 	{
-		for (int i = 0; i < 100; i++)
-		{
-			DSHOT_SEND_PACKET(escSet, cmd, 1, motorNum);
-		}
+		ESC_GROUP* group = &escSet->Groups[g];
+		if (group->DMA != dma) continue;
+#ifdef DSHOT_BIDIR
+		if (escSet->Bidir) DSHOT_START_CAPTURE(escSet, group);
+#endif
+		group->SendingFlag = 0;
 	}
-	// Commands I do not want to be used right now
-	else if (cmd == DSHOT_CMD_3D_MODE_OFF || DSHOT_CMD_3D_MODE_ON || DSHOT_CMD_AUDIO_STREAM_MODE_ON_OFF ||
-					DSHOT_CMD_SILENT_MODE_ON_OFF || DSHOT_CMD_SIGNAL_LINE_TELEMETRY_DISABLE||
-					DSHOT_CMD_SIGNAL_LINE_CONTINUOUS_ERPM_TELEMETRY || DSHOT_CMD_ESC_INFO ||
-					DSHOT_CMD_LED3_ON || DSHOT_CMD_LED3_OFF)
+}
+
+/* Function Summary: Called from a motor timer's update interrupt, which is only enabled
+ * while that timer is listening for eRPM replies, so it marks the end of the reply window
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Param: htim - Timer that updated
+ * Return: VOID
+ */
+void ESC_CAPTURE_DONE(ESC_CONTROLLER* escSet, TIM_HandleTypeDef* htim)
+{
+#ifdef DSHOT_BIDIR
+	for (int g = 0; g < escSet->GroupCount; g++)
 	{
-		// Do nothing because I don't want these commands being sent currently
+		ESC_GROUP* group = &escSet->Groups[g];
+		if (group->Timer == htim && group->CaptureFlag) DSHOT_STOP_CAPTURE(escSet, group);
 	}
-	else if (cmd == DSHOT_CMD_BEACON1 || DSHOT_CMD_BEACON2 || DSHOT_CMD_BEACON3 ||
-					DSHOT_CMD_BEACON4 || DSHOT_CMD_BEACON5)
+#endif
+}
+
+/* Function Summary: Check whether a new frame can go out without waiting
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Return: 1 once every timer has sent its frame and closed its reply window, else 0
+ */
+uint8_t ESC_FRAME_IDLE(ESC_CONTROLLER* escSet)
+{
+	for (int g = 0; g < escSet->GroupCount; g++)
 	{
-		for (int i = 0; i < 100; i++)
-		{
-			DSHOT_SEND_PACKET(escSet, cmd, 1, motorNum);
-		}
-		HAL_Delay(1000);
+		if (escSet->Groups[g].SendingFlag || escSet->Groups[g].CaptureFlag) return 0;
 	}
-	else
+	return 1;
+}
+
+/* Function Summary: Block until the previous frame has left every DMA stream and, with
+ * DSHOT_BIDIR, its reply window has closed, then decode the replies
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Return: VOID
+ */
+static void DSHOT_WAIT_FRAME(ESC_CONTROLLER* escSet)
+{
+	for (int g = 0; g < escSet->GroupCount; g++)
 	{
-		for (int i = 0; i < 100; i++) DSHOT_SEND_PACKET(escSet, cmd, 1, motorNum);
+		ESC_GROUP* group = &escSet->Groups[g];
+		while (group->SendingFlag || group->CaptureFlag);
+#ifdef DSHOT_BIDIR
+		DSHOT_DECODE_TELEMETRY(escSet, group);
+#endif
 	}
 }
 
-/* Function Summary: Calculates throttle values for all motors based on RX inputs
+/* Function Summary: Frame of a timer group the control loop is free to encode into. The
+ * previous frame may still be on the wire, it lives in the other buffer.
+ * Param: group - Timer group
+ * Return: Pointer to the first halfword of the back buffer
+ */
+static uint16_t* DSHOT_BACK_FRAME(ESC_GROUP* group)
+{
+	return group->Frame[group->BackBuffer];
+}
+
+/* Function Summary: Encode one value per motor into the back buffer of every timer group
  * Param: escSet - Pointer to the single ESC_CONTROLLER
- * Param: thisRX - data struct containing RX inputs
- * Param: armed - Need to tell if the arm switch is on or off, if off then throttle = DSHOT_MIN_IDLE
+ * Param: values - Throttle or command per motor
+ * Param: telemMask - Motors to set the telemetry bit for
+ * Param: sendMask - Motors that get a packet, the rest get an empty column and see no pulses
  * Return: VOID
  */
-void ESC_CALC_THROTTLE(ESC_CONTROLLER* escSet, RX_CONTROLLER* thisRX, uint8_t armed)
+static void ESC_ENCODE_FRAME(ESC_CONTROLLER* escSet, const uint16_t* values, uint8_t telemMask, uint8_t sendMask)
 {
-	if (armed)
+	for (int g = 0; g < escSet->GroupCount; g++)
 	{
-		// Initiate array containing set of throttle values for motors
-		MOTOR_THROTTLES motorSet;
-		// Set the base throttle of each motor to the throttle stick value
-		motorSet.FrontLeft = thisRX->throttle;
-		motorSet.FrontRight = thisRX->throttle;
-		motorSet.BackLeft = thisRX->throttle;
-		motorSet.BackRight = thisRX->throttle;
-		// Back side increases throttle if pitching forward, front side decreases
-		if (thisRX->pitch > XYZ_NEUTRAL_VALUE)
+		ESC_GROUP* group = &escSet->Groups[g];
+		uint16_t columns[ESC_TIMER_CHANNELS] = {0};
+		uint8_t columnTelem = 0;
+		uint8_t columnSend = 0;
+		for (int m = 0; m < escSet->MotorCount; m++)
 		{
-			uint32_t addVal = (thisRX->pitch - XYZ_NEUTRAL_VALUE) * SENSITIVITY_CONST;
-			if (motorSet.FrontLeft > addVal) motorSet.FrontLeft -= addVal;
-			else motorSet.FrontLeft = 0;
-			if (motorSet.FrontRight > addVal) motorSet.FrontRight  -= addVal;
-			else motorSet.FrontRight  = 0;
-			motorSet.BackLeft += addVal;
-			motorSet.BackRight += addVal;
+			if (!(group->MotorMask & ESC_MOTOR(m))) continue;
+			uint8_t column = escSet->Motors[m].Column;
+			columns[column] = values[m];
+			if (telemMask & ESC_MOTOR(m)) columnTelem |= 1 << column;
+			if (sendMask & ESC_MOTOR(m)) columnSend |= 1 << column;
 		}
-		// Front side increases throttle pitching backward, back side decreases
-		else if (thisRX->pitch < XYZ_NEUTRAL_VALUE)
+		uint16_t* frame = DSHOT_BACK_FRAME(group);
+		escSet->Protocol->Encode(escSet->Protocol, &escSet->Encoder, frame, columns, group->Width, columnTelem);
+		// Channels between motors are written by the burst too, keep them empty
+		for (int c = 0; c < group->Width; c++)
 		{
-			uint32_t addVal = (XYZ_NEUTRAL_VALUE - thisRX->pitch) * SENSITIVITY_CONST;
-			if (motorSet.BackLeft > addVal) motorSet.BackLeft -= addVal;
-			else motorSet.BackLeft = 0;
-			if (motorSet.BackRight > addVal) motorSet.BackRight  -= addVal;
-			else motorSet.BackRight  = 0;
-			motorSet.FrontLeft += addVal;
-			motorSet.FrontRight += addVal;
+			if (!(columnSend & (1 << c))) DSHOT_CLEAR_FRAME(frame, group->Width, c);
 		}
-		// Left side increases throttle if pitching to the right, right side decreases
-		if (thisRX->roll > XYZ_NEUTRAL_VALUE)
-		{
-			uint32_t addVal = (thisRX->roll - XYZ_NEUTRAL_VALUE) * SENSITIVITY_CONST;
-			if (motorSet.FrontRight > addVal) motorSet.FrontRight -= addVal;
-			else motorSet.FrontRight = 0;
-			if (motorSet.BackRight > addVal) motorSet.BackRight  -= addVal;
-			else motorSet.BackRight  = 0;
-			motorSet.FrontLeft += addVal;
-			motorSet.BackLeft += addVal;
-		}
-		// Right side increases throttle if pitching to the left, left side decreases
-		else if (thisRX->roll < XYZ_NEUTRAL_VALUE)
-		{
-			uint32_t addVal = (XYZ_NEUTRAL_VALUE - thisRX->roll) * SENSITIVITY_CONST;
-			if (motorSet.FrontLeft > addVal) motorSet.FrontLeft -= addVal;
-			else motorSet.FrontLeft = 0;
-			if (motorSet.BackLeft > addVal) motorSet.BackLeft  -= addVal;
-			else motorSet.BackLeft  = 0;
-			motorSet.FrontRight += addVal;
-			motorSet.BackRight += addVal;
-		}
-		// Front left and back right (if spinning counter-clockwise) increase if yaw to the right
-		if (thisRX->yaw > XYZ_NEUTRAL_VALUE)
-		{
-			uint32_t addVal = (thisRX->yaw - XYZ_NEUTRAL_VALUE) * SENSITIVITY_CONST;
-			if (motorSet.FrontRight > addVal) motorSet.FrontRight -= addVal;
-			else motorSet.FrontRight = 0;
-			if (motorSet.BackLeft > addVal) motorSet.BackLeft  -= addVal;
-			else motorSet.BackLeft  = 0;
-			motorSet.FrontLeft += addVal;
-			motorSet.BackRight += addVal;
-		}
-		// Front right and back left (if spinning clockwise) increase if yaw to the left
-		else if (thisRX->yaw < XYZ_NEUTRAL_VALUE)
-		{
-			uint32_t addVal = (XYZ_NEUTRAL_VALUE - thisRX->yaw) * SENSITIVITY_CONST;
-			if (motorSet.FrontLeft > addVal) motorSet.FrontLeft -= addVal;
-			else motorSet.FrontLeft = 0;
-			if (motorSet.BackRight > addVal) motorSet.BackRight  -= addVal;
-			else motorSet.BackRight  = 0;
-			motorSet.FrontRight += addVal;
-			motorSet.BackLeft += addVal;
-		}
-		if (motorSet.FrontLeft > DSHOT_MAX_THROTTLE) motorSet.FrontLeft = DSHOT_MAX_THROTTLE;
-		else if (motorSet.FrontLeft < DSHOT_MIN_IDLE) motorSet.FrontLeft = DSHOT_MIN_IDLE;
-		if (motorSet.FrontRight > DSHOT_MAX_THROTTLE) motorSet.FrontRight = DSHOT_MAX_THROTTLE;
-		else if (motorSet.FrontRight < DSHOT_MIN_IDLE) motorSet.FrontRight = DSHOT_MIN_IDLE;
-		if (motorSet.BackLeft > DSHOT_MAX_THROTTLE) motorSet.BackLeft = DSHOT_MAX_THROTTLE;
-		else if (motorSet.BackLeft < DSHOT_MIN_IDLE) motorSet.BackLeft = DSHOT_MIN_IDLE;
-		if (motorSet.BackRight > DSHOT_MAX_THROTTLE) motorSet.BackRight = DSHOT_MAX_THROTTLE;
-		else if (motorSet.BackRight < DSHOT_MIN_IDLE) motorSet.BackRight = DSHOT_MIN_IDLE;
-		escSet->Throttle[0] = motorSet.FrontLeft;
-		escSet->Throttle[1] = motorSet.FrontRight;
-		escSet->Throttle[2] = motorSet.BackLeft;
-		escSet->Throttle[3] = motorSet.BackRight;
 	}
-	else
+}
+
+/* Function Summary: Publish the back buffers. Waits for the frames on the wire, points each
+ * idle stream at its back buffer, arms it, then hands the old front buffer to the writer,
+ * which holds a frame from two sends ago.
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Return: VOID
+ */
+static void DSHOT_START_FRAME(ESC_CONTROLLER* escSet)
+{
+	DSHOT_WAIT_FRAME(escSet);
+	for (int g = 0; g < escSet->GroupCount; g++)
 	{
-		escSet->Throttle[0] = 0;
-		escSet->Throttle[1] = 0;
-		escSet->Throttle[2] = 0;
-		escSet->Throttle[3] = 0;
+		ESC_GROUP* group = &escSet->Groups[g];
+		DMA_HandleTypeDef* dma = group->DMA;
+		group->SendingFlag = 1;
+		__HAL_DMA_CLEAR_FLAG(dma, __HAL_DMA_GET_TC_FLAG_INDEX(dma) | __HAL_DMA_GET_HT_FLAG_INDEX(dma) |
+									__HAL_DMA_GET_FE_FLAG_INDEX(dma));
+		dma->Instance->M0AR = (uint32_t) DSHOT_BACK_FRAME(group);
+		dma->Instance->NDTR = escSet->Protocol->FrameRows * group->Width;
+		// HAL_DMA_IRQHandler drops TCIE after every normal mode transfer
+		dma->Instance->CR |= DMA_IT_TC;
+		__HAL_DMA_ENABLE(dma);
+		group->BackBuffer ^= 1;
 	}
+	escSet->BackValid = 0;
 }
 
+/* Function Summary: Switch the output protocol. Waits for the frames on the wire, then
+ * reloads every timer's prescaler/period and the encoder for the new protocol.
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Param: protocol - Output protocol from escProtocols_e
+ * Return: VOID
+ */
+void ESC_SET_PROTOCOL(ESC_CONTROLLER* escSet, escProtocols_e protocol)
+{
+	const ESC_PROTOCOL* proto = &ESC_PROTOCOLS[protocol];
+	DSHOT_WAIT_FRAME(escSet);
+	escSet->Protocol = proto;
+	escSet->BackValid = 0;
+	DSHOT_ENCODER_INIT(&escSet->Encoder, proto->LowBit, proto->HighBit);
+#ifdef DSHOT_BIDIR
+	escSet->Bidir = proto->Digital;
+#else
+	escSet->Bidir = 0;
 #endif
+	for (int g = 0; g < escSet->GroupCount; g++)
+	{
+		ESC_GROUP* group = &escSet->Groups[g];
+		TIM_TypeDef* tim = group->Timer->Instance;
+		// Bidirectional lines idle high and every bit is a low pulse
+		if (escSet->Bidir) tim->CCER |= group->CcerInvert;
+		else tim->CCER &= ~group->CcerInvert;
+		for (int c = 0; c < group->Width; c++)
+		{
+			for (int b = 0; b < DSHOT_FRAME_BUFFERS; b++) DSHOT_CLEAR_FRAME(group->Frame[b], group->Width, c);
+			*(&tim->CCR1 + group->BaseChannel + c) = 0;
+		}
+		tim->PSC = proto->Prescaler;
+		tim->ARR = proto->ARR - 1;	// One DSHOT bit or one analog pulse period per update event
+		tim->EGR = TIM_EGR_UG;
+	}
+}
 
+/* Function Summary: Pick the frame geometry ESC_CALC_THROTTLE mixes for and how it desaturates
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Param: layout - Frame layout from mixerLayouts_e
+ * Param: mode - MIXER_MODE_CLAMP, or one of the airmodes to keep attitude authority at the throttle ends
+ * Return: 1 if set, 0 if the layout needs more motors than ESC_INIT was given
+ */
+uint8_t ESC_SET_MIXER(ESC_CONTROLLER* escSet, mixerLayouts_e layout, mixerModes_e mode)
+{
+	const MIXER_LAYOUT* mixer = &MIXER_LAYOUTS[layout];
+	if (mixer->MotorCount > escSet->MotorCount) return 0;
+	escSet->Mixer = mixer;
+	escSet->MixMode = mode;
+	return 1;
+}
 
+/* Function Summary: Send one packet to a motor or group of motors, motors outside the
+ * group get an empty column and see no pulses for this frame
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Param: data - throttle or command value
+ * Param: telemBit - telemetry request bit
+ * Param: motorMask - motor(s) to send to, bit n = motor n
+ * Return: VOID
+ */
+void DSHOT_SEND_PACKET(ESC_CONTROLLER* escSet, uint32_t data, uint32_t telemBit, uint32_t motorMask)
+{
+	uint16_t values[ESC_MAX_MOTORS];
+	for (int i = 0; i < escSet->MotorCount; i++) values[i] = data;
+	ESC_ENCODE_FRAME(escSet, values, telemBit ? motorMask : 0, motorMask);
+	DSHOT_START_FRAME(escSet);
+}
 
+/* Function Summary: Once the throttle has a new value loaded in this is called to
+ * start the output of that throttle value. All motors go out in the same frame. When a
+ * queued command is due it replaces the throttle of the motors it targets for this frame,
+ * every other motor keeps its throttle. Never waits, the frame is encoded into the back
+ * buffer while the last one is still on the wire and goes out on the first call that finds
+ * the outputs idle. It is only encoded again if the throttle, command or telemetry changes.
+ * Param: ESC - Pointer to the single ESC_CONTROLLER that needs throttle to be updated.
+ * Return: 1 if a frame was started, 0 if the outputs were still busy
+ */
+uint8_t ESC_UPDATE_THROTTLE(ESC_CONTROLLER* escSet)
+{
+	uint8_t idle = ESC_FRAME_IDLE(escSet);
+	uint16_t values[ESC_MAX_MOTORS];
+	uint8_t telemMask = escSet->TelemRequest;
+	ESC_CMD* cmd = NULL;
+	// Throttle cannot exceed 11 bits, so max value is 2047
+	for (int i = 0; i < escSet->MotorCount; i++) values[i] = escSet->Throttle[i];
+	uint32_t now = HAL_GetTick();
+	if (escSet->CmdHead != escSet->CmdTail && (int32_t)(now - escSet->CmdDueTick) >= 0)
+	{
+		cmd = &escSet->CmdQueue[escSet->CmdHead];
+		for (int i = 0; i < escSet->MotorCount; i++)
+		{
+			if (cmd->Mask & ESC_MOTOR(i)) values[i] = cmd->Cmd;
+		}
+		if (cmd->TelemBit) telemMask |= cmd->Mask;
+	}
+	// The stream only reads the front buffer, so the back one can be written while it is busy
+	if (!escSet->BackValid || escSet->BackTelem != telemMask ||
+			memcmp(escSet->BackValues, values, escSet->MotorCount * sizeof(values[0])))
+	{
+		ESC_ENCODE_FRAME(escSet, values, telemMask, escSet->MotorMask);
+		memcpy(escSet->BackValues, values, escSet->MotorCount * sizeof(values[0]));
+		escSet->BackTelem = telemMask;
+		escSet->BackValid = 1;
+	}
+	if (!idle) return 0;
+	// Telemetry requests and command frames are only used up once their frame goes out
+	escSet->TelemRequest = 0;
+	if (cmd)
+	{
+		if (--cmd->Repeats == 0)
+		{
+			escSet->CmdHead = (escSet->CmdHead + 1) % ESC_CMD_QUEUE_SIZE;
+			escSet->CmdDone++;
+			escSet->CmdDueTick = now + cmd->GuardDelay;
+		}
+		else escSet->CmdDueTick = now + cmd->RepeatDelay;
+	}
+	DSHOT_START_FRAME(escSet);
+	return 1;
+}
 
+/* Function Summary: Queue a DSHOT command. Nothing is sent here, ESC_UPDATE_THROTTLE sends
+ * the command frames in between throttle frames with the repeats and spacing the command
+ * class needs, so the caller never blocks.
+ * Param: escSet - Pointer to the single ESC_CONTROLLER,
+ * Param: cmd - command from available command list,
+ * Param: motorMask - specific motor(s) to send the command to, bit n = motor n
+ * Return: Ticket for ESC_CMD_COMPLETE, 0 if the command was refused, out of range or the queue is full
+ */
+uint32_t ESC_SEND_CMD(ESC_CONTROLLER* escSet, uint32_t cmd, uint32_t motorMask)
+{
+	uint8_t next = (escSet->CmdTail + 1) % ESC_CMD_QUEUE_SIZE;
+	motorMask &= escSet->MotorMask;
+	if (cmd > DSHOT_CMD_MAX || !escSet->Protocol->Digital || !motorMask || next == escSet->CmdHead) return 0;
+	ESC_CMD* entry = &escSet->CmdQueue[escSet->CmdTail];
+	// Every ESC asked answers on the one telemetry line, so only settings commands ask
+	entry->TelemBit = 0;
+	switch (cmd)
+	{
+		// Settings commands need the telemetry bit set and are only accepted after several copies
+		case DSHOT_CMD_SPIN_DIRECTION_1:
+		case DSHOT_CMD_SPIN_DIRECTION_2:
+		case DSHOT_CMD_SPIN_DIRECTION_NORMAL:
+		case DSHOT_CMD_SPIN_DIRECTION_REVERSED:
+		case DSHOT_CMD_SAVE_SETTINGS:
+			entry->Repeats = 10;
+			entry->RepeatDelay = 1;
+			entry->GuardDelay = 40;		// Save settings writes flash on the ESC
+			entry->TelemBit = 1;
+			break;
+		// Commands I do not want to be used right now
+		case DSHOT_CMD_3D_MODE_OFF:
+		case DSHOT_CMD_3D_MODE_ON:
+		case DSHOT_CMD_AUDIO_STREAM_MODE_ON_OFF:
+		case DSHOT_CMD_SILENT_MODE_ON_OFF:
+		case DSHOT_CMD_SIGNAL_LINE_TELEMETRY_DISABLE:
+		case DSHOT_CMD_SIGNAL_LINE_CONTINUOUS_ERPM_TELEMETRY:
+		case DSHOT_CMD_ESC_INFO:
+		case DSHOT_CMD_LED3_ON:
+		case DSHOT_CMD_LED3_OFF:
+			return 0;
+		// One beacon frame starts a beep, leave it a second before anything else is sent
+		case DSHOT_CMD_BEACON1:
+		case DSHOT_CMD_BEACON2:
+		case DSHOT_CMD_BEACON3:
+		case DSHOT_CMD_BEACON4:
+		case DSHOT_CMD_BEACON5:
+			entry->Repeats = 1;
+			entry->RepeatDelay = 0;
+			entry->GuardDelay = 1000;
+			break;
+		default:
+			entry->Repeats = 10;
+			entry->RepeatDelay = 1;
+			entry->GuardDelay = 1;
+			break;
+	}
+	entry->Cmd = cmd;
+	entry->Mask = motorMask;
+	escSet->CmdTail = next;
+	return ++escSet->CmdQueued;
+}
 
+/* Function Summary: Ask for a serial telemetry frame, the telemetry bit rides on the next
+ * throttle frame of the given motor(s) so no throttle update is lost
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Param: motorMask - specific motor(s) to ask, bit n = motor n
+ * Return: VOID
+ */
+void ESC_REQUEST_TELEMETRY(ESC_CONTROLLER* escSet, uint32_t motorMask)
+{
+	escSet->TelemRequest |= motorMask & escSet->MotorMask;
+}
 
+/* Function Summary: Status poll for a queued command
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Param: ticket - Value returned by ESC_SEND_CMD
+ * Return: 1 once every frame of that command has been sent (or it was refused), else 0
+ */
+uint8_t ESC_CMD_COMPLETE(ESC_CONTROLLER* escSet, uint32_t ticket)
+{
+	return (int32_t)(escSet->CmdDone - ticket) >= 0;
+}
 
+/* Function Summary: Check if the command queue has drained and its guard time has passed
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Return: 1 if no command is queued or waiting out its spacing, else 0
+ */
+uint8_t ESC_CMD_IDLE(ESC_CONTROLLER* escSet)
+{
+	return escSet->CmdHead == escSet->CmdTail && (int32_t)(HAL_GetTick() - escSet->CmdDueTick) >= 0;
+}
 
-
-
+/* Function Summary: Calculates throttle values for all motors from the throttle stick and
+ * the rate loop's roll/pitch/yaw demand
+ * Param: escSet - Pointer to the single ESC_CONTROLLER
+ * Param: demand - Throttle plus roll, pitch and yaw in DSHOT throttle units
+ * Param: armed - Need to tell if the arm switch is on or off, if off then throttle = 0
+ *                 and the motors stay off until ESC_SET_MIXER has picked a layout
+ * Return: VOID
+ */
+void ESC_CALC_THROTTLE(ESC_CONTROLLER* escSet, const MIXER_AXES* demand, uint8_t armed)
+{
+	if (armed && escSet->Mixer)
+	{
+		MIXER_APPLY(escSet->Mixer, demand, escSet->MixMode, DSHOT_MIN_IDLE, DSHOT_MAX_THROTTLE, escSet->Throttle);
+	}
+	else
+	{
+		for (int i = 0; i < escSet->MotorCount; i++) escSet->Throttle[i] = 0;
+	}
+}
@@ -0,0 +1,221 @@
+/*
+ * FILTER.c
+ *
+ *  Created on: Feb 6, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Gyro Filter Chain
+Stages run in order on every sample, each stage handles all FILTER_AXES in one pass.
+
+- PT1: first order lowpass, y += K * (x - y)
+- PT2/PT3: two or three PT1 in series, each PT1's gain set so the chain is still -3dB at Hz
+- Biquad lowpass and notch: RBJ cookbook coefficients, transposed direct form II
+
+Coefficients are only worked out in FILTER_SET_STAGE, and only when the config actually
+changed, so the per sample cost is a handful of multiply-adds per axis per stage.
+*/
+
+#include <math.h>
+#include "FILTER.h"
+
+#define FILTER_PI			3.14159265f
+// Power gain each of n cascaded PT1s has at the cutoff so the chain is -3dB there, 2^(-1/n)
+#define PT1_CUTOFF_POWER	0.5f
+#define PT2_CUTOFF_POWER	0.707107f
+#define PT3_CUTOFF_POWER	0.793701f
+
+/* Function Summary: Empty filter chain, every stage passes samples through
+ * Param: sampleHz - Rate FILTER_APPLY is called at
+ * Return: Pointer to struct containing the filter chain
+ */
+FILTER_CHAIN* FILTER_INIT(float sampleHz)
+{
+	FILTER_CHAIN* chain = malloc(sizeof(FILTER_CHAIN));
+	memset(chain, 0, sizeof(FILTER_CHAIN));
+	chain->SampleHz = sampleHz;
+	return chain;
+}
+
+/* Function Summary: PT1 gain that puts the discrete filter exactly on a power gain at a
+ * frequency. The RC form dt / (RC + dt) is already -3.4dB at 50Hz on a 1660Hz loop and
+ * gets worse towards Nyquist, this solves |K / (1 - (1 - K)z^-1)|^2 = power instead
+ * Param: hz - Frequency
+ * Param: power - Power gain wanted there, 0.5 for -3dB
+ * Param: sampleHz - Filter rate
+ * Return: K in y += K * (x - y)
+ */
+static float FILTER_PT1_GAIN(float hz, float power, float sampleHz)
+{
+	float d = 1.0f - cosf(2.0f * FILTER_PI * hz / sampleHz);
+	return (sqrtf(power * power * d * d + 2.0f * (1.0f - power) * power * d) - power * d) / (1.0f - power);
+}
+
+/* Function Summary: RBJ cookbook biquad coefficients, normalised so A0 = 1
+ * Param: type - FILTER_BIQUAD_LPF or FILTER_BIQUAD_NOTCH
+ * Param: hz - Cutoff or notch centre
+ * Param: q - Quality factor, 0.707 for a flat lowpass, higher is a narrower notch
+ * Param: sampleHz - Filter rate
+ * Param: coeffs - Returns B0, B1, B2, A1, A2
+ */
+static void FILTER_BIQUAD_COEFFS(filterTypes_e type, float hz, float q, float sampleHz, float* coeffs)
+{
+	float omega = 2.0f * FILTER_PI * hz / sampleHz;
+	float cs = cosf(omega);
+	float alpha = sinf(omega) / (2.0f * q);
+	float a0 = 1.0f + alpha;
+	if (type == FILTER_BIQUAD_LPF)
+	{
+		coeffs[0] = (1.0f - cs) / 2.0f / a0;
+		coeffs[1] = (1.0f - cs) / a0;
+		coeffs[2] = coeffs[0];
+	}
+	else
+	{
+		coeffs[0] = 1.0f / a0;
+		coeffs[1] = -2.0f * cs / a0;
+		coeffs[2] = coeffs[0];
+	}
+	coeffs[3] = -2.0f * cs / a0;
+	coeffs[4] = (1.0f - alpha) / a0;
+}
+
+/* Function Summary: Configure one stage, coefficients and state are only touched if the
+ * config is different from what the stage already runs
+ * Param: chain - Filter chain
+ * Param: stage - 0 to FILTER_MAX_STAGES - 1, stages past StageCount are added
+ * Param: config - What the stage should be
+ * Return: 1 if the stage is set, 0 if the stage, cutoff or biquad Q is out of range
+ */
+uint8_t FILTER_SET_STAGE(FILTER_CHAIN* chain, uint8_t stage, const FILTER_CONFIG* config)
+{
+	if (stage >= FILTER_MAX_STAGES) return 0;
+	if (config->Type != FILTER_NONE && (config->Hz <= 0 || config->Hz >= chain->SampleHz / 2)) return 0;
+	// Q divides the biquad alpha, zero or below gives infinite or unstable coefficients
+	if ((config->Type == FILTER_BIQUAD_LPF || config->Type == FILTER_BIQUAD_NOTCH) && !(config->Q > 0)) return 0;
+	if (stage >= chain->StageCount) chain->StageCount = stage + 1;
+	FILTER_STAGE* s = &chain->Stages[stage];
+	if (s->Config.Type == config->Type && s->Config.Hz == config->Hz && s->Config.Q == config->Q) return 1;
+	// Changing type leaves the old state meaningless, a retune keeps it so the output doesn't jump
+	if (s->Config.Type != config->Type)
+	{
+		memset(s->S1, 0, sizeof(s->S1));
+		memset(s->S2, 0, sizeof(s->S2));
+		memset(s->S3, 0, sizeof(s->S3));
+	}
+	s->Config = *config;
+	switch (config->Type)
+	{
+		case FILTER_PT1:
+			s->K = FILTER_PT1_GAIN(config->Hz, PT1_CUTOFF_POWER, chain->SampleHz);
+			break;
+		case FILTER_PT2:
+			s->K = FILTER_PT1_GAIN(config->Hz, PT2_CUTOFF_POWER, chain->SampleHz);
+			break;
+		case FILTER_PT3:
+			s->K = FILTER_PT1_GAIN(config->Hz, PT3_CUTOFF_POWER, chain->SampleHz);
+			break;
+		case FILTER_BIQUAD_LPF:
+		case FILTER_BIQUAD_NOTCH:
+		{
+			float coeffs[5];
+			FILTER_BIQUAD_COEFFS(config->Type, config->Hz, config->Q, chain->SampleHz, coeffs);
+			s->B0 = coeffs[0];
+			s->B1 = coeffs[1];
+			s->B2 = coeffs[2];
+			s->A1 = coeffs[3];
+			s->A2 = coeffs[4];
+			break;
+		}
+		default:
+			break;
+	}
+	return 1;
+}
+
+/* Function Summary: Run one sample of every axis through the whole chain
+ * Param: chain - Filter chain
+ * Param: axes - FILTER_AXES samples, filtered in place
+ * Return: VOID
+ */
+void FILTER_APPLY(FILTER_CHAIN* chain, float* axes)
+{
+	for (int i = 0; i < chain->StageCount; i++)
+	{
+		FILTER_STAGE* s = &chain->Stages[i];
+		float k = s->K;
+		switch (s->Config.Type)
+		{
+			case FILTER_PT1:
+				for (int a = 0; a < FILTER_AXES; a++)
+				{
+					s->S1[a] += k * (axes[a] - s->S1[a]);
+					axes[a] = s->S1[a];
+				}
+				break;
+			case FILTER_PT2:
+				for (int a = 0; a < FILTER_AXES; a++)
+				{
+					s->S1[a] += k * (axes[a] - s->S1[a]);
+					s->S2[a] += k * (s->S1[a] - s->S2[a]);
+					axes[a] = s->S2[a];
+				}
+				break;
+			case FILTER_PT3:
+				for (int a = 0; a < FILTER_AXES; a++)
+				{
+					s->S1[a] += k * (axes[a] - s->S1[a]);
+					s->S2[a] += k * (s->S1[a] - s->S2[a]);
+					s->S3[a] += k * (s->S2[a] - s->S3[a]);
+					axes[a] = s->S3[a];
+				}
+				break;
+			case FILTER_BIQUAD_LPF:
+			case FILTER_BIQUAD_NOTCH:
+				for (int a = 0; a < FILTER_AXES; a++)
+				{
+					float x = axes[a];
+					float y = s->B0 * x + s->S1[a];
+					s->S1[a] = s->B1 * x - s->A1 * y + s->S2[a];
+					s->S2[a] = s->B2 * x - s->A2 * y;
+					axes[a] = y;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+/* Function Summary: Set a single axis biquad, the delay line is kept so retuning on the fly
+ * does not make the output jump
+ * Param: bq - Biquad to set
+ * Param: type - FILTER_BIQUAD_LPF or FILTER_BIQUAD_NOTCH
+ * Param: hz - Cutoff or notch centre
+ * Param: q - Quality factor
+ * Param: sampleHz - Filter rate
+ * Return: VOID
+ */
+void FILTER_BIQUAD_SET(FILTER_BIQUAD* bq, filterTypes_e type, float hz, float q, float sampleHz)
+{
+	float coeffs[5];
+	FILTER_BIQUAD_COEFFS(type, hz, q, sampleHz, coeffs);
+	bq->B0 = coeffs[0];
+	bq->B1 = coeffs[1];
+	bq->B2 = coeffs[2];
+	bq->A1 = coeffs[3];
+	bq->A2 = coeffs[4];
+}
+
+/* Function Summary: Run one sample through a single axis biquad
+ * Param: bq - Biquad
+ * Param: x - Input sample
+ * Return: Filtered sample
+ */
+float FILTER_BIQUAD_APPLY(FILTER_BIQUAD* bq, float x)
+{
+	float y = bq->B0 * x + bq->S1;
+	bq->S1 = bq->B1 * x - bq->A1 * y + bq->S2;
+	bq->S2 = bq->B2 * x - bq->A2 * y;
+	return y;
+}
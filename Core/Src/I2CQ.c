@@ -0,0 +1,350 @@
+/*
+ * I2CQ.c
+ *
+ *  Created on: Mar 6, 2021
+ *      Author: Jeff Raines
+ */
+
+/** I2C Job Queue
+Every sensor on a bus submits its register reads and writes here instead of calling the HAL
+DMA functions itself. Jobs sit in a fixed ring and run one at a time, the HAL complete callback
+finishes the running job, calls its Done callback and starts the next one, so nothing is
+dropped because the bus happened to be busy. Done callbacks may submit follow-up jobs.
+
+A NACK retries the job up to I2CQ_NACK_RETRIES times. A bus error, arbitration loss or timeout
+usually means a slave is holding SDA low part way through a byte, so the peripheral is taken
+down, SCL is clocked by hand until SDA is released, a STOP is sent and the peripheral is brought
+back up before the job is retried. Bringing it back up runs the MSP init, whose DMA set up waits
+on HAL_GetTick, so the error interrupt only flags the recovery and I2CQ_SERVICE runs it from the
+main loop with interrupts on. The queue holds its jobs until then. A start the HAL refuses as
+busy is left queued for I2CQ_SERVICE to try again.
+
+Submits come from the main loop and from interrupts, the ring indices are only touched with
+interrupts masked.
+
+Bus speed comes from I2CQ_SPEED, which works TIMINGR out with I2CTIMING and switches the Fm+
+drive on the pins for 1MHz. The profiler stamps every job with the cycle counter and keeps jobs,
+wire bytes and busy time per device address, I2CQ_PROFILE rolls the counts over once a second.
+*/
+
+#include "I2CQ.h"
+
+/* Function Summary: Busy wait on the cycle counter
+ * Param: cycles - CPU cycles to wait
+ * Return: VOID
+ */
+static void I2CQ_DELAY(uint32_t cycles)
+{
+	uint32_t start = DWT->CYCCNT;
+	while (DWT->CYCCNT - start < cycles);
+}
+
+/* Function Summary: Profiler slot for a device address, takes a free one the first time an
+ * address is seen. Interrupts masked by the caller
+ * Param: q - Queue
+ * Param: addr - 8 bit (shifted) device address
+ * Return: Pointer to the slot, NULL once every slot is taken by other addresses
+ */
+static I2CQ_STATS* I2CQ_DEVICE(I2CQ_CONTROLLER* q, uint16_t addr)
+{
+	for (int i = 0; i < I2CQ_DEVICES; i++)
+	{
+		if (q->Count[i].Addr == addr) return &q->Count[i];
+		if (q->Count[i].Addr == 0)
+		{
+			q->Count[i].Addr = addr;
+			return &q->Count[i];
+		}
+	}
+	return NULL;
+}
+
+/* Function Summary: Charge the running job's bus time to its device
+ * Param: q - Queue
+ * Param: job - Job that just finished or failed
+ * Param: ok - 1 if the data made it, its bytes are counted
+ * Return: VOID
+ */
+static void I2CQ_CHARGE(I2CQ_CONTROLLER* q, I2CQ_JOB* job, uint8_t ok)
+{
+	I2CQ_STATS* stats = I2CQ_DEVICE(q, job->Addr);
+	if (!stats) return;
+	stats->BusyCycles += DWT->CYCCNT - q->StartCycles;
+	// Address and register, reads send the address again after the repeated start
+	if (ok) stats->Bytes += job->Size + (job->Dir == I2CQ_READ ? 3 : 2);
+}
+
+/* Function Summary: Set up the job ring for one I2C peripheral
+ * Param: i2c - HAL handle, already initialised
+ * Param: sclPort, sclPin - SCL pin, driven as GPIO during bus recovery
+ * Param: sdaPort, sdaPin - SDA pin
+ * Return: Pointer to struct containing the queue
+ */
+I2CQ_CONTROLLER* I2CQ_INIT(I2C_HandleTypeDef* i2c, GPIO_TypeDef* sclPort, uint16_t sclPin, GPIO_TypeDef* sdaPort, uint16_t sdaPin)
+{
+	I2CQ_CONTROLLER* q = malloc(sizeof(I2CQ_CONTROLLER));
+	memset(q, 0, sizeof(I2CQ_CONTROLLER));
+	q->I2c = i2c;
+	q->SclPort = sclPort;
+	q->SclPin = sclPin;
+	q->SdaPort = sdaPort;
+	q->SdaPin = sdaPin;
+	q->WindowStart = DWT->CYCCNT;
+	return q;
+}
+
+/* Function Summary: Fail the job at the tail and move on. Interrupts masked by the caller
+ * Param: q - Queue
+ * Return: VOID
+ */
+static void I2CQ_FAIL(I2CQ_CONTROLLER* q)
+{
+	I2CQ_JOB failed = q->Jobs[q->Tail];
+	q->Tail = (q->Tail + 1) & (I2CQ_SIZE - 1);
+	q->Failed++;
+	if (failed.Done) failed.Done(failed.Context, 0);
+}
+
+/* Function Summary: Start the job at the tail if the bus is free and no recovery is waiting.
+ * A busy peripheral leaves the job queued for I2CQ_SERVICE, any other refusal flags a recovery
+ * and fails the job once it is out of tries. Interrupts masked by the caller
+ * Param: q - Queue
+ * Return: VOID
+ */
+static void I2CQ_START(I2CQ_CONTROLLER* q)
+{
+	while (!q->Busy && !q->RecoverPending && q->Tail != q->Head)
+	{
+		I2CQ_JOB* job = &q->Jobs[q->Tail];
+		HAL_StatusTypeDef status;
+		uint32_t start = DWT->CYCCNT;
+		job->Tries++;
+		if (job->Dir == I2CQ_READ)
+		{
+			status = HAL_I2C_Mem_Read_DMA(q->I2c, job->Addr, job->Reg, I2C_MEMADD_SIZE_8BIT, job->Data, job->Size);
+		}
+		else
+		{
+			status = HAL_I2C_Mem_Write_DMA(q->I2c, job->Addr, job->Reg, I2C_MEMADD_SIZE_8BIT, job->Data, job->Size);
+		}
+		if (status == HAL_OK)
+		{
+			I2CQ_STATS* stats = I2CQ_DEVICE(q, job->Addr);
+			if (stats) stats->Jobs++;
+			q->StartCycles = start;
+			q->Busy = 1;
+			return;
+		}
+		if (status == HAL_BUSY)
+		{
+			// Still finishing the last transfer, not an attempt
+			job->Tries--;
+			return;
+		}
+		q->RecoverPending = 1;
+		if (job->Tries > I2CQ_BUS_RETRIES) I2CQ_FAIL(q);
+	}
+}
+
+/* Function Summary: Queue a register read or write, starts it now if the bus is free
+ * Param: q - Queue
+ * Param: addr - 8 bit (shifted) device address
+ * Param: reg - First register
+ * Param: data - Buffer, must stay valid until done runs
+ * Param: size - Bytes to move
+ * Param: dir - I2CQ_READ or I2CQ_WRITE
+ * Param: done - Completion callback, may be NULL
+ * Param: context - Passed to done
+ * Return: 0 if the ring was full and the job was not queued
+ */
+uint8_t I2CQ_SUBMIT(I2CQ_CONTROLLER* q, uint16_t addr, uint8_t reg, uint8_t* data, uint16_t size, i2cqDirs_e dir, I2CQ_DONE done, void* context)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint8_t head = q->Head;
+	uint8_t next = (head + 1) & (I2CQ_SIZE - 1);
+	if (next == q->Tail)
+	{
+		q->Full++;
+		__set_PRIMASK(primask);
+		return 0;
+	}
+	I2CQ_JOB* job = &q->Jobs[head];
+	job->Addr = addr;
+	job->Reg = reg;
+	job->Data = data;
+	job->Size = size;
+	job->Dir = dir;
+	job->Done = done;
+	job->Context = context;
+	job->Tries = 0;
+	q->Head = next;
+	I2CQ_START(q);
+	__set_PRIMASK(primask);
+	return 1;
+}
+
+/* Function Summary: Running job finished, from HAL_I2C_MemRxCpltCallback and
+ * HAL_I2C_MemTxCpltCallback
+ * Param: q - Queue
+ * Return: VOID
+ */
+void I2CQ_CPLT(I2CQ_CONTROLLER* q)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (q->Busy)
+	{
+		I2CQ_JOB done = q->Jobs[q->Tail];
+		I2CQ_CHARGE(q, &done, 1);
+		q->Tail = (q->Tail + 1) & (I2CQ_SIZE - 1);
+		q->Busy = 0;
+		if (done.Done) done.Done(done.Context, 1);
+	}
+	I2CQ_START(q);
+	__set_PRIMASK(primask);
+}
+
+/* Function Summary: Running job failed, from HAL_I2C_ErrorCallback. NACKs are retried as is,
+ * a bus error, arbitration loss or timeout flags a recovery for I2CQ_SERVICE and the queue
+ * waits for it. Anything else (overrun, DMA) is retried without one
+ * Param: q - Queue
+ * Return: VOID
+ */
+void I2CQ_ERROR(I2CQ_CONTROLLER* q)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (q->Busy)
+	{
+		I2CQ_JOB* job = &q->Jobs[q->Tail];
+		uint32_t error = HAL_I2C_GetError(q->I2c);
+		uint8_t retries = I2CQ_NACK_RETRIES;
+		I2CQ_CHARGE(q, job, 0);
+		q->Busy = 0;
+		if (error & I2CQ_STUCK_ERRORS) q->RecoverPending = 1;
+		if (error != HAL_I2C_ERROR_AF) retries = I2CQ_BUS_RETRIES;
+		if (job->Tries > retries) I2CQ_FAIL(q);
+	}
+	I2CQ_START(q);
+	__set_PRIMASK(primask);
+}
+
+/* Function Summary: Free a stuck bus. Up to 9 SCL pulses until the slave lets go of SDA, then a
+ * STOP, then the peripheral is initialised again. Interrupts must be on, the MSP init waits on
+ * HAL_GetTick, so the queue runs it from I2CQ_SERVICE
+ * Param: q - Queue
+ * Return: VOID
+ */
+void I2CQ_RECOVER(I2CQ_CONTROLLER* q)
+{
+	uint32_t half = SystemCoreClock / (2 * I2CQ_RECOVER_HZ);
+	GPIO_InitTypeDef gpio = {0};
+	q->Recoveries++;
+	HAL_I2C_DeInit(q->I2c);
+	gpio.Mode = GPIO_MODE_OUTPUT_OD;
+	gpio.Pull = GPIO_NOPULL;
+	gpio.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+	gpio.Pin = q->SclPin;
+	HAL_GPIO_WritePin(q->SclPort, q->SclPin, GPIO_PIN_SET);
+	HAL_GPIO_Init(q->SclPort, &gpio);
+	gpio.Pin = q->SdaPin;
+	HAL_GPIO_WritePin(q->SdaPort, q->SdaPin, GPIO_PIN_SET);
+	HAL_GPIO_Init(q->SdaPort, &gpio);
+	I2CQ_DELAY(half);
+	for (int i = 0; i < 9 && HAL_GPIO_ReadPin(q->SdaPort, q->SdaPin) == GPIO_PIN_RESET; i++)
+	{
+		HAL_GPIO_WritePin(q->SclPort, q->SclPin, GPIO_PIN_RESET);
+		I2CQ_DELAY(half);
+		HAL_GPIO_WritePin(q->SclPort, q->SclPin, GPIO_PIN_SET);
+		I2CQ_DELAY(half);
+	}
+	// STOP, SDA rises while SCL is high
+	HAL_GPIO_WritePin(q->SclPort, q->SclPin, GPIO_PIN_RESET);
+	I2CQ_DELAY(half);
+	HAL_GPIO_WritePin(q->SdaPort, q->SdaPin, GPIO_PIN_RESET);
+	I2CQ_DELAY(half);
+	HAL_GPIO_WritePin(q->SclPort, q->SclPin, GPIO_PIN_SET);
+	I2CQ_DELAY(half);
+	HAL_GPIO_WritePin(q->SdaPort, q->SdaPin, GPIO_PIN_SET);
+	I2CQ_DELAY(half);
+	// MSP init puts the pins back on the peripheral
+	HAL_I2C_Init(q->I2c);
+	HAL_I2CEx_ConfigAnalogFilter(q->I2c, I2C_ANALOGFILTER_ENABLE);
+}
+
+/* Function Summary: Change the bus speed. TIMINGR is worked out for the PCLK1 kernel clock and
+ * the assumed board edges, the Fm+ drive is on for 1MHz only. Bus recovery keeps the new speed
+ * Param: q - Queue
+ * Param: speed - Speed from i2cTimingSpeeds_e
+ * Param: fmp - HAL I2C_FASTMODEPLUS_ bits for the bus pins, 0 if the pins can't do Fm+
+ * Return: 0 if a job is running (try again later) or no TIMINGR fits, the old speed stays
+ */
+uint8_t I2CQ_SPEED(I2CQ_CONTROLLER* q, i2cTimingSpeeds_e speed, uint32_t fmp)
+{
+	I2CTIMING_RESULT timing;
+	if (speed == I2CTIMING_FAST_PLUS && fmp == 0) return 0;
+	if (!I2CTIMING_CALC(HAL_RCC_GetPCLK1Freq(), speed, I2CTIMING_RISE_NS, I2CTIMING_FALL_NS, &timing)) return 0;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (q->Busy)
+	{
+		__set_PRIMASK(primask);
+		return 0;
+	}
+	// Handle is already up so init only rewrites the registers, the pins stay on the peripheral
+	q->I2c->Init.Timing = timing.Timingr;
+	if (fmp)
+	{
+		if (speed == I2CTIMING_FAST_PLUS) HAL_I2CEx_EnableFastModePlus(fmp);
+		else HAL_I2CEx_DisableFastModePlus(fmp);
+	}
+	HAL_I2C_Init(q->I2c);
+	HAL_I2CEx_ConfigAnalogFilter(q->I2c, I2C_ANALOGFILTER_ENABLE);
+	q->Speed = speed;
+	q->BusHz = timing.BusHz;
+	I2CQ_START(q);
+	__set_PRIMASK(primask);
+	return 1;
+}
+
+/* Function Summary: Run a recovery the error interrupt asked for and restart the queue, or
+ * retry a start the HAL refused as busy. From the main loop, interrupts on
+ * Param: q - Queue
+ * Return: VOID
+ */
+void I2CQ_SERVICE(I2CQ_CONTROLLER* q)
+{
+	if (!q->RecoverPending && (q->Busy || q->Tail == q->Head)) return;
+	// Nothing starts while the flag is up, so the peripheral is ours with interrupts on
+	if (q->RecoverPending) I2CQ_RECOVER(q);
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	q->RecoverPending = 0;
+	I2CQ_START(q);
+	__set_PRIMASK(primask);
+}
+
+/* Function Summary: Roll the profiler over once a second, from the main loop. The last full
+ * second is left in Second, counts that arrive late land in the next window
+ * Param: q - Queue
+ * Return: VOID
+ */
+void I2CQ_PROFILE(I2CQ_CONTROLLER* q)
+{
+	uint32_t now = DWT->CYCCNT;
+	if (now - q->WindowStart < SystemCoreClock) return;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	memcpy(q->Second, q->Count, sizeof(q->Second));
+	for (int i = 0; i < I2CQ_DEVICES; i++)
+	{
+		q->Count[i].Jobs = 0;
+		q->Count[i].Bytes = 0;
+		q->Count[i].BusyCycles = 0;
+	}
+	__set_PRIMASK(primask);
+	// A stalled main loop restarts the window instead of rolling several short ones
+	q->WindowStart += SystemCoreClock;
+	if (now - q->WindowStart >= SystemCoreClock) q->WindowStart = now;
+}
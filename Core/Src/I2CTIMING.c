@@ -0,0 +1,112 @@
+/*
+ * I2CTIMING.c
+ *
+ *  Created on: Mar 13, 2021
+ *      Author: Jeff Raines
+ */
+
+/** I2C TIMINGR calculator
+Works out the I2C_TIMINGR value for a kernel clock and bus speed the same way CubeMX does, so a
+speed can be picked at runtime instead of pasting numbers out of the tool. It does not touch any
+peripheral so it can be compiled and checked off target.
+
+| 31-28 PRESC | 23-20 SCLDEL | 19-16 SDADEL | 15-8 SCLH | 7-0 SCLL |
+
+- tPRESC = (PRESC + 1) * tI2CCLK, everything else counts in tPRESC
+- SDADEL * tPRESC has to cover the SDA fall but be done before tVD;DAT, the reference manual
+  bounds already take the tI2CCLK of resync off
+- Data setup ((SCLDEL + 1) * tPRESC) has to cover the SDA rise plus tSU;DAT
+- Low and high phases are (SCLx + 1) * tPRESC plus the sync delay (analog filter + 2 tI2CCLK),
+  the period adds the SCL rise and fall on top
+
+Each prescaler that gives legal hold and setup delays is tried, the SCLL/SCLH pair closest to the
+target period without going faster wins. Anything between 80% and 100% of the target rate is
+accepted. All times are worked in pS so the 18.5nS kernel clock period keeps its precision.
+*/
+
+#include "I2CTIMING.h"
+
+#define I2CTIMING_AF_MIN_PS		50000	// Analog filter delay, datasheet range
+#define I2CTIMING_AF_MAX_PS		260000
+#define I2CTIMING_NS			1000	// pS per nS
+
+const I2CTIMING_SPEC I2CTIMING_SPECS[I2CTIMING_SPEEDS] = {
+	{100000,	4700,	4000,	1000,	300,	250,	3450},
+	{400000,	1300,	600,	300,	300,	100,	900},
+	{1000000,	500,	260,	120,	120,	50,		450}
+};
+
+/* Function Summary: Calculate TIMINGR for one of the standard bus speeds
+ * Param: clockHz - I2C kernel clock, I2CTIMING_CLOCK_HZ on this board
+ * Param: speed - Speed from i2cTimingSpeeds_e
+ * Param: riseNs - SCL/SDA rise time on the board, must be within the spec for the speed
+ * Param: fallNs - SCL/SDA fall time on the board
+ * Param: result - Chosen fields and resulting bus rate, may be NULL
+ * Return: TIMINGR value, 0 if no setting meets the spec
+ */
+uint32_t I2CTIMING_CALC(uint32_t clockHz, i2cTimingSpeeds_e speed, uint32_t riseNs, uint32_t fallNs, I2CTIMING_RESULT* result)
+{
+	if (result) result->Timingr = 0;
+	if (speed >= I2CTIMING_SPEEDS || clockHz == 0) return 0;
+	const I2CTIMING_SPEC* spec = &I2CTIMING_SPECS[speed];
+	if (riseNs > spec->RiseMax || fallNs > spec->FallMax) return 0;
+
+	int32_t clk = 1000000000000ULL / clockHz;
+	int32_t rise = riseNs * I2CTIMING_NS;
+	int32_t fall = fallNs * I2CTIMING_NS;
+	int32_t sdaDelMin = fall - I2CTIMING_AF_MIN_PS - 3 * clk;
+	int32_t sdaDelMax = (int32_t)spec->DataValidMax * I2CTIMING_NS - rise - I2CTIMING_AF_MAX_PS - 4 * clk;
+	int32_t sclDelMin = rise + (int32_t)spec->DataSetupMin * I2CTIMING_NS;
+	int32_t sync = I2CTIMING_AF_MIN_PS + 2 * clk;
+	int32_t target = 1000000000000ULL / spec->Hz;
+	int32_t periodMin = target;
+	int32_t periodMax = 1000000000000ULL / (spec->Hz * 8 / 10);
+	int32_t bestError = periodMax;
+	int32_t bestPeriod = 0;
+	uint32_t best = 0;
+
+	for (int presc = 0; presc < 16; presc++)
+	{
+		int32_t tPresc = (presc + 1) * clk;
+		// Smallest legal SCLDEL and SDADEL for this prescaler
+		int sclDel = 0;
+		while (sclDel < 16 && (sclDel + 1) * tPresc < sclDelMin) sclDel++;
+		int sdaDel = 0;
+		while (sdaDel < 16 && sdaDel * tPresc < sdaDelMin) sdaDel++;
+		if (sclDel == 16 || sdaDel == 16 || sdaDel * tPresc > sdaDelMax) continue;
+
+		for (int l = 0; l < 256; l++)
+		{
+			int32_t low = (l + 1) * tPresc + sync;
+			// Low phase has to fit the spec and give the peripheral 4 clocks to sample
+			if (low < (int32_t)spec->LowMin * I2CTIMING_NS || clk >= (low - I2CTIMING_AF_MIN_PS) / 4) continue;
+			if (low + sync + rise + fall > periodMax) break;
+			for (int h = 0; h < 256; h++)
+			{
+				int32_t high = (h + 1) * tPresc + sync;
+				int32_t period = low + high + rise + fall;
+				if (period > periodMax) break;
+				if (period < periodMin || high < (int32_t)spec->HighMin * I2CTIMING_NS || clk >= high) continue;
+				int32_t error = period - target;
+				if (error < bestError)
+				{
+					bestError = error;
+					bestPeriod = period;
+					best = ((uint32_t)presc << 28) | ((uint32_t)sclDel << 20) | ((uint32_t)sdaDel << 16) | ((uint32_t)h << 8) | (uint32_t)l;
+				}
+			}
+		}
+	}
+
+	if (result && best)
+	{
+		result->Timingr = best;
+		result->Presc = best >> 28;
+		result->SclDel = (best >> 20) & 0x0F;
+		result->SdaDel = (best >> 16) & 0x0F;
+		result->SclH = (best >> 8) & 0xFF;
+		result->SclL = best & 0xFF;
+		result->BusHz = 1000000000000ULL / bestPeriod;
+	}
+	return best;
+}
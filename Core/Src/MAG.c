@@ -0,0 +1,111 @@
+/*
+ * MAG.c
+ *
+ *  Created on: Mar 20, 2021
+ *      Author: Jeff Raines
+ */
+
+/** LIS3MDL Magnetometer
+The AltIMU-10 magnetometer shares I2C1 with the LSM6DS33. It free runs in continuous mode at
+80Hz and the main loop asks for a sample every few gyro samples with MAG_START, right after a
+gyro read has finished, so the 7 byte read sits in the gap before the next one instead of
+holding up an IMU read in the queue.
+
+STATUS_REG and the output registers come back in one burst, the status says whether the chip
+had a new sample. Decode and calibration are in MAGCAL, MAG_READ applies them outside the
+interrupt.
+*/
+
+#include "MAG.h"
+
+// LSB per gauss for each magRanges_e
+static const float MAG_LSB_PER_GAUSS[MAG_RANGES] = {6842.0f, 3421.0f, 2281.0f, 1711.0f};
+
+/* Function Summary: Check the chip is there and start continuous conversion
+ * Param: bus - Queue for the I2C peripheral, configuration uses blocking writes on its handle
+ * Param: range - Full scale from magRanges_e
+ * Param: cal - Hard and soft iron correction, copied
+ * Return: Pointer to struct containing the magnetometer
+ */
+MAG_CONTROLLER* MAG_INIT(I2CQ_CONTROLLER* bus, magRanges_e range, const MAGCAL_CONFIG* cal)
+{
+	I2C_HandleTypeDef* i2c = bus->I2c;
+	MAG_CONTROLLER* mag = malloc(sizeof(MAG_CONTROLLER));
+	memset(mag, 0, sizeof(MAG_CONTROLLER));
+	mag->Bus = bus;
+	if (range >= MAG_RANGES) range = MAG_RANGE_4G;
+	mag->GaussPerLsb = 1.0f / MAG_LSB_PER_GAUSS[range];
+	mag->Cal = *cal;
+	// Boards without the magnetometer carry on, MAG_START does nothing
+	uint8_t whoAmI = 0;
+	if (HAL_I2C_Mem_Read(i2c, MAG_I2C_ADDR, MAG_WHO_AM_I, 1, &whoAmI, 1, MAG_INIT_TIMEOUT) != HAL_OK ||
+		whoAmI != MAG_WHO_AM_I_VALUE) return mag;
+	mag->Present = 1;
+	uint8_t writeThis = MAG_CTRL1_OM_UHP | MAG_CTRL1_ODR_80;
+	HAL_I2C_Mem_Write(i2c, MAG_I2C_ADDR, MAG_CTRL_REG1, 1, &writeThis, 1, MAG_INIT_TIMEOUT);
+	writeThis = range << 5;
+	HAL_I2C_Mem_Write(i2c, MAG_I2C_ADDR, MAG_CTRL_REG2, 1, &writeThis, 1, MAG_INIT_TIMEOUT);
+	writeThis = MAG_CTRL4_OMZ_UHP;
+	HAL_I2C_Mem_Write(i2c, MAG_I2C_ADDR, MAG_CTRL_REG4, 1, &writeThis, 1, MAG_INIT_TIMEOUT);
+	writeThis = MAG_CTRL5_BDU;
+	HAL_I2C_Mem_Write(i2c, MAG_I2C_ADDR, MAG_CTRL_REG5, 1, &writeThis, 1, MAG_INIT_TIMEOUT);
+	// Conversion starts last, once the mode and range are set
+	writeThis = MAG_CTRL3_CONTINUOUS;
+	HAL_I2C_Mem_Write(i2c, MAG_I2C_ADDR, MAG_CTRL_REG3, 1, &writeThis, 1, MAG_INIT_TIMEOUT);
+	return mag;
+}
+
+/* Function Summary: Burst read finished, keep the sample if the chip had a new one. Runs in the
+ * I2C interrupt
+ * Param: context - Magnetometer
+ * Param: ok - 0 if the read failed after its retries
+ * Return: VOID
+ */
+static void MAG_DONE(void* context, uint8_t ok)
+{
+	MAG_CONTROLLER* mag = context;
+	mag->Busy = 0;
+	if (!ok)
+	{
+		mag->Failed++;
+		return;
+	}
+	if (!(mag->Data[0] & MAG_STATUS_ZYXDA))
+	{
+		mag->Stale++;
+		return;
+	}
+	MAGCAL_DECODE(&mag->Data[1], mag->Raw);
+	mag->Time = DWT->CYCCNT;
+	mag->Ready = 1;
+}
+
+/* Function Summary: Queue one burst read, from the main loop between gyro reads
+ * Param: mag - Magnetometer
+ * Return: 0 if nothing was queued, no chip, a read still running or the queue full
+ */
+uint8_t MAG_START(MAG_CONTROLLER* mag)
+{
+	if (!mag->Present || mag->Busy) return 0;
+	mag->Busy = 1;
+	if (!I2CQ_SUBMIT(mag->Bus, MAG_I2C_ADDR, MAG_STATUS_REG | MAG_AUTO_INC, mag->Data, MAG_BURST_SIZE, I2CQ_READ, MAG_DONE, mag))
+	{
+		mag->Busy = 0;
+		return 0;
+	}
+	return 1;
+}
+
+/* Function Summary: Take the newest sample, calibrated. Call before the next MAG_START, Raw is
+ * only written by the read that starts
+ * Param: mag - Magnetometer
+ * Param: field - Output, gauss in sensor axes
+ * Return: false if there was no new sample
+ */
+bool MAG_READ(MAG_CONTROLLER* mag, float* field)
+{
+	if (!mag->Ready) return false;
+	mag->Ready = 0;
+	MAGCAL_APPLY(&mag->Cal, mag->Raw, mag->GaussPerLsb, field);
+	return true;
+}
@@ -0,0 +1,50 @@
+/*
+ * MAGCAL.c
+ *
+ *  Created on: Mar 20, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Magnetometer decode and calibration
+The register level half of the LIS3MDL driver. It does not touch any peripheral so it can be
+compiled and checked off target.
+
+Output registers OUT_X_L..OUT_Z_H are 16 bit two's complement, little endian (CTRL_REG4 BLE = 0).
+
+Calibration - field = Soft * (raw * gaussPerLsb - Offset)
+- Hard iron (magnetised parts on the frame) shifts the sphere of readings, removed by Offset
+- Soft iron (nearby steel, the battery) stretches it into an ellipsoid, Soft undoes the stretch
+- Both come from an ellipsoid fit done off the board, the matrix is applied as is
+*/
+
+#include "MAGCAL.h"
+
+/* Function Summary: Decode the X/Y/Z output registers
+ * Param: data - OUT_X_L through OUT_Z_H, 6 bytes
+ * Param: raw - Output, counts in sensor axes
+ * Return: VOID
+ */
+void MAGCAL_DECODE(const uint8_t* data, int16_t* raw)
+{
+	for (int i = 0; i < MAGCAL_AXES; i++)
+	{
+		raw[i] = (int16_t)(data[2 * i] | (data[2 * i + 1] << 8));
+	}
+}
+
+/* Function Summary: Scale a reading to gauss and apply the hard and soft iron correction
+ * Param: cal - Calibration
+ * Param: raw - Counts in sensor axes
+ * Param: gaussPerLsb - Sensitivity for the configured range
+ * Param: field - Output, corrected field in gauss, sensor axes
+ * Return: VOID
+ */
+void MAGCAL_APPLY(const MAGCAL_CONFIG* cal, const int16_t* raw, float gaussPerLsb, float* field)
+{
+	float centred[MAGCAL_AXES];
+	for (int i = 0; i < MAGCAL_AXES; i++) centred[i] = raw[i] * gaussPerLsb - cal->Offset[i];
+	for (int i = 0; i < MAGCAL_AXES; i++)
+	{
+		field[i] = cal->Soft[i][0] * centred[0] + cal->Soft[i][1] * centred[1] + cal->Soft[i][2] * centred[2];
+	}
+}
@@ -0,0 +1,157 @@
+/*
+ * MIXER.c
+ *
+ *  Created on: Jan 16, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Motor Mixer
+Each motor's output is the dot product of the stick demand with that motor's weights, then
+clamped once. Every axis is summed before clamping so the result does not depend on the
+order the axes are applied in.
+
+Desaturation (airmode) splits each motor into throttle plus a differential from roll, pitch
+and yaw. The differential is what holds attitude, so it is kept whole when it fits between
+the limits and throttle is shifted up or down to make room. When the differential alone is
+wider than the limits it is scaled down, all axes together or yaw first (MIXER_MODE_AIRMODE_RP).
+The motors then always follow the stick attitude at zero and full throttle, throttle is what
+gives way.
+
+Weights come from the motor position, x forward and y right, seen from above:
+- Roll = -y, motors on the left speed up to roll right
+- Pitch = -x, motors at the back speed up to pitch forward
+- Yaw = +1 / -1 alternating around the frame, props spinning against the yaw speed up
+
+The X layouts keep motors 0-3 at the quad corners (FL, FR, BL, BR) so hex and octo frames only
+add outputs after the quad ones.
+
+- QUAD_X    : FL, FR, BL, BR
+- QUAD_PLUS : Front, Right, Back, Left
+- HEX_X     : FL, FR, BL, BR, Left, Right
+- OCTO_X    : FL, FR, BL, BR, Left front, Right front, Left back, Right back
+*/
+
+#include "MIXER.h"
+
+// sin 30 / cos 30 for the hex corners
+#define HEX_SIDE	0.5f
+#define HEX_CORNER	0.866025f
+// tan 22.5, octo arms are 45 degrees apart and normalised so the outer arms weigh 1
+#define OCTO_INNER	0.414214f
+
+const MIXER_LAYOUT MIXER_LAYOUTS[MIXER_LAYOUT_COUNT] = {
+	[MIXER_QUAD_X] = { "QUAD_X", 4, {
+		{ 1.0f,  1.0f, -1.0f,  1.0f },
+		{ 1.0f, -1.0f, -1.0f, -1.0f },
+		{ 1.0f,  1.0f,  1.0f, -1.0f },
+		{ 1.0f, -1.0f,  1.0f,  1.0f },
+	} },
+	[MIXER_QUAD_PLUS] = { "QUAD_PLUS", 4, {
+		{ 1.0f,  0.0f, -1.0f,  1.0f },
+		{ 1.0f, -1.0f,  0.0f, -1.0f },
+		{ 1.0f,  0.0f,  1.0f,  1.0f },
+		{ 1.0f,  1.0f,  0.0f, -1.0f },
+	} },
+	[MIXER_HEX_X] = { "HEX_X", 6, {
+		{ 1.0f,  HEX_SIDE, -HEX_CORNER,  1.0f },
+		{ 1.0f, -HEX_SIDE, -HEX_CORNER, -1.0f },
+		{ 1.0f,  HEX_SIDE,  HEX_CORNER,  1.0f },
+		{ 1.0f, -HEX_SIDE,  HEX_CORNER, -1.0f },
+		{ 1.0f,  1.0f,      0.0f,       -1.0f },
+		{ 1.0f, -1.0f,      0.0f,        1.0f },
+	} },
+	[MIXER_OCTO_X] = { "OCTO_X", 8, {
+		{ 1.0f,  OCTO_INNER, -1.0f,        1.0f },
+		{ 1.0f, -OCTO_INNER, -1.0f,       -1.0f },
+		{ 1.0f,  OCTO_INNER,  1.0f,       -1.0f },
+		{ 1.0f, -OCTO_INNER,  1.0f,        1.0f },
+		{ 1.0f,  1.0f,       -OCTO_INNER, -1.0f },
+		{ 1.0f, -1.0f,       -OCTO_INNER,  1.0f },
+		{ 1.0f,  1.0f,        OCTO_INNER,  1.0f },
+		{ 1.0f, -1.0f,        OCTO_INNER, -1.0f },
+	} },
+};
+
+/* Function Summary: Lowest and highest value of a motor vector
+ * Param: values - One value per motor
+ * Param: count - Motors in values
+ * Param: min - Returns the lowest value
+ * Param: max - Returns the highest value
+ */
+static void MIXER_RANGE(const float* values, int count, float* min, float* max)
+{
+	*min = values[0];
+	*max = values[0];
+	for (int m = 1; m < count; m++)
+	{
+		if (values[m] < *min) *min = values[m];
+		else if (values[m] > *max) *max = values[m];
+	}
+}
+
+/* Function Summary: Mix the stick demand into every motor of a layout and clamp the results
+ * Param: layout - Frame geometry from MIXER_LAYOUTS
+ * Param: demand - Throttle plus roll, pitch and yaw already scaled to output units
+ * Param: mode - How demand beyond the limits is handled, see mixerModes_e
+ * Param: minOut - Lowest output, motors never drop below this while mixing
+ * Param: maxOut - Highest output
+ * Param: out - layout->MotorCount outputs, one per motor
+ */
+void MIXER_APPLY(const MIXER_LAYOUT* layout, const MIXER_AXES* demand, mixerModes_e mode,
+				 float minOut, float maxOut, uint32_t* out)
+{
+	float attitude[MIXER_MAX_MOTORS];	// Roll and pitch share of each motor
+	float yaw[MIXER_MAX_MOTORS];
+	float diff[MIXER_MAX_MOTORS];		// Everything but throttle
+	float diffMin, diffMax;
+	float span = maxOut - minOut;
+	float throttle = demand->Throttle;
+	int count = layout->MotorCount;
+	// MIXER_RANGE starts from the first motor, a layout without motors has nothing to mix
+	if (count < 1) return;
+	for (int m = 0; m < count; m++)
+	{
+		const MIXER_AXES* w = &layout->Weights[m];
+		attitude[m] = w->Roll * demand->Roll + w->Pitch * demand->Pitch;
+		yaw[m] = w->Yaw * demand->Yaw;
+		diff[m] = attitude[m] + yaw[m];
+	}
+	if (mode != MIXER_MODE_CLAMP)
+	{
+		MIXER_RANGE(diff, count, &diffMin, &diffMax);
+		if (diffMax - diffMin > span)
+		{
+			float attScale = span / (diffMax - diffMin);
+			float yawScale = attScale;
+			if (mode == MIXER_MODE_AIRMODE_RP)
+			{
+				// Shrink yaw into whatever room roll and pitch leave, roll and pitch only if that is none
+				float attMin, attMax, yawMin, yawMax;
+				MIXER_RANGE(attitude, count, &attMin, &attMax);
+				MIXER_RANGE(yaw, count, &yawMin, &yawMax);
+				if (attMax - attMin >= span)
+				{
+					attScale = span / (attMax - attMin);
+					yawScale = 0.0f;
+				}
+				else
+				{
+					attScale = 1.0f;
+					yawScale = (span - (attMax - attMin)) / (yawMax - yawMin);
+				}
+			}
+			for (int m = 0; m < count; m++) diff[m] = attitude[m] * attScale + yaw[m] * yawScale;
+			MIXER_RANGE(diff, count, &diffMin, &diffMax);
+		}
+		// Every layout weighs throttle 1 on all motors, so moving throttle moves the whole vector
+		if (throttle + diffMax > maxOut) throttle = maxOut - diffMax;
+		if (throttle + diffMin < minOut) throttle = minOut - diffMin;
+	}
+	for (int m = 0; m < count; m++)
+	{
+		float mix = layout->Weights[m].Throttle * throttle + diff[m];
+		if (mix > maxOut) mix = maxOut;
+		else if (mix < minOut) mix = minOut;
+		out[m] = (uint32_t) mix;
+	}
+}
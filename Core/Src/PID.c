@@ -0,0 +1,87 @@
+/*
+ * PID.c
+ *
+ *  Created on: Jan 23, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Rate PID
+Runs once per gyro sample with a fixed step, dt is never measured so every step does the
+same work. Setpoint and measurement are body rates in deg/s, positive is roll right, pitch
+forward and yaw right. Outputs go straight into the mixer's roll/pitch/yaw demand.
+
+- P on error
+- I on error, clamped to ILimit and frozen while the output is saturated in the direction
+  the error is pushing (no windup while the motors can't follow)
+- D on measurement, stick moves don't kick the D-term
+*/
+
+#include "PID.h"
+
+/* Function Summary: Set up the three rate loops for a fixed sample rate
+ * Param: gains - PID_AXES gains in pidAxes_e order
+ * Param: sampleHz - Gyro output data rate, one PID_UPDATE per sample
+ * Param: outLimit - Largest output either way on every axis
+ * Return: Pointer to struct containing the rate loop state
+ */
+PID_CONTROLLER* PID_INIT(const PID_GAINS* gains, float sampleHz, float outLimit)
+{
+	PID_CONTROLLER* pid = malloc(sizeof(PID_CONTROLLER));
+	memset(pid, 0, sizeof(PID_CONTROLLER));
+	pid->OutLimit = outLimit;
+	for (int a = 0; a < PID_AXES; a++)
+	{
+		pid->Axes[a].Kp = gains[a].P;
+		pid->Axes[a].KiDt = gains[a].I / sampleHz;
+		pid->Axes[a].KdHz = gains[a].D * sampleHz;
+		pid->Axes[a].ILimit = gains[a].ILimit;
+	}
+	return pid;
+}
+
+/* Function Summary: Clear the integrators and D history, call while disarmed so nothing
+ * winds up on the ground
+ * Param: pid - Rate loop state
+ * Return: VOID
+ */
+void PID_RESET(PID_CONTROLLER* pid)
+{
+	for (int a = 0; a < PID_AXES; a++) pid->Axes[a].Integral = 0;
+	pid->Primed = 0;
+}
+
+/* Function Summary: One fixed step of all three rate loops
+ * Param: pid - Rate loop state
+ * Param: setpoint - Wanted rates, deg/s, pidAxes_e order
+ * Param: measure - Gyro rates, deg/s, pidAxes_e order
+ * Param: out - Roll/pitch/yaw demand, clamped to +/- OutLimit
+ * Return: VOID
+ */
+void PID_UPDATE(PID_CONTROLLER* pid, const float* setpoint, const float* measure, float* out)
+{
+	if (!pid->Primed)
+	{
+		for (int a = 0; a < PID_AXES; a++) pid->Axes[a].LastMeasure = measure[a];
+		pid->Primed = 1;
+	}
+	for (int a = 0; a < PID_AXES; a++)
+	{
+		PID_AXIS* axis = &pid->Axes[a];
+		float error = setpoint[a] - measure[a];
+		float pd = axis->Kp * error - axis->KdHz * (measure[a] - axis->LastMeasure);
+		axis->LastMeasure = measure[a];
+		float integral = axis->Integral + axis->KiDt * error;
+		if (integral > axis->ILimit) integral = axis->ILimit;
+		else if (integral < -axis->ILimit) integral = -axis->ILimit;
+		float output = pd + integral;
+		// Only keep integrating while the output has room in the direction of the error
+		if (!((output > pid->OutLimit && error > 0) || (output < -pid->OutLimit && error < 0)))
+		{
+			axis->Integral = integral;
+		}
+		output = pd + axis->Integral;
+		if (output > pid->OutLimit) output = pid->OutLimit;
+		else if (output < -pid->OutLimit) output = -pid->OutLimit;
+		out[a] = output;
+	}
+}
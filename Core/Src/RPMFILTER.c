@@ -0,0 +1,119 @@
+/*
+ * RPMFILTER.c
+ *
+ *  Created on: Feb 20, 2021
+ *      Author: Jeff Raines
+ */
+
+/** RPM Harmonic Notch Bank
+Each motor puts noise on the gyro at its rotation frequency (RPM / 60) and the harmonics of
+it, so every motor gets RPMFILTER_HARMONICS notches that follow its RPM on all three axes.
+
+RPM comes in through RPMFILTER_SET_RPM from any source, bidirectional DSHOT eRPM or serial
+telemetry, and is smoothed a little. The trig for new coefficients is the expensive part, so
+RPMFILTER_UPDATE only retunes UpdatesPerStep notches per call and works round the bank.
+Notches under MinHz (idle and stopped motors) or near Nyquist are switched off rather than
+left on a frequency they can't track.
+*/
+
+#include <math.h>
+#include "RPMFILTER.h"
+
+#define RPMFILTER_PI			3.14159265f
+#define RPMFILTER_SMOOTHING		0.5f	// Share of each new RPM reading taken
+#define RPMFILTER_MAX_FRACTION	0.45f	// Highest centre as a share of the sample rate
+
+/* Function Summary: Set up a bank with every notch switched off
+ * Param: sampleHz - Gyro rate, one RPMFILTER_APPLY per sample
+ * Param: motorCount - Motors to follow, at most RPMFILTER_MAX_MOTORS
+ * Param: updatesPerStep - Notches retuned per RPMFILTER_UPDATE
+ * Param: minHz - Lowest centre a notch is allowed
+ * Param: q - Notch quality factor
+ * Return: Pointer to struct containing the notch bank
+ */
+RPMFILTER_CONTROLLER* RPMFILTER_INIT(float sampleHz, uint8_t motorCount, uint8_t updatesPerStep, float minHz, float q)
+{
+	RPMFILTER_CONTROLLER* rf = malloc(sizeof(RPMFILTER_CONTROLLER));
+	memset(rf, 0, sizeof(RPMFILTER_CONTROLLER));
+	rf->MotorCount = motorCount > RPMFILTER_MAX_MOTORS ? RPMFILTER_MAX_MOTORS : motorCount;
+	rf->UpdatesPerStep = updatesPerStep ? updatesPerStep : 1;
+	rf->SampleHz = sampleHz;
+	rf->MinHz = minHz;
+	rf->Q = q;
+	return rf;
+}
+
+/* Function Summary: New RPM reading for one motor, picked up as its notches are retuned
+ * Param: rf - Notch bank
+ * Param: motor - 0 to MotorCount - 1
+ * Param: rpm - Mechanical RPM
+ * Return: VOID
+ */
+void RPMFILTER_SET_RPM(RPMFILTER_CONTROLLER* rf, uint8_t motor, float rpm)
+{
+	if (motor >= rf->MotorCount) return;
+	rf->RPM[motor] += (rpm - rf->RPM[motor]) * RPMFILTER_SMOOTHING;
+}
+
+/* Function Summary: Retune the next UpdatesPerStep notches from the motor RPMs
+ * Param: rf - Notch bank
+ * Return: VOID
+ */
+void RPMFILTER_UPDATE(RPMFILTER_CONTROLLER* rf)
+{
+	int count = rf->MotorCount * RPMFILTER_HARMONICS;
+	if (!count) return;
+	for (int i = 0; i < rf->UpdatesPerStep && i < count; i++)
+	{
+		if (rf->NextNotch >= count) rf->NextNotch = 0;
+		RPMFILTER_NOTCH* notch = &rf->Notches[rf->NextNotch];
+		int motor = rf->NextNotch / RPMFILTER_HARMONICS;
+		int harmonic = rf->NextNotch % RPMFILTER_HARMONICS + 1;
+		rf->NextNotch++;
+		float hz = rf->RPM[motor] / 60.0f * harmonic;
+		if (hz < rf->MinHz || hz > rf->SampleHz * RPMFILTER_MAX_FRACTION)
+		{
+			notch->Active = 0;
+			continue;
+		}
+		// Same RBJ notch as FILTER_BIQUAD_SET, written out so B2 isn't stored twice per notch
+		float omega = 2.0f * RPMFILTER_PI * hz / rf->SampleHz;
+		float cs = cosf(omega);
+		float alpha = sinf(omega) / (2.0f * rf->Q);
+		float a0 = 1.0f + alpha;
+		notch->B0 = 1.0f / a0;
+		notch->B1 = -2.0f * cs / a0;
+		notch->A1 = notch->B1;
+		notch->A2 = (1.0f - alpha) / a0;
+		// A notch switching back on starts from a clear delay line
+		if (!notch->Active)
+		{
+			memset(notch->S1, 0, sizeof(notch->S1));
+			memset(notch->S2, 0, sizeof(notch->S2));
+			notch->Active = 1;
+		}
+	}
+}
+
+/* Function Summary: Run every axis through every active notch
+ * Param: rf - Notch bank
+ * Param: axes - FILTER_AXES samples, filtered in place
+ * Return: VOID
+ */
+void RPMFILTER_APPLY(RPMFILTER_CONTROLLER* rf, float* axes)
+{
+	int count = rf->MotorCount * RPMFILTER_HARMONICS;
+	for (int n = 0; n < count; n++)
+	{
+		RPMFILTER_NOTCH* notch = &rf->Notches[n];
+		if (!notch->Active) continue;
+		for (int a = 0; a < FILTER_AXES; a++)
+		{
+			float x = axes[a];
+			float y = notch->B0 * x + notch->S1[a];
+			notch->S1[a] = notch->B1 * x - notch->A1 * y + notch->S2[a];
+			notch->S2[a] = notch->B0 * x - notch->A2 * y;
+			axes[a] = y;
+		}
+	}
+}
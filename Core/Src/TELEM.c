@@ -0,0 +1,193 @@
+/*
+ * TELEM.c
+ *
+ *  Created on: Jan 9, 2021
+ *      Author: Jeff Raines
+ */
+
+/** KISS/BLHeli32 ESC Telemetry
+Every ESC telemetry pin is tied to one UART RX line (115200 8N1). An ESC answers a DSHOT
+packet with the telemetry bit set with one 10 byte frame, so only one motor may be asked
+at a time and the next request waits for the reply or TELEM_TIMEOUT_MS.
+
+| 0 | 1-2 | 3-4 | 5-6 | 7-8 | 9 |
+| Temp C | Voltage 10mV | Current 10mA | Consumption mAh | eRPM / 100 | CRC8 |
+
+Multi byte values are big endian, CRC8 is polynomial 0x07 over bytes 0-8.
+
+Receive is circular DMA into RxBuffer. Idle line, half and full transfer events call
+TELEM_RX_EVENT which parses everything the DMA wrote since the last event. Idle line marks
+the end of a frame so a lost byte never shifts the following frames.
+*/
+
+#include "TELEM.h"
+
+static const uint8_t crc8Table[256] = {
+	0x00, 0x07, 0x0e, 0x09, 0x1c, 0x1b, 0x12, 0x15, 0x38, 0x3f, 0x36, 0x31, 0x24, 0x23, 0x2a, 0x2d,
+	0x70, 0x77, 0x7e, 0x79, 0x6c, 0x6b, 0x62, 0x65, 0x48, 0x4f, 0x46, 0x41, 0x54, 0x53, 0x5a, 0x5d,
+	0xe0, 0xe7, 0xee, 0xe9, 0xfc, 0xfb, 0xf2, 0xf5, 0xd8, 0xdf, 0xd6, 0xd1, 0xc4, 0xc3, 0xca, 0xcd,
+	0x90, 0x97, 0x9e, 0x99, 0x8c, 0x8b, 0x82, 0x85, 0xa8, 0xaf, 0xa6, 0xa1, 0xb4, 0xb3, 0xba, 0xbd,
+	0xc7, 0xc0, 0xc9, 0xce, 0xdb, 0xdc, 0xd5, 0xd2, 0xff, 0xf8, 0xf1, 0xf6, 0xe3, 0xe4, 0xed, 0xea,
+	0xb7, 0xb0, 0xb9, 0xbe, 0xab, 0xac, 0xa5, 0xa2, 0x8f, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9d, 0x9a,
+	0x27, 0x20, 0x29, 0x2e, 0x3b, 0x3c, 0x35, 0x32, 0x1f, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0d, 0x0a,
+	0x57, 0x50, 0x59, 0x5e, 0x4b, 0x4c, 0x45, 0x42, 0x6f, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7d, 0x7a,
+	0x89, 0x8e, 0x87, 0x80, 0x95, 0x92, 0x9b, 0x9c, 0xb1, 0xb6, 0xbf, 0xb8, 0xad, 0xaa, 0xa3, 0xa4,
+	0xf9, 0xfe, 0xf7, 0xf0, 0xe5, 0xe2, 0xeb, 0xec, 0xc1, 0xc6, 0xcf, 0xc8, 0xdd, 0xda, 0xd3, 0xd4,
+	0x69, 0x6e, 0x67, 0x60, 0x75, 0x72, 0x7b, 0x7c, 0x51, 0x56, 0x5f, 0x58, 0x4d, 0x4a, 0x43, 0x44,
+	0x19, 0x1e, 0x17, 0x10, 0x05, 0x02, 0x0b, 0x0c, 0x21, 0x26, 0x2f, 0x28, 0x3d, 0x3a, 0x33, 0x34,
+	0x4e, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5c, 0x5b, 0x76, 0x71, 0x78, 0x7f, 0x6a, 0x6d, 0x64, 0x63,
+	0x3e, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2c, 0x2b, 0x06, 0x01, 0x08, 0x0f, 0x1a, 0x1d, 0x14, 0x13,
+	0xae, 0xa9, 0xa0, 0xa7, 0xb2, 0xb5, 0xbc, 0xbb, 0x96, 0x91, 0x98, 0x9f, 0x8a, 0x8d, 0x84, 0x83,
+	0xde, 0xd9, 0xd0, 0xd7, 0xc2, 0xc5, 0xcc, 0xcb, 0xe6, 0xe1, 0xe8, 0xef, 0xfa, 0xfd, 0xf4, 0xf3
+};
+
+/* Function Summary: Start circular DMA reception with idle line detection on the telemetry UART
+ * Param: uart - UART handle with its RX DMA stream linked in circular mode
+ * Param: motorCount - Motors to poll, at most ESC_MAX_MOTORS
+ * Return: Pointer to struct containing the telemetry receiver state
+ */
+TELEM_CONTROLLER* TELEM_INIT(UART_HandleTypeDef* uart, uint32_t motorCount)
+{
+	TELEM_CONTROLLER* telem = malloc(sizeof(TELEM_CONTROLLER));
+	memset(telem, 0, sizeof(TELEM_CONTROLLER));
+	telem->MotorCount = motorCount > ESC_MAX_MOTORS ? ESC_MAX_MOTORS : motorCount;
+	telem->Pending = -1;
+	telem->UART = uart;
+	HAL_UART_Receive_DMA(uart, telem->RxBuffer, TELEM_RX_SIZE);
+	__HAL_UART_CLEAR_IDLEFLAG(uart);
+	__HAL_UART_ENABLE_IT(uart, UART_IT_IDLE);
+	return telem;
+}
+
+/* Function Summary: CRC8 (polynomial 0x07) as used by KISS and BLHeli32 telemetry
+ * Param: data - Bytes to check
+ * Param: len - Number of bytes
+ * Return: CRC8 of data
+ */
+uint8_t TELEM_CRC8(const uint8_t* data, uint32_t len)
+{
+	uint8_t crc = 0;
+	for (uint32_t i = 0; i < len; i++) crc = crc8Table[crc ^ data[i]];
+	return crc;
+}
+
+/* Function Summary: Check and unpack one telemetry frame
+ * Param: frame - TELEM_FRAME_SIZE bytes as received
+ * Param: out - Decoded values, only written when the CRC matches
+ * Return: 1 if the frame was valid, else 0
+ */
+uint8_t TELEM_PARSE_FRAME(const uint8_t* frame, TELEM_DATA* out)
+{
+	if (TELEM_CRC8(frame, TELEM_FRAME_SIZE - 1) != frame[TELEM_FRAME_SIZE - 1]) return 0;
+	out->Temperature = frame[0];
+	out->Voltage = (frame[1] << 8) | frame[2];
+	out->Current = (frame[3] << 8) | frame[4];
+	out->Consumption = (frame[5] << 8) | frame[6];
+	out->RPM = (((frame[7] << 8) | frame[8]) * 100) / MOTOR_POLE_PAIRS;
+	return 1;
+}
+
+/* Function Summary: Publish a frame to the pending motor's slot. Runs in the UART interrupt,
+ * the main loop only reads slots so a sequence count is enough to keep copies consistent.
+ * Param: telem - Pointer to the telemetry receiver
+ * Return: VOID
+ */
+static void TELEM_FRAME_DONE(TELEM_CONTROLLER* telem)
+{
+	TELEM_DATA data;
+	int8_t motor = telem->Pending;
+	telem->FrameCount = 0;
+	if (!TELEM_PARSE_FRAME(telem->Frame, &data))
+	{
+		telem->CrcErrors++;
+		return;
+	}
+	// A reply with no request outstanding cannot be matched to a motor
+	if (motor < 0) return;
+	data.Tick = HAL_GetTick();
+	TELEM_SLOT* slot = &telem->Slots[motor];
+	slot->Seq++;
+	__DMB();
+	slot->Data = data;
+	__DMB();
+	slot->Seq++;
+	telem->Pending = -1;
+}
+
+/* Function Summary: Parse every byte the DMA has written since the last call. Called from the
+ * UART idle line interrupt and the DMA half/full transfer callbacks.
+ * Param: telem - Pointer to the telemetry receiver
+ * Return: VOID
+ */
+void TELEM_RX_EVENT(TELEM_CONTROLLER* telem)
+{
+	uint8_t idle = __HAL_UART_GET_FLAG(telem->UART, UART_FLAG_IDLE) ? 1 : 0;
+	if (idle) __HAL_UART_CLEAR_IDLEFLAG(telem->UART);
+	uint32_t write = TELEM_RX_SIZE - __HAL_DMA_GET_COUNTER(telem->UART->hdmarx);
+	if (write == TELEM_RX_SIZE) write = 0;
+	while (telem->RxRead != write)
+	{
+		telem->Frame[telem->FrameCount++] = telem->RxBuffer[telem->RxRead];
+		telem->RxRead = (telem->RxRead + 1) % TELEM_RX_SIZE;
+		if (telem->FrameCount == TELEM_FRAME_SIZE) TELEM_FRAME_DONE(telem);
+	}
+	// Line went quiet part way through a frame, drop it so the next one starts aligned
+	if (idle && telem->FrameCount)
+	{
+		telem->FrameCount = 0;
+		telem->CrcErrors++;
+	}
+}
+
+/* Function Summary: Restart reception after a UART error. Noise and framing errors leave the
+ * DMA running, an overrun makes HAL abort it, only the aborted case needs a restart.
+ * Param: telem - Pointer to the telemetry receiver
+ * Return: VOID
+ */
+void TELEM_RX_ERROR(TELEM_CONTROLLER* telem)
+{
+	if (telem->UART->RxState != HAL_UART_STATE_READY) return;
+	telem->RxRead = 0;
+	telem->FrameCount = 0;
+	HAL_UART_Receive_DMA(telem->UART, telem->RxBuffer, TELEM_RX_SIZE);
+}
+
+/* Function Summary: Pick the next motor to ask for telemetry. Only one request is kept in
+ * flight, a motor that does not answer within TELEM_TIMEOUT_MS is skipped.
+ * Param: telem - Pointer to the telemetry receiver
+ * Return: Motor to set the telemetry bit for in the next frame, -1 to send no request
+ */
+int32_t TELEM_NEXT_REQUEST(TELEM_CONTROLLER* telem)
+{
+	uint32_t now = HAL_GetTick();
+	int8_t pending = telem->Pending;
+	if (pending >= 0)
+	{
+		if (now - telem->RequestTick < TELEM_TIMEOUT_MS) return -1;
+		telem->Timeouts[pending]++;
+	}
+	uint8_t motor = telem->NextMotor;
+	telem->NextMotor = (motor + 1) % telem->MotorCount;
+	telem->RequestTick = now;
+	telem->Pending = motor;
+	return motor;
+}
+
+/* Function Summary: Copy out the latest telemetry of one motor without masking interrupts
+ * Param: telem - Pointer to the telemetry receiver
+ * Param: motor - Motor index, 0 to MotorCount - 1
+ * Param: out - Copy of the motor's last good frame
+ * Return: VOID
+ */
+void TELEM_READ(TELEM_CONTROLLER* telem, uint32_t motor, TELEM_DATA* out)
+{
+	TELEM_SLOT* slot = &telem->Slots[motor];
+	uint32_t seq;
+	do
+	{
+		seq = slot->Seq;
+		__DMB();
+		*out = slot->Data;
+		__DMB();
+	} while ((seq & 1) || seq != slot->Seq);
+}
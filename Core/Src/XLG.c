@@ -6,142 +6,319 @@
  */
 
 #include <XLG.h>
+#include <string.h>
 
-/* Function Summary: Starts the XLG chip and makes it read data at fastest rate
+/* Function Summary: Starts the XLG chip and makes it read data at fastest rate. Blocking writes,
+ * only called before the DMA reads start
  * Param: * i2c is the predefined i2c handler
  * Return: VOID
  */
 void XLG_INIT(I2C_HandleTypeDef* i2c)
 {
+	// Auto-increment for the burst read, and keep the H/L bytes of a sample together
+	uint8_t writeThis = XLG_CTRL3_BDU | XLG_CTRL3_IF_INC;
+	HAL_I2C_Mem_Write(i2c, XLG_I2C_ADDR, CTRL3_C, XLG_REG_SIZE, &writeThis, 1, XLG_INIT_TIMEOUT);
+	// Gyro data ready on INT1, latched high until the sample is read
+	writeThis = XLG_INT1_DRDY_G;
+	HAL_I2C_Mem_Write(i2c, XLG_I2C_ADDR, INT1_CTRL, XLG_REG_SIZE, &writeThis, 1, XLG_INIT_TIMEOUT);
 	// Initiate accelerometer IC to start storing data
-	uint8_t writeThis = 0b10000000;
-	XLG_WRITE(i2c, CTRL1_XL, &writeThis, 1);
+	writeThis = 0b10000000;
+	HAL_I2C_Mem_Write(i2c, XLG_I2C_ADDR, CTRL1_XL, XLG_REG_SIZE, &writeThis, 1, XLG_INIT_TIMEOUT);
 	// Initiate gyroscope IC to start storing data
 	writeThis = 0b10001100;
-	XLG_WRITE(i2c, CTRL2 _G, &writeThis, 1);
+	HAL_I2C_Mem_Write(i2c, XLG_I2C_ADDR, CTRL2_G, XLG_REG_SIZE, &writeThis, 1, XLG_INIT_TIMEOUT);
 }
 
-/* Function Summary: Writes to specific address on the IC
- * Param: * i2c - predefined i2c handler
+/* Function Summary: Queues a write to specific address on the IC
+ * Param: * bus - I2C job queue the IC is on
  * Param: addr - address on IC chip,
- * Param: writeByte - data byte to write to addr
+ * Param: writeByte - data byte to write to addr, must stay valid until done runs
  * Param: writeSize - how many bytes to write
+ * Param: done - completion callback, may be NULL
+ * Param: * context - passed to done
+ * Return: 0 if the queue was full
+ */
+uint8_t XLG_WRITE(I2CQ_CONTROLLER* bus, uint8_t addr, uint8_t* writeByte, uint32_t writeSize, I2CQ_DONE done, void* context)
+{
+	return I2CQ_SUBMIT(bus, XLG_I2C_ADDR, addr, writeByte, writeSize, I2CQ_WRITE, done, context);
+}
+
+/* Function Summary: Queues a read from specific address on the IC
+ * Param: * bus - I2C job queue the IC is on
+ * Param: addr - address on IC chip,
+ * Param: readByte - buffer to read into
+ * Param: readSize - how many bytes to read
+ * Param: done - completion callback, may be NULL
+ * Param: * context - passed to done
+ * Return: 0 if the queue was full
+ */
+uint8_t XLG_READ(I2CQ_CONTROLLER* bus, uint8_t addr, uint8_t* readByte, uint32_t readSize, I2CQ_DONE done, void* context)
+{
+	return I2CQ_SUBMIT(bus, XLG_I2C_ADDR, addr, readByte, readSize, I2CQ_READ, done, context);
+}
+
+static void XLG_BURST_DONE(void* context, uint8_t ok);
+static void XLG_FIFO_DONE(void* context, uint8_t ok);
+
+/* Function Summary: Sets up the data ready burst reads
+ * Param: * burst - DMA buffer and read stage
+ * Param: * bus - I2C job queue the IC is on
+ * Param: * gData - pointer to structure holding 3-axis gyroscope data
+ * Param: * xlData - pointer to structure holding 3-axis accelerometer data
  * Return: VOID
  */
-void XLG_WRITE(I2C_HandleTypeDef* i2c, uint8_t addr, uint8_t* writeByte, uint32_t writeSize)
+void XLG_BURST_INIT(XLG_BURST* burst, I2CQ_CONTROLLER* bus, XLG_DATA* gData, XLG_DATA* xlData)
 {
-	if (i2c->hdmatx->State == HAL_DMA_STATE_READY)
+	memset(burst, 0, sizeof(XLG_BURST));
+	burst->Bus = bus;
+	burst->G = gData;
+	burst->XL = xlData;
+}
+
+/* Function Summary: Queues the 12 byte output register burst. Stage drops back to idle if the
+ * queue was full, so the caller can retry
+ * Param: * burst - DMA buffer and read stage
+ * Return: VOID
+ */
+void XLG_BURST_START(XLG_BURST* burst)
+{
+	burst->Stage = XLG_STAGE_DATA;
+	if (!XLG_READ(burst->Bus, OUTX_L_G, burst->Data, XLG_BURST_SIZE, XLG_BURST_DONE, burst)) burst->Stage = XLG_STAGE_IDLE;
+}
+
+/* Function Summary: INT1 data ready edge, from the EXTI interrupt. Starts the burst straight
+ * away, or holds the edge until the read in flight finishes
+ * Param: * burst - DMA buffer and read stage
+ * Return: VOID
+ */
+void XLG_BURST_EDGE(XLG_BURST* burst)
+{
+	uint32_t now = DWT->CYCCNT;
+	if (burst->Stage == XLG_STAGE_IDLE)
 	{
-		HAL_I2C_Mem_Write_DMA(i2c, XLG_I2C_ADDR, addr, XLG_REG_SIZE, writeByte, writeSize);
-		i2c->State = HAL_I2C_STATE_READY;
+		burst->SampleTime = now;
+		XLG_BURST_START(burst);
+	}
+	else
+	{
+		burst->EdgeTime = now;
+		burst->Pending = 1;
 	}
 }
 
-/* Function Summary: Reads from specific address on the IC
- * Param: * i2c - predefined i2c handler
- * Param: addr - address on IC chip,
- * Param: writeByte - data byte to read from addr
- * Param: writeSize - how many bytes to read
+/* Function Summary: Burst job finished, runs from the I2C interrupt. Decodes the sample with its
+ * edge time and starts the next burst if another edge came in meanwhile. Data ready is latched
+ * until read, so a gap of more than one period means samples were overwritten. A failed job
+ * leaves the read idle for the main loop to restart
+ * Param: * context - The XLG_BURST
+ * Param: ok - 0 if the read failed
  * Return: VOID
  */
-void XLG_READ(I2C_HandleTypeDef* i2c, uint8_t addr, uint8_t* readByte, uint32_t readSize)
+static void XLG_BURST_DONE(void* context, uint8_t ok)
 {
-	if (i2c->hdmarx->State == HAL_DMA_STATE_READY)
+	XLG_BURST* burst = context;
+	if (!ok)
 	{
-		HAL_I2C_Mem_Read_DMA(i2c, XLG_I2C_ADDR, addr, XLG_REG_SIZE, readByte, readSize);
-		i2c->State = HAL_I2C_STATE_READY;
+		burst->Stage = XLG_STAGE_IDLE;
+		burst->Pending = 0;
+		return;
+	}
+	XLG_BURST_DECODE(burst->Data, burst->G, burst->XL);
+	burst->G->timestamp = burst->SampleTime;
+	burst->XL->timestamp = burst->SampleTime;
+	uint32_t period = SystemCoreClock / XLG_G_ODR_HZ;
+	uint32_t gap = burst->SampleTime - burst->LastTime;
+	if (burst->LastTime && gap > period + period / 2) burst->Missed += (gap + period / 2) / period - 1;
+	burst->LastTime = burst->SampleTime;
+	burst->Stage = XLG_STAGE_IDLE;
+	if (burst->Pending)
+	{
+		burst->Pending = 0;
+		burst->SampleTime = burst->EdgeTime;
+		XLG_BURST_START(burst);
 	}
 }
 
-/* Function Summary: Reads from interrupt pin on IC to see if accelerometer data is ready
- * Param: * i2c - predefined i2c handler
+/* Function Summary: Splits a burst into gyro and accelerometer axes. Registers are low byte
+ * first (BLE = 0 in CTRL3_C)
+ * Param: * data - XLG_BURST_SIZE bytes starting at OUTX_L_G
+ * Param: * gData - pointer to structure holding 3-axis gyroscope data
+ * Param: * xlData - pointer to structure holding 3-axis accelerometer data
  * Return: VOID
  */
-_Bool XLG_XL_DATA_READY(I2C_HandleTypeDef* i2c)
+void XLG_BURST_DECODE(const uint8_t* data, XLG_DATA* gData, XLG_DATA* xlData)
 {
-	uint8_t status = 0;
-	XLG_READ(i2c, STATUS_REG, &status, 1);
-	return (status & 0b1); // Mask with XLDA bit in STATUS_REG
+	gData->x = (int16_t)((data[1] << 8) | data[0]);
+	gData->y = (int16_t)((data[3] << 8) | data[2]);
+	gData->z = (int16_t)((data[5] << 8) | data[4]);
+	xlData->x = (int16_t)((data[7] << 8) | data[6]);
+	xlData->y = (int16_t)((data[9] << 8) | data[8]);
+	xlData->z = (int16_t)((data[11] << 8) | data[10]);
+	gData->dataReady = true;
+	xlData->dataReady = true;
 }
 
-/* Function Summary: Reads from interrupt pin on IC to see if gyroscope data is ready
- * Param: * i2c - predefined i2c handler
+/* Function Summary: Sets up the chip FIFO in continuous mode with gyro and accelerometer
+ * undecimated at the gyro ODR, watermark routed to INT1 in place of data ready. Call after
+ * XLG_INIT, blocking writes before the queue is in use
+ * Param: * fifo - FIFO drain state and sample ring
+ * Param: * bus - I2C job queue the IC is on
+ * Param: watermark - Samples per batch, 1 to XLG_FIFO_DRAIN_MAX
  * Return: VOID
  */
-_Bool XLG_G_DATA_READY(I2C_HandleTypeDef* i2c)
+void XLG_FIFO_INIT(XLG_FIFO* fifo, I2CQ_CONTROLLER* bus, uint16_t watermark)
 {
-	uint8_t status = 0;
-	XLG_READ(i2c, STATUS_REG, &status, 1);
-	return (status & 0b10); // Mask with DGA bit in STATUS_REG
+	I2C_HandleTypeDef* i2c = bus->I2c;
+	memset(fifo, 0, sizeof(XLG_FIFO));
+	fifo->Bus = bus;
+	if (watermark < 1) watermark = 1;
+	if (watermark > XLG_FIFO_DRAIN_MAX) watermark = XLG_FIFO_DRAIN_MAX;
+	fifo->Watermark = watermark;
+	fifo->Period = SystemCoreClock / XLG_G_ODR_HZ;
+	// Threshold is counted in 16 bit words
+	uint16_t words = watermark * XLG_FIFO_WORDS;
+	uint8_t writeThis[2] = {words & 0xFF, (words >> 8) & 0x0F};
+	HAL_I2C_Mem_Write(i2c, XLG_I2C_ADDR, FIFO_CTRL1, XLG_REG_SIZE, writeThis, 2, XLG_INIT_TIMEOUT);
+	writeThis[0] = XLG_FIFO_NO_DEC;
+	HAL_I2C_Mem_Write(i2c, XLG_I2C_ADDR, FIFO_CTRL3, XLG_REG_SIZE, writeThis, 1, XLG_INIT_TIMEOUT);
+	writeThis[0] = XLG_INT1_FTH;
+	HAL_I2C_Mem_Write(i2c, XLG_I2C_ADDR, INT1_CTRL, XLG_REG_SIZE, writeThis, 1, XLG_INIT_TIMEOUT);
+	writeThis[0] = XLG_FIFO_ODR_1660 | XLG_FIFO_CONTINUOUS;
+	HAL_I2C_Mem_Write(i2c, XLG_I2C_ADDR, FIFO_CTRL5, XLG_REG_SIZE, writeThis, 1, XLG_INIT_TIMEOUT);
 }
 
-/* Function Summary: Reads from interrupt pin on IC to see if temperature data is ready
- * Param: * i2c - predefined i2c handler
+/* Function Summary: Queues a FIFO status read, the fill level and where the pattern is up to
+ * Param: * fifo - FIFO drain state and sample ring
  * Return: VOID
  */
-_Bool XLG_TEMP_DATA_READY(I2C_HandleTypeDef* i2c)
+void XLG_FIFO_START(XLG_FIFO* fifo)
 {
-	uint8_t status = 0;
-	XLG_READ(i2c, STATUS_REG, &status, 1);
-	return (status & 0b100); // Mask with TDA bit in STATUS_REG
+	fifo->Stage = XLG_STAGE_STATUS;
+	if (!XLG_READ(fifo->Bus, FIFO_STATUS1, fifo->Status, sizeof(fifo->Status), XLG_FIFO_DONE, fifo)) fifo->Stage = XLG_STAGE_IDLE;
 }
 
-/* Function Summary: Reads from gyroscope data registers on IC to
- * Param: * i2c - predefined i2c handler
- * Param: * gData - pointer to structure olding 3-axis gyroscope data
+/* Function Summary: INT1 watermark edge, from the EXTI interrupt. Starts the drain straight
+ * away, or holds the edge until the read in flight finishes
+ * Param: * fifo - FIFO drain state and sample ring
  * Return: VOID
  */
-void XLG_G_DATA_READ(I2C_HandleTypeDef* i2c, XLG_DATA* gData)
+void XLG_FIFO_EDGE(XLG_FIFO* fifo)
 {
-	if (XLG_G_DATA_READY(i2c))
+	uint32_t now = DWT->CYCCNT;
+	if (fifo->Stage == XLG_STAGE_IDLE)
 	{
-		gData->dataReady = true;
-		uint8_t readByte[6] = {0};
-		XLG_READ(i2c, OUTX_H_G, &readByte[0], 1);
-		XLG_READ(i2c, OUTX_L_G, &readByte[1], 1);
-		XLG_READ(i2c, OUTY_H_G, &readByte[2], 1);
-		XLG_READ(i2c, OUTY_L_G, &readByte[3], 1);
-		XLG_READ(i2c, OUTZ_H_G, &readByte[4], 1);
-		XLG_READ(i2c, OUTZ_L_G, &readByte[5], 1);
-		gData->x = readByte[0];
-		gData->x = (gData->x << 8) | readByte[1];
-		gData->y = readByte[2];
-		gData->y = (gData->y << 8) | readByte[3];
-		gData->z = readByte[4];
-		gData->z = (gData->z << 8) | readByte[5];
+		fifo->AnchorTime = now;
+		fifo->Anchored = 1;
+		XLG_FIFO_START(fifo);
 	}
 	else
 	{
-		gData->dataReady = false;
+		fifo->EdgeTime = now;
+		fifo->Pending = 1;
 	}
 }
 
-/* Function Summary: Reads from accelerometer data registers on IC to
- * Param: * i2c - predefined i2c handler
- * Param: * xlData - pointer to structure olding 3-axis acceleromter data
+/* Function Summary: FIFO job finished, advances the drain from the I2C interrupt. Past the
+ * watermark every whole sample comes out in one read of FIFO_DATA_OUT, the address wraps
+ * from _H back to _L so the burst keeps popping words. The sample that crossed the watermark
+ * takes the edge time and the rest are spaced at the ODR, then they are queued for
+ * XLG_FIFO_POP. The watermark output is a level, if it is still high after the drain the
+ * next drain starts without waiting for an edge. A failed job leaves the drain idle for the
+ * main loop to restart
+ * Param: * context - The XLG_FIFO
+ * Param: ok - 0 if the read failed
  * Return: VOID
  */
-void XLG_XL_DATA_READ(I2C_HandleTypeDef* i2c, XLG_DATA* xlData)
+static void XLG_FIFO_DONE(void* context, uint8_t ok)
 {
-	if (XLG_XL_DATA_READY(i2c))
+	XLG_FIFO* fifo = context;
+	if (!ok)
 	{
-		xlData->dataReady = true;
-		uint8_t readByte[6] = {0};
-		XLG_READ(i2c, OUTX_H_XL, &readByte[0], 1);
-		XLG_READ(i2c, OUTX_L_XL, &readByte[1], 1);
-		XLG_READ(i2c, OUTY_H_XL, &readByte[2], 1);
-		XLG_READ(i2c, OUTY_L_XL, &readByte[3], 1);
-		XLG_READ(i2c, OUTZ_H_XL, &readByte[4], 1);
-		XLG_READ(i2c, OUTZ_L_XL, &readByte[5], 1);
-		xlData->x = readByte[0];
-		xlData->x = (xlData->x << 8) | readByte[1];
-		xlData->y = readByte[2];
-		xlData->y = (xlData->y << 8) | readByte[3];
-		xlData->z = readByte[4];
-		xlData->z = (xlData->z << 8) | readByte[5];
+		fifo->Stage = XLG_STAGE_IDLE;
+		fifo->Pending = 0;
+		return;
 	}
-	else
+	if (fifo->Stage == XLG_STAGE_STATUS && (fifo->Status[1] & XLG_FIFO_STATUS_WTM))
+	{
+		uint16_t words = ((fifo->Status[1] & 0x0F) << 8) | fifo->Status[0];
+		uint16_t pattern = ((fifo->Status[3] & 0x03) << 8) | fifo->Status[2];
+		if (fifo->Status[1] & XLG_FIFO_STATUS_OVR) fifo->Overruns++;
+		// After an overrun the next word may be mid sample, read up to the next gyro X and drop it
+		fifo->Skip = pattern ? XLG_FIFO_WORDS - pattern : 0;
+		uint16_t samples = (words > fifo->Skip) ? (words - fifo->Skip) / XLG_FIFO_WORDS : 0;
+		if (samples > XLG_FIFO_DRAIN_MAX) samples = XLG_FIFO_DRAIN_MAX;
+		if (samples > 0)
+		{
+			fifo->Draining = samples;
+			fifo->Stage = XLG_STAGE_DATA;
+			if (!XLG_READ(fifo->Bus, FIFO_DATA_OUT_L, fifo->Data, (fifo->Skip + samples * XLG_FIFO_WORDS) * 2, XLG_FIFO_DONE, fifo))
+			{
+				fifo->Stage = XLG_STAGE_IDLE;
+			}
+			return;
+		}
+	}
+	if (fifo->Stage == XLG_STAGE_DATA)
+	{
+		const uint8_t* data = &fifo->Data[fifo->Skip * 2];
+		for (uint16_t i = 0; i < fifo->Draining; i++, data += XLG_FIFO_WORDS * 2)
+		{
+			uint16_t head = fifo->Head;
+			if (((head + 1) & (XLG_FIFO_RING_SIZE - 1)) == fifo->Tail)
+			{
+				fifo->Overruns++;
+				continue;
+			}
+			XLG_SAMPLE* sample = &fifo->Ring[head];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				sample->G[axis] = (int16_t)((data[axis * 2 + 1] << 8) | data[axis * 2]);
+				sample->XL[axis] = (int16_t)((data[axis * 2 + 7] << 8) | data[axis * 2 + 6]);
+			}
+			sample->Time = fifo->LastTime + fifo->Period;
+			if (fifo->Anchored) sample->Time = fifo->AnchorTime + ((int32_t)i - (fifo->Watermark - 1)) * (int32_t)fifo->Period;
+			if (fifo->Timed && (int32_t)(sample->Time - fifo->LastTime) <= 0) sample->Time = fifo->LastTime + fifo->Period;
+			fifo->LastTime = sample->Time;
+			fifo->Timed = 1;
+			fifo->Head = (head + 1) & (XLG_FIFO_RING_SIZE - 1);
+		}
+		fifo->Anchored = 0;
+	}
+	fifo->Stage = XLG_STAGE_IDLE;
+	if (fifo->Pending)
+	{
+		fifo->Pending = 0;
+		fifo->AnchorTime = fifo->EdgeTime;
+		fifo->Anchored = 1;
+		XLG_FIFO_START(fifo);
+	}
+	else if (HAL_GPIO_ReadPin(XLG_INT1_GPIO_Port, XLG_INT1_Pin) == GPIO_PIN_SET)
 	{
-		xlData->dataReady = false;
+		XLG_FIFO_START(fifo);
 	}
 }
+
+/* Function Summary: Takes the oldest queued sample, called from the main loop
+ * Param: * fifo - FIFO drain state and sample ring
+ * Param: * gData - pointer to structure holding 3-axis gyroscope data
+ * Param: * xlData - pointer to structure holding 3-axis accelerometer data
+ * Return: false when the ring is empty
+ */
+bool XLG_FIFO_POP(XLG_FIFO* fifo, XLG_DATA* gData, XLG_DATA* xlData)
+{
+	uint16_t tail = fifo->Tail;
+	if (tail == fifo->Head) return false;
+	const XLG_SAMPLE* sample = &fifo->Ring[tail];
+	gData->x = sample->G[0];
+	gData->y = sample->G[1];
+	gData->z = sample->G[2];
+	xlData->x = sample->XL[0];
+	xlData->y = sample->XL[1];
+	xlData->z = sample->XL[2];
+	gData->timestamp = sample->Time;
+	xlData->timestamp = sample->Time;
+	gData->dataReady = true;
+	xlData->dataReady = true;
+	fifo->Tail = (tail + 1) & (XLG_FIFO_RING_SIZE - 1);
+	return true;
+}
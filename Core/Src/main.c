@@ -28,7 +28,17 @@
 #include "ESC.h"
 #include "ADC.h"
 #include "XLG.h"
+#include "I2CQ.h"
+#include "MAG.h"
+#include "BARO.h"
 #include "RX.h"
+#include "TELEM.h"
+#include "PID.h"
+#include "ATTITUDE.h"
+#include "FILTER.h"
+#include "DYNNOTCH.h"
+#include "RPMFILTER.h"
+#include "ALTITUDE.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -38,6 +48,42 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+#define MOTOR_LAYOUT	MIXER_QUAD_X	// MIXER_HEX_X for hex frames, motors 5 and 6 are on TIM4
+#define MOTOR_COUNT		(MIXER_LAYOUTS[MOTOR_LAYOUT].MotorCount)
+#define MOTOR_MIX_MODE	MIXER_MODE_AIRMODE_RP	// Keep roll/pitch authority on punch-outs and dives
+#define STICK_MAX_RATE	500.0f	// deg/s at full stick deflection
+#define PID_OUT_LIMIT	500.0f	// Largest roll/pitch/yaw demand in DSHOT throttle units
+#define DYN_NOTCH_PEAKS	3		// Motor noise peaks tracked per axis
+#define DYN_NOTCH_MIN	80.0f	// Hz, tracked range of the dynamic notches
+#define DYN_NOTCH_MAX	600.0f
+#define DYN_NOTCH_Q		3.5f
+#define RPM_NOTCH_STEP	3		// RPM notches retuned per gyro sample, whole bank every 4 samples on a quad
+#define RPM_NOTCH_MIN	100.0f	// Hz, harmonics below this are left unfiltered
+#define RPM_NOTCH_Q		5.0f
+#define ANGLE_DIVIDER	2		// Angle loop runs every 2nd gyro sample, 830Hz
+#define ANGLE_KP		6.0f	// deg/s per degree of tilt error
+#define ANGLE_MAX		45.0f	// Tilt at full stick in angle mode
+#define ANGLE_ESTIMATOR	ATTITUDE_MAHONY	// ATTITUDE_EKF for the bias estimating EKF, stepped at the angle loop rate
+#define IMU_FIFO		1		// Batch gyro/accelerometer samples in the chip FIFO, 0 reads them one at a time
+#define IMU_WATERMARK	4		// Samples per FIFO drain
+#define IMU_BUS_SPEED	I2CTIMING_FAST	// I2CTIMING_FAST_PLUS runs the bus past the LSM6DS33 rating
+#define IMU_BUS_FMP		(I2C_FASTMODEPLUS_PB8 | I2C_FASTMODEPLUS_PB9)
+#define MAG_RANGE		MAG_RANGE_4G
+#define MAG_DIVIDER		21		// One magnetometer read per 21 gyro samples, 79Hz against the 80Hz ODR
+#define BARO_DIVIDER	66		// One barometer read per 66 gyro samples, 25Hz
+#define ALT_TAU			1.0f	// s, barometer/accelerometer crossover for the altitude filter
+// Board mounting, sensor X forward / Y left / Z up into roll right / pitch forward / yaw right
+#define GYRO_ROLL(G)	((G).x * XLG_G_DPS_PER_LSB)
+#define GYRO_PITCH(G)	((G).y * XLG_G_DPS_PER_LSB)
+#define GYRO_YAW(G)		(-(G).z * XLG_G_DPS_PER_LSB)
+// Same mounting into body X forward / Y right / Z down for the accelerometer
+#define ACCEL_X(A)		((A).x * XLG_XL_G_PER_LSB)
+#define ACCEL_Y(A)		(-(A).y * XLG_XL_G_PER_LSB)
+#define ACCEL_Z(A)		(-(A).z * XLG_XL_G_PER_LSB)
+// LIS3MDL axes match the LSM6DS33 on the AltIMU-10
+#define MAG_X(F)		((F)[0])
+#define MAG_Y(F)		(-(F)[1])
+#define MAG_Z(F)		(-(F)[2])
 
 /* USER CODE END PD */
 
@@ -58,14 +104,15 @@ TIM_HandleTypeDef htim1;
 TIM_HandleTypeDef htim2;
 TIM_HandleTypeDef htim3;
 TIM_HandleTypeDef htim4;
-TIM_HandleTypeDef htim5;
-
-DMA_HandleTypeDef hdma_tim4_ch1;
+DMA_HandleTypeDef hdma_tim3_ch1_trig;
+DMA_HandleTypeDef hdma_tim3_ch2;
+DMA_HandleTypeDef hdma_tim3_ch3;
+DMA_HandleTypeDef hdma_tim3_ch4_up;
 DMA_HandleTypeDef hdma_tim4_ch2;
-DMA_HandleTypeDef hdma_tim4_ch3;
-DMA_HandleTypeDef hdma_tim5_ch2;
 
 UART_HandleTypeDef huart3;
+UART_HandleTypeDef huart6;
+DMA_HandleTypeDef hdma_usart6_rx;
 
 /* USER CODE BEGIN PV */
 int cmd = 0;
@@ -77,12 +124,58 @@ uint8_t armed = 0;
 uint8_t txDisconnected = 0;
 uint8_t escCMD;
 uint8_t sendMsg[48];
+uint8_t busMsg[320];
+volatile uint8_t busReport = 0;		// 'i' on the command line, print the I2C profiler
+volatile uint8_t busSpeedChange = 0;	// 'I', step to the next bus speed once disarmed
 XLG_DATA gData;
 XLG_DATA xlData;
-DMA_HandleTypeDef* escDMASet[4];
-TIM_HandleTypeDef* dmaPwmTimers[2];
+XLG_BURST xlgBurst;
+XLG_FIFO xlgFifo;
+I2CQ_CONTROLLER* imuBus;
+MAG_CONTROLLER* myMag;
+// Hard/soft iron fit for this airframe, identity until it has been calibrated
+const MAGCAL_CONFIG magCal = MAGCAL_IDENTITY;
+float magField[3];				// Body axes X forward / Y right / Z down, gauss
+uint8_t magFresh = 0;			// magField not yet given to the attitude estimator
+uint8_t magSamples = 0;			// Gyro samples since the last magnetometer read
+BARO_CONTROLLER* myBaro;
+ALTITUDE_CONTROLLER* myAltitude;
+uint8_t baroSamples = 0;		// Gyro samples since the last barometer read
 ESC_CONTROLLER* myESCSet;
 RX_CONTROLLER* myRX;
+TELEM_CONTROLLER* myTelem;
+PID_CONTROLLER* myPID;
+ATTITUDE_CONTROLLER* myAttitude;
+FILTER_CHAIN* gyroFilter;
+DYNNOTCH_CONTROLLER* dynNotch;
+RPMFILTER_CONTROLLER* rpmFilter;
+// Gyro filter stages in order, retune at runtime with FILTER_SET_STAGE
+const FILTER_CONFIG gyroFilterStages[] = {
+	{FILTER_PT1, 250.0f, 0.0f},
+	{FILTER_BIQUAD_LPF, 300.0f, 0.707f}
+};
+// DWT core cycles (216MHz) spent in the last gyro filter pass (dynamic notch included) and the last
+// whole rate loop step
+uint32_t filterCycles = 0;
+uint32_t rpmFilterCycles = 0;	// RPM notch retune plus the pass through the bank
+uint32_t attitudeCycles = 0;	// Attitude estimate, plus the angle loop on its decimated steps
+uint32_t loopCycles = 0;
+MIXER_AXES mixDemand;
+// Rate loop gains in pidAxes_e order: P, I, D, I-term limit
+const PID_GAINS rateGains[PID_AXES] = {
+	{0.8f, 1.5f, 0.010f, 200.0f},
+	{0.8f, 1.5f, 0.010f, 200.0f},
+	{1.5f, 2.0f, 0.0f, 200.0f}
+};
+// Motor n is bit n of every motor mask. TIM4_CH3 has no free DMA stream (S7 is TIM3_CH3) so motor 6 has no eRPM
+const ESC_OUTPUT escOutputs[ESC_MAX_MOTORS] = {
+	{&htim3, TIM_CHANNEL_1, &hdma_tim3_ch4_up, TIM_DMA_UPDATE, &hdma_tim3_ch1_trig},
+	{&htim3, TIM_CHANNEL_2, &hdma_tim3_ch4_up, TIM_DMA_UPDATE, &hdma_tim3_ch2},
+	{&htim3, TIM_CHANNEL_3, &hdma_tim3_ch4_up, TIM_DMA_UPDATE, &hdma_tim3_ch3},
+	{&htim3, TIM_CHANNEL_4, &hdma_tim3_ch4_up, TIM_DMA_UPDATE, &hdma_tim3_ch4_up},
+	{&htim4, TIM_CHANNEL_2, &hdma_tim4_ch2, TIM_DMA_CC2, &hdma_tim4_ch2},
+	{&htim4, TIM_CHANNEL_3, &hdma_tim4_ch2, TIM_DMA_CC2, NULL}
+};
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -97,7 +190,7 @@ static void MX_I2C1_Init(void);
 static void MX_TIM3_Init(void);
 static void MX_TIM2_Init(void);
 static void MX_TIM1_Init(void);
-static void MX_TIM5_Init(void);
+static void MX_USART6_UART_Init(void);
 /* USER CODE BEGIN PFP */
 
 /* USER CODE END PFP */
@@ -108,6 +201,20 @@ static void MX_TIM5_Init(void);
 // Interrupt service routine for command line settings
 void HAL_UART_RxCpltCallback(UART_HandleTypeDef* huart)
 {
+	// ESC telemetry DMA wrapped around its buffer
+	if (huart->Instance == USART6)
+	{
+		TELEM_RX_EVENT(myTelem);
+		return;
+	}
+	// Bus profiler commands are answered from the main loop, the report is too long for an IRQ
+	if (escCMD == 'i' || escCMD == 'I')
+	{
+		if (escCMD == 'I') busSpeedChange = 1;
+		else busReport = 1;
+		HAL_UART_Receive_IT(&huart3, &escCMD, 1);
+		return;
+	}
 	// cmd will be used externally from IRQ to send specific command to ESCs
 	cmd = escCMD - '0';
 	// Start listening for another command via UART
@@ -117,27 +224,137 @@ void HAL_UART_RxCpltCallback(UART_HandleTypeDef* huart)
 	HAL_UART_Transmit_IT(&huart3, sendMsg, strlen((char*)sendMsg));
 }
 
+// ESC telemetry DMA is half way through its buffer
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef* huart)
+{
+	if (huart->Instance == USART6) TELEM_RX_EVENT(myTelem);
+}
+
+// ESC telemetry line error, overruns stop the DMA
+void HAL_UART_ErrorCallback(UART_HandleTypeDef* huart)
+{
+	if (huart->Instance == USART6) TELEM_RX_ERROR(myTelem);
+}
+
+// Motor timer update, only enabled while a timer listens for eRPM replies so it ends the window
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
+{
+	if (myESCSet) ESC_CAPTURE_DONE(myESCSet, htim);
+}
+
 // Interrupt service routine for RX
 void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef *htim)
 {
 	RX_UPDATE(myRX);
-	ESC_CALC_THROTTLE(myESCSet, myRX, armed);
 	watchdog = 0;
 }
 
-// XLG data interrrupt service routine
-void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c)
+// One rate loop step per gyro sample, stick rates against measured rates into the mixer.
+// Switch B selects angle mode, where roll/pitch rates come from the attitude outer loop
+void RATE_LOOP_STEP(void)
+{
+	uint32_t loopStart = DWT->CYCCNT;
+	float target[PID_AXES] = {
+		RX_STICK(myRX->roll) * STICK_MAX_RATE,
+		RX_STICK(myRX->pitch) * STICK_MAX_RATE,
+		RX_STICK(myRX->yaw) * STICK_MAX_RATE
+	};
+	float rates[PID_AXES] = { GYRO_ROLL(gData), GYRO_PITCH(gData), GYRO_YAW(gData) };
+	uint32_t filterStart = DWT->CYCCNT;
+	// Spectrum is taken before any filtering, notches go ahead of the lowpass chain
+	DYNNOTCH_UPDATE(dynNotch, rates);
+	// Motor RPM from the eRPM replies when bidirectional DSHOT is running, serial telemetry otherwise
+	for (int m = 0; m < myESCSet->MotorCount; m++)
+	{
+		TELEM_DATA telem;
+		if (myESCSet->Bidir) RPMFILTER_SET_RPM(rpmFilter, m, myESCSet->RPM[m]);
+		else
+		{
+			TELEM_READ(myTelem, m, &telem);
+			RPMFILTER_SET_RPM(rpmFilter, m, telem.RPM);
+		}
+	}
+	uint32_t rpmStart = DWT->CYCCNT;
+	RPMFILTER_UPDATE(rpmFilter);
+	RPMFILTER_APPLY(rpmFilter, rates);
+	rpmFilterCycles = DWT->CYCCNT - rpmStart;
+	DYNNOTCH_APPLY(dynNotch, rates);
+	FILTER_APPLY(gyroFilter, rates);
+	filterCycles = DWT->CYCCNT - filterStart;
+	float accel[3] = { ACCEL_X(xlData), ACCEL_Y(xlData), ACCEL_Z(xlData) };
+	float out[PID_AXES];
+	// Estimate runs in both modes so switching into angle mode starts from a settled tilt
+	uint32_t attitudeStart = DWT->CYCCNT;
+	// A new field is held until an estimator step has used it
+	if (ATTITUDE_UPDATE(myAttitude, rates, accel, magFresh ? magField : NULL, RX_STICK(myRX->roll), RX_STICK(myRX->pitch))) magFresh = 0;
+	ALTITUDE_PREDICT(myAltitude, myAttitude->R[2], accel, 1.0f / XLG_G_ODR_HZ);
+	attitudeCycles = DWT->CYCCNT - attitudeStart;
+	if (myRX->switchB)
+	{
+		target[PID_ROLL] = myAttitude->RateTarget[PID_ROLL];
+		target[PID_PITCH] = myAttitude->RateTarget[PID_PITCH];
+	}
+	if (!armed) PID_RESET(myPID);
+	PID_UPDATE(myPID, target, rates, out);
+	mixDemand.Throttle = myRX->throttle;
+	mixDemand.Roll = out[PID_ROLL];
+	mixDemand.Pitch = out[PID_PITCH];
+	mixDemand.Yaw = out[PID_YAW];
+	ESC_CALC_THROTTLE(myESCSet, &mixDemand, armed);
+	loopCycles = DWT->CYCCNT - loopStart;
+}
+
+// XLG INT1, data ready or FIFO watermark
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+	if (GPIO_Pin != XLG_INT1_Pin) return;
+#if IMU_FIFO
+	XLG_FIFO_EDGE(&xlgFifo);
+#else
+	XLG_BURST_EDGE(&xlgBurst);
+#endif
+}
+
+// I2C1 job finished, the queue runs its callback and starts the next one
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	if (hi2c == &hi2c1) I2CQ_CPLT(imuBus);
+}
+
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	if (hi2c == &hi2c1) I2CQ_CPLT(imuBus);
+}
+
+// NACK or bus error, the queue retries or recovers the bus
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+	if (hi2c == &hi2c1) I2CQ_ERROR(imuBus);
+}
+
+// Print the last full second of I2C1 use, one line per device. Busy is bus time from job start to
+// complete, so 100% means the IMU rate can't go any higher at this speed
+void BUS_REPORT(void)
 {
-	XLG_G_DATA_READ(&hi2c1, &gData);
-	XLG_XL_DATA_READ(&hi2c1, &xlData);
+	int len = snprintf((char*)busMsg, sizeof(busMsg), "\r\nI2C1 %luHz failed %lu full %lu recovered %lu\r\n",
+			(unsigned long)imuBus->BusHz, (unsigned long)imuBus->Failed, (unsigned long)imuBus->Full,
+			(unsigned long)imuBus->Recoveries);
+	for (int i = 0; i < I2CQ_DEVICES && imuBus->Second[i].Addr; i++)
+	{
+		I2CQ_STATS* stats = &imuBus->Second[i];
+		unsigned long busyUs = stats->BusyCycles / (SystemCoreClock / 1000000);
+		len += snprintf((char*)busMsg + len, sizeof(busMsg) - len, "0x%02X jobs %lu bytes %lu busy %luus %lu.%lu%%\r\n",
+				stats->Addr >> 1, (unsigned long)stats->Jobs, (unsigned long)stats->Bytes, busyUs, busyUs / 10000,
+				(busyUs / 1000) % 10);
+		if (len >= sizeof(busMsg)) break;
+	}
+	HAL_UART_Transmit_IT(&huart3, busMsg, strlen((char*)busMsg));
 }
 
+// DSHOT frame has left one of the motor timer burst streams
 void DMA_XferCpltCallback(DMA_HandleTypeDef *hdma)
 {
-//	if (armed && !myESCSet->SendingFlag)
-//	{
-//		ESC_UPDATE_THROTTLE(myESCSet);
-//	}
+	ESC_FRAME_SENT(myESCSet, hdma);
 }
 
 /* USER CODE END 0 */
@@ -179,20 +396,42 @@ int main(void)
 	MX_TIM3_Init();
 	MX_TIM2_Init();
 	MX_TIM1_Init();
-	MX_TIM5_Init();
+	MX_USART6_UART_Init();
 	/* USER CODE BEGIN 2 */
-	escDMASet[0] = &hdma_tim4_ch1; 		// DMA1: Stream 0 (S0)
-	escDMASet[1] = &hdma_tim4_ch2; 		// DMA1: Stream 3 (S3)
-	escDMASet[2] = &hdma_tim4_ch3; 		// DMA1: Stream 7 (S7)
-	escDMASet[3] = &hdma_tim5_ch2; 		// DMA1: Stream 4 (S4)
-	dmaPwmTimers[0] = &htim4;
-	dmaPwmTimers[1] = &htim5;
-	myESCSet = ESC_INIT(dmaPwmTimers, &htim3, escDMASet);
+	myESCSet = ESC_INIT(escOutputs, MOTOR_COUNT, ESC_PROTOCOL_DSHOT300);	// DMA1: S2/S3 burst, S4/S5/S7/S2/S3 eRPM capture
+	ESC_SET_MIXER(myESCSet, MOTOR_LAYOUT, MOTOR_MIX_MODE);
+	for (int g = 0; g < myESCSet->GroupCount; g++)
+	{
+		HAL_DMA_RegisterCallback(myESCSet->Groups[g].DMA, HAL_DMA_XFER_CPLT_CB_ID, DMA_XferCpltCallback);
+	}
 	myRX = RX_INIT(&htim1, &htim2);
+	myPID = PID_INIT(rateGains, XLG_G_ODR_HZ, PID_OUT_LIMIT);
+	gyroFilter = FILTER_INIT(XLG_G_ODR_HZ);
+	for (int i = 0; i < sizeof(gyroFilterStages) / sizeof(gyroFilterStages[0]); i++)
+	{
+		FILTER_SET_STAGE(gyroFilter, i, &gyroFilterStages[i]);
+	}
+	dynNotch = DYNNOTCH_INIT(XLG_G_ODR_HZ, DYN_NOTCH_PEAKS, DYN_NOTCH_MIN, DYN_NOTCH_MAX, DYN_NOTCH_Q);
+	rpmFilter = RPMFILTER_INIT(XLG_G_ODR_HZ, myESCSet->MotorCount, RPM_NOTCH_STEP, RPM_NOTCH_MIN, RPM_NOTCH_Q);
+	// Cycle counter for loop timing, the M7 DWT is locked until LAR is written
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->LAR = 0xC5ACCE55;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	myAttitude = ATTITUDE_INIT(XLG_G_ODR_HZ, ANGLE_DIVIDER, ANGLE_ESTIMATOR, ANGLE_KP, ANGLE_MAX, STICK_MAX_RATE);
+	imuBus = I2CQ_INIT(&hi2c1, GPIOB, GPIO_PIN_8, GPIOB, GPIO_PIN_9);	// SCL PB8, SDA PB9
+	I2CQ_SPEED(imuBus, IMU_BUS_SPEED, IMU_BUS_FMP);
 	XLG_INIT(&hi2c1);
-	XLG_G_DATA_READ(&hi2c1, &gData);
-	XLG_XL_DATA_READ(&hi2c1, &xlData);
+	myMag = MAG_INIT(imuBus, MAG_RANGE, &magCal);
+	myBaro = BARO_INIT(imuBus);
+	myAltitude = ALTITUDE_INIT(ALT_TAU);
+#if IMU_FIFO
+	XLG_FIFO_INIT(&xlgFifo, imuBus, IMU_WATERMARK);
+#else
+	XLG_BURST_INIT(&xlgBurst, imuBus, &gData, &xlData);
+#endif
 	HAL_UART_Receive_IT(&huart3, &escCMD, 1);
+	myTelem = TELEM_INIT(&huart6, MOTOR_COUNT);	// USART6 RX (PG9), DMA2 S1 circular
 	/* USER CODE END 2 */
 
 	/* Infinite loop */
@@ -204,22 +443,98 @@ int main(void)
 		{
 			armed = 0;
 			RX_DISCONNECTED(myRX);
-			ESC_CALC_THROTTLE(myESCSet, myRX, armed);
-			ESC_UPDATE_THROTTLE(myESCSet);
-			ESC_SEND_CMD(myESCSet, DSHOT_CMD_BEACON3, ALL_MOTORS);
+			ESC_CALC_THROTTLE(myESCSet, &mixDemand, armed);
+			// Keep beeping until the receiver comes back, one beacon queued at a time
+			if (ESC_CMD_IDLE(myESCSet)) ESC_SEND_CMD(myESCSet, DSHOT_CMD_BEACON3, ALL_MOTORS);
 		}
 		else if (!myRX->switchA)
 		{
 			armed = 0;
-			ESC_SEND_CMD(myESCSet, DSHOT_CMD_MOTOR_STOP, ALL_MOTORS);
+			// Zero throttle is DSHOT_CMD_MOTOR_STOP on every motor
+			ESC_CALC_THROTTLE(myESCSet, &mixDemand, armed);
 			throttleHighFlag = 0;
 		}
 		else if ((myRX->switchA && (myRX->throttle < 50)) || throttleHighFlag)
 		{
 			armed = 1;
-			ESC_UPDATE_THROTTLE(myESCSet);
 			throttleHighFlag = 1;
 		}
+		// INT1 high with no read running, the edge came before the EXTI was live or a transfer
+		// failed. The edge is taken here and its EXTI flag cleared so it can't start a second read
+		if (HAL_GPIO_ReadPin(XLG_INT1_GPIO_Port, XLG_INT1_Pin) == GPIO_PIN_SET)
+		{
+			__disable_irq();
+#if IMU_FIFO
+			if (xlgFifo.Stage == XLG_STAGE_IDLE)
+			{
+				__HAL_GPIO_EXTI_CLEAR_IT(XLG_INT1_Pin);
+				XLG_FIFO_EDGE(&xlgFifo);
+			}
+#else
+			if (xlgBurst.Stage == XLG_STAGE_IDLE)
+			{
+				__HAL_GPIO_EXTI_CLEAR_IT(XLG_INT1_Pin);
+				XLG_BURST_EDGE(&xlgBurst);
+			}
+#endif
+			__enable_irq();
+		}
+		// Rate loop runs at the gyro rate, not the RX frame rate
+#if IMU_FIFO
+		// Every queued sample gets a step so the filters see the full rate after an overrun
+		while (XLG_FIFO_POP(&xlgFifo, &gData, &xlData))
+		{
+			gData.dataReady = false;
+			RATE_LOOP_STEP();
+			magSamples++;
+			baroSamples++;
+		}
+		uint8_t imuIdle = (xlgFifo.Stage == XLG_STAGE_IDLE);
+#else
+		if (gData.dataReady)
+		{
+			gData.dataReady = false;
+			RATE_LOOP_STEP();
+			magSamples++;
+			baroSamples++;
+		}
+		uint8_t imuIdle = (xlgBurst.Stage == XLG_STAGE_IDLE);
+#endif
+		// Magnetometer read goes in the gap after a gyro read, decimated so it never queues ahead
+		// of one. The previous sample is taken first, the next read overwrites it
+		float field[3];
+		if (MAG_READ(myMag, field))
+		{
+			magField[0] = MAG_X(field);
+			magField[1] = MAG_Y(field);
+			magField[2] = MAG_Z(field);
+			magFresh = 1;
+		}
+		if (magSamples >= MAG_DIVIDER && imuIdle && MAG_START(myMag)) magSamples = 0;
+		// Barometer the same way, both reads together still fit the gap
+		float pressure;
+		if (BARO_READ(myBaro, &pressure)) ALTITUDE_CORRECT(myAltitude, pressure, 1.0f / BARO_ODR_HZ);
+		if (baroSamples >= BARO_DIVIDER && imuIdle && BARO_START(myBaro)) baroSamples = 0;
+		// Bus recovery runs here with interrupts on. Profiler, report and speed steps wait for the
+		// command UART and an idle bus
+		I2CQ_SERVICE(imuBus);
+		I2CQ_PROFILE(imuBus);
+		if (busSpeedChange && !armed && I2CQ_SPEED(imuBus, (imuBus->Speed + 1) % I2CTIMING_SPEEDS, IMU_BUS_FMP))
+		{
+			busSpeedChange = 0;
+			busReport = 1;
+		}
+		if (busReport && huart3.gState == HAL_UART_STATE_READY)
+		{
+			busReport = 0;
+			BUS_REPORT();
+		}
+		// One serial telemetry request at a time, shared UART line
+		int32_t telemMotor = TELEM_NEXT_REQUEST(myTelem);
+		if (telemMotor >= 0) ESC_REQUEST_TELEMETRY(myESCSet, ESC_MOTOR(telemMotor));
+		// A frame goes out whenever the last one and its reply window are done, queued commands go
+		// out in between throttle frames
+		ESC_UPDATE_THROTTLE(myESCSet);
 		/* USER CODE END WHILE */
 
 		/* USER CODE BEGIN 3 */
@@ -609,7 +924,7 @@ static void MX_TIM4_Init(void)
   htim4.Init.Period = 359;
   htim4.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
   htim4.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
-  if (HAL_TIM_OC_Init(&htim4) != HAL_OK)
+  if (HAL_TIM_PWM_Init(&htim4) != HAL_OK)
   {
     Error_Handler();
   }
@@ -619,19 +934,15 @@ static void MX_TIM4_Init(void)
   {
     Error_Handler();
   }
-  sConfigOC.OCMode = TIM_OCMODE_ACTIVE;
-  sConfigOC.Pulse = 1;
+  sConfigOC.OCMode = TIM_OCMODE_PWM1;
+  sConfigOC.Pulse = 0;
   sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
   sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
-  if (HAL_TIM_OC_ConfigChannel(&htim4, &sConfigOC, TIM_CHANNEL_1) != HAL_OK)
-  {
-    Error_Handler();
-  }
-  if (HAL_TIM_OC_ConfigChannel(&htim4, &sConfigOC, TIM_CHANNEL_2) != HAL_OK)
+  if (HAL_TIM_PWM_ConfigChannel(&htim4, &sConfigOC, TIM_CHANNEL_2) != HAL_OK)
   {
     Error_Handler();
   }
-  if (HAL_TIM_OC_ConfigChannel(&htim4, &sConfigOC, TIM_CHANNEL_3) != HAL_OK)
+  if (HAL_TIM_PWM_ConfigChannel(&htim4, &sConfigOC, TIM_CHANNEL_3) != HAL_OK)
   {
     Error_Handler();
   }
@@ -642,55 +953,6 @@ static void MX_TIM4_Init(void)
 
 }
 
-/**
-  * @brief TIM5 Initialization Function
-  * @param None
-  * @retval None
-  */
-static void MX_TIM5_Init(void)
-{
-
-  /* USER CODE BEGIN TIM5_Init 0 */
-
-  /* USER CODE END TIM5_Init 0 */
-
-  TIM_MasterConfigTypeDef sMasterConfig = {0};
-  TIM_OC_InitTypeDef sConfigOC = {0};
-
-  /* USER CODE BEGIN TIM5_Init 1 */
-
-  /* USER CODE END TIM5_Init 1 */
-  htim5.Instance = TIM5;
-  htim5.Init.Prescaler = 0;
-  htim5.Init.CounterMode = TIM_COUNTERMODE_UP;
-  htim5.Init.Period = 359;
-  htim5.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
-  htim5.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
-  if (HAL_TIM_OC_Init(&htim5) != HAL_OK)
-  {
-    Error_Handler();
-  }
-  sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
-  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
-  if (HAL_TIMEx_MasterConfigSynchronization(&htim5, &sMasterConfig) != HAL_OK)
-  {
-    Error_Handler();
-  }
-  sConfigOC.OCMode = TIM_OCMODE_ACTIVE;
-  sConfigOC.Pulse = 1;
-  sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
-  sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
-  if (HAL_TIM_OC_ConfigChannel(&htim5, &sConfigOC, TIM_CHANNEL_2) != HAL_OK)
-  {
-    Error_Handler();
-  }
-  /* USER CODE BEGIN TIM5_Init 2 */
-
-  /* USER CODE END TIM5_Init 2 */
-  HAL_TIM_MspPostInit(&htim5);
-
-}
-
 /**
   * @brief USART3 Initialization Function
   * @param None
@@ -726,6 +988,41 @@ static void MX_USART3_UART_Init(void)
 
 }
 
+/**
+  * @brief USART6 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_USART6_UART_Init(void)
+{
+
+  /* USER CODE BEGIN USART6_Init 0 */
+
+  /* USER CODE END USART6_Init 0 */
+
+  /* USER CODE BEGIN USART6_Init 1 */
+
+  /* USER CODE END USART6_Init 1 */
+  huart6.Instance = USART6;
+  huart6.Init.BaudRate = 115200;
+  huart6.Init.WordLength = UART_WORDLENGTH_8B;
+  huart6.Init.StopBits = UART_STOPBITS_1;
+  huart6.Init.Parity = UART_PARITY_NONE;
+  huart6.Init.Mode = UART_MODE_RX;
+  huart6.Init.HwFlowCtl = UART_HWCONTROL_NONE;
+  huart6.Init.OverSampling = UART_OVERSAMPLING_16;
+  huart6.Init.OneBitSampling = UART_ONE_BIT_SAMPLE_DISABLE;
+  huart6.AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_NO_INIT;
+  if (HAL_UART_Init(&huart6) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN USART6_Init 2 */
+
+  /* USER CODE END USART6_Init 2 */
+
+}
+
 /**
   * @brief USB_OTG_FS Initialization Function
   * @param None
@@ -755,11 +1052,15 @@ static void MX_DMA_Init(void)
 
   /* DMA controller clock enable */
   __HAL_RCC_DMA1_CLK_ENABLE();
+  __HAL_RCC_DMA2_CLK_ENABLE();
 
   /* DMA interrupt init */
   /* DMA1_Stream0_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DMA1_Stream0_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(DMA1_Stream0_IRQn);
+  /* DMA1_Stream2_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Stream2_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream2_IRQn);
   /* DMA1_Stream3_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DMA1_Stream3_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(DMA1_Stream3_IRQn);
@@ -775,6 +1076,9 @@ static void MX_DMA_Init(void)
   /* DMA1_Stream7_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DMA1_Stream7_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(DMA1_Stream7_IRQn);
+  /* DMA2_Stream1_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA2_Stream1_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream1_IRQn);
 
 }
 
@@ -809,6 +1113,12 @@ static void MX_GPIO_Init(void)
   GPIO_InitStruct.Pull = GPIO_NOPULL;
   HAL_GPIO_Init(USER_Btn_GPIO_Port, &GPIO_InitStruct);
 
+  /*Configure GPIO pin : XLG_INT1_Pin */
+  GPIO_InitStruct.Pin = XLG_INT1_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  HAL_GPIO_Init(XLG_INT1_GPIO_Port, &GPIO_InitStruct);
+
   /*Configure GPIO pins : PF14 PF15 */
   GPIO_InitStruct.Pin = GPIO_PIN_14|GPIO_PIN_15;
   GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
@@ -857,6 +1167,10 @@ static void MX_GPIO_Init(void)
   GPIO_InitStruct.Pull = GPIO_NOPULL;
   HAL_GPIO_Init(USB_VBUS_GPIO_Port, &GPIO_InitStruct);
 
+  /* EXTI interrupt init*/
+  HAL_NVIC_SetPriority(XLG_INT1_EXTI_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(XLG_INT1_EXTI_IRQn);
+
 }
 
 /* USER CODE BEGIN 4 */
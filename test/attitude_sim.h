@@ -0,0 +1,148 @@
+/*
+ * attitude_sim.h
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef TEST_ATTITUDE_SIM_H_
+#define TEST_ATTITUDE_SIM_H_
+
+#include <stdlib.h>
+#include <math.h>
+
+/* Truth model for the attitude tests. A body to earth quaternion is flown through one of the
+ * manoeuvres below in double precision, and the sensors are made from it the way the IMU and
+ * magnetometer would see it, with noise and a constant gyro bias. Axes are body X forward,
+ * Y right, Z down, earth north/east/down */
+
+#define SIM_RAD_TO_DEG		57.29577951308232
+#define SIM_GYRO_BIAS		{0.5, 0.4, 0.3}		// deg/s, body X/Y/Z
+#define SIM_MAG_FIELD		{0.45, 0.0, 0.89}	// Earth field direction, north and down
+
+typedef enum {
+	SIM_STILL = 0,			// Sitting still, tilted
+	SIM_WANDER,				// Slow rolling, pitching and yawing
+	SIM_FLIPS,				// 360 degree roll flip every 5s, yaw spin, 1.5g punch-outs every 3s
+	SIM_COUNT
+} simScenarios_e;
+
+typedef struct SIM_FRAME
+{
+	double Q[4];			// Body to earth, w x y z
+	double Time;
+	double Dt;
+} SIM_FRAME;
+
+// Noise in +-1, seeded per run so every run is repeatable
+static inline double SIM_NOISE(void)
+{
+	return (rand() / (double)RAND_MAX - 0.5) * 2;
+}
+
+/* Function Summary: Start a run rolled 11.5 degrees right
+ * Param: sim - Truth state
+ * Param: sampleHz - Gyro rate
+ * Param: seed - Noise seed
+ * Return: VOID
+ */
+static inline void SIM_INIT(SIM_FRAME* sim, double sampleHz, unsigned seed)
+{
+	srand(seed);
+	sim->Q[0] = cos(0.1);
+	sim->Q[1] = sin(0.1);
+	sim->Q[2] = 0;
+	sim->Q[3] = 0;
+	sim->Time = 0;
+	sim->Dt = 1.0 / sampleHz;
+}
+
+// Body rates of a scenario at a time, rad/s
+static inline void SIM_RATES(simScenarios_e scenario, double t, double* rates)
+{
+	rates[0] = rates[1] = rates[2] = 0;
+	if (scenario == SIM_WANDER)
+	{
+		rates[0] = 1.5 * sin(1.3 * t);
+		rates[1] = 1.0 * sin(0.7 * t + 1);
+		rates[2] = 0.8 * sin(0.3 * t);
+	}
+	else if (scenario == SIM_FLIPS)
+	{
+		rates[0] = fmod(t, 5) < 0.5 ? 4 * M_PI : 0;
+		rates[1] = 0.5 * sin(2 * t);
+		rates[2] = 1.0;
+	}
+}
+
+// Body to earth rotation matrix of the truth quaternion
+static inline void SIM_MATRIX(const SIM_FRAME* sim, double r[3][3])
+{
+	double w = sim->Q[0], x = sim->Q[1], y = sim->Q[2], z = sim->Q[3];
+	r[0][0] = 1 - 2 * (y * y + z * z);
+	r[0][1] = 2 * (x * y - w * z);
+	r[0][2] = 2 * (x * z + w * y);
+	r[1][0] = 2 * (x * y + w * z);
+	r[1][1] = 1 - 2 * (x * x + z * z);
+	r[1][2] = 2 * (y * z - w * x);
+	r[2][0] = 2 * (x * z - w * y);
+	r[2][1] = 2 * (y * z + w * x);
+	r[2][2] = 1 - 2 * (x * x + y * y);
+}
+
+/* Function Summary: Advance the truth one sample and make what the sensors read
+ * Param: sim - Truth state
+ * Param: scenario - Manoeuvre
+ * Param: gyro - Returns deg/s in pidAxes_e order (roll, pitch nose down, yaw), biased
+ * Param: accel - Returns specific force in g, level and still reads (0, 0, -1)
+ * Param: mag - Returns the field direction in body axes, NULL if not wanted
+ * Return: VOID
+ */
+static inline void SIM_STEP(SIM_FRAME* sim, simScenarios_e scenario, float* gyro, float* accel, float* mag)
+{
+	static const double bias[3] = SIM_GYRO_BIAS, field[3] = SIM_MAG_FIELD;
+	double rates[3], dt = sim->Dt;
+	SIM_RATES(scenario, sim->Time, rates);
+	double* q = sim->Q;
+	double dq[4] = {
+		-q[1] * rates[0] - q[2] * rates[1] - q[3] * rates[2],
+		q[0] * rates[0] + q[2] * rates[2] - q[3] * rates[1],
+		q[0] * rates[1] - q[1] * rates[2] + q[3] * rates[0],
+		q[0] * rates[2] + q[1] * rates[1] - q[2] * rates[0]
+	};
+	double norm = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		q[i] += dq[i] * dt / 2;
+		norm += q[i] * q[i];
+	}
+	for (int i = 0; i < 4; i++) q[i] /= sqrt(norm);
+	sim->Time += dt;
+
+	double r[3][3];
+	SIM_MATRIX(sim, r);
+	// Punch-outs push along body -Z on top of gravity
+	double thrust = scenario == SIM_FLIPS && fmod(sim->Time, 3) < 0.4 ? 1.5 : 0;
+	accel[0] = -r[2][0] + 0.02 * SIM_NOISE();
+	accel[1] = -r[2][1] + 0.02 * SIM_NOISE();
+	accel[2] = -r[2][2] - thrust + 0.02 * SIM_NOISE();
+	gyro[0] = (rates[0] * SIM_RAD_TO_DEG + bias[0]) + 0.3 * SIM_NOISE();
+	gyro[1] = -(rates[1] * SIM_RAD_TO_DEG + bias[1]) + 0.3 * SIM_NOISE();
+	gyro[2] = (rates[2] * SIM_RAD_TO_DEG + bias[2]) + 0.3 * SIM_NOISE();
+	if (mag)
+	{
+		for (int k = 0; k < 3; k++) mag[k] = r[0][k] * field[0] + r[1][k] * field[1] + r[2][k] * field[2] + 0.02 * SIM_NOISE();
+	}
+}
+
+// True roll, pitch (nose down positive) and yaw, degrees
+static inline void SIM_ANGLES(const SIM_FRAME* sim, double* angles)
+{
+	double r[3][3];
+	SIM_MATRIX(sim, r);
+	angles[0] = atan2(r[2][1], r[2][2]) * SIM_RAD_TO_DEG;
+	angles[1] = -asin(-r[2][0]) * SIM_RAD_TO_DEG;
+	angles[2] = atan2(r[1][0], r[0][0]) * SIM_RAD_TO_DEG;
+}
+
+#endif /* TEST_ATTITUDE_SIM_H_ */
@@ -0,0 +1,117 @@
+/*
+ * bench_dshot.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** DSHOT encoder benchmark
+The nibble table encoder against the per-bit encoder it replaced, which looped the checksum,
+filled a 24 word packet one bit at a time and copied it into each motor's own buffer. Every
+throttle and telemetry bit has to give the same pulse widths from both, then both are timed
+over the same throttle sweep and reported in nS per 4 motor frame.
+*/
+
+#include <string.h>
+#include "test.h"
+#include "DSHOT.h"
+
+#define MOTORS	4
+#define FRAMES	2000000
+
+#define L		135
+#define H		270
+
+// Per-bit encoder, as DSHOT_SEND_PACKET and makeDshotPacketBytes were before the lookup table
+static uint16_t OLD_PACKET(uint32_t value, uint8_t telemBit)
+{
+	uint16_t packet = (value << 1) | telemBit;
+	int csum = 0;
+	int csumData = packet;
+	for (int i = 0; i < 3; i++)
+	{
+		csum ^= csumData;
+		csumData >>= 4;
+	}
+#ifdef DSHOT_BIDIR
+	csum = ~csum;
+#endif
+	csum &= 0xf;
+	return (packet << 4) | csum;
+}
+
+static void OLD_ENCODE(uint32_t buffers[MOTORS][DSHOT_PACKET_SIZE], const uint16_t* values, uint8_t telemMask)
+{
+	for (int m = 0; m < MOTORS; m++)
+	{
+		uint16_t dshotBytes = OLD_PACKET(values[m], (telemMask >> m) & 1);
+		uint32_t dshotPacket[DSHOT_PACKET_SIZE] = {0};
+		for (int i = 18; i >= 3; i--)
+		{
+			dshotPacket[i] = (dshotBytes & 0b1) ? H : L;
+			dshotBytes >>= 1;
+		}
+		memcpy(buffers[m], dshotPacket, sizeof(dshotPacket));
+	}
+}
+
+// Every throttle and command on every motor position, with and without telemetry
+static void TEST_SAME_FRAMES(const DSHOT_ENCODER* enc)
+{
+	uint32_t old[MOTORS][DSHOT_PACKET_SIZE];
+	uint16_t frame[DSHOT_PACKET_SIZE][MOTORS];
+	uint16_t values[MOTORS];
+	int mismatches = 0;
+	memset(frame, 0, sizeof(frame));
+	for (uint32_t v = 0; v <= DSHOT_MAX_THROTTLE; v++)
+	{
+		for (int m = 0; m < MOTORS; m++) values[m] = (v + 517 * m) & DSHOT_MAX_THROTTLE;
+		uint8_t telemMask = v & 0xf;
+		OLD_ENCODE(old, values, telemMask);
+		DSHOT_ENCODE_THROTTLE(&ESC_PROTOCOLS[ESC_PROTOCOL_DSHOT300], enc, &frame[0][0], values, MOTORS, telemMask);
+		for (int m = 0; m < MOTORS; m++)
+		{
+			for (int row = 0; row < DSHOT_PACKET_SIZE; row++) mismatches += frame[row][m] != old[m][row];
+		}
+	}
+	CHECK(mismatches == 0);
+}
+
+static void BENCH(const DSHOT_ENCODER* enc)
+{
+	static uint32_t old[MOTORS][DSHOT_PACKET_SIZE];
+	static uint16_t frame[DSHOT_PACKET_SIZE][MOTORS];
+	uint16_t values[MOTORS];
+	volatile uint32_t sink = 0;
+
+	double start = TEST_NOW_NS();
+	for (uint32_t i = 0; i < FRAMES; i++)
+	{
+		for (int m = 0; m < MOTORS; m++) values[m] = (i + 517 * m) & DSHOT_MAX_THROTTLE;
+		OLD_ENCODE(old, values, 0);
+		sink += old[i & 3][3 + (i & 15)];
+	}
+	double oldNs = (TEST_NOW_NS() - start) / FRAMES;
+
+	start = TEST_NOW_NS();
+	for (uint32_t i = 0; i < FRAMES; i++)
+	{
+		for (int m = 0; m < MOTORS; m++) values[m] = (i + 517 * m) & DSHOT_MAX_THROTTLE;
+		DSHOT_ENCODE_THROTTLE(&ESC_PROTOCOLS[ESC_PROTOCOL_DSHOT300], enc, &frame[0][0], values, MOTORS, 0);
+		sink += frame[3 + (i & 15)][i & 3];
+	}
+	double newNs = (TEST_NOW_NS() - start) / FRAMES;
+
+	printf("DSHOT encode, %d motors: per-bit %.1f nS/frame, nibble table %.1f nS/frame (%.1fx)\n",
+			MOTORS, oldNs, newNs, oldNs / newNs);
+	(void)sink;
+}
+
+int main(void)
+{
+	DSHOT_ENCODER enc;
+	DSHOT_ENCODER_INIT(&enc, L, H);
+	TEST_SAME_FRAMES(&enc);
+	BENCH(&enc);
+	return TEST_END();
+}
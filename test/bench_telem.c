@@ -0,0 +1,76 @@
+/*
+ * bench_telem.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** ESC telemetry receive benchmark
+A stream of back to back telemetry frames is fed through TELEM_RX_EVENT 32 bytes at a time, the
+half and full transfer cadence of the 64 byte circular buffer. A request is left open at every
+event so a frame of each chunk is published to a slot, the others are checked and dropped. The
+copy into RxBuffer stands in for the DMA and is timed too. Every frame has to pass its CRC, then
+bytes/s and nS per frame are reported against the 11520 bytes/s a 115200 baud line can carry.
+*/
+
+#include <string.h>
+#include "test.h"
+#include "TELEM.h"
+
+#define MOTORS		4
+#define CHUNK		(TELEM_RX_SIZE / 2)
+#define BYTES		200000000
+#define LINE_BYTES	11520.0		// 115200 baud 8N1
+
+static USART_TypeDef usart;
+static DMA_Stream_TypeDef rxStream;
+static DMA_HandleTypeDef hdmarx = {&rxStream};
+static UART_HandleTypeDef huart = {&usart, &hdmarx, 0};
+
+// Frames for every motor and a spread of values, long enough that the ring sees them shift
+static uint8_t stream[TELEM_FRAME_SIZE * CHUNK];
+
+static void MAKE_STREAM(void)
+{
+	for (int n = 0; n < CHUNK; n++)
+	{
+		uint8_t* frame = &stream[n * TELEM_FRAME_SIZE];
+		for (int i = 0; i < TELEM_FRAME_SIZE - 1; i++) frame[i] = n * 31 + i * 7;
+		frame[TELEM_FRAME_SIZE - 1] = TELEM_CRC8(frame, TELEM_FRAME_SIZE - 1);
+	}
+}
+
+static void BENCH(void)
+{
+	TELEM_CONTROLLER* telem;
+	uint32_t offset = 0;
+	volatile uint32_t sink = 0;
+	MOCK_HAL_RESET();
+	MAKE_STREAM();
+	telem = TELEM_INIT(&huart, MOTORS);
+	double start = TEST_NOW_NS();
+	for (uint32_t done = 0; done < BYTES; done += CHUNK)
+	{
+		// DMA fills the half it is in, then the half or full transfer event
+		memcpy(&telem->RxBuffer[done % TELEM_RX_SIZE], &stream[offset], CHUNK);
+		offset = (offset + CHUNK) % sizeof(stream);
+		rxStream.NDTR = TELEM_RX_SIZE - (done + CHUNK) % TELEM_RX_SIZE;
+		telem->Pending = (done / TELEM_FRAME_SIZE) % MOTORS;
+		TELEM_RX_EVENT(telem);
+	}
+	double ns = TEST_NOW_NS() - start;
+	uint32_t frames = 0;
+	for (int m = 0; m < MOTORS; m++) frames += telem->Slots[m].Seq / 2;
+	sink += telem->Slots[0].Data.RPM;
+	CHECK(telem->CrcErrors == 0 && frames == BYTES / CHUNK);
+	printf("TELEM_RX_EVENT: %.0f Mbytes/s, %.1f nS per frame (host), %.0fx a 115200 baud line\n",
+			BYTES / ns * 1e3, ns / (BYTES / TELEM_FRAME_SIZE), BYTES / ns * 1e9 / LINE_BYTES);
+	(void)sink;
+	free(telem);
+}
+
+int main(void)
+{
+	BENCH();
+	return TEST_END();
+}
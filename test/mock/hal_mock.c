@@ -0,0 +1,171 @@
+/*
+ * hal_mock.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Mock HAL
+Just enough of the HAL for the I2C sensor modules, the ESC outputs and the ESC telemetry to run
+on the host. An I2C DMA start records the transfer and refuses a second one until the test
+calls MOCK_I2C_FINISH, the way the peripheral reports busy. Pins read back what was written
+unless the test supplies ReadPin. Timer, DMA stream and UART registers are left to the test,
+which plays the UART DMA by writing the buffer and counting NDTR down itself.
+*/
+
+#include <string.h>
+#include "main.h"
+
+MOCK_HAL mockHal;
+DWT_Type mockDwt;
+GPIO_TypeDef mockGpioB, mockGpioF;
+uint32_t SystemCoreClock = 216000000;
+
+/* Function Summary: Clear everything the mock recorded, interrupts enabled, no DMA running
+ * Return: VOID
+ */
+void MOCK_HAL_RESET(void)
+{
+	memset(&mockHal, 0, sizeof(mockHal));
+	memset(&mockDwt, 0, sizeof(mockDwt));
+	mockGpioB.ODR = 0xFFFF;
+	mockGpioF.ODR = 0xFFFF;
+}
+
+/* Function Summary: The test has played the slave, the peripheral is free again
+ * Return: VOID
+ */
+void MOCK_I2C_FINISH(void)
+{
+	mockHal.Busy = 0;
+}
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef* hi2c)
+{
+	mockHal.Inits++;
+	if (mockHal.Down && mockHal.Primask) mockHal.MaskedInits++;
+	mockHal.Down = 0;
+	hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+	mockHal.Busy = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef* hi2c)
+{
+	(void)hi2c;
+	mockHal.DeInits++;
+	mockHal.Down = 1;
+	mockHal.Busy = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef* hi2c, uint16_t addr, uint16_t reg, uint16_t regSize, uint8_t* data, uint16_t size, uint32_t timeout)
+{
+	(void)hi2c;
+	(void)addr;
+	(void)regSize;
+	(void)timeout;
+	for (int i = 0; i < size && reg + i < 256; i++) mockHal.Regs[reg + i] = data[i];
+	return HAL_OK;
+}
+
+// Both DMA directions, the test finishes the transfer
+static HAL_StatusTypeDef MOCK_DMA_START(uint16_t addr, uint16_t reg, uint8_t* data, uint16_t size, uint8_t read)
+{
+	if (mockHal.StartStatus != HAL_OK) return mockHal.StartStatus;
+	if (mockHal.Busy) return HAL_BUSY;
+	mockHal.Busy = 1;
+	mockHal.Read = read;
+	mockHal.Addr = addr;
+	mockHal.Reg = reg;
+	mockHal.Data = data;
+	mockHal.Size = size;
+	mockHal.Starts++;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef* hi2c, uint16_t addr, uint16_t reg, uint16_t regSize, uint8_t* data, uint16_t size)
+{
+	(void)hi2c;
+	(void)regSize;
+	return MOCK_DMA_START(addr, reg, data, size, 1);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write_DMA(I2C_HandleTypeDef* hi2c, uint16_t addr, uint16_t reg, uint16_t regSize, uint8_t* data, uint16_t size)
+{
+	(void)hi2c;
+	(void)regSize;
+	return MOCK_DMA_START(addr, reg, data, size, 0);
+}
+
+uint32_t HAL_I2C_GetError(I2C_HandleTypeDef* hi2c)
+{
+	return hi2c->ErrorCode;
+}
+
+HAL_StatusTypeDef HAL_I2CEx_ConfigAnalogFilter(I2C_HandleTypeDef* hi2c, uint32_t filter)
+{
+	(void)hi2c;
+	(void)filter;
+	return HAL_OK;
+}
+
+void HAL_I2CEx_EnableFastModePlus(uint32_t fmp)
+{
+	(void)fmp;
+}
+
+void HAL_I2CEx_DisableFastModePlus(uint32_t fmp)
+{
+	(void)fmp;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void)
+{
+	return SystemCoreClock / 4;
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef* port, GPIO_InitTypeDef* init)
+{
+	(void)port;
+	(void)init;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state)
+{
+	if (state == GPIO_PIN_SET) port->ODR |= pin;
+	else port->ODR &= ~pin;
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* port, uint16_t pin)
+{
+	if (mockHal.ReadPin) return mockHal.ReadPin(port, pin);
+	return (port->ODR & pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+uint32_t HAL_GetTick(void)
+{
+	return mockHal.Tick;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef* htim, uint32_t channel)
+{
+	htim->Instance->CCER |= TIM_CCER_CC1E << channel;
+	mockHal.PwmStarts++;
+	return HAL_OK;
+}
+
+// Circular reception, NDTR counts down from size as the test writes bytes into data
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef* huart, uint8_t* data, uint16_t size)
+{
+	(void)data;
+	huart->hdmarx->Instance->NDTR = size;
+	huart->RxState = HAL_UART_STATE_BUSY_RX;
+	mockHal.UartStarts++;
+	return HAL_OK;
+}
+
+void Error_Handler(void)
+{
+	mockHal.Errors++;
+}
@@ -0,0 +1,169 @@
+/*
+ * main.h
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef TEST_MOCK_MAIN_H_
+#define TEST_MOCK_MAIN_H_
+
+/* Stand-in for Core/Inc/main.h and the HAL, just what the I2C sensor modules, the ESC outputs
+ * and the ESC telemetry use. DMA transfers are not run, the test sees what was started in
+ * mockHal and plays the slave by filling the buffer and calling the complete or error path
+ * itself. Timer, DMA stream and UART registers are plain memory the test reads and writes. CMakeLists copies the module headers next to
+ * this file so their #include "main.h" lands here */
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum { HAL_OK = 0, HAL_ERROR, HAL_BUSY, HAL_TIMEOUT } HAL_StatusTypeDef;
+typedef enum { GPIO_PIN_RESET = 0, GPIO_PIN_SET } GPIO_PinState;
+
+typedef struct { uint32_t ODR; } GPIO_TypeDef;
+typedef struct { uint32_t Pin, Mode, Pull, Speed, Alternate; } GPIO_InitTypeDef;
+typedef struct { uint32_t Timing; } I2C_InitTypeDef;
+typedef struct { I2C_InitTypeDef Init; uint32_t ErrorCode; } I2C_HandleTypeDef;
+typedef struct { uint32_t CYCCNT; } DWT_Type;
+
+// Register order matters where the modules index from CCMR1 and CCR1
+typedef struct
+{
+	volatile uint32_t CR1, CR2, SMCR, DIER, SR, EGR, CCMR1, CCMR2, CCER, CNT, PSC, ARR, RCR;
+	volatile uint32_t CCR1, CCR2, CCR3, CCR4, BDTR, DCR, DMAR;
+} TIM_TypeDef;
+typedef struct { TIM_TypeDef* Instance; } TIM_HandleTypeDef;
+typedef struct { volatile uint32_t CR, NDTR, PAR, M0AR, M1AR, FCR; } DMA_Stream_TypeDef;
+typedef struct { DMA_Stream_TypeDef* Instance; } DMA_HandleTypeDef;
+typedef struct { volatile uint32_t CR1, ISR; } USART_TypeDef;
+typedef struct { USART_TypeDef* Instance; DMA_HandleTypeDef* hdmarx; volatile uint32_t RxState; } UART_HandleTypeDef;
+
+#define GPIO_PIN_3					((uint16_t)0x0008)
+#define GPIO_PIN_8					((uint16_t)0x0100)
+#define GPIO_PIN_9					((uint16_t)0x0200)
+#define GPIO_MODE_OUTPUT_OD			0x11u
+#define GPIO_NOPULL					0x00u
+#define GPIO_SPEED_FREQ_VERY_HIGH	0x03u
+#define I2C_MEMADD_SIZE_8BIT		0x01u
+#define I2C_ANALOGFILTER_ENABLE		0x00u
+#define HAL_I2C_ERROR_NONE			0x00u
+#define HAL_I2C_ERROR_BERR			0x01u
+#define HAL_I2C_ERROR_ARLO			0x02u
+#define HAL_I2C_ERROR_AF			0x04u
+#define HAL_I2C_ERROR_OVR			0x08u
+#define HAL_I2C_ERROR_DMA			0x10u
+#define HAL_I2C_ERROR_TIMEOUT		0x20u
+
+#define TIM_CHANNEL_1				0x00u
+#define TIM_CHANNEL_2				0x04u
+#define TIM_CHANNEL_3				0x08u
+#define TIM_CHANNEL_4				0x0Cu
+#define TIM_CCMR1_CC1S_0			0x00000001u
+#define TIM_CCMR1_OC1PE				0x00000008u
+#define TIM_CCMR1_OC1M_1			0x00000020u
+#define TIM_CCMR1_OC1M_2			0x00000040u
+#define TIM_CCMR1_OC1M_3			0x00010000u
+#define TIM_CCER_CC1E				0x0001u
+#define TIM_CCER_CC1P				0x0002u
+#define TIM_CCER_CC1NP				0x0008u
+#define TIM_DIER_UIE				0x0001u
+#define TIM_DIER_CC1DE				0x0200u
+#define TIM_DMA_UPDATE				0x0100u
+#define TIM_DMA_CC2					0x0400u
+#define TIM_DMABASE_CCR1			0x0Du
+#define TIM_DCR_DBL_Pos				8u
+#define TIM_EGR_UG					0x01u
+#define TIM_SR_UIF					0x01u
+#define DMA_SxCR_EN					0x0001u
+#define DMA_SxCR_TCIE				0x0010u
+#define DMA_SxCR_DIR_0				0x0040u
+#define DMA_SxCR_DIR				0x00C0u
+#define DMA_IT_TC					DMA_SxCR_TCIE
+#define UART_FLAG_IDLE				0x0010u
+#define UART_IT_IDLE				0x0010u
+#define HAL_UART_STATE_READY		0x20u
+#define HAL_UART_STATE_BUSY_RX		0x22u
+
+// Stream flags live in the shared DMA status registers on the target, nothing to clear here
+#define __HAL_DMA_GET_TC_FLAG_INDEX(H)	0x20u
+#define __HAL_DMA_GET_HT_FLAG_INDEX(H)	0x10u
+#define __HAL_DMA_GET_TE_FLAG_INDEX(H)	0x08u
+#define __HAL_DMA_GET_FE_FLAG_INDEX(H)	0x01u
+#define __HAL_DMA_CLEAR_FLAG(H, F)		((void)(H), (void)(F))
+#define __HAL_DMA_ENABLE(H)				((H)->Instance->CR |= DMA_SxCR_EN)
+#define __HAL_DMA_DISABLE(H)			((H)->Instance->CR &= ~DMA_SxCR_EN)
+#define __HAL_DMA_GET_COUNTER(H)		((H)->Instance->NDTR)
+#define __HAL_UART_GET_FLAG(H, F)		(((H)->Instance->ISR & (F)) == (F))
+#define __HAL_UART_CLEAR_IDLEFLAG(H)	((H)->Instance->ISR &= ~UART_FLAG_IDLE)
+#define __HAL_UART_ENABLE_IT(H, I)		((H)->Instance->CR1 |= (I))
+
+extern GPIO_TypeDef mockGpioB, mockGpioF;
+#define GPIOB						(&mockGpioB)
+#define GPIOF						(&mockGpioF)
+#define XLG_INT1_Pin				GPIO_PIN_3
+#define XLG_INT1_GPIO_Port			GPIOF
+
+/* What the mock HAL saw and what it does next */
+typedef struct MOCK_HAL
+{
+	uint32_t Primask;					// 1 while interrupts are masked
+	uint32_t CycleStep;					// DWT->CYCCNT advance per read, busy waits need it
+	uint8_t Regs[256];					// Written by blocking HAL_I2C_Mem_Write
+	uint8_t Busy;						// DMA transfer started and not yet finished by the test
+	uint8_t Read;
+	uint16_t Addr;
+	uint16_t Reg;
+	uint8_t* Data;
+	uint16_t Size;
+	HAL_StatusTypeDef StartStatus;		// Returned by the next DMA starts
+	uint32_t Starts;
+	uint32_t Inits;
+	uint32_t DeInits;
+	uint8_t Down;						// DeInit ran, the next Init runs the MSP init
+	uint32_t MaskedInits;				// MSP inits run with interrupts masked, would hang on HAL_GetTick
+	GPIO_PinState (*ReadPin)(GPIO_TypeDef* port, uint16_t pin);		// NULL reads every pin high
+	uint32_t Tick;						// HAL_GetTick
+	uint32_t PwmStarts;
+	uint32_t UartStarts;
+	uint32_t Errors;					// Error_Handler calls, the target would hang
+	void (*Dmb)(void);					// Runs at every barrier, lets a test land an interrupt there
+} MOCK_HAL;
+
+extern MOCK_HAL mockHal;
+extern DWT_Type mockDwt;
+extern uint32_t SystemCoreClock;
+
+static inline DWT_Type* MOCK_DWT(void)
+{
+	mockDwt.CYCCNT += mockHal.CycleStep;
+	return &mockDwt;
+}
+#define DWT		MOCK_DWT()
+
+static inline uint32_t __get_PRIMASK(void) { return mockHal.Primask; }
+static inline void __set_PRIMASK(uint32_t primask) { mockHal.Primask = primask; }
+static inline void __disable_irq(void) { mockHal.Primask = 1; }
+static inline void __enable_irq(void) { mockHal.Primask = 0; }
+static inline void __DMB(void) { if (mockHal.Dmb) mockHal.Dmb(); }
+
+void MOCK_HAL_RESET(void);
+void MOCK_I2C_FINISH(void);
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef* hi2c);
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef* hi2c);
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef* hi2c, uint16_t addr, uint16_t reg, uint16_t regSize, uint8_t* data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef* hi2c, uint16_t addr, uint16_t reg, uint16_t regSize, uint8_t* data, uint16_t size);
+HAL_StatusTypeDef HAL_I2C_Mem_Write_DMA(I2C_HandleTypeDef* hi2c, uint16_t addr, uint16_t reg, uint16_t regSize, uint8_t* data, uint16_t size);
+uint32_t HAL_I2C_GetError(I2C_HandleTypeDef* hi2c);
+HAL_StatusTypeDef HAL_I2CEx_ConfigAnalogFilter(I2C_HandleTypeDef* hi2c, uint32_t filter);
+void HAL_I2CEx_EnableFastModePlus(uint32_t fmp);
+void HAL_I2CEx_DisableFastModePlus(uint32_t fmp);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+void HAL_GPIO_Init(GPIO_TypeDef* port, GPIO_InitTypeDef* init);
+void HAL_GPIO_WritePin(GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* port, uint16_t pin);
+uint32_t HAL_GetTick(void);
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef* htim, uint32_t channel);
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef* huart, uint8_t* data, uint16_t size);
+void Error_Handler(void);
+
+#endif /* TEST_MOCK_MAIN_H_ */
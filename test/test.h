@@ -0,0 +1,43 @@
+/*
+ * test.h
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+#ifndef TEST_TEST_H_
+#define TEST_TEST_H_
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+/* Host test helpers, a failed check prints where it was and the test carries on so one run
+ * shows every failure. main returns TEST_END() */
+static int testFailures = 0;
+
+#define CHECK(COND) do { \
+	if (!(COND)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #COND); testFailures++; } \
+} while (0)
+
+#define CHECK_NEAR(A, B, TOL) do { \
+	double a_ = (A), b_ = (B); \
+	if (!(fabs(a_ - b_) <= (TOL))) { \
+		printf("%s:%d: CHECK_NEAR(%s, %s) failed, %g vs %g\n", __FILE__, __LINE__, #A, #B, a_, b_); \
+		testFailures++; \
+	} \
+} while (0)
+
+#define TEST_END() (printf("%s: %s\n", __FILE__, testFailures ? "FAILED" : "ok"), testFailures != 0)
+
+/* Function Summary: Monotonic host clock for the benchmarks
+ * Return: nS
+ */
+static inline double TEST_NOW_NS(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#endif /* TEST_TEST_H_ */
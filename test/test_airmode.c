@@ -0,0 +1,149 @@
+/*
+ * test_airmode.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Mixer desaturation tests
+Sweeps throttle and roll/pitch/yaw over every layout and mode. What each axis actually got is
+read back out of the motor outputs by projecting them onto that axis's weights, the layouts
+are orthogonal so the other axes and throttle drop out. Reports the authority each mode
+loses against the demand, and checks
+- no output ever leaves the limits
+- airmode keeps the whole differential whenever it fits between the limits
+- airmode RP keeps the whole roll and pitch whenever they fit, giving up yaw first
+- both airmodes lose less than clamping every motor on its own
+*/
+
+#include "test.h"
+#include "MIXER.h"
+
+#define MIN_IDLE		250
+#define MAX_THROTTLE	2047
+// Truncation to whole DSHOT steps on every motor
+#define OUT_TOLERANCE	1.0
+
+static const char* modeNames[MIXER_MODE_COUNT] = {"clamp", "airmode", "airmode RP"};
+
+/* Function Summary: Axis demand the motors actually carry
+ * Param: layout - Frame geometry
+ * Param: out - Motor outputs
+ * Param: axis - 1 roll, 2 pitch, 3 yaw (MIXER_AXES member order)
+ * Return: Demand in output units
+ */
+static float REALISED(const MIXER_LAYOUT* layout, const uint32_t* out, int axis)
+{
+	float num = 0, den = 0;
+	for (int m = 0; m < layout->MotorCount; m++)
+	{
+		float w = (&layout->Weights[m].Throttle)[axis];
+		num += w * out[m];
+		den += w * w;
+	}
+	return num / den;
+}
+
+// Spread of a motor vector built from some of the axes
+static float SPAN(const MIXER_LAYOUT* layout, const MIXER_AXES* demand, int withYaw)
+{
+	float lo = 1e9f, hi = -1e9f;
+	for (int m = 0; m < layout->MotorCount; m++)
+	{
+		const MIXER_AXES* w = &layout->Weights[m];
+		float v = w->Roll * demand->Roll + w->Pitch * demand->Pitch + (withYaw ? w->Yaw * demand->Yaw : 0);
+		if (v < lo) lo = v;
+		if (v > hi) hi = v;
+	}
+	return hi - lo;
+}
+
+static void TEST_SWEEP(void)
+{
+	float span = MAX_THROTTLE - MIN_IDLE;
+	for (int l = 0; l < MIXER_LAYOUT_COUNT; l++)
+	{
+		const MIXER_LAYOUT* layout = &MIXER_LAYOUTS[l];
+		double lostTotal[MIXER_MODE_COUNT] = {0};
+		for (int mode = 0; mode < MIXER_MODE_COUNT; mode++)
+		{
+			double lost[4] = {0}, want[4] = {0};
+			int outside = 0, diffLost = 0, rpLost = 0;
+			for (int t = 0; t <= MAX_THROTTLE; t += 31)
+			{
+				for (int r = -600; r <= 600; r += 75)
+				{
+					for (int p = -600; p <= 600; p += 85)
+					{
+						for (int y = -600; y <= 600; y += 95)
+						{
+							MIXER_AXES demand = {t, r, p, y};
+							uint32_t out[MIXER_MAX_MOTORS];
+							MIXER_APPLY(layout, &demand, mode, MIN_IDLE, MAX_THROTTLE, out);
+							for (int m = 0; m < layout->MotorCount; m++) outside += out[m] < MIN_IDLE || out[m] > MAX_THROTTLE;
+							float got[4] = {0, REALISED(layout, out, 1), REALISED(layout, out, 2), REALISED(layout, out, 3)};
+							float asked[4] = {0, demand.Roll, demand.Pitch, demand.Yaw};
+							for (int a = 1; a < 4; a++)
+							{
+								want[a] += fabsf(asked[a]);
+								lost[a] += fabsf(asked[a] - got[a]);
+							}
+							int rpWhole = fabsf(got[1] - asked[1]) <= OUT_TOLERANCE && fabsf(got[2] - asked[2]) <= OUT_TOLERANCE;
+							int yawWhole = fabsf(got[3] - asked[3]) <= OUT_TOLERANCE;
+							if (mode == MIXER_MODE_AIRMODE && SPAN(layout, &demand, 1) <= span) diffLost += !(rpWhole && yawWhole);
+							if (mode == MIXER_MODE_AIRMODE_RP && SPAN(layout, &demand, 0) <= span) rpLost += !rpWhole;
+						}
+					}
+				}
+			}
+			CHECK(outside == 0);
+			CHECK(diffLost == 0);
+			CHECK(rpLost == 0);
+			lostTotal[mode] = (lost[1] + lost[2] + lost[3]) / (want[1] + want[2] + want[3]);
+			printf("%-9s %-10s authority lost: roll %5.1f%% pitch %5.1f%% yaw %5.1f%%\n", layout->Name, modeNames[mode],
+					100 * lost[1] / want[1], 100 * lost[2] / want[2], 100 * lost[3] / want[3]);
+		}
+		CHECK(lostTotal[MIXER_MODE_AIRMODE] < lostTotal[MIXER_MODE_CLAMP]);
+		CHECK(lostTotal[MIXER_MODE_AIRMODE_RP] < lostTotal[MIXER_MODE_CLAMP]);
+	}
+}
+
+// Full throttle punch-out with a roll, clamping loses half the roll, airmode drops throttle instead
+static void TEST_PUNCH_OUT(void)
+{
+	const MIXER_LAYOUT* layout = &MIXER_LAYOUTS[MIXER_QUAD_X];
+	MIXER_AXES demand = {MAX_THROTTLE, 200, 0, 0};
+	uint32_t out[MIXER_MAX_MOTORS];
+	MIXER_APPLY(layout, &demand, MIXER_MODE_CLAMP, MIN_IDLE, MAX_THROTTLE, out);
+	CHECK_NEAR(REALISED(layout, out, 1), 100, OUT_TOLERANCE);
+	MIXER_APPLY(layout, &demand, MIXER_MODE_AIRMODE, MIN_IDLE, MAX_THROTTLE, out);
+	CHECK_NEAR(REALISED(layout, out, 1), 200, OUT_TOLERANCE);
+	CHECK(out[0] == MAX_THROTTLE && out[1] == MAX_THROTTLE - 400);
+	// Zero throttle dive, airmode lifts the low side off idle to keep the roll
+	demand.Throttle = 0;
+	MIXER_APPLY(layout, &demand, MIXER_MODE_AIRMODE, MIN_IDLE, MAX_THROTTLE, out);
+	CHECK(out[1] == MIN_IDLE && out[0] == MIN_IDLE + 400);
+}
+
+// More yaw than fits beside a full roll, RP mode keeps the roll and shrinks yaw into what is left
+static void TEST_YAW_FIRST(void)
+{
+	const MIXER_LAYOUT* layout = &MIXER_LAYOUTS[MIXER_QUAD_X];
+	MIXER_AXES demand = {1000, 600, 0, 600};
+	uint32_t out[MIXER_MAX_MOTORS];
+	float span = MAX_THROTTLE - MIN_IDLE;
+	MIXER_APPLY(layout, &demand, MIXER_MODE_AIRMODE_RP, MIN_IDLE, MAX_THROTTLE, out);
+	CHECK_NEAR(REALISED(layout, out, 1), 600, OUT_TOLERANCE);
+	CHECK_NEAR(REALISED(layout, out, 3), (span - 1200) / 2, OUT_TOLERANCE);
+	// Plain airmode scales both by the same factor
+	MIXER_APPLY(layout, &demand, MIXER_MODE_AIRMODE, MIN_IDLE, MAX_THROTTLE, out);
+	CHECK_NEAR(REALISED(layout, out, 1) / REALISED(layout, out, 3), 1.0, 0.01);
+}
+
+int main(void)
+{
+	TEST_SWEEP();
+	TEST_PUNCH_OUT();
+	TEST_YAW_FIRST();
+	return TEST_END();
+}
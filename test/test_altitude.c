@@ -0,0 +1,191 @@
+/*
+ * test_altitude.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Altitude tests
+ALTITUDE_FROM_PRESSURE against the standard atmosphere in double precision, every 0.5m from
+-500m to 9km over a low, standard and high ground pressure, with powf in float alongside for
+comparison. Then the complementary filter: the ground reference, a 10m barometer step against
+the closed form response of the triple pole at -1 / tau, and an accelerometer bias step that
+the filter has to learn while holding altitude. Conversion, predict and correct are timed at
+the end.
+*/
+
+#include "test.h"
+#include <stdlib.h>
+#include "ALTITUDE.h"
+
+#define SCALE		44330.8
+#define EXPONENT	0.190263
+#define SAMPLE_HZ	1660
+#define BARO_DIVIDER	66			// Gyro samples per barometer sample, ~25Hz
+#define TAU			1.0f
+#define CALLS		20000000
+
+static const float grounds[] = {950.0f, 1013.25f, 1050.0f};
+
+// Standard atmosphere both ways, double precision
+static double REF_HEIGHT(double pressure, double ground)
+{
+	return SCALE * (1 - pow(pressure / ground, EXPONENT));
+}
+
+static double REF_PRESSURE(double height, double ground)
+{
+	return ground * pow(1 - height / SCALE, 1 / EXPONENT);
+}
+
+static void TEST_CONVERSION(void)
+{
+	double worstLow = 0, worstHigh = 0, worstPowf = 0;
+	for (unsigned g = 0; g < sizeof(grounds) / sizeof(grounds[0]); g++)
+	{
+		for (double h = -500; h <= 9000; h += 0.5)
+		{
+			// Against the float pressure the function actually gets
+			float p = REF_PRESSURE(h, grounds[g]);
+			double ref = REF_HEIGHT(p, grounds[g]);
+			double err = fabs(ALTITUDE_FROM_PRESSURE(p, grounds[g]) - ref);
+			double errPowf = fabs(44330.8f * (1 - powf(p / grounds[g], 0.190263f)) - ref);
+			if (h <= 4000)
+			{
+				worstLow = fmax(worstLow, err);
+				worstPowf = fmax(worstPowf, errPowf);
+			}
+			else worstHigh = fmax(worstHigh, err);
+		}
+	}
+	CHECK(worstLow < 0.001);
+	CHECK(worstHigh < 1.64);
+	CHECK_NEAR(ALTITUDE_FROM_PRESSURE(1013.25f, 1013.25f), 0, 1e-9);
+	printf("ALTITUDE_FROM_PRESSURE worst error: %.2f mm to 4km (powf %.2f mm), %.2f m to 9km\n", worstLow * 1000,
+			worstPowf * 1000, worstHigh);
+}
+
+/* Function Summary: Run the filter level and still apart from what the callers pass in
+ * Param: alt - Filter state
+ * Param: seconds - How long
+ * Param: height - Height the barometer sees, m
+ * Param: accelBias - Error on the vertical accelerometer, m/s^2
+ * Param: trace - Altitude at each barometer sample from the start of the run, NULL if not wanted
+ * Return: VOID
+ */
+static void FLY(ALTITUDE_CONTROLLER* alt, float seconds, double height, double accelBias, float* trace)
+{
+	const float down[3] = {0, 0, 1};
+	const float accel[3] = {0, 0, -1 - accelBias / ALTITUDE_GRAVITY};
+	for (int k = 1; k <= seconds * SAMPLE_HZ; k++)
+	{
+		ALTITUDE_PREDICT(alt, down, accel, 1.0f / SAMPLE_HZ);
+		if (k % BARO_DIVIDER) continue;
+		ALTITUDE_CORRECT(alt, REF_PRESSURE(height, 1013.25), (float)BARO_DIVIDER / SAMPLE_HZ);
+		if (trace) trace[k / BARO_DIVIDER - 1] = alt->Altitude;
+	}
+}
+
+// Nothing moves until the ground reference is in
+static void TEST_GROUND(void)
+{
+	const float down[3] = {0, 0, 1}, accel[3] = {0, 0, -1.5f};
+	ALTITUDE_CONTROLLER* alt = ALTITUDE_INIT(TAU);
+	for (int i = 0; i < ALTITUDE_GROUND_SAMPLES; i++)
+	{
+		CHECK(!alt->Primed);
+		ALTITUDE_PREDICT(alt, down, accel, 0.01f);
+		ALTITUDE_CORRECT(alt, 1013.0f + (i & 1) * 0.5f, 0.04f);
+	}
+	CHECK(alt->Primed && alt->Altitude == 0 && alt->Velocity == 0);
+	CHECK_NEAR(alt->Ground, 1013.0f + 0.5f * (ALTITUDE_GROUND_SAMPLES / 2) / ALTITUDE_GROUND_SAMPLES, 1e-3);
+	free(alt);
+}
+
+// Barometer jumps 10m with the accelerometer still. All three poles at -1 / tau make the error
+// e^(-t / tau) * (1 - 2t / tau + (t / tau)^2 / 2), it overshoots once by 21% and settles
+static void TEST_BARO_STEP(void)
+{
+	static float trace[20 * SAMPLE_HZ / BARO_DIVIDER];
+	ALTITUDE_CONTROLLER* alt = ALTITUDE_INIT(TAU);
+	double worst = 0, peak = 0, peakRef = 0;
+	FLY(alt, 2, 0, 0, NULL);
+	FLY(alt, 20, 10, 0, trace);
+	for (unsigned i = 0; i < sizeof(trace) / sizeof(trace[0]); i++)
+	{
+		double t = (i + 1) * (double)BARO_DIVIDER / SAMPLE_HZ / TAU;
+		double ref = 10 * (1 - exp(-t) * (1 - 2 * t + t * t / 2));
+		worst = fmax(worst, fabs(trace[i] - ref));
+		peak = fmax(peak, trace[i]);
+		peakRef = fmax(peakRef, ref);
+	}
+	// Corrections come at 25Hz, each closing 0.12 of the gap, so the sampled response trails the
+	// continuous one a little
+	CHECK(worst < 0.3);
+	CHECK_NEAR(peak, peakRef, 0.3);
+	CHECK_NEAR(alt->Altitude, 10, 0.01);
+	CHECK_NEAR(alt->Velocity, 0, 0.01);
+	CHECK_NEAR(alt->Bias, 0, 0.01);
+	printf("10m barometer step: peak %.2f m (closed form %.2f m), worst difference %.3f m\n", peak, peakRef, worst);
+	free(alt);
+}
+
+// Accelerometer reads 0.3m/s^2 of climb that isn't there. The bias is learnt and the altitude
+// comes back to the barometer's
+static void TEST_BIAS_STEP(void)
+{
+	ALTITUDE_CONTROLLER* alt = ALTITUDE_INIT(TAU);
+	FLY(alt, 2, 0, 0, NULL);
+	FLY(alt, 2, 0, 0.3, NULL);
+	double drift = alt->Altitude;
+	FLY(alt, 20, 0, 0.3, NULL);
+	CHECK(drift > 0.05 && drift < 0.6);
+	CHECK_NEAR(alt->Bias, 0.3, 0.01);
+	CHECK_NEAR(alt->Altitude, 0, 0.01);
+	CHECK_NEAR(alt->Velocity, 0, 0.01);
+	printf("0.3m/s^2 accelerometer bias: %.2f m off after 2s, bias learnt %.3f m/s^2\n", drift, alt->Bias);
+	free(alt);
+}
+
+static void BENCH(void)
+{
+	static float pressures[1024];
+	const float down[3] = {0, 0, 1};
+	float accel[3] = {0, 0, -1};
+	volatile float sink = 0;
+	double start, fast, slow, predict, correct;
+	for (int i = 0; i < 1024; i++) pressures[i] = 900 + i * 0.11f;
+	start = TEST_NOW_NS();
+	for (int i = 0; i < CALLS; i++) sink += ALTITUDE_FROM_PRESSURE(pressures[i & 1023], 1013.25f);
+	fast = (TEST_NOW_NS() - start) / CALLS;
+	start = TEST_NOW_NS();
+	for (int i = 0; i < CALLS; i++) sink += 44330.8f * (1 - powf(pressures[i & 1023] / 1013.25f, 0.190263f));
+	slow = (TEST_NOW_NS() - start) / CALLS;
+	ALTITUDE_CONTROLLER* alt = ALTITUDE_INIT(TAU);
+	FLY(alt, 2, 0, 0, NULL);
+	start = TEST_NOW_NS();
+	for (int i = 0; i < CALLS; i++)
+	{
+		accel[0] = (i & 15) * 1e-3f;
+		ALTITUDE_PREDICT(alt, down, accel, 1.0f / SAMPLE_HZ);
+	}
+	predict = (TEST_NOW_NS() - start) / CALLS;
+	start = TEST_NOW_NS();
+	for (int i = 0; i < CALLS; i++) ALTITUDE_CORRECT(alt, pressures[i & 1023], 0.04f);
+	correct = (TEST_NOW_NS() - start) / CALLS;
+	sink += alt->Altitude;
+	(void)sink;
+	printf("ALTITUDE_FROM_PRESSURE %.1f nS, powf %.1f nS, PREDICT %.1f nS, CORRECT %.1f nS (host)\n", fast, slow, predict,
+			correct);
+	free(alt);
+}
+
+int main(void)
+{
+	TEST_CONVERSION();
+	TEST_GROUND();
+	TEST_BARO_STEP();
+	TEST_BIAS_STEP();
+	BENCH();
+	return TEST_END();
+}
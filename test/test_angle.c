@@ -0,0 +1,145 @@
+/*
+ * test_angle.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Angle mode tests
+The outer attitude loop closed through the rate PID around a simulated airframe, roll and
+pitch each a motor lag into angular acceleration with drag. The accelerometer sees gravity at
+the true tilt and the gyro carries a constant bias. main.c's gains, decimation and limits.
+*/
+
+#include "test.h"
+#include "PID.h"
+#include "ATTITUDE.h"
+
+#define SAMPLE_HZ		1660.0f
+#define ANGLE_DIVIDER	2
+#define ANGLE_KP		6.0f
+#define ANGLE_MAX		45.0f
+#define MAX_RATE		500.0f
+#define OUT_LIMIT		500.0f
+#define DEG_TO_RAD		0.01745329f
+
+static const PID_GAINS flightGains[PID_AXES] = {
+	{0.8f, 1.5f, 0.010f, 200.0f},
+	{0.8f, 1.5f, 0.010f, 200.0f},
+	{1.5f, 2.0f, 0.0f, 200.0f}
+};
+
+/* Roll and pitch of the simulated frame, degrees, nose down pitch positive */
+typedef struct AIRFRAME
+{
+	float Angle[2];
+	float Rate[2];
+	float Torque[2];
+} AIRFRAME;
+
+// Specific force in g at a roll and nose down pitch, X forward / Y right / Z down
+static void AIRFRAME_ACCEL(const AIRFRAME* frame, float* accel)
+{
+	float roll = frame->Angle[0] * DEG_TO_RAD, pitchUp = -frame->Angle[1] * DEG_TO_RAD;
+	accel[0] = sinf(pitchUp);
+	accel[1] = -sinf(roll) * cosf(pitchUp);
+	accel[2] = -cosf(roll) * cosf(pitchUp);
+}
+
+/* Function Summary: Fly the angle loop for a while
+ * Param: att - Attitude state
+ * Param: pid - Rate loop
+ * Param: frame - Simulated frame, updated
+ * Param: stickRoll - Roll stick, -1 to 1
+ * Param: stickPitch - Pitch stick, -1 to 1
+ * Param: seconds - How long
+ * Param: peak - Returns the largest roll and pitch seen, NULL if not wanted
+ * Return: VOID
+ */
+static void FLY(ATTITUDE_CONTROLLER* att, PID_CONTROLLER* pid, AIRFRAME* frame, float stickRoll, float stickPitch,
+				float seconds, float* peak)
+{
+	float dt = 1.0f / SAMPLE_HZ;
+	for (int i = 0; i < seconds * SAMPLE_HZ; i++)
+	{
+		float gyro[3] = {frame->Rate[0] + 0.5f, frame->Rate[1] - 0.3f, 0.2f};
+		float accel[3];
+		AIRFRAME_ACCEL(frame, accel);
+		ATTITUDE_UPDATE(att, gyro, accel, NULL, stickRoll, stickPitch);
+		float target[PID_AXES] = {att->RateTarget[PID_ROLL], att->RateTarget[PID_PITCH], 0};
+		float out[PID_AXES];
+		PID_UPDATE(pid, target, gyro, out);
+		for (int a = 0; a < 2; a++)
+		{
+			frame->Torque[a] += (out[a] - frame->Torque[a]) * dt / 0.02f;
+			frame->Rate[a] += (frame->Torque[a] * 8 - frame->Rate[a]) * dt;
+			frame->Angle[a] += frame->Rate[a] * dt;
+			if (peak && fabsf(frame->Angle[a]) > peak[a]) peak[a] = fabsf(frame->Angle[a]);
+		}
+	}
+}
+
+// The outer loop runs on every ANGLE_DIVIDER-th sample only
+static void TEST_DECIMATION(void)
+{
+	ATTITUDE_CONTROLLER* att = ATTITUDE_INIT(SAMPLE_HZ, ANGLE_DIVIDER, ATTITUDE_MAHONY, ANGLE_KP, ANGLE_MAX, MAX_RATE);
+	float gyro[3] = {0}, accel[3] = {0, 0, -1};
+	int steps = 0;
+	for (int i = 0; i < 100; i++)
+	{
+		uint8_t ran = ATTITUDE_UPDATE(att, gyro, accel, NULL, 0, 0);
+		CHECK(ran == ((i + 1) % ANGLE_DIVIDER == 0));
+		steps += ran;
+	}
+	CHECK(steps == 100 / ANGLE_DIVIDER);
+	free(att);
+}
+
+// Tilt error maps to rate with the right sign and scale, clamped at MaxRate
+static void TEST_RATE_TARGETS(void)
+{
+	ATTITUDE_CONTROLLER* att = ATTITUDE_INIT(SAMPLE_HZ, 1, ATTITUDE_MAHONY, ANGLE_KP, ANGLE_MAX, 100.0f);
+	AIRFRAME frame = {{10, -5}, {0}, {0}};
+	float gyro[3] = {0}, accel[3];
+	AIRFRAME_ACCEL(&frame, accel);
+	ATTITUDE_UPDATE(att, gyro, accel, NULL, 0, 0);
+	CHECK_NEAR(att->Roll, 10, 0.05);
+	CHECK_NEAR(att->Pitch, -5, 0.05);
+	CHECK_NEAR(att->RateTarget[PID_ROLL], -60, 0.5);
+	CHECK_NEAR(att->RateTarget[PID_PITCH], 30, 0.5);
+	ATTITUDE_UPDATE(att, gyro, accel, NULL, -1, 1);
+	CHECK(att->RateTarget[PID_ROLL] == -100.0f);
+	CHECK(att->RateTarget[PID_PITCH] == 100.0f);
+	free(att);
+}
+
+// Sticks centred from a 10 / -5 degree tilt levels out, then a held stick holds its tilt
+static void TEST_SELF_LEVEL(void)
+{
+	ATTITUDE_CONTROLLER* att = ATTITUDE_INIT(SAMPLE_HZ, ANGLE_DIVIDER, ATTITUDE_MAHONY, ANGLE_KP, ANGLE_MAX, MAX_RATE);
+	PID_CONTROLLER* pid = PID_INIT(flightGains, SAMPLE_HZ, OUT_LIMIT);
+	AIRFRAME frame = {{10, -5}, {0}, {0}};
+	FLY(att, pid, &frame, 0, 0, 1.5f, NULL);
+	CHECK_NEAR(frame.Angle[0], 0, 1.0);
+	CHECK_NEAR(frame.Angle[1], 0, 1.0);
+	float peak[2] = {0};
+	FLY(att, pid, &frame, 0.5f, -0.3f, 2.0f, peak);
+	CHECK_NEAR(frame.Angle[0], 0.5f * ANGLE_MAX, 1.5);
+	CHECK_NEAR(frame.Angle[1], -0.3f * ANGLE_MAX, 1.5);
+	CHECK(peak[0] < 0.5f * ANGLE_MAX * 1.25f);
+	CHECK(peak[1] < 0.3f * ANGLE_MAX * 1.25f);
+	CHECK_NEAR(att->Roll, frame.Angle[0], 1.0);
+	CHECK_NEAR(att->Pitch, frame.Angle[1], 1.0);
+	printf("Angle mode: held %.1f / %.1f deg for 22.5 / -13.5, peak %.1f / %.1f\n",
+			frame.Angle[0], frame.Angle[1], peak[0], peak[1]);
+	free(att);
+	free(pid);
+}
+
+int main(void)
+{
+	TEST_DECIMATION();
+	TEST_RATE_TARGETS();
+	TEST_SELF_LEVEL();
+	return TEST_END();
+}
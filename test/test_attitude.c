@@ -0,0 +1,127 @@
+/*
+ * test_attitude.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Mahony attitude tests
+The estimate seeds from the accelerometer, then flies each attitude_sim.h manoeuvre for 20s
+with a biased, noisy gyro. Roll and pitch have to stay within a degree or two of the truth
+after the first 3s, flips and punch-outs included. Sitting still for longer the I-term has to
+learn the gyro bias, as much of it as gravity can show. Timed per sample at the end.
+*/
+
+#include "test.h"
+#include "attitude_sim.h"
+#include "ATTITUDE.h"
+
+#define SAMPLE_HZ	1660.0f
+#define CALLS		5000000
+
+static const char* scenarioNames[SIM_COUNT] = {"still", "wander", "flips"};
+
+// Worst and mean tilt error allowed per scenario, degrees
+static const float maxError[SIM_COUNT] = {1.0f, 2.5f, 2.5f};
+static const float meanError[SIM_COUNT] = {0.5f, 0.75f, 1.0f};
+
+// First sample seeds roll and pitch straight from the accelerometer
+static void TEST_SEED(void)
+{
+	ATTITUDE_CONTROLLER* att = ATTITUDE_INIT(SAMPLE_HZ, 1, ATTITUDE_MAHONY, 6, 45, 500);
+	float gyro[3] = {0}, accel[3] = {0.5f, -0.5f, -0.70710678f};
+	CHECK(!att->Primed);
+	ATTITUDE_UPDATE(att, gyro, accel, NULL, 0, 0);
+	CHECK(att->Primed);
+	CHECK_NEAR(att->Roll, 35.26, 0.05);
+	CHECK_NEAR(att->Pitch, -30, 0.05);
+	CHECK_NEAR(att->Q[0] * att->Q[0] + att->Q[1] * att->Q[1] + att->Q[2] * att->Q[2] + att->Q[3] * att->Q[3], 1, 1e-5);
+	free(att);
+}
+
+static void TEST_SCENARIOS(void)
+{
+	for (int s = 0; s < SIM_COUNT; s++)
+	{
+		SIM_FRAME sim;
+		SIM_INIT(&sim, SAMPLE_HZ, s + 1);
+		ATTITUDE_CONTROLLER* att = ATTITUDE_INIT(SAMPLE_HZ, 1, ATTITUDE_MAHONY, 6, 45, 500);
+		double worst = 0, sum = 0;
+		int n = 0;
+		for (int i = 0; i < 20 * SAMPLE_HZ; i++)
+		{
+			float gyro[3], accel[3];
+			double truth[3];
+			SIM_STEP(&sim, s, gyro, accel, NULL);
+			ATTITUDE_UPDATE(att, gyro, accel, NULL, 0, 0);
+			if (sim.Time < 3) continue;
+			SIM_ANGLES(&sim, truth);
+			double err = fmax(fabs(remainder(att->Roll - truth[0], 360)), fabs(att->Pitch - truth[1]));
+			if (err > worst) worst = err;
+			sum += err;
+			n++;
+		}
+		CHECK(worst < maxError[s]);
+		CHECK(sum / n < meanError[s]);
+		printf("Mahony %-6s: tilt error mean %.2f deg, worst %.2f deg\n", scenarioNames[s], sum / n, worst);
+		free(att);
+	}
+}
+
+// Gravity only shows the bias across it, the part along the down axis (yaw, mostly) looks the
+// same as a heading change. The I-term has to cancel the rest. KP / KI puts the time constant
+// at 20s, so give it 100s
+static void TEST_BIAS(void)
+{
+	static const double bias[3] = SIM_GYRO_BIAS;
+	SIM_FRAME sim;
+	SIM_INIT(&sim, SAMPLE_HZ, 7);
+	ATTITUDE_CONTROLLER* att = ATTITUDE_INIT(SAMPLE_HZ, 1, ATTITUDE_MAHONY, 6, 45, 500);
+	for (int i = 0; i < 100 * SAMPLE_HZ; i++)
+	{
+		float gyro[3], accel[3];
+		SIM_STEP(&sim, SIM_STILL, gyro, accel, NULL);
+		ATTITUDE_UPDATE(att, gyro, accel, NULL, 0, 0);
+	}
+	double r[3][3], truth[3], along = 0, learnt[3], seen[3];
+	SIM_MATRIX(&sim, r);
+	for (int k = 0; k < 3; k++) along += bias[k] * r[2][k];
+	for (int k = 0; k < 3; k++)
+	{
+		learnt[k] = -att->Integral[k] * SIM_RAD_TO_DEG;
+		seen[k] = bias[k] - along * r[2][k];
+		CHECK_NEAR(learnt[k], seen[k], 0.05);
+	}
+	SIM_ANGLES(&sim, truth);
+	CHECK_NEAR(att->Roll, truth[0], 0.1);
+	CHECK_NEAR(att->Pitch, truth[1], 0.1);
+	printf("Mahony bias learnt: %.2f %.2f %.2f deg/s for the %.2f %.2f %.2f gravity shows\n", learnt[0], learnt[1],
+			learnt[2], seen[0], seen[1], seen[2]);
+	free(att);
+}
+
+static void BENCH(void)
+{
+	ATTITUDE_CONTROLLER* att = ATTITUDE_INIT(SAMPLE_HZ, 2, ATTITUDE_MAHONY, 6, 45, 500);
+	float gyro[3] = {10, -5, 3}, accel[3] = {0.1f, 0.02f, -0.99f};
+	volatile float sink = 0;
+	double start = TEST_NOW_NS();
+	for (int i = 0; i < CALLS; i++)
+	{
+		gyro[0] = i & 15;
+		ATTITUDE_UPDATE(att, gyro, accel, NULL, 0.1f, 0);
+		sink += att->RateTarget[0];
+	}
+	printf("ATTITUDE_UPDATE, Mahony, outer loop every 2nd: %.1f nS (host)\n", (TEST_NOW_NS() - start) / CALLS);
+	(void)sink;
+	free(att);
+}
+
+int main(void)
+{
+	TEST_SEED();
+	TEST_SCENARIOS();
+	TEST_BIAS();
+	BENCH();
+	return TEST_END();
+}
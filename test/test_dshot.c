@@ -0,0 +1,347 @@
+/*
+ * test_dshot.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** DSHOT frame tests
+Interleaved burst frames checked against golden buffers, one halfword per motor per row,
+rows in bit order, so the TIM3 burst stream puts every motor's bit n out together.
+
+eRPM replies are built the way the ESC sends them, period -> checksum -> GCR -> NRZI ->
+capture timer count of every edge, then fed back through the decoders.
+*/
+
+#include <string.h>
+#include "test.h"
+#include "DSHOT.h"
+
+#define MOTORS	4
+
+// DSHOT300 pulse widths at 108MHz, 0 bit 135 / 1 bit 270 out of 360
+#define L		135
+#define H		270
+
+// DSHOT300 reply bit at 108MHz
+#define BIT_TICKS	DSHOT_TELEM_BIT_TICKS(360)
+
+// Nibble to 5 bit GCR symbol, the inverse of the decoder's table
+static const uint8_t gcrEncode[16] = {
+	0x19, 0x1B, 0x12, 0x13, 0x1D, 0x15, 0x16, 0x17, 0x1A, 0x09, 0x0A, 0x0B, 0x1E, 0x0D, 0x0E, 0x0F
+};
+
+// Throttles 48, 1046, 2047 and stop, telemetry bit on motor 1. Packets 0x0609 0x82D8 0xFFE1 0x000F
+static const uint16_t throttles[MOTORS] = {48, 1046, 2047, 0};
+static const uint8_t telemMask = 0b0010;
+static const uint16_t packets[MOTORS] = {0x0609, 0x82D8, 0xFFE1, 0x000F};
+static const uint16_t golden[DSHOT_PACKET_SIZE][MOTORS] = {
+	{0, 0, 0, 0},
+	{0, 0, 0, 0},
+	{0, 0, 0, 0},
+	{L, H, H, L},
+	{L, L, H, L},
+	{L, L, H, L},
+	{L, L, H, L},
+	{L, L, H, L},
+	{H, L, H, L},
+	{H, H, H, L},
+	{L, L, H, L},
+	{L, H, H, L},
+	{L, H, H, L},
+	{L, L, H, L},
+	{L, H, L, L},
+	{H, H, L, H},
+	{L, L, L, H},
+	{L, L, L, H},
+	{H, L, H, H},
+	{0, 0, 0, 0},
+	{0, 0, 0, 0},
+	{0, 0, 0, 0},
+	{0, 0, 0, 0},
+	{0, 0, 0, 0}
+};
+
+static void TEST_PACKETS(void)
+{
+	for (int m = 0; m < MOTORS; m++)
+	{
+		CHECK(makeDshotPacketBytes(throttles[m], (telemMask >> m) & 1) == packets[m]);
+	}
+}
+
+/* Every ESC_PROTOCOLS entry worked out by hand for the 108MHz timer clock. DSHOT: ARR is one
+ * bit, 0 = 37.5% and 1 = 75% of it rounded to the nearest count. Analog: counts of the min and
+ * max pulse and the period, PWM divides by 108 so its 2040uS period fits the 16 bit counter */
+typedef struct PROTOCOL_TIMING
+{
+	escProtocols_e Protocol;
+	uint32_t Prescaler;
+	uint32_t ARR;
+	uint32_t LowBit;
+	uint32_t HighBit;
+	uint32_t FrameRows;
+	uint8_t Digital;
+} PROTOCOL_TIMING;
+
+static const PROTOCOL_TIMING timings[ESC_PROTOCOL_COUNT] = {
+	{ESC_PROTOCOL_DSHOT150,		0,		720,	270,	540,	DSHOT_PACKET_SIZE,	1},	// 6.67uS bit, 2.5 / 5uS
+	{ESC_PROTOCOL_DSHOT300,		0,		360,	L,		H,		DSHOT_PACKET_SIZE,	1},	// 3.33uS bit, 1.25 / 2.5uS
+	{ESC_PROTOCOL_DSHOT600,		0,		180,	68,		135,	DSHOT_PACKET_SIZE,	1},	// 67.5 rounds up
+	{ESC_PROTOCOL_DSHOT1200,	0,		90,		34,		68,		DSHOT_PACKET_SIZE,	1},	// 33.75 and 67.5 round up
+	{ESC_PROTOCOL_ONESHOT125,	0,		28080,	13500,	27000,	2,					0},	// 125 - 250uS in 260uS
+	{ESC_PROTOCOL_ONESHOT42,	0,		9720,	4536,	9072,	2,					0},	// 42 - 84uS in 90uS
+	{ESC_PROTOCOL_MULTISHOT,	0,		3240,	540,	2700,	2,					0},	// 5 - 25uS in 30uS
+	{ESC_PROTOCOL_PWM,			107,	2040,	1000,	2000,	2,					0}	// 1 - 2mS in 2.04mS at 1MHz
+};
+
+static void TEST_PROTOCOL_WIDTHS(void)
+{
+	for (int p = 0; p < ESC_PROTOCOL_COUNT; p++)
+	{
+		const PROTOCOL_TIMING* t = &timings[p];
+		const ESC_PROTOCOL* proto = &ESC_PROTOCOLS[t->Protocol];
+		CHECK(t->Protocol == (escProtocols_e)p);
+		CHECK(proto->Prescaler == t->Prescaler && proto->ARR == t->ARR);
+		CHECK(proto->LowBit == t->LowBit && proto->HighBit == t->HighBit);
+		CHECK(proto->FrameRows == t->FrameRows && proto->Digital == t->Digital);
+		// PSC and ARR are loaded minus one into 16 bit registers, pulses fit inside the period
+		CHECK(proto->Prescaler <= 0xFFFF && proto->ARR - 1 <= 0xFFFF);
+		CHECK(proto->LowBit > 0 && proto->LowBit < proto->HighBit && proto->HighBit < proto->ARR);
+		CHECK(proto->FrameRows <= ESC_PROTOCOL_MAX_ROWS);
+	}
+	// Without the prescaler the PWM period would be 220320 counts
+	CHECK(ESC_PROTOCOLS[ESC_PROTOCOL_PWM].ARR - 1 <= 0xFFFF && 2040 * TIMER_CLOCK_MHZ > 0xFFFF);
+}
+
+// Table rows are the nibble's bits most significant first
+static void TEST_NIBBLE_TABLE(void)
+{
+	DSHOT_ENCODER enc;
+	DSHOT_ENCODER_INIT(&enc, L, H);
+	static const uint16_t expect[][5] = {
+		{0x0, L, L, L, L},
+		{0x1, L, L, L, H},
+		{0x5, L, H, L, H},
+		{0x8, H, L, L, L},
+		{0xC, H, H, L, L},
+		{0xF, H, H, H, H}
+	};
+	for (unsigned i = 0; i < sizeof(expect) / sizeof(expect[0]); i++)
+	{
+		CHECK(memcmp(enc.NibbleWidths[expect[i][0]], &expect[i][1], 4 * sizeof(uint16_t)) == 0);
+	}
+}
+
+// Every analog protocol: stop and commands are the min pulse, 1047 is half way, full throttle and
+// anything above it the max pulse, then a zero row
+static void TEST_ANALOG_FRAME(void)
+{
+	static const uint16_t values[MOTORS] = {0, 1047, 2047, 3000};
+	for (int p = 0; p < ESC_PROTOCOL_COUNT; p++)
+	{
+		const PROTOCOL_TIMING* t = &timings[p];
+		const ESC_PROTOCOL* proto = &ESC_PROTOCOLS[t->Protocol];
+		if (t->Digital) continue;
+		const uint16_t expect[2][MOTORS] = {
+			{t->LowBit, (t->LowBit + t->HighBit) / 2, t->HighBit, t->HighBit},
+			{0, 0, 0, 0}
+		};
+		uint16_t frame[2][MOTORS];
+		memset(frame, 0xFF, sizeof(frame));
+		proto->Encode(proto, NULL, &frame[0][0], values, MOTORS, 0);
+		CHECK(memcmp(frame, expect, sizeof(frame)) == 0);
+	}
+}
+
+// Whole frame through the protocol encoder, rows outside the packet stay zero
+static void TEST_BURST_FRAME(void)
+{
+	const ESC_PROTOCOL* proto = &ESC_PROTOCOLS[ESC_PROTOCOL_DSHOT300];
+	DSHOT_ENCODER enc;
+	uint16_t frame[DSHOT_PACKET_SIZE][MOTORS];
+	DSHOT_ENCODER_INIT(&enc, proto->LowBit, proto->HighBit);
+	memset(frame, 0, sizeof(frame));
+	proto->Encode(proto, &enc, &frame[0][0], throttles, MOTORS, telemMask);
+	CHECK(memcmp(frame, golden, sizeof(frame)) == 0);
+	// Encoding again over an old frame only rewrites the packet rows
+	proto->Encode(proto, &enc, &frame[0][0], throttles, MOTORS, telemMask);
+	CHECK(memcmp(frame, golden, sizeof(frame)) == 0);
+}
+
+// Column writes land in the same places as the row-order encoder, clearing one leaves the rest
+static void TEST_COLUMNS(void)
+{
+	DSHOT_ENCODER enc;
+	uint16_t frame[DSHOT_PACKET_SIZE][MOTORS];
+	DSHOT_ENCODER_INIT(&enc, L, H);
+	memset(frame, 0, sizeof(frame));
+	for (int m = 0; m < MOTORS; m++) DSHOT_WRITE_FRAME(&enc, &frame[0][0], MOTORS, m, packets[m]);
+	CHECK(memcmp(frame, golden, sizeof(frame)) == 0);
+	DSHOT_CLEAR_FRAME(&frame[0][0], MOTORS, 2);
+	for (int row = 0; row < DSHOT_PACKET_SIZE; row++)
+	{
+		CHECK(frame[row][2] == 0);
+		CHECK(frame[row][1] == golden[row][1]);
+	}
+}
+
+// Eight motors, motor n's column is its own packet whatever the stride
+static void TEST_WIDE_FRAME(void)
+{
+	DSHOT_ENCODER enc;
+	uint16_t frame[DSHOT_PACKET_SIZE][DSHOT_MAX_MOTORS];
+	uint16_t wide[DSHOT_MAX_MOTORS];
+	DSHOT_ENCODER_INIT(&enc, L, H);
+	memset(frame, 0, sizeof(frame));
+	for (int m = 0; m < DSHOT_MAX_MOTORS; m++) wide[m] = makeDshotPacketBytes(100 + 250 * m, 0);
+	DSHOT_ENCODE_FRAME(&enc, &frame[0][0], wide, DSHOT_MAX_MOTORS);
+	for (int m = 0; m < DSHOT_MAX_MOTORS; m++)
+	{
+		for (int bit = 0; bit < DSHOT_PACKET_BITS; bit++)
+		{
+			uint16_t expect = ((wide[m] >> (DSHOT_PACKET_BITS - 1 - bit)) & 1) ? H : L;
+			CHECK(frame[DSHOT_PACKET_LEAD + bit][m] == expect);
+		}
+	}
+}
+
+// 12 bit period field with the inverted checksum the ESC sends, xor of all four nibbles is 0xF
+static uint32_t REPLY_PACKET(uint32_t period)
+{
+	uint32_t csum = ~(period ^ (period >> 4) ^ (period >> 8)) & 0xf;
+	return (period << 4) | csum;
+}
+
+// 16 bit packet to the 20 bit GCR value on the wire
+static uint32_t REPLY_GCR(uint32_t packet)
+{
+	uint32_t gcr = 0;
+	for (int i = 0; i < 4; i++) gcr |= (uint32_t)gcrEncode[(packet >> (4 * i)) & 0xf] << (5 * i);
+	return gcr;
+}
+
+/* GCR value to capture timer counts of every edge. The wire starts with a 1 (the start edge)
+ * and every 1 after it is a level change, the line's own edge back to idle goes in as well
+ * with trailing. jitter shifts every other edge by that many counts */
+static uint32_t REPLY_EDGES(uint32_t gcr, uint16_t start, int jitter, int trailing, uint16_t* edges)
+{
+	uint32_t value = 1 << 20;
+	for (int k = 19; k >= 0; k--) value |= (((gcr >> k) ^ (value >> (k + 1))) & 1) << k;
+	uint32_t count = 0;
+	for (int k = 20; k >= 0; k--)
+	{
+		if (!((value >> k) & 1)) continue;
+		int offset = (count & 1) ? jitter : -jitter;
+		edges[count++] = (uint16_t)(start + (20 - k) * BIT_TICKS + offset);
+	}
+	if (trailing) edges[count++] = (uint16_t)(start + 21 * BIT_TICKS);
+	return count;
+}
+
+// Periods across the exponent range decode to 60000000 / (mantissa << exponent)
+static void TEST_ERPM_REPLIES(void)
+{
+	static const uint16_t periods[] = {0x001, 0x12C, 0x3FF, 0x5A5, 0x7D0, 0xA10, 0xE01, 0xFFE};
+	uint16_t edges[DSHOT_TELEM_EDGES + 1];
+	for (unsigned i = 0; i < sizeof(periods) / sizeof(periods[0]); i++)
+	{
+		uint32_t period = periods[i];
+		uint32_t expect = 60000000 / ((period & 0x1FF) << (period >> 9));
+		uint32_t gcr = REPLY_GCR(REPLY_PACKET(period));
+		// Clean, gaps off by 0.4 bit either way, with the edge back to idle, and across the 16 bit wrap
+		uint32_t count = REPLY_EDGES(gcr, 1000, 0, 0, edges);
+		CHECK(count <= DSHOT_TELEM_EDGES);
+		CHECK(DSHOT_DECODE_ERPM(edges, count, BIT_TICKS) == expect);
+		count = REPLY_EDGES(gcr, 1000, BIT_TICKS / 5, 0, edges);
+		CHECK(DSHOT_DECODE_ERPM(edges, count, BIT_TICKS) == expect);
+		count = REPLY_EDGES(gcr, 1000, 0, 1, edges);
+		CHECK(DSHOT_DECODE_ERPM(edges, count, BIT_TICKS) == expect);
+		count = REPLY_EDGES(gcr, 0xFFFF - 3 * BIT_TICKS, 0, 0, edges);
+		CHECK(DSHOT_DECODE_ERPM(edges, count, BIT_TICKS) == expect);
+	}
+}
+
+// 300 << 1 = 600uS, 100000 eRPM, field by field
+static void TEST_GCR_REPLY(void)
+{
+	uint16_t edges[DSHOT_TELEM_EDGES + 1];
+	uint32_t period = (1 << 9) | 300;
+	uint32_t count = REPLY_EDGES(REPLY_GCR(REPLY_PACKET(period)), 1000, 0, 0, edges);
+	uint32_t raw = DSHOT_DECODE_EDGES(edges, count, BIT_TICKS);
+	CHECK(raw != DSHOT_TELEM_INVALID);
+	CHECK(((raw ^ (raw >> 1)) & 0xFFFFF) == REPLY_GCR(REPLY_PACKET(period)));
+	CHECK(DSHOT_DECODE_GCR(raw) == period);
+	CHECK(DSHOT_DECODE_ERPM(edges, count, BIT_TICKS) == 100000);
+}
+
+// 0xFFF is the stopped motor, not a 1.9s period
+static void TEST_STOPPED_REPLY(void)
+{
+	uint16_t edges[DSHOT_TELEM_EDGES + 1];
+	uint32_t count = REPLY_EDGES(REPLY_GCR(REPLY_PACKET(0xFFF)), 1000, 0, 0, edges);
+	CHECK(DSHOT_DECODE_GCR(DSHOT_DECODE_EDGES(edges, count, BIT_TICKS)) == 0xFFF);
+	CHECK(DSHOT_DECODE_ERPM(edges, count, BIT_TICKS) == 0);
+}
+
+// Every wrong checksum is rejected, so is a valid checksum over a zero mantissa
+static void TEST_BAD_CRC(void)
+{
+	uint16_t edges[DSHOT_TELEM_EDGES + 1];
+	uint32_t packet = REPLY_PACKET(0x12C);
+	for (uint32_t flip = 1; flip < 16; flip++)
+	{
+		uint32_t count = REPLY_EDGES(REPLY_GCR(packet ^ flip), 1000, 0, 0, edges);
+		CHECK(DSHOT_DECODE_ERPM(edges, count, BIT_TICKS) == DSHOT_TELEM_INVALID);
+	}
+	uint32_t count = REPLY_EDGES(REPLY_GCR(REPLY_PACKET(0x200)), 1000, 0, 0, edges);
+	CHECK(DSHOT_DECODE_ERPM(edges, count, BIT_TICKS) == DSHOT_TELEM_INVALID);
+}
+
+// Each of the 16 unused symbols in each of the 4 symbol slots
+static void TEST_BAD_GCR(void)
+{
+	uint16_t edges[DSHOT_TELEM_EDGES + 1];
+	uint32_t gcr = REPLY_GCR(REPLY_PACKET(0x12C));
+	for (uint32_t symbol = 0; symbol < 32; symbol++)
+	{
+		int used = 0;
+		for (int n = 0; n < 16; n++) used |= gcrEncode[n] == symbol;
+		if (used) continue;
+		for (int slot = 0; slot < 4; slot++)
+		{
+			uint32_t bad = (gcr & ~(0x1f << (5 * slot))) | (symbol << (5 * slot));
+			uint32_t count = REPLY_EDGES(bad, 1000, 0, 0, edges);
+			CHECK(DSHOT_DECODE_ERPM(edges, count, BIT_TICKS) == DSHOT_TELEM_INVALID);
+		}
+	}
+}
+
+// Missing replies and edges closer than half a bit
+static void TEST_BAD_EDGES(void)
+{
+	uint16_t edges[2] = {1000, 1000 + BIT_TICKS / 4};
+	CHECK(DSHOT_DECODE_EDGES(edges, 0, BIT_TICKS) == DSHOT_TELEM_INVALID);
+	CHECK(DSHOT_DECODE_EDGES(edges, 1, BIT_TICKS) == DSHOT_TELEM_INVALID);
+	CHECK(DSHOT_DECODE_EDGES(edges, 2, BIT_TICKS) == DSHOT_TELEM_INVALID);
+	CHECK(DSHOT_DECODE_GCR(DSHOT_TELEM_INVALID) == DSHOT_TELEM_INVALID);
+	CHECK(DSHOT_DECODE_ERPM(edges, 2, BIT_TICKS) == DSHOT_TELEM_INVALID);
+}
+
+int main(void)
+{
+	TEST_PACKETS();
+	TEST_PROTOCOL_WIDTHS();
+	TEST_NIBBLE_TABLE();
+	TEST_ANALOG_FRAME();
+	TEST_BURST_FRAME();
+	TEST_COLUMNS();
+	TEST_WIDE_FRAME();
+	TEST_GCR_REPLY();
+	TEST_ERPM_REPLIES();
+	TEST_STOPPED_REPLY();
+	TEST_BAD_CRC();
+	TEST_BAD_GCR();
+	TEST_BAD_EDGES();
+	return TEST_END();
+}
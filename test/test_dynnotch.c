@@ -0,0 +1,206 @@
+/*
+ * test_dynnotch.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Dynamic notch tests
+Synthetic gyro spectra, one to three motor tones over white noise, the same on every axis. The
+notch centres have to settle on the tones and take them out of the signal, a notch no tone
+claims has to stay out of the way, and one notch has to follow a tone swept with throttle.
+*/
+
+#include <stdlib.h>
+#include "test.h"
+#include "DYNNOTCH.h"
+
+#define SAMPLE_HZ	1660.0f
+#define MIN_HZ		80.0f
+#define MAX_HZ		600.0f
+#define NOTCH_Q		3.5f
+#define PI_D		3.14159265358979
+#define CALLS		3000000
+
+// Noise in +-1, fixed sequence so the test runs the same every time
+static float NOISE(void)
+{
+	return (rand() / (float)RAND_MAX - 0.5f) * 2;
+}
+
+/* Function Summary: Feed a tone mix plus noise through for a while
+ * Param: dn - Dynamic notch state
+ * Param: tones - Tone frequencies, Hz
+ * Param: amps - Tone amplitudes, deg/s
+ * Param: toneCount - Length of tones and amps
+ * Param: seconds - How long
+ * Return: Tone power left after the notches relative to what went in, dB, over the last second
+ */
+static double RUN_TONES(DYNNOTCH_CONTROLLER* dn, const float* tones, const float* amps, int toneCount, float seconds)
+{
+	double in = 0, out = 0;
+	int samples = seconds * SAMPLE_HZ;
+	for (int i = 0; i < samples; i++)
+	{
+		float tone = 0;
+		for (int t = 0; t < toneCount; t++) tone += amps[t] * sin(2 * PI_D * tones[t] * i / SAMPLE_HZ + t);
+		float axes[FILTER_AXES], noise[FILTER_AXES];
+		for (int a = 0; a < FILTER_AXES; a++)
+		{
+			noise[a] = 5 * NOISE();
+			axes[a] = tone + noise[a];
+		}
+		DYNNOTCH_UPDATE(dn, axes);
+		DYNNOTCH_APPLY(dn, axes);
+		if (i < samples - SAMPLE_HZ) continue;
+		// Noise is mostly outside the notches, take it off to leave what is left of the tones
+		in += tone * tone;
+		out += (axes[0] - noise[0]) * (axes[0] - noise[0]);
+	}
+	return 10 * log10(out / in);
+}
+
+// Closest notch centre to a frequency, Hz away
+static float NEAREST(const DYNNOTCH_CONTROLLER* dn, int axis, float hz)
+{
+	float best = 1e9f;
+	for (int p = 0; p < dn->PeakCount; p++)
+	{
+		if (fabsf(dn->Centre[axis][p] - hz) < best) best = fabsf(dn->Centre[axis][p] - hz);
+	}
+	return best;
+}
+
+// Parked across the range and bypassed, DampingN worked out from the per-sample damping
+static void TEST_INIT(void)
+{
+	DYNNOTCH_CONTROLLER* dn = DYNNOTCH_INIT(SAMPLE_HZ, 3, MIN_HZ, MAX_HZ, NOTCH_Q);
+	CHECK_NEAR(dn->DampingN, 0.993620, 1e-5);
+	for (int a = 0; a < FILTER_AXES; a++)
+	{
+		CHECK(dn->Active[a] == 0);
+		CHECK_NEAR(dn->Centre[a][0], MIN_HZ + (MAX_HZ - MIN_HZ) / 6, 1e-3);
+		CHECK(dn->Centre[a][0] < dn->Centre[a][1] && dn->Centre[a][1] < dn->Centre[a][2]);
+		CHECK(dn->Centre[a][2] < MAX_HZ);
+	}
+	float axes[FILTER_AXES] = {12.5f, -3, 400};
+	DYNNOTCH_APPLY(dn, axes);
+	CHECK(axes[0] == 12.5f && axes[1] == -3 && axes[2] == 400);
+	free(dn);
+}
+
+// One, two and three tones, each found within a few Hz and cut well down
+static void TEST_TONES(void)
+{
+	const float tones[][3] = {{180, 0, 0}, {237, 412, 0}, {150, 300, 555}, {333.3f, 0, 0}};
+	const float amps[3] = {30, 15, 15};
+	const int counts[] = {1, 2, 3, 1};
+	srand(1);
+	for (int c = 0; c < 4; c++)
+	{
+		DYNNOTCH_CONTROLLER* dn = DYNNOTCH_INIT(SAMPLE_HZ, 3, MIN_HZ, MAX_HZ, NOTCH_Q);
+		double left = RUN_TONES(dn, tones[c], amps, counts[c], 2.0f);
+		float worst = 0;
+		for (int a = 0; a < FILTER_AXES; a++)
+		{
+			for (int t = 0; t < counts[c]; t++)
+			{
+				float err = NEAREST(dn, a, tones[c][t]);
+				if (err > worst) worst = err;
+			}
+		}
+		// Bins are 26Hz wide, the parabola fit gets within a few Hz of a lone tone and a bit
+		// less close when neighbouring tones skew the bins either side
+		CHECK(worst < (counts[c] == 1 ? 5 : 10));
+		CHECK(left < (counts[c] == 1 ? -15 : -10));
+		printf("%d tone(s) from %.0fHz: worst centre %.1fHz out, %.1fdB of the tones left\n", counts[c], tones[c][0],
+				worst, left);
+		free(dn);
+	}
+}
+
+// A single tone leaves the spare notches bypassed, they don't touch the low end of the range
+static void TEST_UNCLAIMED(void)
+{
+	srand(2);
+	DYNNOTCH_CONTROLLER* dn = DYNNOTCH_INIT(SAMPLE_HZ, 3, MIN_HZ, MAX_HZ, NOTCH_Q);
+	const float tone = 400, amp = 30;
+	RUN_TONES(dn, &tone, &amp, 1, 2.0f);
+	for (int a = 0; a < FILTER_AXES; a++)
+	{
+		int claimed = 0;
+		for (int p = 0; p < dn->PeakCount; p++) claimed += (dn->Active[a] >> p) & 1;
+		CHECK(claimed == 1);
+	}
+	// A low tone the notches should not be sitting on goes through untouched
+	double in = 0, out = 0;
+	for (int i = 0; i < SAMPLE_HZ; i++)
+	{
+		float low = 10 * sin(2 * PI_D * MIN_HZ * i / SAMPLE_HZ);
+		float axes[FILTER_AXES] = {low + amp * (float)sin(2 * PI_D * tone * i / SAMPLE_HZ), 0, 0};
+		DYNNOTCH_APPLY(dn, axes);
+		if (i < SAMPLE_HZ / 4) continue;
+		in += low * low;
+		out += axes[0] * axes[0];
+	}
+	CHECK(10 * log10(out / in) > -0.5);
+	free(dn);
+}
+
+// Tone swept 150 to 450Hz over 2 seconds, one notch follows it
+static void TEST_SWEEP(void)
+{
+	srand(3);
+	DYNNOTCH_CONTROLLER* dn = DYNNOTCH_INIT(SAMPLE_HZ, 1, MIN_HZ, MAX_HZ, NOTCH_Q);
+	double phase = 0, err = 0, worst = 0;
+	int n = 0;
+	for (int i = 0; i < 3 * SAMPLE_HZ; i++)
+	{
+		float hz = 150 + 300 * fminf(i / (2 * SAMPLE_HZ), 1);
+		phase += 2 * PI_D * hz / SAMPLE_HZ;
+		float axes[FILTER_AXES];
+		for (int a = 0; a < FILTER_AXES; a++) axes[a] = 30 * sin(phase) + 5 * NOISE();
+		DYNNOTCH_UPDATE(dn, axes);
+		if (i > 0.3f * SAMPLE_HZ && i % 50 == 0)
+		{
+			float e = fabsf(dn->Centre[0][0] - hz);
+			err += e;
+			n++;
+			if (e > worst) worst = e;
+		}
+	}
+	CHECK(err / n < 15);
+	CHECK(fabsf(dn->Centre[0][0] - 450) < 10);
+	printf("Sweep 150 to 450Hz: mean lag %.1fHz, worst %.1fHz\n", err / n, worst);
+	free(dn);
+}
+
+static void BENCH(void)
+{
+	// Three tones first so every notch is claimed and running
+	const float tones[3] = {150, 300, 555}, amps[3] = {30, 15, 15};
+	DYNNOTCH_CONTROLLER* dn = DYNNOTCH_INIT(SAMPLE_HZ, 3, MIN_HZ, MAX_HZ, NOTCH_Q);
+	RUN_TONES(dn, tones, amps, 3, 1.0f);
+	volatile float sink = 0;
+	double start = TEST_NOW_NS();
+	for (int i = 0; i < CALLS; i++)
+	{
+		float axes[FILTER_AXES] = {i & 15, (i >> 2) & 15, (i >> 4) & 15};
+		DYNNOTCH_UPDATE(dn, axes);
+		DYNNOTCH_APPLY(dn, axes);
+		sink += axes[0];
+	}
+	printf("DYNNOTCH_UPDATE + APPLY, 3 axes, 3 notches: %.1f nS (host)\n", (TEST_NOW_NS() - start) / CALLS);
+	(void)sink;
+	free(dn);
+}
+
+int main(void)
+{
+	TEST_INIT();
+	TEST_TONES();
+	TEST_UNCLAIMED();
+	TEST_SWEEP();
+	BENCH();
+	return TEST_END();
+}
@@ -0,0 +1,173 @@
+/*
+ * test_ekf.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Attitude EKF tests
+EKF_PREDICT and EKF_ACCEL_UPDATE on their own, then ATTITUDE_EKF through every
+attitude_sim.h manoeuvre for 30s, with and without the magnetometer, side by side with the
+Mahony filter on the same sensor data. The EKF has to hold tilt closer than Mahony does, learn
+the gyro bias, and with the magnetometer stop the heading drifting. Timed per sample at the end.
+*/
+
+#include "test.h"
+#include "attitude_sim.h"
+#include "ATTITUDE.h"
+
+#define SAMPLE_HZ	1660.0f
+#define DIVIDER		2
+#define CALLS		5000000
+
+static const char* scenarioNames[SIM_COUNT] = {"still", "wander", "flips"};
+
+typedef struct RUN_RESULT
+{
+	double MeanTilt;
+	double WorstTilt;
+	double MeanYawDrift;		// Heading error against where it was at 3s
+	float Bias[3];				// deg/s, EKF only
+} RUN_RESULT;
+
+/* Function Summary: Fly one manoeuvre through one estimator
+ * Param: scenario - Manoeuvre
+ * Param: estimator - Mahony or EKF
+ * Param: useMag - Pass the magnetometer
+ * Param: result - Returns the errors after the first 3s
+ * Return: VOID
+ */
+static void RUN(simScenarios_e scenario, attitudeEstimators_e estimator, int useMag, RUN_RESULT* result)
+{
+	SIM_FRAME sim;
+	SIM_INIT(&sim, SAMPLE_HZ, scenario + 1);
+	ATTITUDE_CONTROLLER* att = ATTITUDE_INIT(SAMPLE_HZ, DIVIDER, estimator, 6, 45, 500);
+	double sum = 0, yawSum = 0, yaw0 = 0;
+	int n = 0;
+	memset(result, 0, sizeof(RUN_RESULT));
+	for (int i = 0; i < 30 * SAMPLE_HZ; i++)
+	{
+		float gyro[3], accel[3], mag[3];
+		double truth[3];
+		SIM_STEP(&sim, scenario, gyro, accel, mag);
+		ATTITUDE_UPDATE(att, gyro, accel, useMag ? mag : NULL, 0, 0);
+		if (sim.Time < 3) continue;
+		SIM_ANGLES(&sim, truth);
+		double err = fmax(fabs(remainder(att->Roll - truth[0], 360)), fabs(att->Pitch - truth[1]));
+		double yaw = remainder(att->Yaw - truth[2], 360);
+		if (!n) yaw0 = yaw;
+		if (err > result->WorstTilt) result->WorstTilt = err;
+		sum += err;
+		yawSum += fabs(remainder(yaw - yaw0, 360));
+		n++;
+	}
+	result->MeanTilt = sum / n;
+	result->MeanYawDrift = yawSum / n;
+	if (att->Ekf)
+	{
+		for (int k = 0; k < 3; k++) result->Bias[k] = att->Ekf->Bias[k] * SIM_RAD_TO_DEG;
+		free(att->Ekf);
+	}
+	free(att);
+}
+
+// 1 rad/s about X for 1s is a 1 rad roll, the quaternion stays unit and P grows symmetric
+static void TEST_PREDICT(void)
+{
+	const float level[4] = {1, 0, 0, 0}, rate[3] = {1, 0, 0};
+	EKF_CONTROLLER* ekf = EKF_INIT(level);
+	float trace0 = 0, trace1 = 0;
+	for (int i = 0; i < EKF_STATES; i++) trace0 += ekf->P[i][i];
+	for (int i = 0; i < SAMPLE_HZ; i++) EKF_PREDICT(ekf, rate, 1.0f / SAMPLE_HZ);
+	CHECK_NEAR(ekf->Q[0], cos(0.5), 1e-4);
+	CHECK_NEAR(ekf->Q[1], sin(0.5), 1e-4);
+	CHECK_NEAR(ekf->Q[2], 0, 1e-6);
+	CHECK_NEAR(ekf->Q[3], 0, 1e-6);
+	for (int i = 0; i < EKF_STATES; i++)
+	{
+		trace1 += ekf->P[i][i];
+		for (int j = 0; j < EKF_STATES; j++) CHECK_NEAR(ekf->P[i][j], ekf->P[j][i], 1e-7);
+	}
+	CHECK(trace1 > trace0);
+	free(ekf);
+}
+
+// A 0.2 rad roll error is pulled back by level accelerometer readings and the attitude variance
+// shrinks. One reading far outside the noise model is dropped by the innovation gate
+static void TEST_ACCEL_UPDATE(void)
+{
+	const float rolled[4] = {cos(0.1), sin(0.1), 0, 0}, still[3] = {0}, down[3] = {0, 0, -1};
+	const float tilted[3] = {0, -0.8660254f, -0.5f};
+	EKF_CONTROLLER* ekf = EKF_INIT(rolled);
+	EKF_ACCEL_UPDATE(ekf, tilted);
+	CHECK(ekf->Error[0] == 0 && ekf->Error[1] == 0 && ekf->Error[2] == 0);
+	for (int i = 0; i < SAMPLE_HZ / DIVIDER; i++)
+	{
+		EKF_PREDICT(ekf, still, DIVIDER / SAMPLE_HZ);
+		EKF_ACCEL_UPDATE(ekf, down);
+		EKF_APPLY(ekf);
+	}
+	CHECK_NEAR(ekf->Q[0], 1, 1e-4);
+	CHECK(ekf->P[0][0] < 0.01f * 0.01f && ekf->P[1][1] < 0.01f * 0.01f);
+	free(ekf);
+}
+
+static void TEST_SCENARIOS(void)
+{
+	static const double bias[3] = SIM_GYRO_BIAS;
+	for (int s = 0; s < SIM_COUNT; s++)
+	{
+		RUN_RESULT mahony, ekf, ekfMag;
+		RUN(s, ATTITUDE_MAHONY, 0, &mahony);
+		RUN(s, ATTITUDE_EKF, 0, &ekf);
+		RUN(s, ATTITUDE_EKF, 1, &ekfMag);
+		CHECK(ekf.MeanTilt < 0.5 * mahony.MeanTilt);
+		CHECK(ekfMag.MeanTilt < 0.5 * mahony.MeanTilt);
+		CHECK(ekf.WorstTilt < 1.0 && ekfMag.WorstTilt < 1.0);
+		// Roll and pitch bias show through gravity, with the magnetometer yaw does too
+		CHECK_NEAR(ekfMag.Bias[0], bias[0], 0.05);
+		CHECK_NEAR(ekfMag.Bias[1], bias[1], 0.05);
+		CHECK_NEAR(ekfMag.Bias[2], bias[2], 0.05);
+		CHECK_NEAR(ekf.Bias[0], bias[0], 0.05);
+		CHECK(ekfMag.MeanYawDrift < 0.5);
+		printf("%-6s tilt mean / worst, deg: Mahony %.2f / %.2f, EKF %.2f / %.2f, EKF + mag %.2f / %.2f\n",
+				scenarioNames[s], mahony.MeanTilt, mahony.WorstTilt, ekf.MeanTilt, ekf.WorstTilt, ekfMag.MeanTilt,
+				ekfMag.WorstTilt);
+		printf("%-6s yaw drift, deg: Mahony %.2f, EKF %.2f, EKF + mag %.2f. Bias %.2f %.2f %.2f deg/s\n",
+				scenarioNames[s], mahony.MeanYawDrift, ekf.MeanYawDrift, ekfMag.MeanYawDrift, ekfMag.Bias[0],
+				ekfMag.Bias[1], ekfMag.Bias[2]);
+	}
+}
+
+static void BENCH(void)
+{
+	float gyro[3] = {10, -5, 3}, accel[3] = {0.1f, 0.02f, -0.99f}, mag[3] = {0.4f, 0.1f, 0.9f};
+	double ns[3];
+	for (int e = 0; e < 3; e++)
+	{
+		ATTITUDE_CONTROLLER* att = ATTITUDE_INIT(SAMPLE_HZ, DIVIDER, e ? ATTITUDE_EKF : ATTITUDE_MAHONY, 6, 45, 500);
+		volatile float sink = 0;
+		double start = TEST_NOW_NS();
+		for (int i = 0; i < CALLS; i++)
+		{
+			gyro[0] = i & 15;
+			ATTITUDE_UPDATE(att, gyro, accel, e == 2 ? mag : NULL, 0.1f, 0);
+			sink += att->RateTarget[0];
+		}
+		ns[e] = (TEST_NOW_NS() - start) / CALLS;
+		(void)sink;
+		if (att->Ekf) free(att->Ekf);
+		free(att);
+	}
+	printf("ATTITUDE_UPDATE per sample, EKF every %d: Mahony %.1f nS, EKF %.1f nS, EKF + mag %.1f nS (host)\n",
+			DIVIDER, ns[0], ns[1], ns[2]);
+}
+
+int main(void)
+{
+	TEST_PREDICT();
+	TEST_ACCEL_UPDATE();
+	TEST_SCENARIOS();
+	BENCH();
+	return TEST_END();
+}
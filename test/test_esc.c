@@ -0,0 +1,255 @@
+/*
+ * test_esc.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** ESC output tests
+ESC.c runs over the mock HAL with the board's output table, TIM3 CH1-CH4 and TIM4 CH2-CH3. The
+test plays the DMA: a frame is on the wire from DSHOT_START_FRAME until the test calls the
+burst complete and the end of the reply window. While it is, ESC_UPDATE_THROTTLE has to encode
+into the buffer the stream is not reading and leave the one it is reading alone, then start the
+back buffer once the outputs are idle. Telemetry requests and command frames are only used up
+by a frame that actually goes out.
+*/
+
+#include <string.h>
+#include "test.h"
+#include "ESC.h"
+
+#define MOTORS		6
+#define ROWS		(ESC_PROTOCOL_MAX_ROWS * ESC_TIMER_CHANNELS)
+
+static TIM_TypeDef tim3, tim4;
+static TIM_HandleTypeDef htim3 = {&tim3}, htim4 = {&tim4};
+static DMA_Stream_TypeDef streams[6];
+static DMA_HandleTypeDef hdma_tim3_ch1_trig = {&streams[0]}, hdma_tim3_ch2 = {&streams[1]};
+static DMA_HandleTypeDef hdma_tim3_ch3 = {&streams[2]}, hdma_tim3_ch4_up = {&streams[3]};
+static DMA_HandleTypeDef hdma_tim4_ch2 = {&streams[4]};
+
+// Same table as main.c
+static const ESC_OUTPUT outputs[MOTORS] = {
+	{&htim3, TIM_CHANNEL_1, &hdma_tim3_ch4_up, TIM_DMA_UPDATE, &hdma_tim3_ch1_trig},
+	{&htim3, TIM_CHANNEL_2, &hdma_tim3_ch4_up, TIM_DMA_UPDATE, &hdma_tim3_ch2},
+	{&htim3, TIM_CHANNEL_3, &hdma_tim3_ch4_up, TIM_DMA_UPDATE, &hdma_tim3_ch3},
+	{&htim3, TIM_CHANNEL_4, &hdma_tim3_ch4_up, TIM_DMA_UPDATE, &hdma_tim3_ch4_up},
+	{&htim4, TIM_CHANNEL_2, &hdma_tim4_ch2, TIM_DMA_CC2, &hdma_tim4_ch2},
+	{&htim4, TIM_CHANNEL_3, &hdma_tim4_ch2, TIM_DMA_CC2, NULL}
+};
+
+static ESC_CONTROLLER* esc;
+
+static void SETUP(void)
+{
+	MOCK_HAL_RESET();
+	memset(&tim3, 0, sizeof(tim3));
+	memset(&tim4, 0, sizeof(tim4));
+	memset(streams, 0, sizeof(streams));
+	if (esc) free(esc);
+	esc = ESC_INIT(outputs, MOTORS, ESC_PROTOCOL_DSHOT300);
+	CHECK(esc->GroupCount == 2 && mockHal.Errors == 0 && mockHal.PwmStarts == MOTORS);
+}
+
+static void SET_THROTTLE(uint32_t base)
+{
+	for (int m = 0; m < MOTORS; m++) esc->Throttle[m] = base + 100 * m;
+}
+
+/* Function Summary: Buffer the group's burst stream was last pointed at
+ * Param: group - Timer group
+ * Return: 0 or 1, -1 if the stream points at neither
+ */
+static int FRONT(const ESC_GROUP* group)
+{
+	for (int b = 0; b < DSHOT_FRAME_BUFFERS; b++)
+	{
+		if (group->DMA->Instance->M0AR == (uint32_t)(uintptr_t)group->Frame[b]) return b;
+	}
+	return -1;
+}
+
+/* Function Summary: Encode a group's frame the way it should come out, straight from DSHOT.c
+ * Param: group - Timer group
+ * Param: values - One value per motor
+ * Param: telemMask - Motors with the telemetry bit set
+ * Param: frame - ROWS halfwords
+ * Return: VOID
+ */
+static void EXPECT(const ESC_GROUP* group, const uint16_t* values, uint8_t telemMask, uint16_t* frame)
+{
+	const ESC_PROTOCOL* proto = esc->Protocol;
+	DSHOT_ENCODER enc;
+	uint16_t columns[ESC_TIMER_CHANNELS] = {0};
+	uint8_t columnTelem = 0;
+	DSHOT_ENCODER_INIT(&enc, proto->LowBit, proto->HighBit);
+	memset(frame, 0, ROWS * sizeof(frame[0]));
+	for (int m = 0; m < MOTORS; m++)
+	{
+		if (!(group->MotorMask & ESC_MOTOR(m))) continue;
+		columns[esc->Motors[m].Column] = values[m];
+		if (telemMask & ESC_MOTOR(m)) columnTelem |= 1 << esc->Motors[m].Column;
+	}
+	proto->Encode(proto, &enc, frame, columns, group->Width, columnTelem);
+}
+
+/* Function Summary: Check a buffer of every group against the expected frame
+ * Param: buffer - 0 or 1, -1 for the buffer each stream is reading
+ * Param: values - One value per motor
+ * Param: telemMask - Motors with the telemetry bit set
+ * Return: 1 if every group matches
+ */
+static int FRAMES_ARE(int buffer, const uint16_t* values, uint8_t telemMask)
+{
+	int ok = 1;
+	for (int g = 0; g < esc->GroupCount; g++)
+	{
+		const ESC_GROUP* group = &esc->Groups[g];
+		uint16_t frame[ROWS];
+		int b = buffer < 0 ? FRONT(group) : buffer;
+		EXPECT(group, values, telemMask, frame);
+		ok &= b >= 0 && !memcmp(group->Frame[b], frame, esc->Protocol->FrameRows * group->Width * sizeof(frame[0]));
+	}
+	return ok;
+}
+
+static void THROTTLE_VALUES(uint16_t* values)
+{
+	for (int m = 0; m < MOTORS; m++) values[m] = esc->Throttle[m];
+}
+
+// Burst complete then the end of the reply window, from the interrupts
+static void FINISH(void)
+{
+	for (int g = 0; g < esc->GroupCount; g++) ESC_FRAME_SENT(esc, esc->Groups[g].DMA);
+	CHECK(!ESC_FRAME_IDLE(esc));
+	for (int g = 0; g < esc->GroupCount; g++) ESC_CAPTURE_DONE(esc, esc->Groups[g].Timer);
+	CHECK(ESC_FRAME_IDLE(esc));
+}
+
+// Each stream reads one buffer while the next frame lands in the other, which goes out next
+static void TEST_BACK_BUFFER(void)
+{
+	uint16_t values[MOTORS];
+	uint16_t sent[ESC_MAX_TIMERS][ROWS];
+	SETUP();
+	SET_THROTTLE(100);
+	THROTTLE_VALUES(values);
+	CHECK(ESC_UPDATE_THROTTLE(esc) == 1);
+	for (int g = 0; g < esc->GroupCount; g++)
+	{
+		ESC_GROUP* group = &esc->Groups[g];
+		CHECK(FRONT(group) >= 0 && FRONT(group) != group->BackBuffer);
+		CHECK(group->SendingFlag && (group->DMA->Instance->CR & DMA_SxCR_EN));
+		CHECK(group->DMA->Instance->NDTR == esc->Protocol->FrameRows * group->Width);
+		memcpy(sent[g], group->Frame[FRONT(group)], sizeof(sent[g]));
+	}
+	CHECK(FRAMES_ARE(-1, values, 0));
+	// Two updates while busy, both land in the back buffer and the frame on the wire is untouched
+	for (uint32_t base = 200; base <= 300; base += 100)
+	{
+		SET_THROTTLE(base);
+		THROTTLE_VALUES(values);
+		CHECK(ESC_UPDATE_THROTTLE(esc) == 0);
+		for (int g = 0; g < esc->GroupCount; g++)
+		{
+			ESC_GROUP* group = &esc->Groups[g];
+			CHECK(FRONT(group) != group->BackBuffer);
+			CHECK(!memcmp(group->Frame[FRONT(group)], sent[g], sizeof(sent[g])));
+		}
+		CHECK(FRAMES_ARE(esc->Groups[0].BackBuffer, values, 0));
+	}
+	// Idle, the back buffer goes out as it is and the stream swaps over
+	int front = FRONT(&esc->Groups[0]);
+	FINISH();
+	CHECK(ESC_UPDATE_THROTTLE(esc) == 1);
+	CHECK(FRONT(&esc->Groups[0]) == !front && esc->Groups[0].BackBuffer == front);
+	CHECK(FRONT(&esc->Groups[1]) == FRONT(&esc->Groups[0]));
+	CHECK(FRAMES_ARE(-1, values, 0));
+	CHECK(esc->TelemErrors[0] == 1 && esc->TelemErrors[5] == 0);
+}
+
+// A telemetry request made while busy rides on the frame that goes out, not the one encoded
+static void TEST_TELEMETRY_WAITS(void)
+{
+	uint16_t values[MOTORS];
+	SETUP();
+	SET_THROTTLE(500);
+	THROTTLE_VALUES(values);
+	CHECK(ESC_UPDATE_THROTTLE(esc) == 1);
+	ESC_REQUEST_TELEMETRY(esc, ESC_MOTOR(4));
+	CHECK(ESC_UPDATE_THROTTLE(esc) == 0);
+	CHECK(esc->TelemRequest == ESC_MOTOR(4));
+	CHECK(FRAMES_ARE(esc->Groups[0].BackBuffer, values, ESC_MOTOR(4)));
+	FINISH();
+	CHECK(ESC_UPDATE_THROTTLE(esc) == 1);
+	CHECK(esc->TelemRequest == 0 && FRAMES_ARE(-1, values, ESC_MOTOR(4)));
+	FINISH();
+	CHECK(ESC_UPDATE_THROTTLE(esc) == 1 && FRAMES_ARE(-1, values, 0));
+}
+
+// A due command is encoded while busy but its repeat is only counted when its frame starts. A
+// beacon carries no telemetry bit
+static void TEST_COMMAND_WAITS(void)
+{
+	uint16_t values[MOTORS];
+	SETUP();
+	SET_THROTTLE(500);
+	CHECK(ESC_UPDATE_THROTTLE(esc) == 1);
+	mockHal.Tick = 100;
+	uint32_t ticket = ESC_SEND_CMD(esc, DSHOT_CMD_BEACON1, ESC_MOTOR(0));
+	ESC_CMD* cmd = &esc->CmdQueue[esc->CmdHead];
+	CHECK(ticket && cmd->Repeats == 1 && !cmd->TelemBit);
+	THROTTLE_VALUES(values);
+	values[0] = DSHOT_CMD_BEACON1;
+	CHECK(ESC_UPDATE_THROTTLE(esc) == 0);
+	CHECK(!ESC_CMD_COMPLETE(esc, ticket) && cmd->Repeats == 1);
+	CHECK(FRAMES_ARE(esc->Groups[0].BackBuffer, values, 0));
+	FINISH();
+	CHECK(ESC_UPDATE_THROTTLE(esc) == 1);
+	CHECK(ESC_CMD_COMPLETE(esc, ticket) && FRAMES_ARE(-1, values, 0));
+	// Beacon guard, throttle only until it has passed
+	FINISH();
+	THROTTLE_VALUES(values);
+	CHECK(ESC_UPDATE_THROTTLE(esc) == 1 && FRAMES_ARE(-1, values, 0) && !ESC_CMD_IDLE(esc));
+}
+
+// Commands are 0 - 47, anything above is a throttle and must not be queued as one
+static void TEST_COMMAND_RANGE(void)
+{
+	SETUP();
+	CHECK(ESC_SEND_CMD(esc, DSHOT_CMD_MAX + 1, ESC_MOTOR(0)) == 0);
+	CHECK(ESC_SEND_CMD(esc, 1000, ESC_MOTOR(0)) == 0);
+	CHECK(esc->CmdHead == esc->CmdTail && esc->CmdQueued == 0);
+	CHECK(ESC_SEND_CMD(esc, DSHOT_CMD_MAX, ESC_MOTOR(0)) == 1);
+}
+
+// Every ESC answers a telemetry bit on the one shared line, only settings commands may set it
+static void TEST_COMMAND_TELEMETRY(void)
+{
+	static const uint8_t settings[] = {DSHOT_CMD_SPIN_DIRECTION_1, DSHOT_CMD_SPIN_DIRECTION_2,
+			DSHOT_CMD_SPIN_DIRECTION_NORMAL, DSHOT_CMD_SPIN_DIRECTION_REVERSED, DSHOT_CMD_SAVE_SETTINGS};
+	static const uint8_t others[] = {DSHOT_CMD_MOTOR_STOP, DSHOT_CMD_BEACON3, DSHOT_CMD_LED0_ON};
+	SETUP();
+	for (unsigned i = 0; i < sizeof(settings); i++)
+	{
+		ESC_CMD* entry = &esc->CmdQueue[esc->CmdTail];
+		CHECK(ESC_SEND_CMD(esc, settings[i], ESC_MOTOR(0)) && entry->TelemBit);
+	}
+	SETUP();
+	for (unsigned i = 0; i < sizeof(others); i++)
+	{
+		ESC_CMD* entry = &esc->CmdQueue[esc->CmdTail];
+		CHECK(ESC_SEND_CMD(esc, others[i], ALL_MOTORS) && !entry->TelemBit);
+	}
+}
+
+int main(void)
+{
+	TEST_BACK_BUFFER();
+	TEST_TELEMETRY_WAITS();
+	TEST_COMMAND_WAITS();
+	TEST_COMMAND_RANGE();
+	TEST_COMMAND_TELEMETRY();
+	return TEST_END();
+}
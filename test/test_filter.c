@@ -0,0 +1,234 @@
+/*
+ * test_filter.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Gyro filter chain tests
+Each stage type is driven with sines and its gain read back by demodulating the settled output
+against the input, then checked against the transfer function the coefficients describe.
+Every lowpass has to sit on -3dB at its Hz, the PTn ones included.
+
+Benchmarks time the chain main.c runs, a longer chain and the filters plus rate PID per sample.
+These are host figures only, the on-target cycles come from filterCycles/loopCycles.
+*/
+
+#include <stdlib.h>
+#include "test.h"
+#include "FILTER.h"
+#include "PID.h"
+
+#define SAMPLE_HZ		1660.0f
+#define PI_D			3.14159265358979
+#define CALLS			10000000
+
+/* Function Summary: Gain of a one stage chain at a frequency, same sine on every axis
+ * Param: config - Stage
+ * Param: hz - Sine frequency
+ * Return: Gain in dB, every axis has to agree
+ */
+static double MEASURE_DB(const FILTER_CONFIG* config, double hz)
+{
+	FILTER_CHAIN* chain = FILTER_INIT(SAMPLE_HZ);
+	FILTER_SET_STAGE(chain, 0, config);
+	double re = 0, im = 0, spread = 0;
+	int settle = SAMPLE_HZ, n = 4 * SAMPLE_HZ;
+	for (int i = 0; i < settle + n; i++)
+	{
+		double phase = 2 * PI_D * hz * i / SAMPLE_HZ;
+		float axes[FILTER_AXES];
+		for (int a = 0; a < FILTER_AXES; a++) axes[a] = (a + 1) * sin(phase);
+		FILTER_APPLY(chain, axes);
+		if (i < settle) continue;
+		re += axes[0] * sin(phase);
+		im += axes[0] * cos(phase);
+		for (int a = 1; a < FILTER_AXES; a++) spread += fabs(axes[a] - (a + 1) * axes[0]);
+	}
+	CHECK(spread / n < 1e-4);
+	free(chain);
+	return 10 * log10(4 * (re * re + im * im) / ((double)n * n));
+}
+
+/* Function Summary: What the stage's own coefficients say the gain is
+ * Param: config - Stage
+ * Param: hz - Frequency
+ * Return: Gain in dB
+ */
+static double EXPECTED_DB(const FILTER_CONFIG* config, double hz)
+{
+	FILTER_CHAIN* chain = FILTER_INIT(SAMPLE_HZ);
+	FILTER_SET_STAGE(chain, 0, config);
+	const FILTER_STAGE* s = &chain->Stages[0];
+	double w = 2 * PI_D * hz / SAMPLE_HZ, mag2;
+	if (config->Type == FILTER_BIQUAD_LPF || config->Type == FILTER_BIQUAD_NOTCH)
+	{
+		double nr = s->B0 + s->B1 * cos(w) + s->B2 * cos(2 * w), ni = -s->B1 * sin(w) - s->B2 * sin(2 * w);
+		double dr = 1 + s->A1 * cos(w) + s->A2 * cos(2 * w), di = -s->A1 * sin(w) - s->A2 * sin(2 * w);
+		mag2 = (nr * nr + ni * ni) / (dr * dr + di * di);
+	}
+	else
+	{
+		// K / (1 - (1 - K) z^-1), once per cascaded PT1
+		double dr = 1 - (1 - s->K) * cos(w), di = (1 - s->K) * sin(w);
+		mag2 = pow(s->K * s->K / (dr * dr + di * di), config->Type - FILTER_PT1 + 1);
+	}
+	free(chain);
+	return 10 * log10(mag2);
+}
+
+// Every type passes DC, lowpasses roll off as designed, the notch takes out its centre only
+static void TEST_RESPONSES(void)
+{
+	const FILTER_CONFIG configs[] = {
+		{FILTER_PT1, 250, 0},
+		{FILTER_PT2, 250, 0},
+		{FILTER_PT3, 250, 0},
+		{FILTER_PT1, 50, 0},
+		{FILTER_PT3, 50, 0},
+		{FILTER_BIQUAD_LPF, 300, 0.707f},
+		{FILTER_BIQUAD_NOTCH, 200, 3.0f}
+	};
+	const double probes[] = {20, 50, 100, 200, 250, 300, 400, 600};
+	for (unsigned c = 0; c < sizeof(configs) / sizeof(configs[0]); c++)
+	{
+		const FILTER_CONFIG* config = &configs[c];
+		CHECK_NEAR(EXPECTED_DB(config, 0), 0, 1e-3);
+		for (unsigned p = 0; p < sizeof(probes) / sizeof(probes[0]); p++)
+		{
+			// Below -80dB the sum is float rounding, deep enough either way
+			double expected = EXPECTED_DB(config, probes[p]);
+			if (expected > -80) CHECK_NEAR(MEASURE_DB(config, probes[p]), expected, 0.05);
+		}
+		double atHz = MEASURE_DB(config, config->Hz);
+		if (config->Type == FILTER_BIQUAD_NOTCH) CHECK(atHz < -40);
+		else CHECK_NEAR(atHz, -3.01, 0.05);
+		printf("Type %d at %.0fHz: %.2fdB, an octave up %.2fdB\n", config->Type, config->Hz, atHz,
+				EXPECTED_DB(config, config->Hz * 2 < SAMPLE_HZ / 2 ? config->Hz * 2 : SAMPLE_HZ / 2 - 1));
+	}
+	// Close to Nyquist too
+	const FILTER_CONFIG highPt2 = {FILTER_PT2, 700, 0};
+	CHECK_NEAR(EXPECTED_DB(&highPt2, 700), -3.01, 0.01);
+	// Notch is nearly flat an octave either side
+	const FILTER_CONFIG notch = {FILTER_BIQUAD_NOTCH, 200, 3.0f};
+	CHECK(MEASURE_DB(&notch, 100) > -0.3);
+	CHECK(MEASURE_DB(&notch, 400) > -0.6);
+}
+
+// Out of range stages are refused, a retune keeps the state, a type change clears it
+static void TEST_SET_STAGE(void)
+{
+	FILTER_CHAIN* chain = FILTER_INIT(SAMPLE_HZ);
+	FILTER_CONFIG pt1 = {FILTER_PT1, 100, 0}, tooHigh = {FILTER_PT1, SAMPLE_HZ / 2, 0}, zero = {FILTER_BIQUAD_LPF, 0, 0.7f};
+	CHECK(FILTER_SET_STAGE(chain, FILTER_MAX_STAGES, &pt1) == 0);
+	CHECK(FILTER_SET_STAGE(chain, 0, &tooHigh) == 0);
+	CHECK(FILTER_SET_STAGE(chain, 0, &zero) == 0);
+	// Biquads need Q above 0, PT stages ignore it
+	FILTER_CONFIG noQ = {FILTER_BIQUAD_LPF, 100, 0}, negQ = {FILTER_BIQUAD_NOTCH, 100, -1}, nanQ = {FILTER_BIQUAD_LPF, 100, NAN};
+	CHECK(FILTER_SET_STAGE(chain, 0, &noQ) == 0);
+	CHECK(FILTER_SET_STAGE(chain, 0, &negQ) == 0);
+	CHECK(FILTER_SET_STAGE(chain, 0, &nanQ) == 0);
+	CHECK(chain->StageCount == 0);
+	// An empty chain and an unused stage pass samples through
+	float axes[FILTER_AXES] = {1, -2, 3};
+	FILTER_APPLY(chain, axes);
+	CHECK(axes[0] == 1 && axes[1] == -2 && axes[2] == 3);
+	CHECK(FILTER_SET_STAGE(chain, 2, &pt1) == 1);
+	CHECK(chain->StageCount == 3);
+	for (int i = 0; i < SAMPLE_HZ; i++)
+	{
+		axes[0] = 10;
+		axes[1] = 20;
+		axes[2] = 30;
+		FILTER_APPLY(chain, axes);
+	}
+	CHECK_NEAR(axes[2], 30, 1e-3);
+	pt1.Hz = 120;
+	FILTER_SET_STAGE(chain, 2, &pt1);
+	CHECK_NEAR(chain->Stages[2].S1[2], 30, 1e-3);
+	FILTER_CONFIG lpf = {FILTER_BIQUAD_LPF, 120, 0.707f};
+	FILTER_SET_STAGE(chain, 2, &lpf);
+	CHECK(chain->Stages[2].S1[2] == 0 && chain->Stages[2].S2[2] == 0);
+	free(chain);
+}
+
+// The single axis biquad runs the same coefficients and arithmetic as a chain stage
+static void TEST_SINGLE_BIQUAD(void)
+{
+	FILTER_CHAIN* chain = FILTER_INIT(SAMPLE_HZ);
+	FILTER_CONFIG notch = {FILTER_BIQUAD_NOTCH, 180, 2.5f};
+	FILTER_SET_STAGE(chain, 0, &notch);
+	FILTER_BIQUAD bq = {0};
+	FILTER_BIQUAD_SET(&bq, FILTER_BIQUAD_NOTCH, 180, 2.5f, SAMPLE_HZ);
+	int differ = 0;
+	for (int i = 0; i < 5000; i++)
+	{
+		float x = sinf(i * 0.37f) * 100 + (i % 17);
+		float axes[FILTER_AXES] = {x, 0, 0};
+		FILTER_APPLY(chain, axes);
+		differ += FILTER_BIQUAD_APPLY(&bq, x) != axes[0];
+	}
+	CHECK(differ == 0);
+	free(chain);
+}
+
+static double BENCH_CHAIN(FILTER_CHAIN* chain)
+{
+	float axes[FILTER_AXES] = {1, 2, 3};
+	volatile float sink = 0;
+	double start = TEST_NOW_NS();
+	for (int i = 0; i < CALLS; i++)
+	{
+		axes[0] = i & 7;
+		FILTER_APPLY(chain, axes);
+		sink += axes[1];
+	}
+	(void)sink;
+	return (TEST_NOW_NS() - start) / CALLS;
+}
+
+static void BENCH(void)
+{
+	const FILTER_CONFIG stages[] = {
+		{FILTER_PT1, 250, 0},
+		{FILTER_BIQUAD_LPF, 300, 0.707f},
+		{FILTER_BIQUAD_NOTCH, 200, 3.0f},
+		{FILTER_PT3, 400, 0}
+	};
+	FILTER_CHAIN* chain = FILTER_INIT(SAMPLE_HZ);
+	FILTER_SET_STAGE(chain, 0, &stages[0]);
+	FILTER_SET_STAGE(chain, 1, &stages[1]);
+	double flightNs = BENCH_CHAIN(chain);
+	FILTER_SET_STAGE(chain, 2, &stages[2]);
+	FILTER_SET_STAGE(chain, 3, &stages[3]);
+	double fourNs = BENCH_CHAIN(chain);
+
+	// Filters then the rate PID, what RATE_LOOP_STEP does per sample less the RPM notches and mixer
+	const PID_GAINS gains[PID_AXES] = {{0.8f, 1.5f, 0.010f, 200}, {0.8f, 1.5f, 0.010f, 200}, {1.5f, 2.0f, 0, 200}};
+	PID_CONTROLLER* pid = PID_INIT(gains, SAMPLE_HZ, 500);
+	float setpoint[PID_AXES] = {0}, out[PID_AXES];
+	volatile float sink = 0;
+	double start = TEST_NOW_NS();
+	for (int i = 0; i < CALLS; i++)
+	{
+		float axes[FILTER_AXES] = {i & 7, 2, 3};
+		FILTER_APPLY(chain, axes);
+		PID_UPDATE(pid, setpoint, axes, out);
+		sink += out[0];
+	}
+	(void)sink;
+	double loopNs = (TEST_NOW_NS() - start) / CALLS;
+	printf("FILTER_APPLY, 3 axes: main.c chain %.1f nS, 4 stages %.1f nS, 4 stages + PID %.1f nS (host)\n",
+			flightNs, fourNs, loopNs);
+	free(chain);
+	free(pid);
+}
+
+int main(void)
+{
+	TEST_RESPONSES();
+	TEST_SET_STAGE();
+	TEST_SINGLE_BIQUAD();
+	BENCH();
+	return TEST_END();
+}
@@ -0,0 +1,99 @@
+/*
+ * test_halfword.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Halfword frame tests
+Frames used to be one uint32_t per bit per motor. Every protocol's halfword frame is checked
+against the word frame the old encoders built, for every throttle and every group width a
+timer can have, and every value the DMA moves has to fit the 16 bit timer registers.
+*/
+
+#include <string.h>
+#include "test.h"
+#include "DSHOT.h"
+
+#define TIMER_CHANNELS	4
+
+/* Word frame as the per-bit encoder built it, one DSHOT_PACKET_SIZE column per motor,
+ * packet bits from row DSHOT_PACKET_LEAD, everything else zero */
+static void WORD_DSHOT(const ESC_PROTOCOL* proto, uint32_t* words, uint32_t value, uint8_t telemBit)
+{
+	uint16_t dshotBytes = makeDshotPacketBytes(value, telemBit);
+	memset(words, 0, DSHOT_PACKET_SIZE * sizeof(uint32_t));
+	for (int i = DSHOT_PACKET_LEAD + DSHOT_PACKET_BITS - 1; i >= DSHOT_PACKET_LEAD; i--)
+	{
+		words[i] = (dshotBytes & 0b1) ? proto->HighBit : proto->LowBit;
+		dshotBytes >>= 1;
+	}
+}
+
+// One pulse word then a zero word
+static void WORD_ANALOG(const ESC_PROTOCOL* proto, uint32_t* words, uint32_t value)
+{
+	if (value > DSHOT_MAX_THROTTLE) value = DSHOT_MAX_THROTTLE;
+	if (value <= DSHOT_MIN_THROTTLE) words[0] = proto->LowBit;
+	else words[0] = proto->LowBit + (value - DSHOT_MIN_THROTTLE) * (proto->HighBit - proto->LowBit) /
+					(DSHOT_MAX_THROTTLE - DSHOT_MIN_THROTTLE);
+	words[1] = 0;
+}
+
+// Every value the timers see fits 16 bits, rows fit the shared frame buffer
+static void TEST_PROTOCOL_RANGES(void)
+{
+	for (int p = 0; p < ESC_PROTOCOL_COUNT; p++)
+	{
+		const ESC_PROTOCOL* proto = &ESC_PROTOCOLS[p];
+		CHECK(proto->ARR - 1 <= 0xFFFF);
+		CHECK(proto->HighBit <= 0xFFFF);
+		CHECK(proto->LowBit < proto->HighBit);
+		CHECK(proto->HighBit < proto->ARR);
+		CHECK(proto->FrameRows <= ESC_PROTOCOL_MAX_ROWS);
+		if (proto->Digital) CHECK(DSHOT_TELEM_WINDOW(proto->ARR) <= 0xFFFF);
+	}
+}
+
+// Every protocol, throttle and group width against the word frames
+static void TEST_SAME_AS_WORDS(void)
+{
+	uint16_t frame[ESC_PROTOCOL_MAX_ROWS * TIMER_CHANNELS];
+	uint32_t words[TIMER_CHANNELS][DSHOT_PACKET_SIZE];
+	uint16_t values[TIMER_CHANNELS];
+	DSHOT_ENCODER enc;
+	for (int p = 0; p < ESC_PROTOCOL_COUNT; p++)
+	{
+		const ESC_PROTOCOL* proto = &ESC_PROTOCOLS[p];
+		int mismatches = 0;
+		DSHOT_ENCODER_INIT(&enc, proto->LowBit, proto->HighBit);
+		for (uint32_t width = 1; width <= TIMER_CHANNELS; width++)
+		{
+			memset(frame, 0, sizeof(frame));
+			for (uint32_t v = 0; v <= DSHOT_MAX_THROTTLE; v++)
+			{
+				uint8_t telemMask = v & ((1 << width) - 1);
+				for (uint32_t m = 0; m < width; m++)
+				{
+					values[m] = (v + 700 * m) & DSHOT_MAX_THROTTLE;
+					if (proto->Digital) WORD_DSHOT(proto, words[m], values[m], (telemMask >> m) & 1);
+					else WORD_ANALOG(proto, words[m], values[m]);
+				}
+				proto->Encode(proto, &enc, frame, values, width, telemMask);
+				for (uint32_t m = 0; m < width; m++)
+				{
+					for (uint32_t row = 0; row < proto->FrameRows; row++) mismatches += frame[row * width + m] != words[m][row];
+				}
+			}
+		}
+		if (mismatches) printf("%s: %d rows differ from the word frames\n", proto->Name, mismatches);
+		CHECK(mismatches == 0);
+	}
+}
+
+int main(void)
+{
+	TEST_PROTOCOL_RANGES();
+	TEST_SAME_AS_WORDS();
+	return TEST_END();
+}
@@ -0,0 +1,182 @@
+/*
+ * test_i2cq.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** I2C job queue tests
+The queue runs over the mock HAL and the test finishes or fails each transfer the way the
+complete and error interrupts would. Jobs have to run one at a time in order, NACKs retry
+without touching the bus, and a bus error, arbitration loss or timeout has to leave the
+recovery for I2CQ_SERVICE, with the queue held until it has run. No MSP init may ever run with
+interrupts masked. A start refused as busy is not a stuck bus, it waits for I2CQ_SERVICE.
+*/
+
+#include "test.h"
+#include "I2CQ.h"
+
+#define JOBS		4
+
+static I2C_HandleTypeDef hi2c;
+static I2CQ_CONTROLLER* q;
+static uint8_t buffers[JOBS][2];
+static int doneCount;
+static int doneJob[16];
+static uint8_t doneOk[16];
+
+static void DONE(void* context, uint8_t ok)
+{
+	doneJob[doneCount] = (uint8_t(*)[2])context - buffers;
+	doneOk[doneCount] = ok;
+	doneCount++;
+}
+
+static void SETUP(void)
+{
+	MOCK_HAL_RESET();
+	// Recovery busy waits on the cycle counter
+	mockHal.CycleStep = 100;
+	doneCount = 0;
+	if (q) free(q);
+	q = I2CQ_INIT(&hi2c, GPIOB, GPIO_PIN_8, GPIOB, GPIO_PIN_9);
+}
+
+static void SUBMIT(int job)
+{
+	CHECK(I2CQ_SUBMIT(q, 0xD4, 0x22 + job, buffers[job], sizeof(buffers[job]), I2CQ_READ, DONE, buffers[job]));
+}
+
+// The running transfer finishes, from the complete interrupt
+static void COMPLETE(void)
+{
+	CHECK(mockHal.Busy);
+	MOCK_I2C_FINISH();
+	I2CQ_CPLT(q);
+}
+
+// The running transfer fails with a HAL error code, from the error interrupt
+static void FAIL(uint32_t error)
+{
+	CHECK(mockHal.Busy);
+	MOCK_I2C_FINISH();
+	hi2c.ErrorCode = error;
+	I2CQ_ERROR(q);
+}
+
+// Submitted together, started one at a time in order, each started as the last completes
+static void TEST_ORDER(void)
+{
+	SETUP();
+	for (int i = 0; i < JOBS; i++) SUBMIT(i);
+	for (int i = 0; i < JOBS; i++)
+	{
+		CHECK(mockHal.Busy && mockHal.Reg == 0x22 + i && mockHal.Data == buffers[i]);
+		CHECK(mockHal.Starts == (uint32_t)i + 1);
+		COMPLETE();
+		CHECK(doneCount == i + 1 && doneJob[i] == i && doneOk[i]);
+	}
+	CHECK(!mockHal.Busy && !q->Busy);
+	// One slot always stays empty
+	for (int i = 0; i < I2CQ_SIZE - 1; i++) SUBMIT(0);
+	CHECK(!I2CQ_SUBMIT(q, 0xD4, 0x22, buffers[0], 2, I2CQ_READ, DONE, buffers[0]) && q->Full == 1);
+}
+
+// A NACK retries on the spot, no recovery, then fails and the next job runs
+static void TEST_NACK(void)
+{
+	SETUP();
+	SUBMIT(0);
+	SUBMIT(1);
+	for (int i = 0; i < I2CQ_NACK_RETRIES; i++)
+	{
+		FAIL(HAL_I2C_ERROR_AF);
+		CHECK(mockHal.Busy && mockHal.Reg == 0x22 && doneCount == 0);
+	}
+	FAIL(HAL_I2C_ERROR_AF);
+	CHECK(doneCount == 1 && doneJob[0] == 0 && !doneOk[0] && q->Failed == 1);
+	CHECK(mockHal.Busy && mockHal.Reg == 0x23);
+	CHECK(!q->RecoverPending && q->Recoveries == 0 && mockHal.DeInits == 0);
+}
+
+// Each stuck bus error only flags the recovery from the interrupt. The queue holds, submits
+// wait, and I2CQ_SERVICE recovers with interrupts on then retries the job
+static void TEST_STUCK(void)
+{
+	static const uint32_t errors[] = {HAL_I2C_ERROR_BERR, HAL_I2C_ERROR_ARLO, HAL_I2C_ERROR_TIMEOUT};
+	for (unsigned e = 0; e < sizeof(errors) / sizeof(errors[0]); e++)
+	{
+		SETUP();
+		SUBMIT(0);
+		FAIL(errors[e]);
+		CHECK(q->RecoverPending && q->Recoveries == 0 && mockHal.DeInits == 0);
+		SUBMIT(1);
+		CHECK(!mockHal.Busy && mockHal.Starts == 1);
+		I2CQ_SERVICE(q);
+		CHECK(!q->RecoverPending && q->Recoveries == 1 && mockHal.DeInits == 1 && mockHal.Inits == 1);
+		CHECK(mockHal.Busy && mockHal.Reg == 0x22);
+		// Out of tries the second time, the job fails but the next one still waits
+		FAIL(errors[e]);
+		CHECK(doneCount == 1 && !doneOk[0] && q->RecoverPending && !mockHal.Busy);
+		I2CQ_SERVICE(q);
+		CHECK(q->Recoveries == 2 && mockHal.Busy && mockHal.Reg == 0x23);
+		COMPLETE();
+		CHECK(doneCount == 2 && doneOk[1]);
+		CHECK(mockHal.MaskedInits == 0);
+	}
+}
+
+// Overrun and DMA errors don't mean a stuck bus, retried without a recovery
+static void TEST_OTHER_ERRORS(void)
+{
+	SETUP();
+	SUBMIT(0);
+	FAIL(HAL_I2C_ERROR_OVR);
+	CHECK(!q->RecoverPending && mockHal.Busy && mockHal.Starts == 2);
+	FAIL(HAL_I2C_ERROR_DMA);
+	CHECK(doneCount == 1 && !doneOk[0] && q->Recoveries == 0 && !mockHal.Busy);
+}
+
+// Refused as busy, the job stays queued without using a try until I2CQ_SERVICE gets it going
+static void TEST_BUSY(void)
+{
+	SETUP();
+	mockHal.StartStatus = HAL_BUSY;
+	SUBMIT(0);
+	CHECK(!q->Busy && !q->RecoverPending && q->Jobs[q->Tail].Tries == 0 && doneCount == 0);
+	I2CQ_SERVICE(q);
+	CHECK(!q->Busy && q->Recoveries == 0);
+	mockHal.StartStatus = HAL_OK;
+	I2CQ_SERVICE(q);
+	CHECK(q->Busy && mockHal.Starts == 1 && q->Jobs[q->Tail].Tries == 1);
+	COMPLETE();
+	CHECK(doneCount == 1 && doneOk[0] && mockHal.DeInits == 0);
+}
+
+// Any other refusal is a stuck bus, recovered from I2CQ_SERVICE like an error
+static void TEST_START_ERROR(void)
+{
+	SETUP();
+	mockHal.StartStatus = HAL_ERROR;
+	SUBMIT(0);
+	SUBMIT(1);
+	CHECK(q->RecoverPending && q->Recoveries == 0 && doneCount == 0);
+	I2CQ_SERVICE(q);
+	CHECK(q->Recoveries == 1 && q->RecoverPending && doneCount == 1 && doneJob[0] == 0 && !doneOk[0]);
+	mockHal.StartStatus = HAL_OK;
+	I2CQ_SERVICE(q);
+	CHECK(q->Recoveries == 2 && mockHal.Busy && mockHal.Reg == 0x23);
+	COMPLETE();
+	CHECK(doneCount == 2 && doneOk[1] && mockHal.MaskedInits == 0);
+}
+
+int main(void)
+{
+	TEST_ORDER();
+	TEST_NACK();
+	TEST_STUCK();
+	TEST_OTHER_ERRORS();
+	TEST_BUSY();
+	TEST_START_ERROR();
+	return TEST_END();
+}
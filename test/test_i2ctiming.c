@@ -0,0 +1,145 @@
+/*
+ * test_i2ctiming.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** I2C TIMINGR calculator tests
+The values for the 54MHz kernel clock are pinned, and the 100kHz one with no edge allowance is
+held against what CubeMX generated for this board. Every TIMINGR the calculator gives, over a
+sweep of kernel clocks and edges, is decoded here with the reference manual formulas and has
+to meet the I2C spec with the rate between 80% and 100% of the target.
+*/
+
+#include "test.h"
+#include "I2CTIMING.h"
+
+#define AF_MIN_NS	50.0		// Analog filter delay range
+#define AF_MAX_NS	260.0
+
+/* Pinned values, 54MHz */
+typedef struct REFERENCE
+{
+	i2cTimingSpeeds_e Speed;
+	uint32_t RiseNs;
+	uint32_t FallNs;
+	uint32_t Timingr;
+} REFERENCE;
+
+static const REFERENCE references[] = {
+	{I2CTIMING_STANDARD,	I2CTIMING_RISE_NS,	I2CTIMING_FALL_NS,	0x10808A7C},
+	{I2CTIMING_FAST,		I2CTIMING_RISE_NS,	I2CTIMING_FALL_NS,	0x00803841},
+	{I2CTIMING_FAST_PLUS,	I2CTIMING_RISE_NS,	I2CTIMING_FALL_NS,	0x00501216},
+	{I2CTIMING_STANDARD,	0,					0,					0x20405C53},
+	{I2CTIMING_FAST,		0,					0,					0x00503B41},
+	{I2CTIMING_FAST_PLUS,	0,					0,					0x00201516},
+};
+
+// What CubeMX put in MX_I2C1_Init for 100kHz at 54MHz, no edges, analog filter on
+#define CUBEMX_100K		0x20404768
+
+/* Function Summary: Decode a TIMINGR and check it against the spec for a speed, RM0431 I2C
+ * timings with the analog filter on and no digital filter
+ * Param: clockHz - Kernel clock
+ * Param: speed - Speed from i2cTimingSpeeds_e
+ * Param: riseNs, fallNs - Bus edges
+ * Param: timingr - Register value
+ * Return: SCL rate, 0 if any limit is broken
+ */
+static double SPEC_HZ(uint32_t clockHz, i2cTimingSpeeds_e speed, double riseNs, double fallNs, uint32_t timingr)
+{
+	const I2CTIMING_SPEC* spec = &I2CTIMING_SPECS[speed];
+	double clk = 1e9 / clockHz;
+	double tPresc = ((timingr >> 28) + 1) * clk;
+	double sclDel = (timingr >> 20) & 0x0F, sdaDel = (timingr >> 16) & 0x0F;
+	double sclH = (timingr >> 8) & 0xFF, sclL = timingr & 0xFF;
+	double sync = AF_MIN_NS + 2 * clk;
+	double low = (sclL + 1) * tPresc + sync, high = (sclH + 1) * tPresc + sync;
+	double period = low + high + riseNs + fallNs;
+	int ok = low >= spec->LowMin && high >= spec->HighMin;
+	// Data hold covers the fall, data valid in time, setup covers the rise
+	ok &= sdaDel * tPresc >= fallNs - AF_MIN_NS - 3 * clk;
+	ok &= sdaDel * tPresc <= spec->DataValidMax - riseNs - AF_MAX_NS - 4 * clk;
+	ok &= (sclDel + 1) * tPresc >= riseNs + spec->DataSetupMin;
+	// Peripheral needs 4 kernel clocks of low phase and more than one of high
+	ok &= low - AF_MIN_NS > 4 * clk && high > clk;
+	return ok ? 1e9 / period : 0;
+}
+
+static void TEST_REFERENCES(void)
+{
+	for (unsigned i = 0; i < sizeof(references) / sizeof(references[0]); i++)
+	{
+		const REFERENCE* ref = &references[i];
+		I2CTIMING_RESULT result;
+		uint32_t timingr = I2CTIMING_CALC(I2CTIMING_CLOCK_HZ, ref->Speed, ref->RiseNs, ref->FallNs, &result);
+		CHECK(timingr == ref->Timingr && result.Timingr == timingr);
+		CHECK(result.Presc == timingr >> 28 && result.SclDel == ((timingr >> 20) & 0x0F));
+		CHECK(result.SdaDel == ((timingr >> 16) & 0x0F));
+		CHECK(result.SclH == ((timingr >> 8) & 0xFF) && result.SclL == (timingr & 0xFF));
+		double hz = SPEC_HZ(I2CTIMING_CLOCK_HZ, ref->Speed, ref->RiseNs, ref->FallNs, timingr);
+		CHECK(hz > 0);
+		// Calculator works in whole pS, 18518 for the 18518.5 kernel clock
+		CHECK_NEAR(result.BusHz, hz, hz * 1e-4);
+		printf("%7lu Hz, %2lu/%2lu nS edges: 0x%08lX, %.0f Hz\n", (unsigned long)I2CTIMING_SPECS[ref->Speed].Hz,
+				(unsigned long)ref->RiseNs, (unsigned long)ref->FallNs, (unsigned long)timingr, hz);
+	}
+}
+
+// Same prescaler, delays and period as CubeMX, the low/high split is the only difference
+static void TEST_CUBEMX(void)
+{
+	uint32_t timingr = I2CTIMING_CALC(I2CTIMING_CLOCK_HZ, I2CTIMING_STANDARD, 0, 0, NULL);
+	CHECK((timingr & 0xFFFF0000) == (CUBEMX_100K & 0xFFFF0000));
+	CHECK(((timingr >> 8) & 0xFF) + (timingr & 0xFF) == ((CUBEMX_100K >> 8) & 0xFF) + (CUBEMX_100K & 0xFF));
+	CHECK_NEAR(SPEC_HZ(I2CTIMING_CLOCK_HZ, I2CTIMING_STANDARD, 0, 0, timingr),
+			SPEC_HZ(I2CTIMING_CLOCK_HZ, I2CTIMING_STANDARD, 0, 0, CUBEMX_100K), 0.01);
+}
+
+// Kernel clocks 8 to 108MHz, no edges, the board's and the worst the spec allows. Whatever comes
+// back has to pass, and the board's clock and edges have to get every speed
+static void TEST_SWEEP(void)
+{
+	int found = 0, tried = 0;
+	for (int speed = 0; speed < I2CTIMING_SPEEDS; speed++)
+	{
+		const I2CTIMING_SPEC* spec = &I2CTIMING_SPECS[speed];
+		const uint32_t edges[3][2] = {{0, 0}, {I2CTIMING_RISE_NS, I2CTIMING_FALL_NS}, {spec->RiseMax, spec->FallMax}};
+		for (uint32_t mhz = 8; mhz <= 108; mhz++)
+		{
+			for (int e = 0; e < 3; e++)
+			{
+				I2CTIMING_RESULT result;
+				uint32_t timingr = I2CTIMING_CALC(mhz * 1000000, speed, edges[e][0], edges[e][1], &result);
+				tried++;
+				if (!timingr) continue;
+				found++;
+				double hz = SPEC_HZ(mhz * 1000000, speed, edges[e][0], edges[e][1], timingr);
+				CHECK(hz <= spec->Hz && hz >= spec->Hz * 0.8);
+			}
+		}
+		CHECK(I2CTIMING_CALC(I2CTIMING_CLOCK_HZ, speed, I2CTIMING_RISE_NS, I2CTIMING_FALL_NS, NULL) != 0);
+	}
+	printf("Sweep: %d of %d clock, speed and edge settings have a TIMINGR, all in spec\n", found, tried);
+}
+
+static void TEST_LIMITS(void)
+{
+	I2CTIMING_RESULT result = {.Timingr = 1};
+	CHECK(I2CTIMING_CALC(I2CTIMING_CLOCK_HZ, I2CTIMING_SPEEDS, 0, 0, &result) == 0 && result.Timingr == 0);
+	CHECK(I2CTIMING_CALC(0, I2CTIMING_STANDARD, 0, 0, &result) == 0);
+	CHECK(I2CTIMING_CALC(I2CTIMING_CLOCK_HZ, I2CTIMING_FAST_PLUS, 121, 0, &result) == 0);
+	CHECK(I2CTIMING_CALC(I2CTIMING_CLOCK_HZ, I2CTIMING_FAST, 0, 301, &result) == 0);
+	// 1MHz at a 2MHz kernel clock, the low phase alone needs more than a period
+	CHECK(I2CTIMING_CALC(2000000, I2CTIMING_FAST_PLUS, 0, 0, &result) == 0);
+}
+
+int main(void)
+{
+	TEST_REFERENCES();
+	TEST_CUBEMX();
+	TEST_SWEEP();
+	TEST_LIMITS();
+	return TEST_END();
+}
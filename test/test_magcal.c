@@ -0,0 +1,145 @@
+/*
+ * test_magcal.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Magnetometer decode and calibration tests
+MAGCAL_DECODE has to put the low byte first and sign extend. MAGCAL_APPLY is checked by hand
+for the order of the offset and the matrix, then against a simulated board: a 0.5 gauss field
+turned through every direction, distorted by a hard iron offset and a soft iron ellipsoid and
+quantised at the 4 gauss range sensitivity. With the inverse of the distortion as calibration
+the field has to come back the same size in every direction and point the right way. Timed
+per sample at the end.
+*/
+
+#include "test.h"
+#include <stdlib.h>
+#include "MAGCAL.h"
+
+#define LSB_PER_GAUSS	6842.0f		// LIS3MDL, 4 gauss range
+#define FIELD_GAUSS		0.5
+#define READINGS		100000
+#define CALLS			10000000
+
+// Board distortion, soft iron ellipsoid and hard iron offset in gauss
+static const double distortion[3][3] = {{1.15, 0.08, -0.03}, {0.08, 0.92, 0.05}, {-0.03, 0.05, 1.04}};
+static const double offset[3] = {0.21, -0.13, 0.34};
+
+// Inverse of a 3x3 by cofactors
+static void INVERT(const double a[3][3], double out[3][3])
+{
+	double det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1]) - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+			+ a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			int i1 = (j + 1) % 3, i2 = (j + 2) % 3, j1 = (i + 1) % 3, j2 = (i + 2) % 3;
+			out[i][j] = (a[i1][j1] * a[i2][j2] - a[i1][j2] * a[i2][j1]) / det;
+		}
+	}
+}
+
+// OUT_X_L first, two's complement
+static void TEST_DECODE(void)
+{
+	const uint8_t data[6] = {0x34, 0x12, 0xFF, 0xFF, 0x00, 0x80};
+	const uint8_t edges[6] = {0xFF, 0x7F, 0x01, 0x00, 0xFE, 0xFF};
+	int16_t raw[3];
+	MAGCAL_DECODE(data, raw);
+	CHECK(raw[0] == 0x1234 && raw[1] == -1 && raw[2] == -32768);
+	MAGCAL_DECODE(edges, raw);
+	CHECK(raw[0] == 32767 && raw[1] == 1 && raw[2] == -2);
+}
+
+// Identity only scales. The offset comes off before the matrix, and the matrix is by row, an
+// asymmetric one shows a transpose
+static void TEST_APPLY(void)
+{
+	const MAGCAL_CONFIG none = MAGCAL_IDENTITY;
+	const MAGCAL_CONFIG cal = {{0.1f, -0.2f, 0.3f}, {{1, 2, 0}, {0, 1, 0}, {0, 0, 3}}};
+	const int16_t raw[3] = {1000, -2000, 3000};
+	const float lsb = 0.001f;
+	float field[3];
+	MAGCAL_APPLY(&none, raw, lsb, field);
+	CHECK_NEAR(field[0], 1.0, 1e-6);
+	CHECK_NEAR(field[1], -2.0, 1e-6);
+	CHECK_NEAR(field[2], 3.0, 1e-6);
+	// Centred (0.9, -1.8, 2.7)
+	MAGCAL_APPLY(&cal, raw, lsb, field);
+	CHECK_NEAR(field[0], 0.9 - 3.6, 1e-5);
+	CHECK_NEAR(field[1], -1.8, 1e-5);
+	CHECK_NEAR(field[2], 8.1, 1e-5);
+}
+
+static void TEST_ELLIPSOID(void)
+{
+	const float lsb = 1.0f / LSB_PER_GAUSS;
+	const MAGCAL_CONFIG none = MAGCAL_IDENTITY;
+	MAGCAL_CONFIG cal;
+	double inverse[3][3], worstSize = 0, worstRaw = 0, worstAngle = 0;
+	INVERT(distortion, inverse);
+	for (int i = 0; i < 3; i++)
+	{
+		cal.Offset[i] = offset[i];
+		for (int j = 0; j < 3; j++) cal.Soft[i][j] = inverse[i][j];
+	}
+	srand(1);
+	for (int n = 0; n < READINGS; n++)
+	{
+		// Uniform on the sphere
+		double z = 2.0 * rand() / RAND_MAX - 1, phi = 2 * M_PI * rand() / RAND_MAX, u[3];
+		u[0] = sqrt(1 - z * z) * cos(phi);
+		u[1] = sqrt(1 - z * z) * sin(phi);
+		u[2] = z;
+		int16_t raw[3];
+		for (int i = 0; i < 3; i++)
+		{
+			double m = offset[i];
+			for (int j = 0; j < 3; j++) m += distortion[i][j] * u[j] * FIELD_GAUSS;
+			raw[i] = (int16_t)lround(m / lsb);
+		}
+		float f[3], g[3];
+		MAGCAL_APPLY(&cal, raw, lsb, f);
+		MAGCAL_APPLY(&none, raw, lsb, g);
+		double size = sqrt(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+		double sizeRaw = sqrt(g[0] * g[0] + g[1] * g[1] + g[2] * g[2]);
+		double dot = (f[0] * u[0] + f[1] * u[1] + f[2] * u[2]) / size;
+		worstSize = fmax(worstSize, fabs(size - FIELD_GAUSS) / FIELD_GAUSS);
+		worstRaw = fmax(worstRaw, fabs(sizeRaw - FIELD_GAUSS) / FIELD_GAUSS);
+		worstAngle = fmax(worstAngle, acos(fmin(dot, 1)) * 180 / M_PI);
+	}
+	CHECK(worstSize < 0.002);
+	CHECK(worstAngle < 0.1);
+	CHECK(worstRaw > 0.5);
+	printf("Calibrated field size error worst %.3f%% (uncorrected %.1f%%), direction worst %.3f deg\n", worstSize * 100,
+			worstRaw * 100, worstAngle);
+}
+
+static void BENCH(void)
+{
+	const MAGCAL_CONFIG cal = {{0.21f, -0.13f, 0.34f}, {{0.88f, -0.08f, 0.03f}, {-0.08f, 1.09f, -0.05f}, {0.03f, -0.05f, 0.96f}}};
+	int16_t raw[3] = {1234, -2345, 3456};
+	float field[3];
+	volatile float sink = 0;
+	double start = TEST_NOW_NS();
+	for (int i = 0; i < CALLS; i++)
+	{
+		raw[0] ^= i & 1;
+		MAGCAL_APPLY(&cal, raw, 1.0f / LSB_PER_GAUSS, field);
+		sink += field[0];
+	}
+	printf("MAGCAL_APPLY: %.1f nS (host)\n", (TEST_NOW_NS() - start) / CALLS);
+	(void)sink;
+}
+
+int main(void)
+{
+	TEST_DECODE();
+	TEST_APPLY();
+	TEST_ELLIPSOID();
+	BENCH();
+	return TEST_END();
+}
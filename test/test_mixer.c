@@ -0,0 +1,176 @@
+/*
+ * test_mixer.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Mixer tests
+Layout weights checked for balance, then MIXER_APPLY against the hand-written quad X mix it
+replaced, over the stick range where that mix never clamped an axis. Stick offsets are
+multiples of 4 so the old 0.25 sensitivity truncated nothing and the two have to agree
+exactly. Both are timed per call at the end.
+*/
+
+#include <stdlib.h>
+#include "test.h"
+#include "MIXER.h"
+
+#define MIN_IDLE		250
+#define MAX_THROTTLE	2047
+#define STICK_NEUTRAL	1028
+#define CALLS			10000000
+
+typedef struct { uint32_t throttle, pitch, roll, yaw; } OLD_RX;
+
+/* Per-axis unsigned mix as ESC_CALC_THROTTLE had it, motors FL, FR, BL, BR. Each axis adds to
+ * one side and takes from the other, clamping at 0 as it goes */
+static void OLD_ADD(uint32_t* up0, uint32_t* up1, uint32_t* down0, uint32_t* down1, uint32_t addVal)
+{
+	*down0 = *down0 > addVal ? *down0 - addVal : 0;
+	*down1 = *down1 > addVal ? *down1 - addVal : 0;
+	*up0 += addVal;
+	*up1 += addVal;
+}
+
+static void OLD_QUAD_X(const OLD_RX* rx, uint32_t* out)
+{
+	uint32_t fl = rx->throttle, fr = rx->throttle, bl = rx->throttle, br = rx->throttle;
+	if (rx->pitch > STICK_NEUTRAL) OLD_ADD(&bl, &br, &fl, &fr, (rx->pitch - STICK_NEUTRAL) * 0.25);
+	else if (rx->pitch < STICK_NEUTRAL) OLD_ADD(&fl, &fr, &bl, &br, (STICK_NEUTRAL - rx->pitch) * 0.25);
+	if (rx->roll > STICK_NEUTRAL) OLD_ADD(&fl, &bl, &fr, &br, (rx->roll - STICK_NEUTRAL) * 0.25);
+	else if (rx->roll < STICK_NEUTRAL) OLD_ADD(&fr, &br, &fl, &bl, (STICK_NEUTRAL - rx->roll) * 0.25);
+	if (rx->yaw > STICK_NEUTRAL) OLD_ADD(&fl, &br, &fr, &bl, (rx->yaw - STICK_NEUTRAL) * 0.25);
+	else if (rx->yaw < STICK_NEUTRAL) OLD_ADD(&fr, &bl, &fl, &br, (STICK_NEUTRAL - rx->yaw) * 0.25);
+	uint32_t motors[4] = {fl, fr, bl, br};
+	for (int m = 0; m < 4; m++)
+	{
+		if (motors[m] > MAX_THROTTLE) motors[m] = MAX_THROTTLE;
+		else if (motors[m] < MIN_IDLE) motors[m] = MIN_IDLE;
+		out[m] = motors[m];
+	}
+}
+
+static MIXER_AXES DEMAND(const OLD_RX* rx)
+{
+	MIXER_AXES demand = {
+		rx->throttle,
+		((int32_t)rx->roll - STICK_NEUTRAL) * 0.25f,
+		((int32_t)rx->pitch - STICK_NEUTRAL) * 0.25f,
+		((int32_t)rx->yaw - STICK_NEUTRAL) * 0.25f
+	};
+	return demand;
+}
+
+// Throttle weighs 1 everywhere, roll/pitch/yaw sum to zero so they never move total thrust,
+// and no axis leaks into another
+static void TEST_WEIGHTS(void)
+{
+	for (int l = 0; l < MIXER_LAYOUT_COUNT; l++)
+	{
+		const MIXER_LAYOUT* layout = &MIXER_LAYOUTS[l];
+		float roll = 0, pitch = 0, yaw = 0, rollPitch = 0, rollYaw = 0, pitchYaw = 0;
+		CHECK(layout->MotorCount <= MIXER_MAX_MOTORS);
+		for (int m = 0; m < layout->MotorCount; m++)
+		{
+			const MIXER_AXES* w = &layout->Weights[m];
+			CHECK(w->Throttle == 1.0f);
+			CHECK(fabsf(w->Roll) <= 1.0f && fabsf(w->Pitch) <= 1.0f && fabsf(w->Yaw) == 1.0f);
+			roll += w->Roll;
+			pitch += w->Pitch;
+			yaw += w->Yaw;
+			rollPitch += w->Roll * w->Pitch;
+			rollYaw += w->Roll * w->Yaw;
+			pitchYaw += w->Pitch * w->Yaw;
+		}
+		CHECK_NEAR(roll, 0, 1e-5);
+		CHECK_NEAR(pitch, 0, 1e-5);
+		CHECK_NEAR(yaw, 0, 1e-5);
+		CHECK_NEAR(rollPitch, 0, 1e-5);
+		CHECK_NEAR(rollYaw, 0, 1e-5);
+		CHECK_NEAR(pitchYaw, 0, 1e-5);
+	}
+}
+
+// Roll right speeds up the left motors, pitch forward the back ones, yaw right FL and BR
+static void TEST_QUAD_X_DIRECTIONS(void)
+{
+	const MIXER_LAYOUT* layout = &MIXER_LAYOUTS[MIXER_QUAD_X];
+	uint32_t out[MIXER_MAX_MOTORS];
+	MIXER_AXES roll = {1000, 100, 0, 0}, pitch = {1000, 0, 100, 0}, yaw = {1000, 0, 0, 100};
+	MIXER_APPLY(layout, &roll, MIXER_MODE_CLAMP, MIN_IDLE, MAX_THROTTLE, out);
+	CHECK(out[0] == 1100 && out[1] == 900 && out[2] == 1100 && out[3] == 900);
+	MIXER_APPLY(layout, &pitch, MIXER_MODE_CLAMP, MIN_IDLE, MAX_THROTTLE, out);
+	CHECK(out[0] == 900 && out[1] == 900 && out[2] == 1100 && out[3] == 1100);
+	MIXER_APPLY(layout, &yaw, MIXER_MODE_CLAMP, MIN_IDLE, MAX_THROTTLE, out);
+	CHECK(out[0] == 1100 && out[1] == 900 && out[2] == 900 && out[3] == 1100);
+}
+
+// Same motor outputs as the old mix wherever none of its axes clamped
+static void TEST_SAME_AS_OLD(void)
+{
+	const MIXER_LAYOUT* layout = &MIXER_LAYOUTS[MIXER_QUAD_X];
+	long cases = 0, differ = 0;
+	for (uint32_t t = 330; t <= MAX_THROTTLE; t += 7)
+	{
+		for (uint32_t p = 600; p <= 1456; p += 36)
+		{
+			for (uint32_t r = 600; r <= 1456; r += 44)
+			{
+				for (uint32_t y = 600; y <= 1456; y += 52)
+				{
+					OLD_RX rx = {t, p, r, y};
+					uint32_t old[4], out[MIXER_MAX_MOTORS];
+					OLD_QUAD_X(&rx, old);
+					// Skip sticks where the old mix clamped at the ends. From 330 up its three axes, 107
+					// each at most, can't take a motor to 0 part way through
+					int clean = 1;
+					for (int m = 0; m < 4; m++) clean &= old[m] > MIN_IDLE && old[m] < MAX_THROTTLE;
+					if (!clean) continue;
+					MIXER_AXES demand = DEMAND(&rx);
+					MIXER_APPLY(layout, &demand, MIXER_MODE_CLAMP, MIN_IDLE, MAX_THROTTLE, out);
+					cases++;
+					for (int m = 0; m < 4; m++) differ += out[m] != old[m];
+				}
+			}
+		}
+	}
+	CHECK(cases > 100000);
+	CHECK(differ == 0);
+}
+
+static void BENCH(void)
+{
+	const MIXER_LAYOUT* layout = &MIXER_LAYOUTS[MIXER_QUAD_X];
+	OLD_RX rx = {1200, 1100, 900, 1052};
+	uint32_t out[MIXER_MAX_MOTORS];
+	volatile uint32_t sink = 0;
+	double start = TEST_NOW_NS();
+	for (int i = 0; i < CALLS; i++)
+	{
+		rx.roll = 900 + (i & 255);
+		OLD_QUAD_X(&rx, out);
+		sink += out[i & 3];
+	}
+	double oldNs = (TEST_NOW_NS() - start) / CALLS;
+	MIXER_AXES demand = DEMAND(&rx);
+	start = TEST_NOW_NS();
+	for (int i = 0; i < CALLS; i++)
+	{
+		demand.Roll = -32.0f + (i & 255);
+		MIXER_APPLY(layout, &demand, MIXER_MODE_CLAMP, MIN_IDLE, MAX_THROTTLE, out);
+		sink += out[i & 3];
+	}
+	double newNs = (TEST_NOW_NS() - start) / CALLS;
+	printf("Quad X mix: per-axis %.1f nS, weight matrix %.1f nS\n", oldNs, newNs);
+	(void)sink;
+}
+
+int main(void)
+{
+	TEST_WEIGHTS();
+	TEST_QUAD_X_DIRECTIONS();
+	TEST_SAME_AS_OLD();
+	BENCH();
+	return TEST_END();
+}
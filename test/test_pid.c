@@ -0,0 +1,159 @@
+/*
+ * test_pid.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** Rate PID tests
+Each term on its own against hand worked values, then the flight gains closed around a
+simple airframe axis, motor lag into angular acceleration with drag and a constant
+disturbance torque that only the I-term can hold off. The step response has to settle on
+the setpoint with no steady state error.
+*/
+
+#include "test.h"
+#include "PID.h"
+
+#define SAMPLE_HZ		1660.0f
+#define OUT_LIMIT		500.0f
+#define CALLS			10000000
+
+// main.c rate loop gains
+static const PID_GAINS flightGains[PID_AXES] = {
+	{0.8f, 1.5f, 0.010f, 200.0f},
+	{0.8f, 1.5f, 0.010f, 200.0f},
+	{1.5f, 2.0f, 0.0f, 200.0f}
+};
+
+static PID_CONTROLLER* SINGLE_TERM(float p, float i, float d, float iLimit)
+{
+	PID_GAINS gains[PID_AXES];
+	for (int a = 0; a < PID_AXES; a++) gains[a] = (PID_GAINS){p, i, d, iLimit};
+	return PID_INIT(gains, SAMPLE_HZ, OUT_LIMIT);
+}
+
+static void TEST_P(void)
+{
+	PID_CONTROLLER* pid = SINGLE_TERM(0.8f, 0, 0, 0);
+	float setpoint[PID_AXES] = {100, -50, 0}, measure[PID_AXES] = {0, 0, 20}, out[PID_AXES];
+	PID_UPDATE(pid, setpoint, measure, out);
+	CHECK_NEAR(out[PID_ROLL], 80, 1e-4);
+	CHECK_NEAR(out[PID_PITCH], -40, 1e-4);
+	CHECK_NEAR(out[PID_YAW], -16, 1e-4);
+	// Clamped to the output limit
+	setpoint[PID_ROLL] = 1000;
+	PID_UPDATE(pid, setpoint, measure, out);
+	CHECK(out[PID_ROLL] == OUT_LIMIT);
+	free(pid);
+}
+
+// 100 deg/s of error for one second at I = 1.5 is 150, a longer error stops at ILimit
+static void TEST_I(void)
+{
+	PID_CONTROLLER* pid = SINGLE_TERM(0, 1.5f, 0, 200);
+	float setpoint[PID_AXES] = {100, -100, 0}, measure[PID_AXES] = {0}, out[PID_AXES];
+	for (int i = 0; i < SAMPLE_HZ; i++) PID_UPDATE(pid, setpoint, measure, out);
+	CHECK_NEAR(out[PID_ROLL], 150, 0.1);
+	CHECK_NEAR(out[PID_PITCH], -150, 0.1);
+	for (int i = 0; i < SAMPLE_HZ; i++) PID_UPDATE(pid, setpoint, measure, out);
+	CHECK(out[PID_ROLL] == 200 && out[PID_PITCH] == -200);
+	PID_RESET(pid);
+	CHECK(pid->Axes[PID_ROLL].Integral == 0 && pid->Axes[PID_PITCH].Integral == 0);
+	free(pid);
+}
+
+// While P alone holds the output at the limit the integral must not grow, so once the error
+// drops back inside the linear range the output follows P straight away
+static void TEST_ANTI_WINDUP(void)
+{
+	PID_CONTROLLER* pid = SINGLE_TERM(10.0f, 5.0f, 0, 1000);
+	float setpoint[PID_AXES] = {100, 0, 0}, measure[PID_AXES] = {0}, out[PID_AXES];
+	for (int i = 0; i < SAMPLE_HZ; i++) PID_UPDATE(pid, setpoint, measure, out);
+	CHECK(out[PID_ROLL] == OUT_LIMIT);
+	CHECK(pid->Axes[PID_ROLL].Integral == 0);
+	setpoint[PID_ROLL] = 20;
+	PID_UPDATE(pid, setpoint, measure, out);
+	CHECK_NEAR(out[PID_ROLL], 200 + 5.0 * 20 / SAMPLE_HZ, 1e-3);
+	// Below the limit it integrates again, either way
+	setpoint[PID_ROLL] = -20;
+	PID_UPDATE(pid, setpoint, measure, out);
+	CHECK_NEAR(pid->Axes[PID_ROLL].Integral, 0, 1e-6);
+	free(pid);
+}
+
+// D acts on the measurement, a setpoint step does nothing, a 1 deg/s gyro step over one
+// sample is D * 1660 the other way. No kick on the first sample after a reset
+static void TEST_D(void)
+{
+	PID_CONTROLLER* pid = SINGLE_TERM(0, 0, 0.01f, 0);
+	float setpoint[PID_AXES] = {0}, measure[PID_AXES] = {50, 50, 50}, out[PID_AXES];
+	PID_UPDATE(pid, setpoint, measure, out);
+	CHECK(out[PID_ROLL] == 0);
+	setpoint[PID_ROLL] = 300;
+	PID_UPDATE(pid, setpoint, measure, out);
+	CHECK(out[PID_ROLL] == 0);
+	measure[PID_ROLL] = 51;
+	PID_UPDATE(pid, setpoint, measure, out);
+	CHECK_NEAR(out[PID_ROLL], -0.01 * SAMPLE_HZ, 1e-3);
+	PID_RESET(pid);
+	measure[PID_ROLL] = 250;
+	PID_UPDATE(pid, setpoint, measure, out);
+	CHECK(out[PID_ROLL] == 0);
+	free(pid);
+}
+
+/* Flight gains around one airframe axis. Thrust follows the demand through a 20mS motor lag,
+ * 8 deg/s^2 per output count, drag of 1/s and a disturbance of 150 deg/s^2. Rate in deg/s */
+static void TEST_CLOSED_LOOP_STEP(void)
+{
+	PID_CONTROLLER* pid = PID_INIT(flightGains, SAMPLE_HZ, OUT_LIMIT);
+	float setpoint[PID_AXES] = {200, -200, 100}, rate[PID_AXES] = {0}, torque[PID_AXES] = {0}, out[PID_AXES];
+	float peak[PID_AXES] = {0};
+	float dt = 1.0f / SAMPLE_HZ;
+	for (int i = 0; i < 2 * SAMPLE_HZ; i++)
+	{
+		PID_UPDATE(pid, setpoint, rate, out);
+		for (int a = 0; a < PID_AXES; a++)
+		{
+			torque[a] += (out[a] - torque[a]) * dt / 0.02f;
+			rate[a] += (torque[a] * 8 - rate[a] - 150) * dt;
+			if (fabsf(rate[a]) > peak[a]) peak[a] = fabsf(rate[a]);
+		}
+	}
+	for (int a = 0; a < PID_AXES; a++)
+	{
+		CHECK_NEAR(rate[a], setpoint[a], 0.02 * fabsf(setpoint[a]));
+		CHECK(peak[a] < 1.25f * fabsf(setpoint[a]));
+		printf("Axis %d: %.0f deg/s step, %.1f after 2S, peak %.1f\n", a, setpoint[a], rate[a], peak[a]);
+	}
+	free(pid);
+}
+
+static void BENCH(void)
+{
+	PID_CONTROLLER* pid = PID_INIT(flightGains, SAMPLE_HZ, OUT_LIMIT);
+	float setpoint[PID_AXES] = {0}, measure[PID_AXES] = {10, -10, 5}, out[PID_AXES];
+	volatile float sink = 0;
+	double start = TEST_NOW_NS();
+	for (int i = 0; i < CALLS; i++)
+	{
+		setpoint[PID_ROLL] = i & 63;
+		PID_UPDATE(pid, setpoint, measure, out);
+		sink += out[PID_ROLL];
+	}
+	printf("PID_UPDATE, 3 axes: %.1f nS\n", (TEST_NOW_NS() - start) / CALLS);
+	(void)sink;
+	free(pid);
+}
+
+int main(void)
+{
+	TEST_P();
+	TEST_I();
+	TEST_ANTI_WINDUP();
+	TEST_D();
+	TEST_CLOSED_LOOP_STEP();
+	BENCH();
+	return TEST_END();
+}
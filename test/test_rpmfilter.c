@@ -0,0 +1,169 @@
+/*
+ * test_rpmfilter.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** RPM notch bank tests
+Notch coefficients checked against FILTER_BIQUAD_SET at every motor harmonic, the range limits
+that switch notches off, then four motors with RPM wandering between 6000 and 12000 and jittery
+readings. The notches have to take the motor harmonics out of the gyro and leave the slow
+motion of the frame alone.
+*/
+
+#include "test.h"
+#include "RPMFILTER.h"
+
+#define SAMPLE_HZ	1660.0f
+#define MOTORS		4
+#define NOTCH_STEP	3
+#define NOTCH_MIN	100.0f
+#define NOTCH_Q		5.0f
+#define PI_D		3.14159265358979
+#define CALLS		3000000
+
+// Updates that retune the whole bank once
+#define BANK_STEPS	((MOTORS * RPMFILTER_HARMONICS + NOTCH_STEP - 1) / NOTCH_STEP)
+
+// Everything off until an RPM comes in, off passes samples through
+static void TEST_INIT(void)
+{
+	RPMFILTER_CONTROLLER* rf = RPMFILTER_INIT(SAMPLE_HZ, MOTORS, NOTCH_STEP, NOTCH_MIN, NOTCH_Q);
+	for (int n = 0; n < RPMFILTER_NOTCHES; n++) CHECK(!rf->Notches[n].Active);
+	for (int i = 0; i < BANK_STEPS; i++) RPMFILTER_UPDATE(rf);
+	for (int n = 0; n < RPMFILTER_NOTCHES; n++) CHECK(!rf->Notches[n].Active);
+	float axes[FILTER_AXES] = {7, -8, 9};
+	RPMFILTER_APPLY(rf, axes);
+	CHECK(axes[0] == 7 && axes[1] == -8 && axes[2] == 9);
+	// Too many motors is capped, an out of range motor is ignored
+	free(rf);
+	rf = RPMFILTER_INIT(SAMPLE_HZ, 12, 0, NOTCH_MIN, NOTCH_Q);
+	CHECK(rf->MotorCount == RPMFILTER_MAX_MOTORS && rf->UpdatesPerStep == 1);
+	RPMFILTER_SET_RPM(rf, RPMFILTER_MAX_MOTORS, 9000);
+	for (int m = 0; m < RPMFILTER_MAX_MOTORS; m++) CHECK(rf->RPM[m] == 0);
+	free(rf);
+}
+
+// One pass round the bank sets every harmonic to the same notch FILTER_BIQUAD_SET would
+static void TEST_COEFFS(void)
+{
+	RPMFILTER_CONTROLLER* rf = RPMFILTER_INIT(SAMPLE_HZ, MOTORS, NOTCH_STEP, NOTCH_MIN, NOTCH_Q);
+	const float rpm[MOTORS] = {7000, 8000, 9000, 10000};
+	// Smoothing takes half of each reading, enough readings to land on it
+	for (int i = 0; i < 40; i++)
+	{
+		for (int m = 0; m < MOTORS; m++) RPMFILTER_SET_RPM(rf, m, rpm[m]);
+	}
+	// Retuned in order, UpdatesPerStep at a time
+	RPMFILTER_UPDATE(rf);
+	CHECK(rf->Notches[NOTCH_STEP - 1].Active && !rf->Notches[NOTCH_STEP].Active);
+	for (int i = 1; i < BANK_STEPS; i++) RPMFILTER_UPDATE(rf);
+	for (int m = 0; m < MOTORS; m++)
+	{
+		CHECK_NEAR(rf->RPM[m], rpm[m], 0.01);
+		for (int h = 0; h < RPMFILTER_HARMONICS; h++)
+		{
+			const RPMFILTER_NOTCH* notch = &rf->Notches[m * RPMFILTER_HARMONICS + h];
+			FILTER_BIQUAD bq;
+			FILTER_BIQUAD_SET(&bq, FILTER_BIQUAD_NOTCH, rf->RPM[m] / 60.0f * (h + 1), NOTCH_Q, SAMPLE_HZ);
+			CHECK(notch->Active);
+			CHECK_NEAR(notch->B0, bq.B0, 1e-6);
+			CHECK_NEAR(notch->B1, bq.B1, 1e-6);
+			CHECK_NEAR(notch->A1, bq.A1, 1e-6);
+			CHECK_NEAR(notch->A2, bq.A2, 1e-6);
+			CHECK_NEAR(bq.B2, bq.B0, 1e-7);
+		}
+	}
+	free(rf);
+}
+
+// Harmonics below MinHz or above 0.45 of the sample rate are off, and back on with a clear
+// delay line once they are in range again
+static void TEST_LIMITS(void)
+{
+	RPMFILTER_CONTROLLER* rf = RPMFILTER_INIT(SAMPLE_HZ, 1, RPMFILTER_HARMONICS, NOTCH_MIN, NOTCH_Q);
+	rf->RPM[0] = 4000;		// 66.7, 133.3 and 200Hz
+	RPMFILTER_UPDATE(rf);
+	CHECK(!rf->Notches[0].Active && rf->Notches[1].Active && rf->Notches[2].Active);
+	rf->RPM[0] = 16000;		// 266.7, 533.3 and 800Hz, 747Hz is the top
+	RPMFILTER_UPDATE(rf);
+	CHECK(rf->Notches[0].Active && rf->Notches[1].Active && !rf->Notches[2].Active);
+	float axes[FILTER_AXES] = {100, 100, 100};
+	for (int i = 0; i < 10; i++) RPMFILTER_APPLY(rf, axes);
+	CHECK(rf->Notches[0].S1[0] != 0);
+	rf->RPM[0] = 0;
+	RPMFILTER_UPDATE(rf);
+	CHECK(!rf->Notches[0].Active && !rf->Notches[1].Active && !rf->Notches[2].Active);
+	rf->RPM[0] = 9000;
+	RPMFILTER_UPDATE(rf);
+	CHECK(rf->Notches[0].Active && rf->Notches[0].S1[0] == 0 && rf->Notches[0].S2[0] == 0);
+	free(rf);
+}
+
+/* Four motors wandering between 6000 and 12000 RPM, each putting its rotation frequency and two
+ * harmonics on the gyro, with a 3Hz frame motion underneath. Readings jitter by up to 60 RPM */
+static void TEST_TRACKING(void)
+{
+	RPMFILTER_CONTROLLER* rf = RPMFILTER_INIT(SAMPLE_HZ, MOTORS, NOTCH_STEP, NOTCH_MIN, NOTCH_Q);
+	double phase[MOTORS][RPMFILTER_HARMONICS] = {{0}};
+	double noiseIn = 0, left = 0, motion = 0;
+	for (int i = 0; i < 4 * SAMPLE_HZ; i++)
+	{
+		double t = i / SAMPLE_HZ;
+		double frame = 20 * sin(2 * PI_D * 3 * t), noise = 0;
+		for (int m = 0; m < MOTORS; m++)
+		{
+			double rpm = 6000 + m * 700 + 5000 * (0.5 + 0.5 * sin(0.8 * t + m));
+			RPMFILTER_SET_RPM(rf, m, rpm + (i % 7) * 10);
+			for (int h = 0; h < RPMFILTER_HARMONICS; h++)
+			{
+				phase[m][h] += 2 * PI_D * rpm / 60 * (h + 1) / SAMPLE_HZ;
+				noise += (h == 0 ? 10 : 5) * sin(phase[m][h]);
+			}
+		}
+		float axes[FILTER_AXES] = {frame + noise, frame + noise, frame + noise};
+		RPMFILTER_UPDATE(rf);
+		RPMFILTER_APPLY(rf, axes);
+		if (i < SAMPLE_HZ) continue;
+		CHECK(axes[0] == axes[1] && axes[1] == axes[2]);
+		noiseIn += noise * noise;
+		left += (axes[0] - frame) * (axes[0] - frame);
+		motion += frame * frame;
+	}
+	// What is left includes the notches' small phase lag on the 3Hz motion
+	double db = 10 * log10(left / noiseIn);
+	CHECK(db < -25);
+	CHECK(left / motion < 0.01);
+	printf("Motor harmonics through the bank: %.1fdB\n", db);
+	free(rf);
+}
+
+static void BENCH(void)
+{
+	RPMFILTER_CONTROLLER* rf = RPMFILTER_INIT(SAMPLE_HZ, MOTORS, NOTCH_STEP, NOTCH_MIN, NOTCH_Q);
+	float axes[FILTER_AXES] = {1, 2, 3};
+	volatile float sink = 0;
+	double start = TEST_NOW_NS();
+	for (int i = 0; i < CALLS; i++)
+	{
+		RPMFILTER_SET_RPM(rf, i & 3, 9000 + (i & 255));
+		RPMFILTER_UPDATE(rf);
+		axes[0] = i & 15;
+		RPMFILTER_APPLY(rf, axes);
+		sink += axes[0];
+	}
+	printf("RPMFILTER_UPDATE + APPLY, %d motors: %.1f nS (host)\n", MOTORS, (TEST_NOW_NS() - start) / CALLS);
+	(void)sink;
+	free(rf);
+}
+
+int main(void)
+{
+	TEST_INIT();
+	TEST_COEFFS();
+	TEST_LIMITS();
+	TEST_TRACKING();
+	BENCH();
+	return TEST_END();
+}
@@ -0,0 +1,318 @@
+/*
+ * test_telem.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** ESC serial telemetry tests
+CRC8 against the published check value and a bitwise polynomial 0x07 reference, then frame
+decode field by field with eRPM / 100 turned into RPM over MOTOR_POLE_PAIRS. The receive path
+runs over the mock HAL, the test plays the circular DMA by writing RxBuffer and counting NDTR
+down, and calls TELEM_RX_EVENT where the idle line, half and full transfer interrupts would.
+A dropped byte or the line going quiet part way through a frame may only cost that frame, a
+frame across the end of the buffer or cut by a half/full transfer event has to arrive whole.
+TELEM_READ is run with the UART interrupt landing between its barriers.
+*/
+
+#include <string.h>
+#include "test.h"
+#include "TELEM.h"
+
+#define MOTORS		4
+
+static USART_TypeDef usart;
+static DMA_Stream_TypeDef rxStream;
+static DMA_HandleTypeDef hdmarx = {&rxStream};
+static UART_HandleTypeDef huart = {&usart, &hdmarx, 0};
+static TELEM_CONTROLLER* telem;
+
+// 35C, 16.80V, 12.34A, 567mAh, 210000 eRPM = 30000 RPM on 7 pole pairs
+static const TELEM_DATA sample = {35, 1680, 1234, 567, 30000, 0};
+
+// Bit at a time CRC8, polynomial 0x07, no reflection, zero start
+static uint8_t REF_CRC8(const uint8_t* data, uint32_t len)
+{
+	uint8_t crc = 0;
+	for (uint32_t i = 0; i < len; i++)
+	{
+		crc ^= data[i];
+		for (int b = 0; b < 8; b++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+	return crc;
+}
+
+/* Function Summary: Build the frame an ESC sends
+ * Param: data - Values to send, RPM is sent as eRPM / 100
+ * Param: frame - TELEM_FRAME_SIZE bytes
+ * Return: VOID
+ */
+static void MAKE_FRAME(const TELEM_DATA* data, uint8_t* frame)
+{
+	uint32_t erpm = data->RPM * MOTOR_POLE_PAIRS / 100;
+	frame[0] = data->Temperature;
+	frame[1] = data->Voltage >> 8;
+	frame[2] = data->Voltage;
+	frame[3] = data->Current >> 8;
+	frame[4] = data->Current;
+	frame[5] = data->Consumption >> 8;
+	frame[6] = data->Consumption;
+	frame[7] = erpm >> 8;
+	frame[8] = erpm;
+	frame[9] = REF_CRC8(frame, TELEM_FRAME_SIZE - 1);
+}
+
+static int SAME(const TELEM_DATA* a, const TELEM_DATA* b)
+{
+	return a->Temperature == b->Temperature && a->Voltage == b->Voltage && a->Current == b->Current &&
+			a->Consumption == b->Consumption && a->RPM == b->RPM;
+}
+
+static void SETUP(void)
+{
+	MOCK_HAL_RESET();
+	memset(&usart, 0, sizeof(usart));
+	if (telem) free(telem);
+	telem = TELEM_INIT(&huart, MOTORS);
+	CHECK(mockHal.UartStarts == 1 && rxStream.NDTR == TELEM_RX_SIZE && (usart.CR1 & UART_IT_IDLE));
+}
+
+// The DMA writes bytes at the position NDTR gives and reloads NDTR at the end of the buffer
+static void RECEIVE(const uint8_t* data, uint32_t len)
+{
+	for (uint32_t i = 0; i < len; i++)
+	{
+		telem->RxBuffer[TELEM_RX_SIZE - rxStream.NDTR] = data[i];
+		if (--rxStream.NDTR == 0) rxStream.NDTR = TELEM_RX_SIZE;
+	}
+}
+
+// The line goes quiet, idle line interrupt
+static void IDLE(void)
+{
+	usart.ISR |= UART_FLAG_IDLE;
+	TELEM_RX_EVENT(telem);
+	CHECK(!(usart.ISR & UART_FLAG_IDLE));
+}
+
+// The next motor is asked and answers with one whole frame
+static int32_t REPLY(const TELEM_DATA* data)
+{
+	uint8_t frame[TELEM_FRAME_SIZE];
+	int32_t motor = TELEM_NEXT_REQUEST(telem);
+	MAKE_FRAME(data, frame);
+	RECEIVE(frame, TELEM_FRAME_SIZE);
+	IDLE();
+	return motor;
+}
+
+static void TEST_CRC8(void)
+{
+	static const uint8_t check[] = "123456789";
+	uint8_t data[64];
+	CHECK(TELEM_CRC8(check, 9) == 0xF4);
+	CHECK(TELEM_CRC8(check, 0) == 0x00);
+	for (int b = 0; b < 256; b++)
+	{
+		data[0] = b;
+		CHECK(TELEM_CRC8(data, 1) == REF_CRC8(data, 1));
+	}
+	for (int i = 0; i < 64; i++) data[i] = i * 37 + 11;
+	for (int len = 1; len <= 64; len++) CHECK(TELEM_CRC8(data, len) == REF_CRC8(data, len));
+	// A frame run through with its own CRC leaves nothing over
+	uint8_t frame[TELEM_FRAME_SIZE];
+	MAKE_FRAME(&sample, frame);
+	CHECK(TELEM_CRC8(frame, TELEM_FRAME_SIZE) == 0);
+}
+
+// Big endian fields, eRPM / 100 in bytes 7-8
+static void TEST_PARSE(void)
+{
+	static const uint8_t frame[TELEM_FRAME_SIZE] = {0x23, 0x06, 0x90, 0x04, 0xD2, 0x02, 0x37, 0x08, 0x34, 0x00};
+	uint8_t good[TELEM_FRAME_SIZE];
+	TELEM_DATA out;
+	memcpy(good, frame, sizeof(good));
+	good[9] = REF_CRC8(good, 9);
+	CHECK(TELEM_PARSE_FRAME(good, &out) == 1);
+	CHECK(SAME(&out, &sample));
+	// Top of every field
+	memset(good, 0xFF, sizeof(good));
+	good[9] = REF_CRC8(good, 9);
+	CHECK(TELEM_PARSE_FRAME(good, &out) == 1);
+	CHECK(out.Temperature == 255 && out.Voltage == 0xFFFF && out.Current == 0xFFFF && out.Consumption == 0xFFFF);
+	CHECK(out.RPM == 0xFFFF * 100 / MOTOR_POLE_PAIRS);
+}
+
+// Any single bit flipped fails the CRC and the output is left alone
+static void TEST_BAD_CRC(void)
+{
+	uint8_t frame[TELEM_FRAME_SIZE];
+	TELEM_DATA out;
+	int rejected = 0;
+	MAKE_FRAME(&sample, frame);
+	for (int bit = 0; bit < TELEM_FRAME_SIZE * 8; bit++)
+	{
+		frame[bit / 8] ^= 1 << (bit % 8);
+		memset(&out, 0xAA, sizeof(out));
+		rejected += TELEM_PARSE_FRAME(frame, &out) == 0 && out.Temperature == 0xAA && out.RPM == 0xAAAAAAAA;
+		frame[bit / 8] ^= 1 << (bit % 8);
+	}
+	CHECK(rejected == TELEM_FRAME_SIZE * 8);
+	// Through the receiver, counted and not published
+	SETUP();
+	frame[4] ^= 0x10;
+	TELEM_NEXT_REQUEST(telem);
+	RECEIVE(frame, TELEM_FRAME_SIZE);
+	IDLE();
+	CHECK(telem->CrcErrors == 1 && telem->Slots[0].Seq == 0 && telem->Pending == 0);
+}
+
+// One reply per request lands in that motor's slot, stamped with the tick
+static void TEST_RECEIVE(void)
+{
+	TELEM_DATA out, data = sample;
+	SETUP();
+	for (int m = 0; m < MOTORS; m++)
+	{
+		mockHal.Tick = 1000 + m * TELEM_TIMEOUT_MS;
+		data.Temperature = 30 + m;
+		CHECK(REPLY(&data) == m);
+		TELEM_READ(telem, m, &out);
+		CHECK(SAME(&out, &data) && out.Tick == mockHal.Tick && telem->Slots[m].Seq == 2);
+		CHECK(telem->Pending == -1 && telem->CrcErrors == 0);
+	}
+}
+
+// A byte lost on the wire leaves 9 bytes when the line goes idle. Only that frame is lost, the
+// next one starts aligned
+static void TEST_DROPPED_BYTE(void)
+{
+	uint8_t frame[TELEM_FRAME_SIZE];
+	TELEM_DATA out, data = sample;
+	SETUP();
+	MAKE_FRAME(&sample, frame);
+	TELEM_NEXT_REQUEST(telem);
+	RECEIVE(frame, 4);
+	RECEIVE(frame + 5, TELEM_FRAME_SIZE - 5);
+	IDLE();
+	CHECK(telem->CrcErrors == 1 && telem->FrameCount == 0 && telem->Slots[0].Seq == 0);
+	// Motor 0 timed out, motor 1 answers
+	mockHal.Tick += TELEM_TIMEOUT_MS;
+	data.Current = 99;
+	CHECK(REPLY(&data) == 1);
+	TELEM_READ(telem, 1, &out);
+	CHECK(SAME(&out, &data) && telem->CrcErrors == 1 && telem->Timeouts[0] == 1);
+}
+
+// Frames run across the end of the circular buffer, with the full transfer event at the wrap
+// and half transfer events part way through frames, nothing is lost
+static void TEST_WRAP(void)
+{
+	uint8_t frame[TELEM_FRAME_SIZE];
+	TELEM_DATA out, data = sample;
+	int good = 0;
+	SETUP();
+	for (int n = 0; n < 3 * TELEM_RX_SIZE / TELEM_FRAME_SIZE; n++)
+	{
+		int32_t motor = TELEM_NEXT_REQUEST(telem);
+		data.Voltage = 1500 + n;
+		MAKE_FRAME(&data, frame);
+		for (int i = 0; i < TELEM_FRAME_SIZE; i++)
+		{
+			RECEIVE(&frame[i], 1);
+			// DMA half and full transfer land wherever the write position crosses 32 or 64
+			if (rxStream.NDTR == TELEM_RX_SIZE || rxStream.NDTR == TELEM_RX_SIZE / 2) TELEM_RX_EVENT(telem);
+		}
+		IDLE();
+		TELEM_READ(telem, motor, &out);
+		good += SAME(&out, &data);
+		mockHal.Tick += TELEM_TIMEOUT_MS;
+	}
+	CHECK(good == 3 * TELEM_RX_SIZE / TELEM_FRAME_SIZE && telem->CrcErrors == 0);
+	CHECK(telem->RxRead == (3 * TELEM_RX_SIZE / TELEM_FRAME_SIZE * TELEM_FRAME_SIZE) % TELEM_RX_SIZE);
+}
+
+// The line goes quiet part way through a frame, that partial frame and the rest of it are
+// dropped, the next frame comes through
+static void TEST_IDLE_MID_FRAME(void)
+{
+	uint8_t frame[TELEM_FRAME_SIZE];
+	TELEM_DATA out, data = sample;
+	SETUP();
+	MAKE_FRAME(&sample, frame);
+	TELEM_NEXT_REQUEST(telem);
+	RECEIVE(frame, 4);
+	IDLE();
+	CHECK(telem->CrcErrors == 1 && telem->FrameCount == 0);
+	RECEIVE(frame + 4, TELEM_FRAME_SIZE - 4);
+	IDLE();
+	CHECK(telem->CrcErrors == 2 && telem->Slots[0].Seq == 0 && telem->Pending == 0);
+	data.Consumption = 1;
+	mockHal.Tick += TELEM_TIMEOUT_MS;
+	CHECK(REPLY(&data) == 1);
+	TELEM_READ(telem, 1, &out);
+	CHECK(SAME(&out, &data) && telem->CrcErrors == 2);
+}
+
+/* UART interrupt landing inside TELEM_READ: at its first barrier the interrupt starts writing
+ * the slot (unless the test left it part written already), at its second it finishes, so the
+ * copy in between is torn */
+static TELEM_SLOT* irqSlot;
+static TELEM_DATA irqData;
+static int barriers;
+static int irqStarts;
+
+static void IRQ_AT_BARRIER(void)
+{
+	barriers++;
+	if (barriers == 1 && irqStarts)
+	{
+		irqSlot->Seq++;
+		irqSlot->Data.Temperature = irqData.Temperature;
+	}
+	else if (barriers == 2)
+	{
+		irqSlot->Data = irqData;
+		irqSlot->Seq++;
+	}
+}
+
+static void TEST_SEQLOCK(void)
+{
+	TELEM_DATA out, first = sample;
+	SETUP();
+	REPLY(&first);
+	irqSlot = &telem->Slots[0];
+	irqData = sample;
+	irqData.Temperature = 90;
+	irqData.RPM = 12345;
+	// Torn copy is thrown away and read again
+	barriers = 0;
+	irqStarts = 1;
+	mockHal.Dmb = IRQ_AT_BARRIER;
+	TELEM_READ(telem, 0, &out);
+	mockHal.Dmb = NULL;
+	CHECK(barriers == 4 && SAME(&out, &irqData) && irqSlot->Seq == 4);
+	// Odd count, the copy starts with a write under way and has to go round again
+	irqSlot->Seq++;
+	barriers = 0;
+	irqStarts = 0;
+	irqData.RPM = 777;
+	mockHal.Dmb = IRQ_AT_BARRIER;
+	TELEM_READ(telem, 0, &out);
+	mockHal.Dmb = NULL;
+	CHECK(barriers == 4 && SAME(&out, &irqData) && irqSlot->Seq == 6);
+}
+
+int main(void)
+{
+	TEST_CRC8();
+	TEST_PARSE();
+	TEST_BAD_CRC();
+	TEST_RECEIVE();
+	TEST_DROPPED_BYTE();
+	TEST_WRAP();
+	TEST_IDLE_MID_FRAME();
+	TEST_SEQLOCK();
+	return TEST_END();
+}
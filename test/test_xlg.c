@@ -0,0 +1,245 @@
+/*
+ * test_xlg.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** XLG FIFO drain tests
+XLG_FIFO runs on the real I2C queue over the mock HAL, the test plays the LSM6DS33 FIFO: a
+word stream filling at the gyro ODR, the watermark flag and INT1 level, the pattern position
+and the overrun flag. Samples popped have to come out in order with their values intact and
+timestamps exactly one ODR period apart, across the cycle counter wrapping, a watermark edge
+landing while a drain is still running, an overrun leaving the FIFO mid sample and the ring
+filling up.
+*/
+
+#include "test.h"
+#include "XLG.h"
+
+#define WATERMARK	4
+#define START_TIME	0xFFFF0000u		// Wraps during the first batches
+
+/* The chip side, whole FIFO as one word stream */
+typedef struct CHIP
+{
+	uint32_t Written;				// Words put in the FIFO
+	uint32_t Read;					// Words taken out
+	uint8_t Overrun;				// Report OVR on the next status read
+	uint32_t Period;
+} CHIP;
+
+static CHIP chip;
+static I2C_HandleTypeDef hi2c;
+static I2CQ_CONTROLLER* bus;
+static XLG_FIFO fifo;
+
+// Word w of sample s, made to tell every sample and axis apart and to go negative
+static int16_t VALUE(uint32_t s, uint32_t w)
+{
+	return (int16_t)(s * 7 + w * 1000 - 3000);
+}
+
+static uint32_t SAMPLE_TIME(uint32_t s)
+{
+	return START_TIME + s * chip.Period;
+}
+
+static uint32_t LEVEL(void)
+{
+	return chip.Written - chip.Read;
+}
+
+// INT1 is the watermark flag, a level
+static GPIO_PinState READ_PIN(GPIO_TypeDef* port, uint16_t pin)
+{
+	if (port == XLG_INT1_GPIO_Port && pin == XLG_INT1_Pin) return LEVEL() >= WATERMARK * XLG_FIFO_WORDS;
+	return (port->ODR & pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+/* Function Summary: Answer the transfers the queue starts until it goes quiet, status from the
+ * FIFO state, data words popped off the stream
+ * Return: VOID
+ */
+static void SERVE(void)
+{
+	while (mockHal.Busy)
+	{
+		uint8_t* data = mockHal.Data;
+		CHECK(mockHal.Read && mockHal.Addr == (XLG_I2C_ADDR));
+		if (mockHal.Reg == FIFO_STATUS1)
+		{
+			uint32_t level = LEVEL(), pattern = chip.Read % XLG_FIFO_WORDS;
+			CHECK(mockHal.Size == 4);
+			data[0] = level & 0xFF;
+			data[1] = (level >> 8) & 0x0F;
+			if (level >= WATERMARK * XLG_FIFO_WORDS) data[1] |= XLG_FIFO_STATUS_WTM;
+			if (chip.Overrun) data[1] |= XLG_FIFO_STATUS_OVR;
+			data[2] = pattern & 0xFF;
+			data[3] = pattern >> 8;
+			chip.Overrun = 0;
+		}
+		else
+		{
+			CHECK(mockHal.Reg == FIFO_DATA_OUT_L);
+			CHECK(mockHal.Size / 2 <= LEVEL());
+			for (int i = 0; i < mockHal.Size / 2; i++, chip.Read++)
+			{
+				int16_t v = VALUE(chip.Read / XLG_FIFO_WORDS, chip.Read % XLG_FIFO_WORDS);
+				data[i * 2] = v & 0xFF;
+				data[i * 2 + 1] = (uint16_t)v >> 8;
+			}
+		}
+		MOCK_I2C_FINISH();
+		I2CQ_CPLT(bus);
+	}
+}
+
+/* Function Summary: The chip takes samples, the watermark edge comes at the sample that
+ * reaches it and is answered straight away unless hold is set
+ * Param: n - Samples
+ * Param: hold - Leave the transfers started by the edge running
+ * Return: VOID
+ */
+static void PRODUCE(int n, int hold)
+{
+	for (int i = 0; i < n; i++)
+	{
+		uint32_t before = LEVEL();
+		chip.Written += XLG_FIFO_WORDS;
+		if (before < WATERMARK * XLG_FIFO_WORDS && LEVEL() >= WATERMARK * XLG_FIFO_WORDS)
+		{
+			mockDwt.CYCCNT = SAMPLE_TIME(chip.Written / XLG_FIFO_WORDS - 1);
+			XLG_FIFO_EDGE(&fifo);
+			if (!hold) SERVE();
+		}
+	}
+}
+
+/* Function Summary: Pop everything queued and check it against the stream
+ * Param: next - First sample expected, returns the one after the last popped
+ * Return: Samples popped
+ */
+static int POP_ALL(uint32_t* next)
+{
+	XLG_DATA g, xl;
+	int n = 0;
+	while (XLG_FIFO_POP(&fifo, &g, &xl))
+	{
+		uint32_t s = (*next)++;
+		CHECK(g.dataReady && xl.dataReady);
+		CHECK(g.x == VALUE(s, 0) && g.y == VALUE(s, 1) && g.z == VALUE(s, 2));
+		CHECK(xl.x == VALUE(s, 3) && xl.y == VALUE(s, 4) && xl.z == VALUE(s, 5));
+		CHECK(g.timestamp == SAMPLE_TIME(s) && xl.timestamp == g.timestamp);
+		n++;
+	}
+	return n;
+}
+
+static void SETUP(void)
+{
+	MOCK_HAL_RESET();
+	mockHal.ReadPin = READ_PIN;
+	memset(&chip, 0, sizeof(chip));
+	if (bus) free(bus);
+	bus = I2CQ_INIT(&hi2c, GPIOB, GPIO_PIN_8, GPIOB, GPIO_PIN_9);
+	XLG_FIFO_INIT(&fifo, bus, WATERMARK);
+	chip.Period = fifo.Period;
+}
+
+// Threshold in words, both decimations off, watermark on INT1, continuous at 1.66kHz
+static void TEST_INIT(void)
+{
+	SETUP();
+	CHECK(mockHal.Regs[FIFO_CTRL1] == WATERMARK * XLG_FIFO_WORDS && mockHal.Regs[FIFO_CTRL2] == 0);
+	CHECK(mockHal.Regs[FIFO_CTRL3] == 0x09);
+	CHECK(mockHal.Regs[INT1_CTRL] == 0x08);
+	CHECK(mockHal.Regs[FIFO_CTRL5] == 0x46);
+	CHECK(fifo.Period == 216000000 / 1660);
+	XLG_FIFO_INIT(&fifo, bus, 0);
+	CHECK(fifo.Watermark == 1 && mockHal.Regs[FIFO_CTRL1] == XLG_FIFO_WORDS);
+	XLG_FIFO_INIT(&fifo, bus, 100);
+	CHECK(fifo.Watermark == XLG_FIFO_DRAIN_MAX && mockHal.Regs[FIFO_CTRL1] == XLG_FIFO_DRAIN_MAX * XLG_FIFO_WORDS);
+}
+
+// 500 batches popped three at a time, so the ring wraps over and over
+static void TEST_BATCHES(void)
+{
+	uint32_t next = 0;
+	int popped = 0;
+	SETUP();
+	for (int batch = 1; batch <= 500; batch++)
+	{
+		PRODUCE(WATERMARK, 0);
+		CHECK(fifo.Stage == XLG_STAGE_IDLE && LEVEL() == 0);
+		if (batch % 3 == 0) popped += POP_ALL(&next);
+	}
+	popped += POP_ALL(&next);
+	CHECK(popped == 500 * WATERMARK);
+	CHECK(fifo.Overruns == 0 && bus->Failed == 0);
+	printf("XLG FIFO: %d samples popped, %lu cycles apart\n", popped, (unsigned long)fifo.Period);
+}
+
+// The next watermark comes while the status read is still out. The drain takes everything
+// there by then and the held edge finds the FIFO empty
+static void TEST_PENDING(void)
+{
+	uint32_t next = 0;
+	SETUP();
+	PRODUCE(WATERMARK, 1);
+	CHECK(fifo.Stage == XLG_STAGE_STATUS && mockHal.Busy);
+	// Pin is still high from the first batch, force the edge the EXTI would have latched
+	mockDwt.CYCCNT = SAMPLE_TIME(2 * WATERMARK - 1);
+	chip.Written += WATERMARK * XLG_FIFO_WORDS;
+	XLG_FIFO_EDGE(&fifo);
+	CHECK(fifo.Pending);
+	SERVE();
+	CHECK(!fifo.Pending && fifo.Stage == XLG_STAGE_IDLE);
+	CHECK(POP_ALL(&next) == 2 * WATERMARK);
+	PRODUCE(WATERMARK, 0);
+	CHECK(POP_ALL(&next) == WATERMARK);
+}
+
+// Overwritten data leaves the read position 3 words into sample 0. Those words are read and
+// dropped, the drain picks up at the gyro X of sample 1 and the overrun is counted. Timestamps
+// are a guess after an overrun, only the order is checked
+static void TEST_OVERRUN(void)
+{
+	uint32_t s = 1, last = 0;
+	XLG_DATA g, xl;
+	SETUP();
+	chip.Read = 3;
+	chip.Written = 3;
+	chip.Overrun = 1;
+	PRODUCE(WATERMARK, 0);
+	CHECK(fifo.Overruns == 1);
+	while (XLG_FIFO_POP(&fifo, &g, &xl))
+	{
+		CHECK(g.x == VALUE(s, 0) && g.z == VALUE(s, 2) && xl.z == VALUE(s, 5));
+		CHECK(s == 1 || (int32_t)(g.timestamp - last) == (int32_t)fifo.Period);
+		last = g.timestamp;
+		s++;
+	}
+	CHECK(s == WATERMARK);
+	CHECK(LEVEL() == 3);
+}
+
+// Nobody pops, the ring keeps the oldest 31 and counts the rest
+static void TEST_RING_FULL(void)
+{
+	uint32_t next = 0;
+	SETUP();
+	PRODUCE(10 * WATERMARK, 0);
+	CHECK(fifo.Overruns == 10 * WATERMARK - (XLG_FIFO_RING_SIZE - 1));
+	CHECK(POP_ALL(&next) == XLG_FIFO_RING_SIZE - 1);
+}
+
+int main(void)
+{
+	TEST_INIT();
+	TEST_BATCHES();
+	TEST_PENDING();
+	TEST_OVERRUN();
+	TEST_RING_FULL();
+	return TEST_END();
+}
@@ -0,0 +1,153 @@
+/*
+ * test_xlgburst.c
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Jeff Raines
+ */
+
+/** XLG single sample burst tests
+XLG_BURST_EDGE and XLG_BURST_DONE run on the real I2C queue over the mock HAL, the test plays
+the INT1 data ready edge and the LSM6DS33 answering the 12 byte output register read. An edge
+while idle has to start exactly one burst stamped with its own time. An edge during a read is
+held and starts exactly one follow-up burst stamped with that edge, a second edge during the
+same read replaces it and counts the sample lost. A failed read goes back to idle with nothing
+held.
+*/
+
+#include <string.h>
+#include "test.h"
+#include "XLG.h"
+
+#define START_TIME	0xFFFFF000u		// Wraps a few samples in
+
+static I2C_HandleTypeDef hi2c;
+static I2CQ_CONTROLLER* bus;
+static XLG_BURST burst;
+static XLG_DATA g, xl;
+static uint32_t period;
+
+static void SETUP(void)
+{
+	MOCK_HAL_RESET();
+	memset(&g, 0, sizeof(g));
+	memset(&xl, 0, sizeof(xl));
+	if (bus) free(bus);
+	bus = I2CQ_INIT(&hi2c, GPIOB, GPIO_PIN_8, GPIOB, GPIO_PIN_9);
+	XLG_BURST_INIT(&burst, bus, &g, &xl);
+	period = SystemCoreClock / XLG_G_ODR_HZ;
+}
+
+// INT1 rises at a cycle count, from the EXTI interrupt
+static void EDGE(uint32_t time)
+{
+	mockDwt.CYCCNT = time;
+	XLG_BURST_EDGE(&burst);
+}
+
+/* Function Summary: The chip answers the read in flight with sample s, gyro then accelerometer,
+ * low byte first
+ * Param: s - Sample number, sets every axis value
+ * Return: VOID
+ */
+static void ANSWER(int s)
+{
+	CHECK(mockHal.Busy && mockHal.Read && mockHal.Reg == OUTX_L_G && mockHal.Size == XLG_BURST_SIZE);
+	for (int w = 0; w < XLG_BURST_SIZE / 2; w++)
+	{
+		int16_t v = (int16_t)(s * 11 + w * 1000 - 2500);
+		mockHal.Data[w * 2] = v & 0xFF;
+		mockHal.Data[w * 2 + 1] = (uint16_t)v >> 8;
+	}
+	MOCK_I2C_FINISH();
+	I2CQ_CPLT(bus);
+}
+
+// Decoded sample s with its edge time
+static int GOT(int s, uint32_t time)
+{
+	return g.x == (int16_t)(s * 11 - 2500) && g.z == (int16_t)(s * 11 + 2000 - 2500) &&
+			xl.x == (int16_t)(s * 11 + 3000 - 2500) && xl.z == (int16_t)(s * 11 + 5000 - 2500) &&
+			g.timestamp == time && xl.timestamp == time;
+}
+
+// One edge, one burst, one sample stamped with that edge
+static void TEST_IDLE_EDGE(void)
+{
+	SETUP();
+	EDGE(START_TIME);
+	CHECK(mockHal.Starts == 1 && burst.Stage == XLG_STAGE_DATA && !burst.Pending);
+	ANSWER(0);
+	CHECK(GOT(0, START_TIME) && burst.Stage == XLG_STAGE_IDLE && mockHal.Starts == 1 && !mockHal.Busy);
+	// Every period after, across the counter wrap, nothing missed
+	for (int s = 1; s < 20; s++)
+	{
+		EDGE(START_TIME + s * period);
+		CHECK(mockHal.Starts == (uint32_t)s + 1);
+		ANSWER(s);
+		CHECK(GOT(s, START_TIME + s * period));
+	}
+	CHECK(burst.Missed == 0);
+}
+
+// The next edge comes before the read finishes. It is held, and exactly one follow-up burst
+// starts when the read completes, stamped with the held edge
+static void TEST_HELD_EDGE(void)
+{
+	SETUP();
+	EDGE(START_TIME);
+	EDGE(START_TIME + period);
+	CHECK(burst.Pending && burst.EdgeTime == START_TIME + period && mockHal.Starts == 1);
+	ANSWER(0);
+	CHECK(GOT(0, START_TIME));
+	CHECK(!burst.Pending && burst.Stage == XLG_STAGE_DATA && mockHal.Starts == 2);
+	ANSWER(1);
+	CHECK(GOT(1, START_TIME + period));
+	CHECK(burst.Stage == XLG_STAGE_IDLE && mockHal.Starts == 2 && !mockHal.Busy && burst.Missed == 0);
+}
+
+// Two edges during one read, the first is overwritten on the chip and counted once
+static void TEST_TWO_EDGES(void)
+{
+	SETUP();
+	EDGE(START_TIME);
+	EDGE(START_TIME + period);
+	EDGE(START_TIME + 2 * period);
+	CHECK(burst.EdgeTime == START_TIME + 2 * period && mockHal.Starts == 1);
+	ANSWER(0);
+	CHECK(mockHal.Starts == 2 && burst.Missed == 0);
+	ANSWER(2);
+	CHECK(GOT(2, START_TIME + 2 * period));
+	CHECK(burst.Missed == 1 && mockHal.Starts == 2 && burst.Stage == XLG_STAGE_IDLE);
+}
+
+// The read fails for good with an edge held. Back to idle, the held edge is dropped and the
+// next edge starts a fresh burst
+static void TEST_FAILED_READ(void)
+{
+	SETUP();
+	EDGE(START_TIME);
+	EDGE(START_TIME + period);
+	CHECK(burst.Pending);
+	for (int i = 0; i <= I2CQ_NACK_RETRIES; i++)
+	{
+		CHECK(mockHal.Busy);
+		MOCK_I2C_FINISH();
+		hi2c.ErrorCode = HAL_I2C_ERROR_AF;
+		I2CQ_ERROR(bus);
+	}
+	CHECK(bus->Failed == 1 && burst.Stage == XLG_STAGE_IDLE && !burst.Pending);
+	CHECK(!mockHal.Busy && mockHal.Starts == I2CQ_NACK_RETRIES + 1 && g.timestamp == 0);
+	EDGE(START_TIME + 3 * period);
+	CHECK(burst.Stage == XLG_STAGE_DATA && mockHal.Starts == I2CQ_NACK_RETRIES + 2);
+	ANSWER(3);
+	CHECK(GOT(3, START_TIME + 3 * period) && burst.Stage == XLG_STAGE_IDLE);
+}
+
+int main(void)
+{
+	TEST_IDLE_EDGE();
+	TEST_HELD_EDGE();
+	TEST_TWO_EDGES();
+	TEST_FAILED_READ();
+	return TEST_END();
+}